@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * collide batches of bodies with a heightfield. each body gets the
+ * same response heightfield_collision would give it: if it's below
+ * the plane of the quad under it, it's pushed back out, and any of
+ * its velocity into the plane is removed. four bodies are worked on
+ * at once with SSE2; a body on the edge of a quad, where more than
+ * one quad has to be tried, is left to heightfield_collision
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "object.h"
+#include "heightfield.h"
+#include "map.h"
+#include "bodybatch.h"
+#include "parallel.h"
+
+#define BODIES_PER_THREAD 4096 /* smallest batch worth its own thread */
+
+struct body_batch_job {
+	struct heightfield *hf;
+	struct body_batch *b;
+	unsigned int num_threads;
+	unsigned int hits[64];
+};
+
+/* remove the part of body i's velocity going into plane p */
+static void
+stop_body(struct body_batch *b, unsigned int i, float *p)
+{
+	float vn;
+
+	if(!b->vx)
+		return;
+
+	vn = b->vx[i] * p[0] + b->vy[i] * p[1] + b->vz[i] * p[2];
+	if(vn < 0.0f) {
+		b->vx[i] -= vn * p[0];
+		b->vy[i] -= vn * p[1];
+		b->vz[i] -= vn * p[2];
+	}
+}
+
+/* collide body i on its own; returns 1 if it was pushed out */
+static int
+collide_body(struct heightfield *hf, struct body_batch *b, unsigned int i)
+{
+	float v[3], *p;
+
+	v[0] = b->x[i];
+	v[1] = b->y[i];
+	v[2] = b->z[i];
+	p = heightfield_collision_plane(hf, v);
+	if(b->hits)
+		b->hits[i] = (p != NULL);
+	if(!p)
+		return 0;
+
+	b->x[i] = v[0];
+	b->y[i] = v[1];
+	b->z[i] = v[2];
+	stop_body(b, i, p);
+
+	return 1;
+}
+
+#ifdef __SSE2__
+/*
+ * collide bodies first to last - 1, four at a time; the quad
+ * under each body is found for all four at once, then the planes
+ * of the four quads are gathered so that the plane equations and
+ * pushes are worked out together
+ */
+static unsigned int
+collide_body_range(struct heightfield *hf, struct body_batch *b,
+                   unsigned int first, unsigned int last)
+{
+	unsigned int i, k, hits = 0;
+	int cols[4], rows[4], ci[4], ri[4], edge, below;
+	float *p, pl[4][4], edges[4][4];
+	__m128 x, y, z, d, nd, x0, y0, qs, px, py, pz, pw, lo, hi, inside;
+	__m128i c, r;
+
+	x0 = _mm_set1_ps(hf->xs[0]);
+	y0 = _mm_set1_ps(hf->ys[0]);
+	qs = _mm_set1_ps(hf->quadsize);
+
+	for(i = first; i + 4 <= last; i += 4) {
+		x = _mm_loadu_ps(&b->x[i]);
+		y = _mm_loadu_ps(&b->y[i]);
+		z = _mm_loadu_ps(&b->z[i]);
+
+		/* same rounding as heightfield_collision */
+		c = _mm_cvttps_epi32(_mm_div_ps(_mm_sub_ps(x, x0), qs));
+		r = _mm_cvttps_epi32(_mm_div_ps(_mm_sub_ps(y, y0), qs));
+		_mm_storeu_si128((__m128i *)cols, c);
+		_mm_storeu_si128((__m128i *)rows, r);
+
+		/*
+		 * gather the edges and plane of each body's quad, clamping
+		 * the quad to the heightfield; a body is only done here if
+		 * it's strictly inside its quad, so no other quad could be
+		 * tried before it
+		 */
+		for(k = 0; k < 4; k++) {
+			ci[k] = (cols[k] < 0) ? 0 : (cols[k] >= (int)hf->cols) ? (int)hf->cols - 1 : cols[k];
+			ri[k] = (rows[k] < 0) ? 0 : (rows[k] >= (int)hf->rows) ? (int)hf->rows - 1 : rows[k];
+			edges[0][k] = hf->xs[ci[k]];
+			edges[1][k] = hf->xs[ci[k] + 1];
+			edges[2][k] = hf->ys[ri[k]];
+			edges[3][k] = hf->ys[ri[k] + 1];
+			memcpy(pl[k], &hf->planes[(ri[k] * hf->cols + ci[k]) * 4], sizeof(pl[k]));
+		}
+
+		inside = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(x, _mm_loadu_ps(edges[0])),
+		                               _mm_cmplt_ps(x, _mm_loadu_ps(edges[1]))),
+		                    _mm_and_ps(_mm_cmpgt_ps(y, _mm_loadu_ps(edges[2])),
+		                               _mm_cmplt_ps(y, _mm_loadu_ps(edges[3]))));
+		inside = _mm_and_ps(inside, _mm_castsi128_ps(_mm_and_si128(
+		                    _mm_cmpeq_epi32(c, _mm_loadu_si128((__m128i *)ci)),
+		                    _mm_cmpeq_epi32(r, _mm_loadu_si128((__m128i *)ri)))));
+		edge = ~_mm_movemask_ps(inside) & 0xf;
+
+		/* transpose the planes into one vector per coefficient */
+		px = _mm_loadu_ps(pl[0]);
+		py = _mm_loadu_ps(pl[1]);
+		pz = _mm_loadu_ps(pl[2]);
+		pw = _mm_loadu_ps(pl[3]);
+		_MM_TRANSPOSE4_PS(px, py, pz, pw);
+
+		/* same order of operations as plane_equation */
+		d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, px), _mm_mul_ps(y, py)),
+		                          _mm_mul_ps(z, pz)), pw);
+		below = _mm_movemask_ps(_mm_cmple_ps(d, _mm_setzero_ps()));
+
+		nd = _mm_sub_ps(_mm_setzero_ps(), d);
+		lo = _mm_add_ps(x, _mm_mul_ps(nd, px));
+		hi = _mm_add_ps(y, _mm_mul_ps(nd, py));
+		z = _mm_add_ps(z, _mm_div_ps(_mm_mul_ps(nd, pz), _mm_set1_ps(2.0f)));
+		_mm_storeu_ps(pl[0], lo);
+		_mm_storeu_ps(pl[1], hi);
+		_mm_storeu_ps(pl[2], z);
+
+		for(k = 0; k < 4; k++) {
+			if((edge >> k) & 1) {
+				hits += collide_body(hf, b, i + k);
+				continue;
+			}
+
+			if(b->hits)
+				b->hits[i + k] = (below >> k) & 1;
+			if(!((below >> k) & 1))
+				continue;
+
+			b->x[i + k] = pl[0][k];
+			b->y[i + k] = pl[1][k];
+			b->z[i + k] = pl[2][k];
+			p = &hf->planes[(ri[k] * hf->cols + ci[k]) * 4];
+			stop_body(b, i + k, p);
+			hits++;
+		}
+	}
+
+	for(; i < last; i++)
+		hits += collide_body(hf, b, i);
+
+	return hits;
+}
+#else
+static unsigned int
+collide_body_range(struct heightfield *hf, struct body_batch *b,
+                   unsigned int first, unsigned int last)
+{
+	unsigned int i, hits = 0;
+
+	for(i = first; i < last; i++)
+		hits += collide_body(hf, b, i);
+
+	return hits;
+}
+#endif
+
+static void
+collide_body_band(void *arg, unsigned int n)
+{
+	struct body_batch_job *job = arg;
+	unsigned int first, last;
+
+	first = (unsigned int)((unsigned long)job->b->num * n / job->num_threads);
+	last = (unsigned int)((unsigned long)job->b->num * (n + 1) / job->num_threads);
+	job->hits[n] = collide_body_range(job->hf, job->b, first, last);
+}
+
+/*
+ * collide all bodies in a batch with a heightfield, splitting big
+ * batches across up to num_threads threads (0 for one per
+ * processor); returns the number of bodies pushed out
+ */
+unsigned int
+collide_body_batch(struct heightfield *hf, struct body_batch *b, unsigned int num_threads)
+{
+	struct body_batch_job job;
+	unsigned int i, hits = 0;
+
+	if(hf->cols == 0 || hf->rows == 0) {
+		if(b->hits)
+			memset(b->hits, 0, b->num);
+		return 0;
+	}
+
+	if(num_threads == 0)
+		num_threads = get_num_cpus();
+	if(num_threads > b->num / BODIES_PER_THREAD)
+		num_threads = b->num / BODIES_PER_THREAD;
+	if(num_threads > 64)
+		num_threads = 64;
+	if(num_threads <= 1)
+		return collide_body_range(hf, b, 0, b->num);
+
+	job.hf = hf;
+	job.b = b;
+	job.num_threads = num_threads;
+	run_parallel(collide_body_band, &job, num_threads);
+
+	for(i = 0; i < num_threads; i++)
+		hits += job.hits[i];
+
+	return hits;
+}
+
+/* fill a batch with bodies scattered over the heightfield around its surface */
+static void
+scatter_bodies(struct heightfield *hf, struct body_batch *b)
+{
+	unsigned int i;
+	float z;
+
+	srand(1);
+	for(i = 0; i < b->num; i++) {
+		b->x[i] = hf->xs[0] + (hf->xs[hf->cols] - hf->xs[0]) * rand() / (float)RAND_MAX;
+		b->y[i] = hf->ys[0] + (hf->ys[hf->rows] - hf->ys[0]) * rand() / (float)RAND_MAX;
+		if(!get_heightfield_height(hf, b->x[i], b->y[i], &z, NULL))
+			z = 0.0f;
+		b->z[i] = z + 2.0f * rand() / (float)RAND_MAX - 1.0f;
+		b->vx[i] = rand() / (float)RAND_MAX - 0.5f;
+		b->vy[i] = rand() / (float)RAND_MAX - 0.5f;
+		b->vz[i] = -rand() / (float)RAND_MAX;
+	}
+}
+
+static int
+alloc_body_batch(struct body_batch *b, unsigned int n)
+{
+	b->num = n;
+	b->x = malloc(sizeof(float) * n * 6);
+	b->hits = malloc(n);
+	if(!b->x || !b->hits) {
+		free(b->x);
+		free(b->hits);
+		return 0;
+	}
+
+	b->y = b->x + n;
+	b->z = b->y + n;
+	b->vx = b->z + n;
+	b->vy = b->vx + n;
+	b->vz = b->vy + n;
+
+	return 1;
+}
+
+static void
+copy_body_batch(struct body_batch *to, struct body_batch *from)
+{
+	memcpy(to->x, from->x, sizeof(float) * from->num * 6);
+}
+
+/*
+ * time colliding batches of bodies with a map one at a time with
+ * heightfield_collision, with SSE2 on one thread and with SSE2 on
+ * every processor, and check that they all give the same results
+ */
+void
+benchmark_body_batch(const char *filename)
+{
+	static const unsigned int counts[] = { 1000, 10000, 100000, 1000000 };
+	struct map *m;
+	struct heightfield *hf;
+	struct body_batch start, ref, b;
+	unsigned int c, i, n, run, hits, ok;
+	float v[3], *p;
+	double t, scalar, single, threaded;
+
+	m = load_map(filename);
+	if(!m)
+		return;
+	hf = m->heightfield;
+
+	printf("%s: %u x %u quads, %u processors\n", filename, hf->cols, hf->rows, get_num_cpus());
+	printf(" bodies    one at a time (M/s)    SSE2 (M/s)    SSE2 threaded (M/s)    collided\n");
+	for(c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		n = counts[c];
+		if(!alloc_body_batch(&start, n) || !alloc_body_batch(&ref, n) || !alloc_body_batch(&b, n)) {
+			fprintf(stderr, "Error: Couldn't allocate memory for bodies\n");
+			break;
+		}
+		scatter_bodies(hf, &start);
+
+		/* best of three runs of each */
+		scalar = single = threaded = 0.0;
+		hits = 0;
+		for(run = 0; run < 3; run++) {
+			copy_body_batch(&ref, &start);
+			t = get_time_ms();
+			for(i = 0; i < n; i++) {
+				v[0] = ref.x[i];
+				v[1] = ref.y[i];
+				v[2] = ref.z[i];
+				p = heightfield_collision_plane(hf, v);
+				ref.hits[i] = (p != NULL);
+				if(p) {
+					ref.x[i] = v[0];
+					ref.y[i] = v[1];
+					ref.z[i] = v[2];
+					stop_body(&ref, i, p);
+				}
+			}
+			t = get_time_ms() - t;
+			if(run == 0 || t < scalar)
+				scalar = t;
+
+			copy_body_batch(&b, &start);
+			t = get_time_ms();
+			collide_body_batch(hf, &b, 1);
+			t = get_time_ms() - t;
+			if(run == 0 || t < single)
+				single = t;
+
+			copy_body_batch(&b, &start);
+			t = get_time_ms();
+			hits = collide_body_batch(hf, &b, 0);
+			t = get_time_ms() - t;
+			if(run == 0 || t < threaded)
+				threaded = t;
+		}
+
+		ok = (memcmp(ref.x, b.x, sizeof(float) * n * 6) == 0 && memcmp(ref.hits, b.hits, n) == 0);
+		printf("%7u    %19.1f    %10.1f    %19.1f    %8u%s\n", n,
+		       n / (scalar * 1000.0), n / (single * 1000.0), n / (threaded * 1000.0),
+		       hits, ok ? "" : " (results differ!)");
+
+		free(start.x);
+		free(start.hits);
+		free(ref.x);
+		free(ref.hits);
+		free(b.x);
+		free(b.hits);
+	}
+
+	free_map(m);
+}
@@ -0,0 +1,485 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "object.h"
+#include "octree.h"
+#include "broadphase.h"
+#include "parallel.h"
+
+struct broadphase {
+	float cellsize; /* smallest cell size to use */
+	float cell;     /* cell size used by the last update */
+
+	/* the dynamic objects, in order of object number */
+	unsigned int num, max;
+	unsigned int *nums;
+	float *spheres;        /* x, y, z and radius of each object */
+	int *cells;            /* x, y, z of each object's cell */
+	unsigned int *hashes;
+
+	/* the same, grouped by hash so that buckets are read in order */
+	unsigned int *sorted_nums;
+	float *sorted_spheres;
+	int *sorted_cells;
+
+	unsigned int table_size; /* a power of two */
+	unsigned int *starts;    /* first object with each hash, table_size + 1 */
+
+	struct object_pair *pairs;
+	unsigned int num_pairs, max_pairs;
+};
+
+static unsigned int
+hash_cell(int x, int y, int z, unsigned int table_size)
+{
+	unsigned int h;
+
+	h = ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u) ^
+	    ((unsigned int)z * 83492791u);
+
+	/* mix the high bits into the low ones used for the bucket */
+	h ^= h >> 16;
+	h *= 0x45d9f3bu;
+	h ^= h >> 16;
+
+	return h & (table_size - 1);
+}
+
+/*
+ * create a broadphase; cells are at least cellsize across, and
+ * are made bigger if needed to fit the biggest object
+ */
+struct broadphase *
+new_broadphase(float cellsize)
+{
+	struct broadphase *bp;
+
+	bp = calloc(1, sizeof(struct broadphase));
+	if(!bp) {
+		fprintf(stderr, "Error: Couldn't allocate memory for broadphase\n");
+		return NULL;
+	}
+
+	bp->cellsize = cellsize;
+	return bp;
+}
+
+void
+free_broadphase(struct broadphase *bp)
+{
+	if(!bp)
+		return;
+
+	free(bp->nums);
+	free(bp->spheres);
+	free(bp->cells);
+	free(bp->hashes);
+	free(bp->sorted_nums);
+	free(bp->sorted_spheres);
+	free(bp->sorted_cells);
+	free(bp->starts);
+	free(bp->pairs);
+	free(bp);
+}
+
+/* make room for n objects and a hash table to suit; returns 1 on success */
+static int
+reserve_broadphase(struct broadphase *bp, unsigned int n)
+{
+	unsigned int size;
+	void *tmp;
+
+	if(n > bp->max) {
+		size = bp->max ? bp->max : 256;
+		while(size < n)
+			size *= 2;
+
+		if(!(tmp = realloc(bp->nums, sizeof(unsigned int) * size)))
+			return 0;
+		bp->nums = tmp;
+		if(!(tmp = realloc(bp->spheres, sizeof(float) * 4 * size)))
+			return 0;
+		bp->spheres = tmp;
+		if(!(tmp = realloc(bp->cells, sizeof(int) * 3 * size)))
+			return 0;
+		bp->cells = tmp;
+		if(!(tmp = realloc(bp->hashes, sizeof(unsigned int) * size)))
+			return 0;
+		bp->hashes = tmp;
+		if(!(tmp = realloc(bp->sorted_nums, sizeof(unsigned int) * size)))
+			return 0;
+		bp->sorted_nums = tmp;
+		if(!(tmp = realloc(bp->sorted_spheres, sizeof(float) * 4 * size)))
+			return 0;
+		bp->sorted_spheres = tmp;
+		if(!(tmp = realloc(bp->sorted_cells, sizeof(int) * 3 * size)))
+			return 0;
+		bp->sorted_cells = tmp;
+		bp->max = size;
+	}
+
+	/* about two buckets per object keeps buckets short */
+	for(size = 64; size < n * 2; size *= 2)
+		;
+	if(size > bp->table_size) {
+		if(!(tmp = realloc(bp->starts, sizeof(unsigned int) * (size + 1))))
+			return 0;
+		bp->starts = tmp;
+		bp->table_size = size;
+	}
+
+	return 1;
+}
+
+static int
+add_object_pair(struct broadphase *bp, unsigned int a, unsigned int b)
+{
+	struct object_pair *tmp;
+
+	if(bp->num_pairs >= bp->max_pairs) {
+		tmp = realloc(bp->pairs, sizeof(struct object_pair) * (bp->max_pairs ? bp->max_pairs * 2 : 1024));
+		if(!tmp)
+			return 0;
+		bp->pairs = tmp;
+		bp->max_pairs = bp->max_pairs ? bp->max_pairs * 2 : 1024;
+	}
+
+	bp->pairs[bp->num_pairs].a = a;
+	bp->pairs[bp->num_pairs].b = b;
+	bp->num_pairs++;
+
+	return 1;
+}
+
+static int
+compare_object_pairs(const void *p1, const void *p2)
+{
+	const struct object_pair *a = p1, *b = p2;
+
+	if(a->a != b->a)
+		return (a->a < b->a) ? -1 : 1;
+	if(a->b != b->b)
+		return (a->b < b->b) ? -1 : 1;
+
+	return 0;
+}
+
+/* gather the dynamic objects; returns the radius of the biggest */
+static float
+gather_dynamic_objects(struct broadphase *bp)
+{
+	unsigned int i, n;
+	struct object *o;
+	float *s, maxr = 0.0f;
+
+	n = 0;
+	for(i = 0; i < get_num_objects(); i++) {
+		o = get_object(i);
+		if(o->type != OBJ_DEFAULT)
+			continue;
+
+		s = &bp->spheres[n * 4];
+		s[0] = o->position[0];
+		s[1] = o->position[1];
+		s[2] = o->position[2];
+		s[3] = o->radius;
+		if(o->radius > maxr)
+			maxr = o->radius;
+		bp->nums[n++] = i;
+	}
+	bp->num = n;
+
+	return maxr;
+}
+
+/*
+ * sort the dynamic objects into cells and find the pairs whose
+ * bounding boxes overlap; called once per frame after objects
+ * have moved. returns the number of pairs
+ */
+unsigned int
+update_broadphase(struct broadphase *bp)
+{
+	unsigned int i, j, k, h, n;
+	int x, y, z, lo[3], hi[3], *c, *cj;
+	float *s, *sj, maxr;
+
+	bp->num_pairs = 0;
+
+	n = 0;
+	for(i = 0; i < get_num_objects(); i++) {
+		if(get_object(i)->type == OBJ_DEFAULT)
+			n++;
+	}
+	if(!reserve_broadphase(bp, n)) {
+		fprintf(stderr, "Error: Couldn't allocate memory for broadphase\n");
+		bp->num = 0;
+		return 0;
+	}
+
+	/*
+	 * cells are at least twice as big as any pair of objects, so
+	 * each object only has to look at one or two cells each way
+	 */
+	maxr = gather_dynamic_objects(bp);
+	bp->cell = (bp->cellsize > maxr * 4.0f) ? bp->cellsize : maxr * 4.0f;
+	if(bp->cell <= 0.0f)
+		bp->cell = 1.0f;
+
+	memset(bp->starts, 0, sizeof(unsigned int) * (bp->table_size + 1));
+	for(i = 0; i < bp->num; i++) {
+		s = &bp->spheres[i * 4];
+		c = &bp->cells[i * 3];
+		c[0] = (int)floorf(s[0] / bp->cell);
+		c[1] = (int)floorf(s[1] / bp->cell);
+		c[2] = (int)floorf(s[2] / bp->cell);
+		bp->hashes[i] = hash_cell(c[0], c[1], c[2], bp->table_size);
+		bp->starts[bp->hashes[i]]++;
+	}
+
+	/*
+	 * counting sort by hash; filling each bucket from its end while
+	 * going backwards keeps the objects in a bucket in order
+	 */
+	for(h = 1; h <= bp->table_size; h++)
+		bp->starts[h] += bp->starts[h - 1];
+	for(i = bp->num; i > 0; i--) {
+		k = --bp->starts[bp->hashes[i - 1]];
+		bp->sorted_nums[k] = bp->nums[i - 1];
+		memcpy(&bp->sorted_spheres[k * 4], &bp->spheres[(i - 1) * 4], sizeof(float) * 4);
+		memcpy(&bp->sorted_cells[k * 3], &bp->cells[(i - 1) * 3], sizeof(int) * 3);
+	}
+
+	/*
+	 * go through the objects bucket by bucket, so that objects in
+	 * the same cell look at the same neighbouring buckets one after
+	 * another. an object can only touch objects whose centres are
+	 * within its radius plus the biggest radius, so only the cells
+	 * that range covers are looked at. each pair is found from its
+	 * lower numbered object
+	 */
+	for(i = 0; i < bp->num; i++) {
+		s = &bp->sorted_spheres[i * 4];
+		for(k = 0; k < 3; k++) {
+			lo[k] = (int)floorf((s[k] - s[3] - maxr) / bp->cell);
+			hi[k] = (int)floorf((s[k] + s[3] + maxr) / bp->cell);
+		}
+
+		for(z = lo[2]; z <= hi[2]; z++) {
+			for(y = lo[1]; y <= hi[1]; y++) {
+				for(x = lo[0]; x <= hi[0]; x++) {
+					h = hash_cell(x, y, z, bp->table_size);
+					for(j = bp->starts[h]; j < bp->starts[h + 1]; j++) {
+						cj = &bp->sorted_cells[j * 3];
+						if(bp->sorted_nums[j] <= bp->sorted_nums[i] ||
+						   cj[0] != x || cj[1] != y || cj[2] != z)
+							continue;
+
+						sj = &bp->sorted_spheres[j * 4];
+						if(fabsf(s[0] - sj[0]) > s[3] + sj[3] ||
+						   fabsf(s[1] - sj[1]) > s[3] + sj[3] ||
+						   fabsf(s[2] - sj[2]) > s[3] + sj[3])
+							continue;
+
+						if(!add_object_pair(bp, bp->sorted_nums[i], bp->sorted_nums[j])) {
+							fprintf(stderr, "Error: Couldn't allocate memory for object pairs\n");
+							bp->num_pairs = 0;
+							return 0;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	/* the pairs come out in bucket order, so put them in object order */
+	qsort(bp->pairs, bp->num_pairs, sizeof(struct object_pair), compare_object_pairs);
+
+	return bp->num_pairs;
+}
+
+/* get the pairs found by the last update */
+struct object_pair *
+get_broadphase_pairs(struct broadphase *bp, unsigned int *num_pairs)
+{
+	*num_pairs = bp->num_pairs;
+	return bp->pairs;
+}
+
+/*
+ * narrowphase; push apart the spheres of each pair that overlap,
+ * in pair order, and move them to their new octree leaves.
+ * returns the number of pairs that collided
+ */
+unsigned int
+collide_object_pairs(struct broadphase *bp)
+{
+	unsigned int i, hits = 0;
+	struct object *a, *b;
+	float d[3], dist, r, push;
+
+	for(i = 0; i < bp->num_pairs; i++) {
+		a = get_object(bp->pairs[i].a);
+		b = get_object(bp->pairs[i].b);
+
+		d[0] = b->position[0] - a->position[0];
+		d[1] = b->position[1] - a->position[1];
+		d[2] = b->position[2] - a->position[2];
+		dist = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+		r = a->radius + b->radius;
+		if(dist >= r * r)
+			continue;
+
+		dist = sqrtf(dist);
+		if(dist > 0.0f) {
+			d[0] /= dist;
+			d[1] /= dist;
+			d[2] /= dist;
+		} else {
+			d[0] = 1.0f;
+			d[1] = d[2] = 0.0f;
+		}
+
+		push = (r - dist) / 2.0f;
+		a->position[0] -= d[0] * push;
+		a->position[1] -= d[1] * push;
+		a->position[2] -= d[2] * push;
+		b->position[0] += d[0] * push;
+		b->position[1] += d[1] * push;
+		b->position[2] += d[2] * push;
+		if(a->node)
+			relink_object_in_octree(a);
+		if(b->node)
+			relink_object_in_octree(b);
+		hits++;
+	}
+
+	return hits;
+}
+
+/* count the overlapping boxes by testing every pair */
+static unsigned int
+count_pairs_brute_force()
+{
+	unsigned int i, j, n, count = 0;
+	struct object *a, *b;
+
+	n = get_num_objects();
+	for(i = 0; i < n; i++) {
+		a = get_object(i);
+		for(j = i + 1; j < n; j++) {
+			b = get_object(j);
+			if(fabsf(a->position[0] - b->position[0]) <= a->radius + b->radius &&
+			   fabsf(a->position[1] - b->position[1]) <= a->radius + b->radius &&
+			   fabsf(a->position[2] - b->position[2]) <= a->radius + b->radius)
+				count++;
+		}
+	}
+
+	return count;
+}
+
+/*
+ * time the broadphase and narrowphase with 1k, 10k and 100k
+ * objects moving about at the same density, checking the
+ * pairs against testing every pair where that's quick enough.
+ * all objects are freed afterwards
+ */
+void
+benchmark_broadphase()
+{
+	static const unsigned int counts[] = { 1000, 10000, 100000 };
+	struct broadphase *bp;
+	struct object *o;
+	unsigned int c, i, frame, n, pairs, hits, brute;
+	float side;
+	double start, broad, narrow, bruteforce;
+
+	bp = new_broadphase(2.0f);
+	if(!bp)
+		return;
+
+	printf("objects    broadphase (ms)    narrowphase (ms)    pairs    all pairs (ms)\n");
+	for(c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		n = counts[c];
+		free_all_objects();
+		for(i = 0; i < n; i++) {
+			if(!create_object(OBJ_DEFAULT))
+				break;
+		}
+		if(i < n)
+			break;
+
+		/* about one object per 64 cubic units */
+		srand(1);
+		side = cbrtf((float)n * 64.0f);
+		for(i = 0; i < n; i++) {
+			o = get_object(i);
+			o->position[0] = side * rand() / (float)RAND_MAX;
+			o->position[1] = side * rand() / (float)RAND_MAX;
+			o->position[2] = side * rand() / (float)RAND_MAX;
+			o->radius = 0.5f + 0.5f * rand() / (float)RAND_MAX;
+		}
+
+		broad = narrow = 0.0f;
+		pairs = hits = 0;
+		for(frame = 0; frame < 10; frame++) {
+			for(i = 0; i < n; i++) {
+				o = get_object(i);
+				o->position[0] += rand() / (float)RAND_MAX - 0.5f;
+				o->position[1] += rand() / (float)RAND_MAX - 0.5f;
+				o->position[2] += rand() / (float)RAND_MAX - 0.5f;
+			}
+
+			start = get_time_ms();
+			pairs = update_broadphase(bp);
+			broad += get_time_ms() - start;
+
+			start = get_time_ms();
+			hits += collide_object_pairs(bp);
+			narrow += get_time_ms() - start;
+		}
+
+		/* objects have been pushed apart since the last update */
+		pairs = update_broadphase(bp);
+		if(n <= 10000) {
+			start = get_time_ms();
+			brute = count_pairs_brute_force();
+			bruteforce = get_time_ms() - start;
+			printf("%7u    %15.3f    %16.3f    %5u    %14.2f%s\n", n, broad / 10.0, narrow / 10.0,
+			       pairs, bruteforce, (brute == pairs) ? "" : " (pairs differ!)");
+		} else {
+			printf("%7u    %15.3f    %16.3f    %5u    %14s\n", n, broad / 10.0, narrow / 10.0,
+			       pairs, "-");
+		}
+	}
+
+	free_all_objects();
+	free_broadphase(bp);
+}
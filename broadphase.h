@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * the broadphase finds pairs of dynamic (OBJ_DEFAULT) objects
+ * that might be touching without testing every object against
+ * every other one. objects are sorted into the cells of a uniform
+ * grid, which is hashed so that it doesn't need bounds, and only
+ * objects in neighbouring cells are paired up. pairs come out
+ * sorted by object number, so they don't depend on where objects
+ * happen to be stored
+ */
+
+struct object_pair {
+	unsigned int a, b; /* object numbers, a < b */
+};
+
+struct broadphase *new_broadphase(float);
+void free_broadphase(struct broadphase *);
+unsigned int update_broadphase(struct broadphase *);
+struct object_pair *get_broadphase_pairs(struct broadphase *, unsigned int *);
+unsigned int collide_object_pairs(struct broadphase *);
+void benchmark_broadphase();
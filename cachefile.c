@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * files baked from another file (map caches, terrain pages and
+ * mipmap chains) are kept until the file they're baked from changes
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "cachefile.h"
+
+/* return 1 if the cache exists and isn't older than the file it's baked from */
+int
+is_cache_fresh(const char *filename, const char *cachename)
+{
+	struct stat src, cache;
+
+	if(stat(cachename, &cache) != 0)
+		return 0;
+	if(stat(filename, &src) != 0)
+		return 1; /* nothing to rebuild from, so use the cache */
+
+	if(src.st_mtim.tv_sec != cache.st_mtim.tv_sec)
+		return (src.st_mtim.tv_sec < cache.st_mtim.tv_sec);
+
+	return (src.st_mtim.tv_nsec <= cache.st_mtim.tv_nsec);
+}
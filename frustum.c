@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * test batches of boxes against the view frustum, four or eight at
+ * a time. each box gets the same answer cull_box_in_viewport would
+ * give it: a box is outside if the corner furthest along a plane's
+ * normal is behind it, and is entirely inside a plane if the nearest
+ * corner isn't. which corner that is only depends on the plane, so
+ * the same rows are loaded for every box in the batch. the widest
+ * instruction set the processor has is picked the first time
+ * cull_boxes is called, so the program doesn't have to be built for
+ * a particular processor
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CULL_X86
+#include <immintrin.h>
+#endif
+#include "object.h"
+#include "heightfield.h"
+#include "octree.h"
+#include "quadtree.h"
+#include "map.h"
+#include "my_math.h"
+#include "frustum.h"
+#include "parallel.h"
+
+typedef unsigned int (*cull_boxes_func)(float[6][4], const float *, unsigned int, unsigned int,
+                                        unsigned int, unsigned int *);
+
+static unsigned int
+cull_boxes_scalar(float p[6][4], const float *b, unsigned int stride, unsigned int n,
+                  unsigned int planes, unsigned int *left)
+{
+	unsigned int i, j, mask, visible = 0;
+	float v[3];
+
+	for(i = 0; i < n; i++) {
+		mask = planes;
+		for(j = 0; j < 6; j++) {
+			if(!(planes & (1 << j)))
+				continue;
+
+			v[0] = b[((p[j][0] > 0.0f) ? 1 : 0) * stride + i];
+			v[1] = b[((p[j][1] > 0.0f) ? 3 : 2) * stride + i];
+			v[2] = b[((p[j][2] > 0.0f) ? 5 : 4) * stride + i];
+			if(plane_equation(p[j], v) < 0.0f)
+				break;
+
+			v[0] = b[((p[j][0] > 0.0f) ? 0 : 1) * stride + i];
+			v[1] = b[((p[j][1] > 0.0f) ? 2 : 3) * stride + i];
+			v[2] = b[((p[j][2] > 0.0f) ? 4 : 5) * stride + i];
+			if(plane_equation(p[j], v) >= 0.0f)
+				mask &= ~(1 << j);
+		}
+		if(j < 6)
+			continue;
+
+		visible |= 1 << i;
+		left[i] = mask;
+	}
+
+	return visible;
+}
+
+#ifdef CULL_X86
+/*
+ * the four boxes from i on; the planes left for each box are worked
+ * out a lane at a time, by clearing plane j's bit in the lanes that
+ * are in front of it, and stored for all four whatever count is.
+ * once all of them are behind a plane, the rest aren't tested
+ */
+__attribute__((target("sse2"))) static inline unsigned int
+cull_four_boxes(float p[6][4], const float *b, unsigned int stride, unsigned int i,
+                unsigned int count, unsigned int planes, unsigned int *left)
+{
+	__m128 a, bb, c, d, x, y, z, dist, zero = _mm_setzero_ps();
+	__m128i mask = _mm_set1_epi32(planes);
+	unsigned int j, outside = 0, lanes = (1 << count) - 1;
+
+	for(j = 0; j < 6; j++) {
+		if(!(planes & (1 << j)))
+			continue;
+
+		a = _mm_set1_ps(p[j][0]);
+		bb = _mm_set1_ps(p[j][1]);
+		c = _mm_set1_ps(p[j][2]);
+		d = _mm_set1_ps(p[j][3]);
+
+		x = _mm_loadu_ps(&b[((p[j][0] > 0.0f) ? 1 : 0) * stride + i]);
+		y = _mm_loadu_ps(&b[((p[j][1] > 0.0f) ? 3 : 2) * stride + i]);
+		z = _mm_loadu_ps(&b[((p[j][2] > 0.0f) ? 5 : 4) * stride + i]);
+		dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, a), _mm_mul_ps(y, bb)),
+		                             _mm_mul_ps(z, c)), d);
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(dist, zero));
+		if((outside & lanes) == lanes)
+			return 0;
+
+		x = _mm_loadu_ps(&b[((p[j][0] > 0.0f) ? 0 : 1) * stride + i]);
+		y = _mm_loadu_ps(&b[((p[j][1] > 0.0f) ? 2 : 3) * stride + i]);
+		z = _mm_loadu_ps(&b[((p[j][2] > 0.0f) ? 4 : 5) * stride + i]);
+		dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, a), _mm_mul_ps(y, bb)),
+		                             _mm_mul_ps(z, c)), d);
+		mask = _mm_andnot_si128(_mm_and_si128(_mm_castps_si128(_mm_cmpge_ps(dist, zero)),
+		                                      _mm_set1_epi32(1 << j)), mask);
+	}
+	_mm_storeu_si128((__m128i *)&left[i], mask);
+
+	return (~outside & lanes) << i;
+}
+
+__attribute__((target("sse2"))) static unsigned int
+cull_boxes_sse2(float p[6][4], const float *b, unsigned int stride, unsigned int n,
+                unsigned int planes, unsigned int *left)
+{
+	unsigned int i, visible = 0;
+
+	for(i = 0; i < n; i += 4)
+		visible |= cull_four_boxes(p, b, stride, i, (n - i < 4) ? n - i : 4, planes, left);
+
+	return visible;
+}
+
+/* the eight boxes from i on, the same way */
+__attribute__((target("avx"))) static inline unsigned int
+cull_eight_boxes(float p[6][4], const float *b, unsigned int stride, unsigned int i,
+                 unsigned int count, unsigned int planes, unsigned int *left)
+{
+	__m256 a, bb, c, d, x, y, z, dist, zero = _mm256_setzero_ps();
+	__m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(planes));
+	unsigned int j, outside = 0, lanes = (1 << count) - 1;
+
+	for(j = 0; j < 6; j++) {
+		if(!(planes & (1 << j)))
+			continue;
+
+		a = _mm256_set1_ps(p[j][0]);
+		bb = _mm256_set1_ps(p[j][1]);
+		c = _mm256_set1_ps(p[j][2]);
+		d = _mm256_set1_ps(p[j][3]);
+
+		x = _mm256_loadu_ps(&b[((p[j][0] > 0.0f) ? 1 : 0) * stride + i]);
+		y = _mm256_loadu_ps(&b[((p[j][1] > 0.0f) ? 3 : 2) * stride + i]);
+		z = _mm256_loadu_ps(&b[((p[j][2] > 0.0f) ? 5 : 4) * stride + i]);
+		dist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, a), _mm256_mul_ps(y, bb)),
+		                                   _mm256_mul_ps(z, c)), d);
+		outside |= _mm256_movemask_ps(_mm256_cmp_ps(dist, zero, _CMP_LT_OQ));
+		if((outside & lanes) == lanes)
+			return 0;
+
+		x = _mm256_loadu_ps(&b[((p[j][0] > 0.0f) ? 0 : 1) * stride + i]);
+		y = _mm256_loadu_ps(&b[((p[j][1] > 0.0f) ? 2 : 3) * stride + i]);
+		z = _mm256_loadu_ps(&b[((p[j][2] > 0.0f) ? 4 : 5) * stride + i]);
+		dist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, a), _mm256_mul_ps(y, bb)),
+		                                   _mm256_mul_ps(z, c)), d);
+
+		/* plain avx has no integer and, but the float ones do the same */
+		mask = _mm256_andnot_ps(_mm256_and_ps(_mm256_cmp_ps(dist, zero, _CMP_GE_OQ),
+		                                      _mm256_castsi256_ps(_mm256_set1_epi32(1 << j))), mask);
+	}
+	_mm256_storeu_ps((float *)&left[i], mask);
+
+	return (~outside & lanes) << i;
+}
+
+/* eight at a time while the rows are long enough, then four */
+__attribute__((target("avx"))) static unsigned int
+cull_boxes_avx(float p[6][4], const float *b, unsigned int stride, unsigned int n,
+               unsigned int planes, unsigned int *left)
+{
+	unsigned int i, visible = 0;
+
+	for(i = 0; i + 4 < n && i + 8 <= stride; i += 8)
+		visible |= cull_eight_boxes(p, b, stride, i, (n - i < 8) ? n - i : 8, planes, left);
+	for(; i < n; i += 4)
+		visible |= cull_four_boxes(p, b, stride, i, (n - i < 4) ? n - i : 4, planes, left);
+
+	return visible;
+}
+
+static int
+has_sse2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static int
+has_avx()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx");
+}
+#endif
+
+static int
+has_nothing()
+{
+	return 1;
+}
+
+/* the implementations, best first */
+static struct {
+	const char *name;
+	cull_boxes_func func;
+	int (*supported)();
+} cull_impls[] = {
+#ifdef CULL_X86
+	{ "avx", cull_boxes_avx, has_avx },
+	{ "sse2", cull_boxes_sse2, has_sse2 },
+#endif
+	{ "scalar", cull_boxes_scalar, has_nothing }
+};
+
+#define NUM_CULL_IMPLS (sizeof(cull_impls) / sizeof(cull_impls[0]))
+
+static unsigned int cull_impl = NUM_CULL_IMPLS;
+
+static void
+select_cull_impl()
+{
+	unsigned int i;
+
+	for(i = 0; i < NUM_CULL_IMPLS - 1; i++) {
+		if(cull_impls[i].supported())
+			break;
+	}
+	cull_impl = i;
+}
+
+/*
+ * classify n boxes against the planes in mask; returns a mask with
+ * the bits of the boxes that aren't outside set, and left[i] gets
+ * the planes box i isn't entirely inside of. left must have room
+ * for stride entries, and is only meaningful for the visible boxes
+ */
+unsigned int
+cull_boxes(float planes[6][4], const float *bounds, unsigned int stride, unsigned int n,
+           unsigned int mask, unsigned int *left)
+{
+	if(cull_impl == NUM_CULL_IMPLS)
+		select_cull_impl();
+
+	return cull_impls[cull_impl].func(planes, bounds, stride, n, mask, left);
+}
+
+/* name the instruction set cull_boxes uses */
+const char *
+get_cull_boxes_name()
+{
+	if(cull_impl == NUM_CULL_IMPLS)
+		select_cull_impl();
+
+	return cull_impls[cull_impl].name;
+}
+
+/*
+ * make the matrices glRotatef and glTranslatef would for a camera
+ * at pos turned by yaw and pitch, the way draw_world places it, and
+ * a perspective projection out to far; for benchmarks, which have
+ * no GL context to get them from
+ */
+void
+make_view_matrices(float mm[16], float pm[16], float pos[3], float yaw, float pitch, float far)
+{
+	float rx[16], rz[16], t[16], r[16];
+	float n = 0.5f, f = 1.0f / tanf(DEG2RAD(45.0f) / 2.0f);
+
+	memset(rx, 0, sizeof(rx));
+	memset(rz, 0, sizeof(rz));
+	memset(t, 0, sizeof(t));
+	rx[0] = rx[15] = rz[10] = rz[15] = t[0] = t[5] = t[10] = t[15] = 1.0f;
+	rx[5] = rx[10] = cosf(pitch);
+	rx[6] = sinf(pitch);
+	rx[9] = -rx[6];
+	rz[0] = rz[5] = cosf(yaw);
+	rz[1] = sinf(yaw);
+	rz[4] = -rz[1];
+	t[12] = -pos[0];
+	t[13] = -pos[1];
+	t[14] = -pos[2];
+
+	/* column major, so m1 * m2 is mult_matrix_4x4(out, m2, m1) */
+	mult_matrix_4x4(r, rz, rx);
+	mult_matrix_4x4(mm, t, r);
+
+	memset(pm, 0, sizeof(float) * 16);
+	pm[0] = pm[5] = f;
+	pm[10] = (far + n) / (n - far);
+	pm[11] = -1.0f;
+	pm[14] = 2.0f * far * n / (n - far);
+}
+
+/*
+ * put the bounds of a quadtree's nodes in rows of batch boxes;
+ * returns the number of batches
+ */
+static unsigned int
+get_quadtree_batches(struct terrain_quadtree *qt, unsigned int batch, float **bounds)
+{
+	unsigned int i, k, num;
+	float *b;
+
+	num = (qt->num_nodes + batch - 1) / batch;
+	b = malloc(sizeof(float) * 6 * batch * num);
+	if(!b) {
+		fprintf(stderr, "Error: Couldn't allocate memory for node bounds\n");
+		return 0;
+	}
+
+	/* the last batch is padded with copies of the last node */
+	for(i = 0; i < num * batch; i++) {
+		for(k = 0; k < 6; k++)
+			b[(i / batch) * 6 * batch + k * batch + (i % batch)] =
+				qt->nodes[(i < qt->num_nodes) ? i : qt->num_nodes - 1].bounds[k];
+	}
+
+	*bounds = b;
+	return num;
+}
+
+/*
+ * time each implementation of cull_boxes over the nodes of a
+ * heightfield's quadtree, from cameras at random points over it,
+ * in the batches of 32 a flat list would use and the batches of four
+ * siblings draw_terrain_quadtree uses; all must agree with scalar
+ */
+static void
+benchmark_culling(const char *name, struct heightfield *hf)
+{
+	static const unsigned int batches[2] = { CULL_BATCH_MAX, 4 };
+	struct terrain_quadtree *qt;
+	unsigned int i, j, k, v, n, num[2], num_views = 64, rounds;
+	unsigned int *visible, *left, *ref_visible[2] = { NULL, NULL }, *ref_left[2] = { NULL, NULL };
+	unsigned int mismatches = 0;
+	unsigned long found;
+	float *bounds[2], planes[64][6][4], mm[16], pm[16], pos[3], far;
+	double t, scalar[2] = { 0.0, 0.0 }, rate;
+
+	qt = build_terrain_quadtree(hf);
+	if(!qt)
+		return;
+	num[0] = get_quadtree_batches(qt, batches[0], &bounds[0]);
+	num[1] = get_quadtree_batches(qt, batches[1], &bounds[1]);
+	if(!num[0] || !num[1]) {
+		free(bounds[0]);
+		free(bounds[1]);
+		free_terrain_quadtree(qt);
+		return;
+	}
+
+	srand(1);
+	far = (hf->xs[hf->cols] - hf->xs[0]) / 4.0f;
+	for(v = 0; v < num_views; v++) {
+		pos[0] = hf->xs[0] + (hf->xs[hf->cols] - hf->xs[0]) * rand() / (float)RAND_MAX;
+		pos[1] = hf->ys[0] + (hf->ys[hf->rows] - hf->ys[0]) * rand() / (float)RAND_MAX;
+		pos[2] = hf->maxz + 2.0f;
+		make_view_matrices(mm, pm, pos, 2.0f * M_PI * rand() / (float)RAND_MAX,
+		                   DEG2RAD(-90.0f + 60.0f * rand() / (float)RAND_MAX), far);
+		get_frustum_planes(planes[v], mm, pm);
+	}
+
+	/* enough rounds for about twenty million tests */
+	rounds = 20000000 / (num_views * num[0] * CULL_BATCH_MAX) + 1;
+
+	printf("%s: %u quadtree nodes, %u views; cull_boxes uses %s\n",
+	       name, qt->num_nodes, num_views, get_cull_boxes_name());
+	printf("          batch    nodes/s (M)   speed-up    visible\n");
+	for(i = NUM_CULL_IMPLS; i-- > 0; ) {
+		if(!cull_impls[i].supported())
+			continue;
+
+		for(j = 0; j < 2; j++) {
+			n = batches[j] * num[j];
+			visible = malloc(sizeof(unsigned int) * num[j] * num_views);
+			left = malloc(sizeof(unsigned int) * n * num_views);
+			if(!visible || !left) {
+				fprintf(stderr, "Error: Couldn't allocate memory for culling results\n");
+				free(visible);
+				free(left);
+				continue;
+			}
+
+			t = get_time_ms();
+			for(k = 0; k < rounds; k++) {
+				for(v = 0; v < num_views; v++) {
+					for(n = 0; n < num[j]; n++)
+						visible[v * num[j] + n] = cull_impls[i].func(planes[v],
+						    bounds[j] + n * 6 * batches[j], batches[j], batches[j],
+						    VIEW_ALL_PLANES, left + (v * num[j] + n) * batches[j]);
+				}
+			}
+			t = get_time_ms() - t;
+			rate = (double)rounds * num_views * num[j] * batches[j] / (t * 1e3);
+
+			found = 0;
+			for(n = 0; n < num[j] * num_views; n++) {
+				for(k = 0; k < batches[j]; k++)
+					found += (visible[n] >> k) & 1;
+			}
+
+			/* the scalar results are the reference; check the others against them */
+			if(i == NUM_CULL_IMPLS - 1) {
+				scalar[j] = rate;
+				ref_visible[j] = visible;
+				ref_left[j] = left;
+				visible = left = NULL;
+			} else if(ref_visible[j]) {
+				for(n = 0; n < num[j] * num_views; n++) {
+					if(visible[n] != ref_visible[j][n]) {
+						mismatches++;
+						continue;
+					}
+					for(k = 0; k < batches[j]; k++) {
+						if((visible[n] & (1 << k)) &&
+						   left[n * batches[j] + k] != ref_left[j][n * batches[j] + k])
+							mismatches++;
+					}
+				}
+			}
+			printf("%-8s %6u %14.1f %9.2fx %10lu\n", cull_impls[i].name, batches[j],
+			       rate, rate / scalar[j], found / num_views);
+			free(visible);
+			free(left);
+		}
+	}
+	printf("%u differences from scalar\n", mismatches);
+
+	for(j = 0; j < 2; j++) {
+		free(ref_visible[j]);
+		free(ref_left[j]);
+	}
+	free(bounds[0]);
+	free(bounds[1]);
+	free_terrain_quadtree(qt);
+}
+
+/* compare the culling implementations over a map and a big synthetic heightfield */
+void
+benchmark_frustum_culling(const char *filename)
+{
+	struct map *m;
+	struct heightfield hf;
+
+	m = load_map(filename);
+	if(m) {
+		benchmark_culling(filename, m->heightfield);
+		free_map(m);
+	}
+
+	if(!init_hills_heightfield(&hf, 2048, 2048))
+		return;
+	benchmark_culling("synthetic hills", &hf);
+	free_heightfield_data(&hf);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * cull_boxes tests a batch of boxes against the planes of a view
+ * frustum at once. the boxes are kept in struct of arrays order:
+ * component k (min x, max x, min y, max y, min z, max z) of box i is
+ * at bounds[k * stride + i], so a row of min x's, a row of max x's
+ * and so on, which lets four or eight boxes be loaded into a
+ * register at a time. stride must be a multiple of four, and the
+ * rows are read up to it whatever n is
+ */
+
+#define CULL_BATCH_MAX 32 /* most boxes in one batch */
+
+unsigned int cull_boxes(float[6][4], const float *, unsigned int, unsigned int, unsigned int, unsigned int *);
+const char *get_cull_boxes_name();
+void make_view_matrices(float[16], float[16], float[3], float, float, float);
+void benchmark_frustum_culling(const char *);
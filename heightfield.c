@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <GL/gl.h>
+#include "object.h"
+#include "heightfield.h"
+#include "my_math.h"
+
+/* return highest of four floats */
+static float
+highest(float f1, float f2, float f3, float f4)
+{
+	float retval;
+
+	retval = f1;
+	if(f2 > retval)
+		retval = f2;
+	if(f3 > retval)
+		retval = f3;
+	if(f4 > retval)
+		retval = f4;
+
+	return retval;
+}
+
+/* return lowest of four floats */
+static float
+lowest(float f1, float f2, float f3, float f4)
+{
+	float retval;
+
+	retval = f1;
+	if(f2 < retval)
+		retval = f2;
+	if(f3 < retval)
+		retval = f3;
+	if(f4 < retval)
+		retval = f4;
+
+	return retval;
+}
+
+/* bytes of sample and plane data for a cols x rows heightfield */
+size_t
+get_heightfield_data_size(unsigned int cols, unsigned int rows)
+{
+	return sizeof(float) * ((cols + 1) + (rows + 1) +
+	                        (cols + 1) * (rows + 1) + cols * rows * 4);
+}
+
+/*
+ * allocate the sample and plane arrays for a heightfield of
+ * up to cols x rows quads in a single block; cols and rows
+ * can be lowered afterwards to use part of the arrays
+ */
+int
+init_heightfield(struct heightfield *hf, unsigned int cols, unsigned int rows)
+{
+	float *data;
+
+	memset(hf, 0, sizeof(struct heightfield));
+
+	data = malloc(get_heightfield_data_size(cols, rows));
+	if(!data) {
+		fprintf(stderr, "Error: Couldn't allocate memory for heightfield\n");
+		return 0;
+	}
+
+	hf->cols = cols;
+	hf->rows = rows;
+	hf->planes = data;
+	hf->heights = hf->planes + cols * rows * 4;
+	hf->xs = hf->heights + (cols + 1) * (rows + 1);
+	hf->ys = hf->xs + cols + 1;
+
+	return 1;
+}
+
+void
+free_heightfield_data(struct heightfield *hf)
+{
+	free(hf->planes);
+	hf->planes = hf->heights = hf->xs = hf->ys = NULL;
+	hf->cols = hf->rows = 0;
+}
+
+/*
+ * work out the planes of the quads in columns firstc to lastc - 1
+ * of rows firstr to lastr - 1
+ */
+void
+setup_heightfield_quad_planes(struct heightfield *hf, unsigned int firstc, unsigned int firstr,
+                              unsigned int lastc, unsigned int lastr)
+{
+	unsigned int r, c;
+	float v0[3], v1[3], v2[3];
+
+	for(r = firstr; r < lastr; r++) {
+		for(c = firstc; c < lastc; c++) {
+			v0[0] = hf->xs[c];
+			v0[1] = hf->ys[r + 1];
+			v0[2] = HEIGHTFIELD_SAMPLE(hf, c, r + 1);
+			v1[0] = hf->xs[c + 1];
+			v1[1] = hf->ys[r + 1];
+			v1[2] = HEIGHTFIELD_SAMPLE(hf, c + 1, r + 1);
+			v2[0] = hf->xs[c + 1];
+			v2[1] = hf->ys[r];
+			v2[2] = HEIGHTFIELD_SAMPLE(hf, c + 1, r);
+
+			setup_plane(&hf->planes[(r * hf->cols + c) * 4], v0, v1, v2);
+		}
+	}
+}
+
+/* work out the planes of the quads in rows first to last - 1 */
+void
+setup_heightfield_planes(struct heightfield *hf, unsigned int first, unsigned int last)
+{
+	setup_heightfield_quad_planes(hf, 0, first, hf->cols, last);
+}
+
+/*
+ * make a cols x rows heightfield of rolling hills with quads of
+ * one unit, centred on the origin, for benchmarks that need more
+ * terrain than the map has; returns 1 on success
+ */
+int
+init_hills_heightfield(struct heightfield *hf, unsigned int cols, unsigned int rows)
+{
+	unsigned int c, r;
+	float x, y;
+
+	if(!init_heightfield(hf, cols, rows))
+		return 0;
+
+	hf->quadsize = 1.0f;
+	for(c = 0; c <= cols; c++)
+		hf->xs[c] = (float)c - (float)(cols / 2);
+	for(r = 0; r <= rows; r++)
+		hf->ys[r] = (float)r - (float)(rows / 2);
+	for(r = 0; r <= rows; r++) {
+		for(c = 0; c <= cols; c++) {
+			x = hf->xs[c];
+			y = hf->ys[r];
+			HEIGHTFIELD_SAMPLE(hf, c, r) = 20.0f * sinf(x * 0.013f) * cosf(y * 0.017f) +
+			                               4.0f * sinf(x * 0.11f + y * 0.07f);
+		}
+	}
+	setup_heightfield_planes(hf, 0, rows);
+	update_heightfield_bounds(hf);
+
+	return 1;
+}
+
+/* update the lowest and highest samples */
+void
+update_heightfield_bounds(struct heightfield *hf)
+{
+	unsigned int i, n;
+
+	n = (hf->cols + 1) * (hf->rows + 1);
+	hf->minz = hf->maxz = n ? hf->heights[0] : 0.0f;
+	for(i = 1; i < n; i++) {
+		if(hf->heights[i] < hf->minz)
+			hf->minz = hf->heights[i];
+		if(hf->heights[i] > hf->maxz)
+			hf->maxz = hf->heights[i];
+	}
+}
+
+/* get the minx, maxx, miny, maxy, minz, maxz of quad q */
+void
+get_heightfield_quad_bounds(struct heightfield *hf, unsigned int q, float b[6])
+{
+	unsigned int c, r;
+
+	c = q % hf->cols;
+	r = q / hf->cols;
+
+	b[0] = hf->xs[c];
+	b[1] = hf->xs[c + 1];
+	b[2] = hf->ys[r];
+	b[3] = hf->ys[r + 1];
+	b[4] = lowest(HEIGHTFIELD_SAMPLE(hf, c, r + 1), HEIGHTFIELD_SAMPLE(hf, c + 1, r + 1),
+	              HEIGHTFIELD_SAMPLE(hf, c + 1, r), HEIGHTFIELD_SAMPLE(hf, c, r));
+	b[5] = highest(HEIGHTFIELD_SAMPLE(hf, c, r + 1), HEIGHTFIELD_SAMPLE(hf, c + 1, r + 1),
+	               HEIGHTFIELD_SAMPLE(hf, c + 1, r), HEIGHTFIELD_SAMPLE(hf, c, r));
+}
+
+/*
+ * get the four vertices of quad q; the terrain texture repeats every
+ * TERRAIN_TEXTURE_SIZE units whatever size the quads are, so texture
+ * coordinates come from where the vertices are, and t goes down as
+ * y goes up, as it does in an image
+ */
+void
+get_heightfield_quad_vertices(struct heightfield *hf, unsigned int q, struct vertex v[4])
+{
+	unsigned int c, r;
+	float s0, s1, t0, t1;
+
+	c = q % hf->cols;
+	r = q / hf->cols;
+	s0 = hf->xs[c] / TERRAIN_TEXTURE_SIZE;
+	s1 = hf->xs[c + 1] / TERRAIN_TEXTURE_SIZE;
+	t0 = -hf->ys[r] / TERRAIN_TEXTURE_SIZE;
+	t1 = -hf->ys[r + 1] / TERRAIN_TEXTURE_SIZE;
+
+	v[0].texcoord[0] = s0;
+	v[0].texcoord[1] = t1;
+	v[0].point[0] = hf->xs[c];
+	v[0].point[1] = hf->ys[r + 1];
+	v[0].point[2] = HEIGHTFIELD_SAMPLE(hf, c, r + 1);
+
+	v[1].texcoord[0] = s1;
+	v[1].texcoord[1] = t1;
+	v[1].point[0] = hf->xs[c + 1];
+	v[1].point[1] = hf->ys[r + 1];
+	v[1].point[2] = HEIGHTFIELD_SAMPLE(hf, c + 1, r + 1);
+
+	v[2].texcoord[0] = s1;
+	v[2].texcoord[1] = t0;
+	v[2].point[0] = hf->xs[c + 1];
+	v[2].point[1] = hf->ys[r];
+	v[2].point[2] = HEIGHTFIELD_SAMPLE(hf, c + 1, r);
+
+	v[3].texcoord[0] = s0;
+	v[3].texcoord[1] = t0;
+	v[3].point[0] = hf->xs[c];
+	v[3].point[1] = hf->ys[r];
+	v[3].point[2] = HEIGHTFIELD_SAMPLE(hf, c, r);
+}
+
+/* draw quad q; must be called between glBegin(GL_QUADS) and glEnd() */
+void
+draw_heightfield_quad(struct heightfield *hf, unsigned int q)
+{
+	int i;
+	struct vertex v[4];
+
+	get_heightfield_quad_vertices(hf, q, v);
+	for(i = 0; i < 4; i++) {
+		glTexCoord2f(v[i].texcoord[0], v[i].texcoord[1]);
+		glVertex3f(v[i].point[0], v[i].point[1], v[i].point[2]);
+	}
+}
+
+/* draw every quad; must be called between glBegin(GL_QUADS) and glEnd() */
+void
+draw_heightfield(struct heightfield *hf)
+{
+	unsigned int q;
+
+	for(q = 0; q < hf->cols * hf->rows; q++)
+		draw_heightfield_quad(hf, q);
+}
+
+/*
+ * get the height and normal of the surface at x, y by looking up
+ * the quad under it; a quad is drawn as the triangles v0 v1 v2 and
+ * v0 v2 v3, so the height is interpolated across whichever of those
+ * x, y is in. returns 0 if x, y is outside of the heightfield
+ */
+int
+get_heightfield_height(struct heightfield *hf, float x, float y, float *z, float n[3])
+{
+	int c, r;
+	float u, v, h00, h10, h01, h11, dzdu, dzdv, len;
+
+	if(hf->cols == 0 || hf->rows == 0)
+		return 0;
+	if(x < hf->xs[0] || x > hf->xs[hf->cols] ||
+	   y < hf->ys[0] || y > hf->ys[hf->rows])
+		return 0;
+
+	c = (int)((x - hf->xs[0]) / hf->quadsize);
+	r = (int)((y - hf->ys[0]) / hf->quadsize);
+	if(c >= (int)hf->cols)
+		c = hf->cols - 1;
+	if(r >= (int)hf->rows)
+		r = hf->rows - 1;
+
+	u = (x - hf->xs[c]) / (hf->xs[c + 1] - hf->xs[c]);
+	v = (y - hf->ys[r]) / (hf->ys[r + 1] - hf->ys[r]);
+	h00 = HEIGHTFIELD_SAMPLE(hf, c, r);
+	h10 = HEIGHTFIELD_SAMPLE(hf, c + 1, r);
+	h01 = HEIGHTFIELD_SAMPLE(hf, c, r + 1);
+	h11 = HEIGHTFIELD_SAMPLE(hf, c + 1, r + 1);
+
+	if(u + v >= 1.0f) {
+		/* v0 v1 v2, the triangle with corner (c + 1, r + 1) */
+		dzdu = h11 - h01;
+		dzdv = h11 - h10;
+		*z = h11 - (1.0f - u) * dzdu - (1.0f - v) * dzdv;
+	} else {
+		dzdu = h10 - h00;
+		dzdv = h01 - h00;
+		*z = h00 + u * dzdu + v * dzdv;
+	}
+
+	if(n) {
+		n[0] = -dzdu / (hf->xs[c + 1] - hf->xs[c]);
+		n[1] = -dzdv / (hf->ys[r + 1] - hf->ys[r]);
+		n[2] = 1.0f;
+		len = sqrtf(n[0] * n[0] + n[1] * n[1] + 1.0f);
+		n[0] /= len;
+		n[1] /= len;
+		n[2] /= len;
+	}
+
+	return 1;
+}
+
+/*
+ * push v out of the heightfield if it's below the quad under it,
+ * returning the plane of the quad it was pushed out of, or NULL.
+ * the quad is found directly from v's position; a point on the
+ * edge of a quad is inside its neighbours too, so the quads
+ * around it are tried in order, the first one v is below winning
+ */
+float *
+heightfield_collision_plane(struct heightfield *hf, float v[3])
+{
+	int col, row, c, r, lastc, lastr;
+	float *p;
+	float d;
+
+	if(hf->cols == 0 || hf->rows == 0)
+		return NULL;
+	if(v[0] < hf->xs[0] || v[0] > hf->xs[hf->cols] ||
+	   v[1] < hf->ys[0] || v[1] > hf->ys[hf->rows])
+		return NULL;
+
+	col = (int)((v[0] - hf->xs[0]) / hf->quadsize);
+	row = (int)((v[1] - hf->ys[0]) / hf->quadsize);
+	lastc = (col + 1 < (int)hf->cols) ? col + 1 : (int)hf->cols - 1;
+	lastr = (row + 1 < (int)hf->rows) ? row + 1 : (int)hf->rows - 1;
+
+	for(r = (row > 0) ? row - 1 : 0; r <= lastr; r++) {
+		if(v[1] < hf->ys[r] || v[1] > hf->ys[r + 1])
+			continue;
+		for(c = (col > 0) ? col - 1 : 0; c <= lastc; c++) {
+			if(v[0] < hf->xs[c] || v[0] > hf->xs[c + 1])
+				continue;
+
+			p = &hf->planes[(r * hf->cols + c) * 4];
+			d = plane_equation(p, v);
+			if(d <= 0.0f) {
+				v[0] += -d * p[0];
+				v[1] += -d * p[1];
+				v[2] += (-d * p[2]) / 2.0f;
+				return p;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* push v out of the heightfield; returns 1 if it was below it */
+int
+heightfield_collision(struct heightfield *hf, float v[3])
+{
+	return heightfield_collision_plane(hf, v) != NULL;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * a heightfield is a grid of quads sharing their corners; the
+ * height of every corner is stored once, and quad bounds and
+ * vertices are worked out from the grid when they're needed.
+ * quad number q is column q % cols of row q / cols, and its
+ * corners are samples (c, r), (c + 1, r), (c, r + 1), (c + 1, r + 1)
+ */
+struct heightfield {
+	unsigned int cols, rows;  /* quads */
+	unsigned int col0, row0;  /* column and row of the first quad in the map */
+	float quadsize;           /* units along the side of a quad */
+	float minz, maxz;         /* lowest and highest sample */
+
+	float *xs;      /* cols + 1 sample x positions */
+	float *ys;      /* rows + 1 sample y positions */
+	float *heights; /* (cols + 1) * (rows + 1) sample heights, row by row */
+	float *planes;  /* cols * rows quad planes, 4 floats each */
+};
+
+#define HEIGHTFIELD_SAMPLE(hf, c, r) ((hf)->heights[(r) * ((hf)->cols + 1) + (c)])
+
+#define TERRAIN_TEXTURE_SIZE 32.0f /* units the terrain texture covers before it repeats */
+
+int init_heightfield(struct heightfield *, unsigned int, unsigned int);
+void free_heightfield_data(struct heightfield *);
+size_t get_heightfield_data_size(unsigned int, unsigned int);
+void setup_heightfield_quad_planes(struct heightfield *, unsigned int, unsigned int, unsigned int, unsigned int);
+void setup_heightfield_planes(struct heightfield *, unsigned int, unsigned int);
+void update_heightfield_bounds(struct heightfield *);
+int init_hills_heightfield(struct heightfield *, unsigned int, unsigned int);
+void get_heightfield_quad_bounds(struct heightfield *, unsigned int, float[6]);
+void get_heightfield_quad_vertices(struct heightfield *, unsigned int, struct vertex[4]);
+void draw_heightfield_quad(struct heightfield *, unsigned int);
+void draw_heightfield(struct heightfield *);
+int get_heightfield_height(struct heightfield *, float, float, float *, float[3]);
+float *heightfield_collision_plane(struct heightfield *, float[3]);
+int heightfield_collision(struct heightfield *, float[3]);
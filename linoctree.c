@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "object.h"
+#include "heightfield.h"
+#include "octree.h"
+#include "linoctree.h"
+#include "map.h"
+#include "my_math.h"
+#include "parallel.h"
+
+/* subnodes in Morton order: x is the lowest bit, then y, then z */
+static const int morton_subnodes[8] = { 4, 5, 7, 6, 0, 1, 3, 2 };
+
+/* count a branch's nodes and items; returns 0 if its quads aren't all in one heightfield */
+static int
+count_linear_octree(struct octree_node *on, unsigned int *nodes, unsigned int *items,
+                    struct heightfield **hf)
+{
+	int i;
+
+	(*nodes)++;
+	*items += on->num_objects + on->num_quads;
+	if(on->num_quads) {
+		if(*hf && *hf != on->heightfield)
+			return 0;
+		*hf = on->heightfield;
+	}
+
+	for(i = 0; i < 8; i++) {
+		if(on->subnodes[i] && !count_linear_octree(on->subnodes[i], nodes, items, hf))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void
+fill_linear_octree(struct linear_octree *lo, struct octree_node *on,
+                   unsigned int *next_node, unsigned int *next_item)
+{
+	struct linear_octree_node *n;
+	unsigned int num;
+	int i;
+
+	num = (*next_node)++;
+	n = &lo->nodes[num];
+	n->minx = on->minx; n->maxx = on->maxx;
+	n->miny = on->miny; n->maxy = on->maxy;
+	n->minz = on->minz; n->maxz = on->maxz;
+	memcpy(n->bounds, on->bounds, sizeof(n->bounds));
+	n->items = *next_item;
+	n->num_objects = on->num_objects;
+	n->num_quads = on->num_quads;
+	memcpy(&lo->items[*next_item], on->objects, sizeof(unsigned int) * on->num_objects);
+	*next_item += on->num_objects;
+	memcpy(&lo->items[*next_item], on->quads, sizeof(unsigned int) * on->num_quads);
+	*next_item += on->num_quads;
+
+	for(i = 0; i < 8; i++) {
+		if(on->subnodes[morton_subnodes[i]])
+			fill_linear_octree(lo, on->subnodes[morton_subnodes[i]], next_node, next_item);
+	}
+
+	/* n may only be used by index from here on */
+	lo->nodes[num].skip = *next_node;
+}
+
+/*
+ * pack an octree into a linear octree in one allocation; returns
+ * NULL on failure
+ */
+struct linear_octree *
+build_linear_octree(struct octree_node *root)
+{
+	struct linear_octree *lo;
+	struct heightfield *hf = NULL;
+	unsigned int nodes = 0, items = 0, next_node = 0, next_item = 0;
+
+	if(!root)
+		return NULL;
+
+	if(!count_linear_octree(root, &nodes, &items, &hf)) {
+		fprintf(stderr, "Error: Octree has quads from more than one heightfield\n");
+		return NULL;
+	}
+
+	lo = malloc(sizeof(struct linear_octree) + sizeof(struct linear_octree_node) * nodes +
+	            sizeof(unsigned int) * items);
+	if(!lo) {
+		fprintf(stderr, "Error: Couldn't allocate memory for linear octree\n");
+		return NULL;
+	}
+
+	lo->num_nodes = nodes;
+	lo->num_items = items;
+	lo->heightfield = hf;
+	lo->nodes = (struct linear_octree_node *)(lo + 1);
+	lo->items = (unsigned int *)(lo->nodes + nodes);
+	fill_linear_octree(lo, root, &next_node, &next_item);
+
+	return lo;
+}
+
+void
+free_linear_octree(struct linear_octree *lo)
+{
+	free(lo);
+}
+
+static int
+is_point_in_linear_node(struct linear_octree_node *n, float p[3])
+{
+	return (p[0] >= n->minx && p[0] < n->maxx &&
+	        p[1] >= n->miny && p[1] < n->maxy &&
+	        p[2] >= n->minz && p[2] < n->maxz);
+}
+
+/* get the leaf that point p falls within, like get_octree_leaf_from_point */
+int
+get_linear_octree_leaf_from_point(struct linear_octree *lo, float p[3])
+{
+	unsigned int n = 0, c;
+
+	if(!lo || lo->num_nodes == 0)
+		return -1;
+
+	for(;;) {
+		/* children are between the node and its skip */
+		for(c = n + 1; c < lo->nodes[n].skip; c = lo->nodes[c].skip) {
+			if(is_point_in_linear_node(&lo->nodes[c], p))
+				break;
+		}
+		if(c >= lo->nodes[n].skip)
+			return n;
+		n = c;
+	}
+}
+
+/*
+ * get the smallest node that entirely contains the box, like
+ * get_octree_node_from_box; returns -1 if the box isn't inside
+ * the octree at all
+ */
+int
+get_linear_octree_node_from_box(struct linear_octree *lo, float minx, float maxx,
+                                float miny, float maxy, float minz, float maxz)
+{
+	struct linear_octree_node *cn;
+	unsigned int n = 0, c;
+
+	if(!lo || lo->num_nodes == 0)
+		return -1;
+
+	cn = &lo->nodes[0];
+	if(minx < cn->minx || maxx > cn->maxx || miny < cn->miny ||
+	   maxy > cn->maxy || minz < cn->minz || maxz > cn->maxz)
+		return -1;
+
+	for(;;) {
+		for(c = n + 1; c < lo->nodes[n].skip; c = lo->nodes[c].skip) {
+			cn = &lo->nodes[c];
+			if(minx >= cn->minx && maxx <= cn->maxx && miny >= cn->miny &&
+			   maxy <= cn->maxy && minz >= cn->minz && maxz <= cn->maxz)
+				break;
+		}
+		if(c >= lo->nodes[n].skip)
+			return n;
+		n = c;
+	}
+}
+
+/* count the quads in the nodes of a pointer octree whose bounds overlap box b */
+static unsigned int
+count_box_quads(struct octree_node *on, float b[6])
+{
+	unsigned int i, n;
+
+	if(!on || on->bounds[1] < b[0] || on->bounds[0] > b[1] || on->bounds[3] < b[2] ||
+	   on->bounds[2] > b[3] || on->bounds[5] < b[4] || on->bounds[4] > b[5])
+		return 0;
+
+	n = on->num_quads;
+	for(i = 0; i < 8; i++)
+		n += count_box_quads(on->subnodes[i], b);
+
+	return n;
+}
+
+/* the same for a linear octree */
+static unsigned int
+count_linear_box_quads(struct linear_octree *lo, float b[6])
+{
+	struct linear_octree_node *on;
+	unsigned int i, n = 0;
+
+	for(i = 0; i < lo->num_nodes; ) {
+		on = &lo->nodes[i];
+		if(on->bounds[1] < b[0] || on->bounds[0] > b[1] || on->bounds[3] < b[2] ||
+		   on->bounds[2] > b[3] || on->bounds[5] < b[4] || on->bounds[4] > b[5]) {
+			i = on->skip;
+			continue;
+		}
+		n += on->num_quads;
+		i++;
+	}
+
+	return n;
+}
+
+/* get box n of a benchmark's boxes, four quads across around its nth point */
+static void
+get_benchmark_box(float b[6], const float *points, unsigned int n, float size)
+{
+	b[0] = points[n * 3] - size;
+	b[1] = points[n * 3] + size;
+	b[2] = points[n * 3 + 1] - size;
+	b[3] = points[n * 3 + 1] + size;
+	b[4] = points[n * 3 + 2] - size;
+	b[5] = points[n * 3 + 2] + size;
+}
+
+/*
+ * time leaf lookups, the lookups of the node a box fits in and box
+ * queries, the searches collision and culling make, in a pointer
+ * octree and its linear copy
+ */
+static void
+benchmark_octree_layouts(const char *name, struct octree_node *root, struct heightfield *hf)
+{
+	struct linear_octree *lo;
+	struct octree_node *on;
+	unsigned int i, n, num_points = 1000000, num_boxes = 20000, mismatches = 0;
+	unsigned long found[2];
+	float *points, b[6], size;
+	double t, built, times[3][2];
+	int ln;
+
+	t = get_time_ms();
+	lo = build_linear_octree(root);
+	built = get_time_ms() - t;
+	points = malloc(sizeof(float) * 3 * num_points);
+	if(!lo || !points) {
+		fprintf(stderr, "Error: Couldn't allocate memory for octree benchmark\n");
+		free_linear_octree(lo);
+		free(points);
+		return;
+	}
+
+	srand(1);
+	for(i = 0; i < num_points; i++) {
+		points[i * 3] = hf->xs[0] + (hf->xs[hf->cols] - hf->xs[0]) * rand() / (float)RAND_MAX;
+		points[i * 3 + 1] = hf->ys[0] + (hf->ys[hf->rows] - hf->ys[0]) * rand() / (float)RAND_MAX;
+		points[i * 3 + 2] = hf->minz + (hf->maxz - hf->minz) * rand() / (float)RAND_MAX;
+	}
+
+	/* leaf lookups, checking both find the same leaf */
+	found[0] = found[1] = 0;
+	t = get_time_ms();
+	for(i = 0; i < num_points; i++)
+		found[0] += get_octree_leaf_from_point(root, &points[i * 3])->num_quads;
+	times[0][0] = get_time_ms() - t;
+	t = get_time_ms();
+	for(i = 0; i < num_points; i++)
+		found[1] += lo->nodes[get_linear_octree_leaf_from_point(lo, &points[i * 3])].num_quads;
+	times[0][1] = get_time_ms() - t;
+	for(i = 0; i < num_points; i += 97) {
+		on = get_octree_leaf_from_point(root, &points[i * 3]);
+		ln = get_linear_octree_leaf_from_point(lo, &points[i * 3]);
+		if(on->minx != lo->nodes[ln].minx || on->miny != lo->nodes[ln].miny ||
+		   on->minz != lo->nodes[ln].minz || on->num_quads != lo->nodes[ln].num_quads ||
+		   (on->num_quads && memcmp(on->quads, LINEAR_OCTREE_QUADS(lo, ln),
+		                            sizeof(unsigned int) * on->num_quads) != 0))
+			mismatches++;
+	}
+	if(found[0] != found[1])
+		mismatches++;
+
+	/* the nodes boxes fit in, checking both find the same node */
+	size = hf->quadsize * 2.0f;
+	found[0] = found[1] = 0;
+	t = get_time_ms();
+	for(i = 0; i < num_points; i++) {
+		get_benchmark_box(b, points, i, size);
+		on = get_octree_node_from_box(root, b[0], b[1], b[2], b[3], b[4], b[5]);
+		found[0] += on ? on->num_quads : 0;
+	}
+	times[1][0] = get_time_ms() - t;
+	t = get_time_ms();
+	for(i = 0; i < num_points; i++) {
+		get_benchmark_box(b, points, i, size);
+		ln = get_linear_octree_node_from_box(lo, b[0], b[1], b[2], b[3], b[4], b[5]);
+		found[1] += ln >= 0 ? lo->nodes[ln].num_quads : 0;
+	}
+	times[1][1] = get_time_ms() - t;
+	for(i = 0; i < num_points; i += 97) {
+		get_benchmark_box(b, points, i, size);
+		on = get_octree_node_from_box(root, b[0], b[1], b[2], b[3], b[4], b[5]);
+		ln = get_linear_octree_node_from_box(lo, b[0], b[1], b[2], b[3], b[4], b[5]);
+		if(!on != (ln < 0) || (on && (on->minx != lo->nodes[ln].minx || on->miny != lo->nodes[ln].miny ||
+		                              on->minz != lo->nodes[ln].minz || on->maxx != lo->nodes[ln].maxx)))
+			mismatches++;
+	}
+	if(found[0] != found[1])
+		mismatches++;
+
+	/* the quads in boxes around the lookup points */
+	found[0] = found[1] = 0;
+	for(n = 0; n < 2; n++) {
+		t = get_time_ms();
+		for(i = 0; i < num_boxes; i++) {
+			get_benchmark_box(b, points, i, size);
+			found[n] += n ? count_linear_box_quads(lo, b) : count_box_quads(root, b);
+		}
+		times[2][n] = get_time_ms() - t;
+	}
+	if(found[0] != found[1])
+		mismatches++;
+
+	printf("%s: %u nodes, %u items, linear copy built in %.2f ms (%.1f KB)\n", name,
+	       lo->num_nodes, lo->num_items, built,
+	       (sizeof(struct linear_octree) + sizeof(struct linear_octree_node) * lo->num_nodes +
+	        sizeof(unsigned int) * lo->num_items) / 1024.0);
+	printf("                      pointer tree    linear tree    speed-up\n");
+	printf("leaf lookups (ns)     %12.1f   %12.1f    %7.2fx\n", times[0][0] * 1e6 / num_points,
+	       times[0][1] * 1e6 / num_points, times[0][0] / times[0][1]);
+	printf("box nodes (ns)        %12.1f   %12.1f    %7.2fx\n", times[1][0] * 1e6 / num_points,
+	       times[1][1] * 1e6 / num_points, times[1][0] / times[1][1]);
+	printf("box queries (us)      %12.2f   %12.2f    %7.2fx\n", times[2][0] * 1e3 / num_boxes,
+	       times[2][1] * 1e3 / num_boxes, times[2][0] / times[2][1]);
+	printf("%u differences between the two\n", mismatches);
+
+	free_linear_octree(lo);
+	free(points);
+}
+
+/*
+ * compare pointer and linear octrees over a map and over a big
+ * synthetic heightfield put in an octree the way build_map does
+ */
+void
+benchmark_linear_octree(const char *filename)
+{
+	struct map *m;
+	struct heightfield hf;
+	struct octree_node *root;
+
+	m = load_map(filename);
+	if(m) {
+		benchmark_octree_layouts(filename, m->octree, m->heightfield);
+		free_map(m);
+	}
+
+	if(!init_hills_heightfield(&hf, 1024, 1024))
+		return;
+
+	root = build_heightfield_octree(&hf, get_num_cpus());
+	if(root) {
+		benchmark_octree_layouts("synthetic hills", root, &hf);
+		free_octree_branch(root);
+	}
+	free_heightfield_data(&hf);
+}
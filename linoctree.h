@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * a linear octree is a read-only copy of an octree packed into one
+ * block: the nodes in depth first order with children in Morton
+ * order, then the numbers of the objects and quads in them. a node
+ * refers to other nodes only by index; its first child is the node
+ * after it and skip is the node after its whole branch, so the block
+ * can be written out or mapped as it is. the game draws and queries
+ * through the pointer octree, which takes edits; this layout is only
+ * measured against it, by -octreebench and -quadbench
+ */
+struct linear_octree_node {
+	float minx, maxx;
+	float miny, maxy;
+	float minz, maxz;
+	float bounds[6]; /* around what's in the branch, as in the octree */
+
+	unsigned int skip;  /* node after this branch; the next node if it's a leaf */
+	unsigned int items; /* its first object in items; its quads follow */
+	unsigned int num_objects, num_quads;
+};
+
+struct linear_octree {
+	unsigned int num_nodes, num_items;
+	struct heightfield *heightfield; /* heightfield the quads are in */
+
+	struct linear_octree_node *nodes;
+	unsigned int *items;
+};
+
+#define LINEAR_OCTREE_OBJECTS(lo, n) (&(lo)->items[(lo)->nodes[n].items])
+#define LINEAR_OCTREE_QUADS(lo, n) (&(lo)->items[(lo)->nodes[n].items + (lo)->nodes[n].num_objects])
+
+struct linear_octree *build_linear_octree(struct octree_node *);
+void free_linear_octree(struct linear_octree *);
+int get_linear_octree_leaf_from_point(struct linear_octree *, float[3]);
+int get_linear_octree_node_from_box(struct linear_octree *, float, float, float, float, float, float);
+void benchmark_linear_octree(const char *);
@@ -0,0 +1,653 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "object.h"
+#include "heightfield.h"
+#include "quadtree.h"
+#include "mesh.h"
+#include "lod.h"
+#include "map.h"
+#include "my_math.h"
+#include "frustum.h"
+#include "parallel.h"
+#include "occlusion.h"
+
+#define LOD_FLOOR_DEPTH 1.0f /* how far below the lowest sample the skirts hang */
+#define LOD_MAX_DEPTH   16   /* deepest quadtree the neighbours are worked out for */
+
+/* sides of a node, in the order their skirts are stored */
+#define LOD_BOTTOM 0
+#define LOD_RIGHT  1
+#define LOD_TOP    2
+#define LOD_LEFT   3
+
+/* quads between a node's mesh vertices, for a node depth levels down */
+static unsigned int
+get_lod_step(struct terrain_lod *lod, unsigned int depth)
+{
+	return (lod->size >> depth) / TERRAIN_LOD_GRID;
+}
+
+/*
+ * get the columns, or rows, of mesh vertices across [first, last],
+ * step quads apart but for the last, which may be cut off at the
+ * edge of the map; returns the number of quads between them
+ */
+static unsigned int
+get_lod_lines(unsigned int first, unsigned int last, unsigned int step, unsigned int lines[TERRAIN_LOD_GRID + 1])
+{
+	unsigned int n = 0, i;
+
+	for(i = first; i < last; i += step)
+		lines[n++] = i;
+	lines[n] = last;
+
+	return n;
+}
+
+/*
+ * find how far the mesh of node n, step quads between vertices,
+ * is from the samples in [firstc, lastc] x [firstr, lastr] that are
+ * under it. the mesh's quads are split the way the map's are
+ */
+static float
+get_lod_error(struct terrain_lod *lod, unsigned int n, unsigned int step, unsigned int firstc,
+              unsigned int firstr, unsigned int lastc, unsigned int lastr)
+{
+	struct terrain_quadtree_node *on = &lod->quadtree->nodes[n];
+	struct heightfield *hf = lod->quadtree->heightfield;
+	unsigned int cs[TERRAIN_LOD_GRID + 1], rs[TERRAIN_LOD_GRID + 1];
+	unsigned int nx, ny, c, r, i, j, c0, c1, r0, r1;
+	float u, v, z, e, error = 0.0f;
+
+	nx = get_lod_lines(on->firstc, on->lastc, step, cs);
+	ny = get_lod_lines(on->firstr, on->lastr, step, rs);
+	if(firstc < on->firstc)
+		firstc = on->firstc;
+	if(firstr < on->firstr)
+		firstr = on->firstr;
+	if(lastc > on->lastc)
+		lastc = on->lastc;
+	if(lastr > on->lastr)
+		lastr = on->lastr;
+
+	for(r = firstr; r <= lastr; r++) {
+		j = (r - on->firstr) / step;
+		if(j >= ny)
+			j = ny - 1;
+		r0 = rs[j];
+		r1 = rs[j + 1];
+		v = (float)(r - r0) / (float)(r1 - r0);
+		for(c = firstc; c <= lastc; c++) {
+			i = (c - on->firstc) / step;
+			if(i >= nx)
+				i = nx - 1;
+			c0 = cs[i];
+			c1 = cs[i + 1];
+			u = (float)(c - c0) / (float)(c1 - c0);
+
+			/* the triangles v0 v1 v2 and v0 v2 v3 meet on the diagonal u + v = 1 */
+			if(u + v >= 1.0f)
+				z = HEIGHTFIELD_SAMPLE(hf, c1, r1) +
+				    (HEIGHTFIELD_SAMPLE(hf, c0, r1) - HEIGHTFIELD_SAMPLE(hf, c1, r1)) * (1.0f - u) +
+				    (HEIGHTFIELD_SAMPLE(hf, c1, r0) - HEIGHTFIELD_SAMPLE(hf, c1, r1)) * (1.0f - v);
+			else
+				z = HEIGHTFIELD_SAMPLE(hf, c0, r0) +
+				    (HEIGHTFIELD_SAMPLE(hf, c1, r0) - HEIGHTFIELD_SAMPLE(hf, c0, r0)) * u +
+				    (HEIGHTFIELD_SAMPLE(hf, c0, r1) - HEIGHTFIELD_SAMPLE(hf, c0, r0)) * v;
+
+			e = fabsf(HEIGHTFIELD_SAMPLE(hf, c, r) - z);
+			if(e > error)
+				error = e;
+		}
+	}
+
+	return error;
+}
+
+/* add a skirt from the edge a b down to the floor vertices under them */
+static unsigned int *
+add_lod_skirt(unsigned int *idx, unsigned int a, unsigned int b, unsigned int floor)
+{
+	idx[0] = a;
+	idx[1] = b;
+	idx[2] = b + floor;
+	idx[3] = a;
+	idx[4] = b + floor;
+	idx[5] = a + floor;
+
+	return idx + 6;
+}
+
+/*
+ * put the mesh and skirts of node n, depth levels down, and then of
+ * the nodes under it, into the index array at *idx, and work out how
+ * far each node's mesh is from the samples. a node's error is never
+ * less than its children's, so that a node that's good enough has
+ * children that are too. cells gets each node's place at its depth
+ */
+static void
+fill_lod_node(struct terrain_lod *lod, unsigned int n, unsigned int depth, unsigned int **idx,
+              unsigned int *cells)
+{
+	struct terrain_quadtree *qt = lod->quadtree;
+	struct terrain_quadtree_node *on = &qt->nodes[n];
+	struct heightfield *hf = qt->heightfield;
+	unsigned int cs[TERRAIN_LOD_GRID + 1], rs[TERRAIN_LOD_GRID + 1];
+	unsigned int *start = &lod->starts[n * 5], *p = *idx;
+	unsigned int nx, ny, i, j, w, floor, step, c;
+
+	step = get_lod_step(lod, depth);
+	nx = get_lod_lines(on->firstc, on->lastc, step, cs);
+	ny = get_lod_lines(on->firstr, on->lastr, step, rs);
+	w = hf->cols + 1;
+	floor = w * (hf->rows + 1);
+
+	start[0] = p - lod->indices;
+	for(j = 0; j < ny; j++) {
+		for(i = 0; i < nx; i++) {
+			p[0] = rs[j + 1] * w + cs[i];
+			p[1] = rs[j + 1] * w + cs[i + 1];
+			p[2] = rs[j] * w + cs[i + 1];
+			p[3] = p[0];
+			p[4] = p[2];
+			p[5] = rs[j] * w + cs[i];
+			p += 6;
+		}
+	}
+
+	/* there's nothing to leave a crack with past the map's edges */
+	start[1 + LOD_BOTTOM] = p - lod->indices;
+	for(i = 0; on->firstr > 0 && i < nx; i++)
+		p = add_lod_skirt(p, rs[0] * w + cs[i], rs[0] * w + cs[i + 1], floor);
+	start[1 + LOD_RIGHT] = p - lod->indices;
+	for(j = 0; on->lastc < hf->cols && j < ny; j++)
+		p = add_lod_skirt(p, rs[j] * w + cs[nx], rs[j + 1] * w + cs[nx], floor);
+	start[1 + LOD_TOP] = p - lod->indices;
+	for(i = 0; on->lastr < hf->rows && i < nx; i++)
+		p = add_lod_skirt(p, rs[ny] * w + cs[i + 1], rs[ny] * w + cs[i], floor);
+	start[1 + LOD_LEFT] = p - lod->indices;
+	for(j = 0; on->firstc > 0 && j < ny; j++)
+		p = add_lod_skirt(p, rs[j + 1] * w + cs[0], rs[j] * w + cs[0], floor);
+	*idx = p;
+
+	if(depth < LOD_MAX_DEPTH)
+		cells[((1u << (2 * depth)) - 1) / 3 + (on->firstr / (lod->size >> depth) << depth) +
+		      on->firstc / (lod->size >> depth)] = n;
+
+	/* a leaf's mesh is its own quads */
+	lod->errors[n] = 0.0f;
+	if(on->skip == n + 1)
+		return;
+
+	lod->errors[n] = get_lod_error(lod, n, step, on->firstc, on->firstr, on->lastc, on->lastr);
+	for(c = n + 1; c < on->skip; c = qt->nodes[c].skip) {
+		fill_lod_node(lod, c, depth + 1, idx, cells);
+		if(lod->errors[c] > lod->errors[n])
+			lod->errors[n] = lod->errors[c];
+	}
+}
+
+/* find the nodes of the same size on each side of node n and those under it */
+static void
+link_lod_node(struct terrain_lod *lod, unsigned int n, unsigned int depth, const unsigned int *cells)
+{
+	struct terrain_quadtree_node *on = &lod->quadtree->nodes[n];
+	unsigned int *nb = &lod->neighbours[n * 4], cx, cy, side, row, c;
+
+	nb[LOD_BOTTOM] = nb[LOD_RIGHT] = nb[LOD_TOP] = nb[LOD_LEFT] = ~0u;
+	if(depth < LOD_MAX_DEPTH) {
+		side = 1u << depth;
+		cx = on->firstc / (lod->size >> depth);
+		cy = on->firstr / (lod->size >> depth);
+		row = ((1u << (2 * depth)) - 1) / 3;
+		if(cy > 0)
+			nb[LOD_BOTTOM] = cells[row + (cy - 1) * side + cx];
+		if(cx + 1 < side)
+			nb[LOD_RIGHT] = cells[row + cy * side + cx + 1];
+		if(cy + 1 < side)
+			nb[LOD_TOP] = cells[row + (cy + 1) * side + cx];
+		if(cx > 0)
+			nb[LOD_LEFT] = cells[row + cy * side + cx - 1];
+	}
+
+	for(c = n + 1; c < on->skip; c = lod->quadtree->nodes[c].skip)
+		link_lod_node(lod, c, depth + 1, cells);
+}
+
+/*
+ * build the LOD meshes of a quadtree's nodes, in buffer objects if
+ * use_buffers is set, or to be drawn from memory if it isn't; needs
+ * a current GL context for the buffers
+ */
+struct terrain_lod *
+new_terrain_lod(struct terrain_quadtree *qt, int use_buffers)
+{
+	struct terrain_lod *lod;
+	struct heightfield *hf;
+	unsigned int i, depth, num_cells, grid, *idx, *cells;
+	float *floor;
+
+	if(!qt || qt->num_nodes == 0)
+		return NULL;
+
+	lod = malloc(sizeof(struct terrain_lod));
+	if(!lod) {
+		fprintf(stderr, "Error: Couldn't allocate memory for terrain LOD\n");
+		return NULL;
+	}
+	bzero(lod, sizeof(struct terrain_lod));
+
+	hf = qt->heightfield;
+	lod->quadtree = qt;
+	lod->threshold = TERRAIN_LOD_THRESHOLD;
+	for(lod->size = TERRAIN_QUADTREE_LEAF_QUADS, depth = 0;
+	    lod->size < hf->cols || lod->size < hf->rows; lod->size *= 2, depth++)
+		;
+
+	/* no node has more than its mesh and a skirt along each side */
+	grid = (hf->cols + 1) * (hf->rows + 1);
+	lod->num_vertices = 2 * grid;
+	lod->num_indices = qt->num_nodes * (TERRAIN_LOD_GRID * TERRAIN_LOD_GRID + 4 * TERRAIN_LOD_GRID) * 6;
+	num_cells = ((1u << (2 * ((depth < LOD_MAX_DEPTH ? depth : LOD_MAX_DEPTH - 1) + 1))) - 1) / 3;
+
+	lod->vertices = malloc(sizeof(float) * MESH_VERTEX_FLOATS * lod->num_vertices);
+	lod->indices = malloc(sizeof(unsigned int) * lod->num_indices);
+	lod->starts = malloc(sizeof(unsigned int) * (qt->num_nodes * 5 + 1));
+	lod->errors = malloc(sizeof(float) * qt->num_nodes);
+	lod->neighbours = malloc(sizeof(unsigned int) * qt->num_nodes * 4);
+	lod->marks = malloc(sizeof(unsigned int) * qt->num_nodes);
+	lod->picked = malloc(sizeof(unsigned int) * qt->num_nodes);
+	lod->firsts = malloc(sizeof(unsigned int) * qt->num_nodes * 3);
+	lod->counts = malloc(sizeof(int) * qt->num_nodes * 3);
+	lod->offsets = malloc(sizeof(void *) * qt->num_nodes * 3);
+	cells = malloc(sizeof(unsigned int) * num_cells);
+	if(!lod->vertices || !lod->indices || !lod->starts || !lod->errors || !lod->neighbours ||
+	   !lod->marks || !lod->picked || !lod->firsts || !lod->counts || !lod->offsets || !cells) {
+		fprintf(stderr, "Error: Couldn't allocate memory for terrain LOD\n");
+		free(cells);
+		free_terrain_lod(lod);
+		return NULL;
+	}
+
+	/* the floor the skirts hang down to is under every sample, edited or not */
+	set_terrain_mesh_vertices(hf, lod->vertices, 0, 0, hf->cols + 1, hf->rows + 1);
+	memcpy(lod->vertices + grid * MESH_VERTEX_FLOATS, lod->vertices,
+	       sizeof(float) * MESH_VERTEX_FLOATS * grid);
+	floor = lod->vertices + grid * MESH_VERTEX_FLOATS;
+	for(i = 0; i < grid; i++)
+		floor[i * MESH_VERTEX_FLOATS + 2] = hf->minz - LOD_FLOOR_DEPTH;
+
+	memset(cells, 0xff, sizeof(unsigned int) * num_cells);
+	idx = lod->indices;
+	fill_lod_node(lod, 0, 0, &idx, cells);
+	lod->starts[qt->num_nodes * 5] = idx - lod->indices;
+	lod->num_indices = idx - lod->indices;
+	link_lod_node(lod, 0, 0, cells);
+	free(cells);
+	bzero(lod->marks, sizeof(unsigned int) * qt->num_nodes);
+
+	if(use_buffers && upload_mesh_buffers(lod->buffers, lod->vertices, lod->num_vertices,
+	                                      lod->indices, lod->num_indices)) {
+		free(lod->vertices);
+		free(lod->indices);
+		lod->vertices = NULL;
+		lod->indices = NULL;
+	}
+
+	return lod;
+}
+
+void
+free_terrain_lod(struct terrain_lod *lod)
+{
+	if(!lod)
+		return;
+
+	if(lod->buffers[0])
+		glDeleteBuffers(2, lod->buffers);
+	free(lod->vertices);
+	free(lod->indices);
+	free(lod->starts);
+	free(lod->errors);
+	free(lod->neighbours);
+	free(lod->marks);
+	free(lod->picked);
+	free(lod->firsts);
+	free(lod->counts);
+	free(lod->offsets);
+	free(lod);
+}
+
+/*
+ * work the errors of node n and those under it out again around
+ * samples [firstc, lastc) x [firstr, lastr); a changed sample moves
+ * the mesh up to a step away from it. errors only grow, so they stay
+ * conservative, the way the quadtree's bounds do
+ */
+static void
+refit_lod_node(struct terrain_lod *lod, unsigned int n, unsigned int depth, unsigned int firstc,
+               unsigned int firstr, unsigned int lastc, unsigned int lastr)
+{
+	struct terrain_quadtree_node *on = &lod->quadtree->nodes[n];
+	unsigned int step, c;
+	float e;
+
+	if(on->lastc < firstc || on->firstc >= lastc || on->lastr < firstr || on->firstr >= lastr ||
+	   on->skip == n + 1)
+		return;
+
+	step = get_lod_step(lod, depth);
+	e = get_lod_error(lod, n, step, (firstc > step) ? firstc - step : 0, (firstr > step) ? firstr - step : 0,
+	                  lastc - 1 + step, lastr - 1 + step);
+	if(e > lod->errors[n])
+		lod->errors[n] = e;
+
+	for(c = n + 1; c < on->skip; c = lod->quadtree->nodes[c].skip) {
+		refit_lod_node(lod, c, depth + 1, firstc, firstr, lastc, lastr);
+		if(lod->errors[c] > lod->errors[n])
+			lod->errors[n] = lod->errors[c];
+	}
+}
+
+/*
+ * bring the LOD up to date after samples [firstc, lastc) x
+ * [firstr, lastr) of its heightfield have been edited. the floor
+ * under the map doesn't move: skirts fill cracks wherever it is
+ */
+void
+update_terrain_lod(struct terrain_lod *lod, unsigned int firstc, unsigned int firstr,
+                   unsigned int lastc, unsigned int lastr)
+{
+	if(!lod || firstc >= lastc || firstr >= lastr)
+		return;
+
+	update_mesh_vertices(lod->buffers[0], lod->vertices, lod->quadtree->heightfield,
+	                     firstc, firstr, lastc, lastr);
+	refit_lod_node(lod, 0, 0, firstc, firstr, lastc, lastr);
+}
+
+/*
+ * take the camera position from the modelview matrix, and how many
+ * pixels a unit of error takes up from the projection matrix and the
+ * height of the viewport in pixels
+ */
+void
+set_terrain_lod_view(struct terrain_lod *lod, float mm[16], float pm[16], unsigned int height)
+{
+	int i;
+
+	for(i = 0; i < 3; i++)
+		lod->eye[i] = -(mm[i * 4] * mm[12] + mm[i * 4 + 1] * mm[13] + mm[i * 4 + 2] * mm[14]);
+	lod->pixels = pm[5] * (float)height / 2.0f;
+}
+
+/* distance from the camera to the nearest point of box b */
+static float
+get_lod_distance(struct terrain_lod *lod, const float b[6])
+{
+	float d[3];
+	int i;
+
+	for(i = 0; i < 3; i++) {
+		if(lod->eye[i] < b[i * 2])
+			d[i] = b[i * 2] - lod->eye[i];
+		else if(lod->eye[i] > b[i * 2 + 1])
+			d[i] = lod->eye[i] - b[i * 2 + 1];
+		else
+			d[i] = 0.0f;
+	}
+
+	return sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+}
+
+/*
+ * pick node n if its error is under the threshold from where the
+ * camera is, or it's a leaf; otherwise go on to its children that
+ * are in the view frustum, culled against the planes in planes
+ */
+static void
+pick_lod_node(struct terrain_lod *lod, struct occlusion_buffer *ob,
+              unsigned int n, unsigned int depth, unsigned int planes)
+{
+	struct terrain_quadtree *qt = lod->quadtree;
+	struct terrain_quadtree_node *on = &qt->nodes[n];
+	struct terrain_quadtree_branch *br;
+	unsigned int i, j, visible, left[4], order[4] = { 0, 1, 2, 3 };
+
+	if(on->skip != n + 1 &&
+	   lod->errors[n] * lod->pixels > lod->threshold * get_lod_distance(lod, on->bounds)) {
+		br = &qt->branches[on->branch];
+		if(planes) {
+			visible = cull_boxes_in_viewport(&br->bounds[0][0], 4, br->num_children, planes, left);
+		} else {
+			visible = (1 << br->num_children) - 1;
+			bzero(left, sizeof(left));
+		}
+		if(ob)
+			get_occlusion_order(ob, qt, n, order);
+		for(j = 0; j < br->num_children; j++) {
+			i = order[j];
+			if(!(visible & (1 << i)))
+				continue;
+			if(ob && is_terrain_node_occluded(ob, qt, br->children[i]))
+				continue;
+			pick_lod_node(lod, ob, br->children[i], depth + 1, left[i]);
+		}
+		return;
+	}
+
+	lod->marks[n] = lod->frame;
+	lod->picked[lod->num_picked++] = n;
+	if(ob)
+		add_occluder_node(ob, qt, n, get_lod_step(lod, depth));
+}
+
+/* add indices [first, last) to the ranges to draw, onto the last range if they follow it */
+static void
+add_lod_range(struct terrain_lod *lod, unsigned int first, unsigned int last)
+{
+	unsigned int r = lod->num_ranges;
+
+	lod->stats.triangles += (last - first) / 3;
+	if(r && lod->firsts[r - 1] + (unsigned int)lod->counts[r - 1] == first) {
+		lod->counts[r - 1] += last - first;
+		return;
+	}
+
+	lod->firsts[r] = first;
+	lod->counts[r] = last - first;
+	lod->num_ranges++;
+}
+
+/*
+ * pick the nodes to draw for the view set by set_terrain_lod_view
+ * and the frustum set by set_view_frustum, and the index ranges to
+ * draw them with. a skirt is only drawn along a side with something
+ * other than a node of the same size drawn past it. given an
+ * occlusion buffer cleared for the same view, nodes are picked
+ * nearest first, each drawn into the buffer at the detail it's
+ * picked at, and nodes hidden behind them are left out
+ */
+void
+pick_terrain_lod(struct terrain_lod *lod, struct occlusion_buffer *ob)
+{
+	struct terrain_quadtree *qt = lod->quadtree;
+	unsigned int i, k, n, nb, planes = VIEW_ALL_PLANES, *s;
+	double t = 0.0;
+
+	lod->frame++;
+	lod->num_picked = 0;
+	lod->num_ranges = 0;
+	if(ob) {
+		t = get_time_ms();
+		set_occlusion_terrain(ob, qt->heightfield);
+	}
+	if(cull_box_in_viewport(qt->nodes[0].bounds, &planes) != VIEW_OUTSIDE)
+		pick_lod_node(lod, ob, 0, 0, planes);
+	if(ob)
+		ob->stats.ms += get_time_ms() - t;
+
+	for(i = 0; i < lod->num_picked; i++) {
+		n = lod->picked[i];
+		s = &lod->starts[n * 5];
+		add_lod_range(lod, s[0], s[1]);
+		for(k = 0; k < 4; k++) {
+			nb = lod->neighbours[n * 4 + k];
+			if(s[k + 1] == s[k + 2] || (nb != ~0u && lod->marks[nb] == lod->frame))
+				continue;
+			add_lod_range(lod, s[k + 1], s[k + 2]);
+			lod->stats.skirts += (s[k + 2] - s[k + 1]) / 3;
+		}
+	}
+	lod->stats.nodes += lod->num_picked;
+}
+
+/*
+ * draw the terrain at the detail the view needs, leaving out what's
+ * hidden if given an occlusion buffer; the ranges picked all go in
+ * one glMultiDrawElements call from buffer objects
+ */
+void
+draw_terrain_lod(struct terrain_lod *lod, struct occlusion_buffer *ob)
+{
+	unsigned int i, count = 0;
+
+	pick_terrain_lod(lod, ob);
+	if(lod->num_ranges == 0)
+		return;
+
+	bind_mesh_buffers(lod->buffers, lod->vertices);
+	for(i = 0; i < lod->num_ranges; i++) {
+		count += lod->counts[i];
+		if(lod->buffers[0])
+			lod->offsets[i] = (const void *)(sizeof(unsigned int) * (size_t)lod->firsts[i]);
+		else
+			glDrawElements(GL_TRIANGLES, lod->counts[i], GL_UNSIGNED_INT, lod->indices + lod->firsts[i]);
+	}
+	if(lod->buffers[0]) {
+		glMultiDrawElements(GL_TRIANGLES, lod->counts, GL_UNSIGNED_INT, lod->offsets, lod->num_ranges);
+		add_draw_stats(1, count);
+	} else {
+		add_draw_stats(lod->num_ranges, count);
+	}
+	unbind_mesh_buffers(lod->buffers);
+}
+
+/* copy the LOD's counters into s and reset them to zero */
+void
+take_lod_stats(struct terrain_lod *lod, struct lod_stats *s)
+{
+	*s = lod->stats;
+	bzero(&lod->stats, sizeof(struct lod_stats));
+}
+
+/*
+ * pick the nodes of a heightfield's LOD from the same random views
+ * at a few thresholds, and print the triangles drawn and time taken
+ */
+static void
+benchmark_terrain_lod_heightfield(const char *name, struct heightfield *hf)
+{
+	static float thresholds[] = { 0.0f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f };
+	struct terrain_quadtree *qt;
+	struct terrain_lod *lod;
+	struct lod_stats s;
+	struct cull_stats cs;
+	unsigned int i, j, num_views = 200;
+	float mm[16], pm[16], pos[3], far;
+	double t;
+
+	qt = build_terrain_quadtree(hf);
+	lod = new_terrain_lod(qt, 0);
+	if(!qt || !lod) {
+		free_terrain_quadtree(qt);
+		return;
+	}
+
+	printf("%s: %u x %u quads, %u views\n", name, hf->cols, hf->rows, num_views);
+	printf("error (px)      nodes   triangles      skirts  picking (ms)\n");
+	far = (hf->xs[hf->cols] - hf->xs[0]) / 2.0f;
+	for(j = 0; j < sizeof(thresholds) / sizeof(thresholds[0]); j++) {
+		lod->threshold = thresholds[j];
+		take_lod_stats(lod, &s);
+		t = 0.0;
+		srand(1);
+		for(i = 0; i < num_views; i++) {
+			pos[0] = hf->xs[0] + (hf->xs[hf->cols] - hf->xs[0]) * rand() / (float)RAND_MAX;
+			pos[1] = hf->ys[0] + (hf->ys[hf->rows] - hf->ys[0]) * rand() / (float)RAND_MAX;
+			if(!get_heightfield_height(hf, pos[0], pos[1], &pos[2], NULL))
+				pos[2] = hf->maxz;
+			pos[2] += 2.0f;
+			make_view_matrices(mm, pm, pos, 2.0f * M_PI * rand() / (float)RAND_MAX,
+			                   DEG2RAD(-90.0f + 20.0f * rand() / (float)RAND_MAX), far);
+			set_view_frustum(mm, pm);
+			set_terrain_lod_view(lod, mm, pm, 480);
+
+			t -= get_time_ms();
+			pick_terrain_lod(lod, NULL);
+			t += get_time_ms();
+		}
+		take_lod_stats(lod, &s);
+		printf("%10.1f %10u %11u %11u %13.3f\n", thresholds[j], s.nodes / num_views,
+		       s.triangles / num_views, s.skirts / num_views, t / num_views);
+	}
+	take_cull_stats(&cs);
+
+	free_terrain_lod(lod);
+	free_terrain_quadtree(qt);
+}
+
+/*
+ * compare the triangles the terrain LOD draws at a few error
+ * thresholds with drawing every quad in view, at a threshold of 0,
+ * over a map kept at full detail and synthetic hills
+ */
+void
+benchmark_terrain_lod(const char *filename)
+{
+	struct heightfield hf;
+	struct map *m;
+
+	set_map_tilesize(MAP_FULL_TILESIZE);
+	m = load_map(filename);
+	set_map_tilesize(MAP_TILESIZE);
+	if(m) {
+		benchmark_terrain_lod_heightfield(filename, m->heightfield);
+		free_map(m);
+	}
+
+	if(!init_hills_heightfield(&hf, 1024, 1024))
+		return;
+	benchmark_terrain_lod_heightfield("synthetic hills", &hf);
+	free_heightfield_data(&hf);
+}
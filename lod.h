@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * a terrain LOD draws each part of a map's quadtree with as few
+ * triangles as it can without looking wrong. every node has a mesh
+ * of TERRAIN_LOD_GRID x TERRAIN_LOD_GRID quads spread across it, so
+ * a leaf's is its own quads and each level up is half as detailed,
+ * and knows how far that mesh strays from the samples under it. a
+ * node is drawn instead of its children once that error would be
+ * under a threshold in pixels on the screen. nodes drawn next to
+ * coarser or finer ones hang skirts from their edges down to below
+ * the whole map to fill any cracks between them
+ */
+
+struct occlusion_buffer; /* see occlusion.h */
+
+#define TERRAIN_LOD_GRID      TERRAIN_QUADTREE_LEAF_QUADS /* quads across each node's mesh */
+#define TERRAIN_LOD_THRESHOLD 2.0f /* default screen-space error allowed, in pixels */
+
+/* what's been drawn since the counters were taken */
+struct lod_stats {
+	unsigned int nodes;     /* nodes drawn */
+	unsigned int triangles; /* triangles drawn, with the skirts' */
+	unsigned int skirts;    /* triangles drawn in skirts */
+};
+
+struct terrain_lod {
+	struct terrain_quadtree *quadtree;
+	unsigned int size;        /* quads across the root, before it's cut off at the map's edges */
+	unsigned int num_vertices, num_indices;
+	float *vertices;          /* the samples, then the samples again on a floor under the map */
+	unsigned int *indices;    /* each node's mesh, then its skirts along each side */
+	unsigned int *starts;     /* 5 per node: where its mesh and each skirt start; and the end */
+	float *errors;            /* how far each node's mesh strays from the samples, at most */
+	unsigned int *neighbours; /* 4 per node: the node of the same size past each side, or ~0 */
+	unsigned int buffers[2];  /* vertex and index buffer objects, or 0 to draw from memory */
+
+	float eye[3];             /* where the camera is */
+	float pixels;             /* pixels an upright unit takes up one unit from the camera */
+	float threshold;          /* screen-space error allowed, in pixels */
+
+	unsigned int frame, *marks; /* frame each node was last picked in */
+	unsigned int num_picked, *picked;
+	unsigned int num_ranges, *firsts; /* index ranges to draw */
+	int *counts;
+	const void **offsets;
+	struct lod_stats stats;
+};
+
+struct terrain_lod *new_terrain_lod(struct terrain_quadtree *, int);
+void free_terrain_lod(struct terrain_lod *);
+void update_terrain_lod(struct terrain_lod *, unsigned int, unsigned int, unsigned int, unsigned int);
+void set_terrain_lod_view(struct terrain_lod *, float[16], float[16], unsigned int);
+void pick_terrain_lod(struct terrain_lod *, struct occlusion_buffer *);
+void draw_terrain_lod(struct terrain_lod *, struct occlusion_buffer *);
+void take_lod_stats(struct terrain_lod *, struct lod_stats *);
+void benchmark_terrain_lod(const char *);
@@ -25,12 +25,27 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <GL/glx.h>
 #include "object.h"
+#include "heightfield.h"
+#include "map.h"
+#include "broadphase.h"
+#include "bodybatch.h"
+#include "raycast.h"
+#include "linoctree.h"
+#include "quadtree.h"
+#include "mesh.h"
+#include "lod.h"
+#include "mipmap.h"
+#include "texture.h"
+#include "frustum.h"
+#include "visible.h"
+#include "occlusion.h"
 #include "world.h"
 
 #define WINDOW_WIDTH  640
@@ -83,6 +98,69 @@ main(int argc, char *argv[])
 	Window root;
 	Window window;
 	int attriblist[] = { GLX_RGBA, GLX_DOUBLEBUFFER, GLX_DEPTH_SIZE, 16, None };
+	int i;
+
+	for(i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+			set_map_build_threads((unsigned int)atoi(argv[++i]));
+		} else if(strcmp(argv[i], "-tiled") == 0) {
+			set_world_tiled(1);
+		} else if(strcmp(argv[i], "-novbo") == 0) {
+			set_world_vertex_buffers(0);
+		} else if(strcmp(argv[i], "-occlusion") == 0) {
+			set_world_occlusion(1);
+		} else if(strcmp(argv[i], "-lod") == 0) {
+			set_world_lod(1);
+		} else if(strcmp(argv[i], "-dxt") == 0) {
+			set_texture_compression(1);
+		} else if(strcmp(argv[i], "-bake") == 0) {
+			if(!bake_map("data/map.png"))
+				return 1;
+			return 0;
+		} else if(strcmp(argv[i], "-loadbench") == 0) {
+			benchmark_map_build("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-collidebench") == 0) {
+			benchmark_broadphase();
+			return 0;
+		} else if(strcmp(argv[i], "-bodybench") == 0) {
+			benchmark_body_batch("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-raybench") == 0) {
+			benchmark_raycast("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-octreestats") == 0) {
+			print_map_octree_stats("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-octreebench") == 0) {
+			benchmark_linear_octree("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-quadbench") == 0) {
+			benchmark_terrain_quadtree("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-meshstats") == 0) {
+			print_terrain_mesh_stats("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-lodbench") == 0) {
+			benchmark_terrain_lod("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-texbench") == 0) {
+			benchmark_mipmaps("data/terrain.png");
+			return 0;
+		} else if(strcmp(argv[i], "-cullbench") == 0) {
+			benchmark_frustum_culling("data/map.png");
+			return 0;
+		} else if(strcmp(argv[i], "-visiblebench") == 0) {
+			benchmark_visible_sets();
+			return 0;
+		} else if(strcmp(argv[i], "-occlusionbench") == 0) {
+			benchmark_occlusion("data/map.png");
+			return 0;
+		} else {
+			fprintf(stderr, "Usage: %s [-threads n] [-tiled] [-novbo] [-occlusion] [-lod] [-dxt] [-bake] [-loadbench] [-collidebench] [-bodybench] [-raybench] [-octreestats] [-octreebench] [-quadbench] [-meshstats] [-lodbench] [-texbench] [-cullbench] [-visiblebench] [-occlusionbench]\n", argv[0]);
+			return 1;
+		}
+	}
 
 	if(!(dpyname = getenv("DISPLAY")))
 		dpyname = ":0.0";
@@ -25,73 +25,231 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "map.h"
+#include <string.h>
+#include <sys/mman.h>
 #include "object.h"
+#include "heightfield.h"
+#include "map.h"
 #include "octree.h"
 #include "my_math.h"
+#include "parallel.h"
+#include "raycast.h"
+#include "quadtree.h"
+#include "cachefile.h"
 
 extern void *read_png(const char *, unsigned int *, unsigned int *, int *);
 
-/* return highest of four floats */
-static float
-highest(float f1, float f2, float f3, float f4)
+unsigned char
+get_pixel(unsigned char *data, unsigned int x, unsigned int y, unsigned int w)
 {
-	float retval;
+	return data[(w * y * 3) + (x * 3)];
+}
+
+/*
+ * state shared by the threads building the map's heightfield;
+ * each thread fills in a band of rows
+ */
+struct map_build {
+	unsigned char *data;
+	struct map_grid grid;
+	struct heightfield *hf;
+
+	unsigned int num_threads;
+};
 
-	retval = f1;
-	if(f2 > retval)
-		retval = f2;
-	if(f3 > retval)
-		retval = f3;
-	if(f4 > retval)
-		retval = f4;
+static unsigned int build_threads = 0; /* 0 means one per processor */
+static unsigned int map_tilesize = MAP_TILESIZE;
+static struct map map_structure;
+static struct heightfield map_heightfield;
 
-	return retval;
+/* set the number of threads used to build map quads */
+void
+set_map_build_threads(unsigned int n)
+{
+	build_threads = n;
 }
 
-/* return lowest of four floats */
-static float
-lowest(float f1, float f2, float f3, float f4)
+static unsigned int
+get_map_build_threads()
 {
-	float retval;
+	return build_threads ? build_threads : get_num_cpus();
+}
 
-	retval = f1;
-	if(f2 < retval)
-		retval = f2;
-	if(f3 < retval)
-		retval = f3;
-	if(f4 < retval)
-		retval = f4;
+/* set the heightmap pixels along the side of a quad for maps loaded after this */
+void
+set_map_tilesize(unsigned int tilesize)
+{
+	map_tilesize = tilesize ? tilesize : MAP_TILESIZE;
+}
 
-	return retval;
+/* maps loaded at other than the usual tilesize are cached apart from it */
+static void
+get_map_cache_name(char *cachename, size_t size, const char *filename)
+{
+	if(map_tilesize == MAP_TILESIZE)
+		snprintf(cachename, size, "%s%s", filename, MAP_CACHE_SUFFIX);
+	else
+		snprintf(cachename, size, "%s.%u%s", filename, map_tilesize, MAP_CACHE_SUFFIX);
 }
 
-unsigned char
-get_pixel(unsigned char *data, unsigned int x, unsigned int y, unsigned int w)
+/*
+ * set up the grid of quads for a width x height heightmap, with
+ * quads tilesize pixels across
+ */
+void
+init_map_grid(struct map_grid *g, unsigned int width, unsigned int height, unsigned int tilesize)
 {
-	return data[(w * y * 3) + (x * 3)];
+	g->width = width;
+	g->height = height;
+	g->tilesize = tilesize;
+	g->xydiv = 1.0f;
+	g->zdiv = 9.0f;
+	g->rows = (height > g->tilesize) ? (height - g->tilesize + g->tilesize - 1) / g->tilesize : 0;
+	g->cols = (width > g->tilesize) ? (width - g->tilesize + g->tilesize - 1) / g->tilesize : 0;
 }
 
 /*
- * create an octree, load the heightmap, load all
- * map quads into object structures and place them
- * in the appropriate leaf nodes of the octree
+ * set the sample positions of a heightfield covering the quads
+ * starting at column col0 and row row0 of the map; quad (c, r)
+ * of the map spans pixels (c * tilesize, r * tilesize) to
+ * ((c + 1) * tilesize, (r + 1) * tilesize) of the heightmap
  */
-struct map *
-load_map(const char *filename)
+void
+setup_map_heightfield(const struct map_grid *g, struct heightfield *hf,
+                      unsigned int col0, unsigned int row0)
+{
+	unsigned int i;
+
+	hf->col0 = col0;
+	hf->row0 = row0;
+	hf->quadsize = (float)g->tilesize / g->xydiv;
+
+	for(i = 0; i <= hf->cols; i++)
+		hf->xs[i] = (float)((col0 + i) * g->tilesize) / g->xydiv - (float)(g->width / 2) / g->xydiv;
+	for(i = 0; i <= hf->rows; i++)
+		hf->ys[i] = (float)((row0 + i) * g->tilesize) / g->xydiv - (float)(g->height / 2) / g->xydiv;
+}
+
+/* band of rows for thread n of num_threads */
+static void
+get_map_band(unsigned int rows, unsigned int n, unsigned int num_threads,
+             unsigned int *first, unsigned int *last)
+{
+	*first = (unsigned int)((unsigned long)rows * n / num_threads);
+	*last = (unsigned int)((unsigned long)rows * (n + 1) / num_threads);
+}
+
+/*
+ * build thread; the z value of each sample is taken from the
+ * pixel corresponding to the current position on the heightmap
+ * using the get_pixel function
+ */
+static void
+build_map_heights(void *arg, unsigned int n)
+{
+	struct map_build *b = arg;
+	struct map_grid *g = &b->grid;
+	unsigned int r, c, first, last;
+
+	get_map_band(g->rows + 1, n, b->num_threads, &first, &last);
+	for(r = first; r < last; r++) {
+		for(c = 0; c <= g->cols; c++)
+			HEIGHTFIELD_SAMPLE(b->hf, c, r) = (float)get_pixel(b->data, c * g->tilesize, r * g->tilesize, g->width) / g->zdiv;
+	}
+}
+
+/* build thread; works out the planes of a band of quad rows */
+static void
+build_map_planes(void *arg, unsigned int n)
+{
+	struct map_build *b = arg;
+	unsigned int first, last;
+
+	get_map_band(b->grid.rows, n, b->num_threads, &first, &last);
+	setup_heightfield_planes(b->hf, first, last);
+}
+
+/*
+ * build the heightfield from the heightmap, splitting the
+ * rows into bands across num_threads threads; the samples
+ * are all filled in before any planes are worked out, since
+ * a quad's plane depends on samples in the next row
+ */
+static void
+run_map_build(struct map_build *b, unsigned int num_threads)
 {
-	unsigned int i, j, k;
+	if(num_threads < 1)
+		num_threads = 1;
+	if(num_threads > b->grid.rows && b->grid.rows > 0)
+		num_threads = b->grid.rows;
+
+	b->num_threads = num_threads;
+	setup_map_heightfield(&b->grid, b->hf, 0, 0);
+	run_parallel(build_map_heights, b, num_threads);
+	run_parallel(build_map_planes, b, num_threads);
+	update_heightfield_bounds(b->hf);
+}
+
+static int
+init_map_build(struct map_build *b, unsigned char *data, unsigned int width,
+               unsigned int height, struct heightfield *hf)
+{
+	memset(b, 0, sizeof(struct map_build));
+	b->data = data;
+	init_map_grid(&b->grid, width, height, map_tilesize);
+	b->hf = hf;
+
+	return init_heightfield(hf, b->grid.cols, b->grid.rows);
+}
+
+/* create the object that other objects collide with the map through */
+static int
+create_map_object(struct map *m)
+{
+	struct object *o;
+
+	o = create_objects_in_place(OBJ_HEIGHTFIELD, 1, NULL, 0, m->heightfield, sizeof(struct heightfield));
+	if(!o)
+		return 0;
+
+	m->object = get_object_num(o);
+	return 1;
+}
+
+/*
+ * build what's drawn, ray cast and collided with from a map's
+ * heightfield; returns 0 if any of it couldn't be built
+ */
+static int
+finish_map(struct map *m)
+{
+	m->pyramid = build_height_pyramid(m->heightfield);
+	if(!m->pyramid)
+		return 0;
+	m->quadtree = build_terrain_quadtree(m->heightfield);
+	if(!m->quadtree)
+		return 0;
+
+	return create_map_object(m);
+}
+
+/*
+ * create an octree, load the heightmap into a heightfield
+ * and place all of its quads in the appropriate leaf nodes
+ * of the octree
+ */
+static struct map *
+build_map(const char *filename)
+{
+	unsigned int quads;
 	unsigned char *data;
 	unsigned int width, height;
 	int type;
-	unsigned int tilesize = 8;
-	float xydiv = 1.0f;
-	float zdiv = 9.0f;
-	static struct map map_structure;
-	struct vertex vertices[4];
-	struct object *o;
-	struct plane_object *p;
-	struct octree_node *on;
+	struct map_build b;
+	struct heightfield *hf = &map_heightfield;
+	double start, decoded, built, merged;
+
+	start = get_time_ms();
 
 	/* data is a pointer to the raw rgb data of the heightmap */
 	data = (unsigned char *)read_png(filename, &width, &height, &type);
@@ -99,92 +257,303 @@ load_map(const char *filename)
 		fprintf(stderr, "Error: Couldn't load heightmap %s\n", filename);
 		return NULL;
 	}
+	decoded = get_time_ms();
+
+	if(!init_map_build(&b, data, width, height, hf)) {
+		free(data);
+		return NULL;
+	}
 
-	map_structure.octree = new_octree_branch(NULL, -((float)width / xydiv), (float)width / xydiv, -((float)height / xydiv), (float)height / xydiv, -255.0f, 255.0f);
+	/* create map quads from heightmap */
+	run_map_build(&b, get_map_build_threads());
+	built = get_time_ms();
+
+	/*
+	 * place each quad in the leaf that its first vertex falls
+	 * within; the octree is the same whatever the number of threads
+	 */
+	map_structure.octree = build_heightfield_octree(hf, b.num_threads);
 	if(!map_structure.octree) {
 		fprintf(stderr, "Error: Couldn't create octree\n");
+		free_heightfield_data(hf);
 		free(data);
 		return NULL;
 	}
 
 	snprintf(map_structure.skypic, 256, "data/sky.png");
+	map_structure.heightfield = hf;
+	map_structure.cache = NULL;
+	map_structure.cache_size = 0;
+	merged = get_time_ms();
 
-	/*
-	 * create map quads from heightmap; the z value of each
-	 * point is taken from the pixel corresponding to the
-	 * current position on the heightmap using the get_pixel
-	 * function
-	 */
-	k = 0;
-	for(i = 0; i < height - tilesize; i+= tilesize) {
-		for(j = 0; j < width - tilesize; j += tilesize) {
-			vertices[k].texcoord[0] = 0.25f * (j/tilesize % 4);
-			vertices[k].texcoord[1] = 0.25f * (i/tilesize % 4);
-			vertices[k].point[0] = (float)j / xydiv - (float)(width / 2) / xydiv;
-			vertices[k].point[1] = (float)(i + tilesize) / xydiv - (float)(height / 2) / xydiv;
-			vertices[k].point[2] = (float)get_pixel(data, j, i + tilesize, width) / zdiv;
-			k++;
-
-			vertices[k].texcoord[0] = 0.25f * ((j/tilesize % 4) + 1.0f);
-			vertices[k].texcoord[1] = 0.25f * (i/tilesize % 4);
-			vertices[k].point[0] = (float)(j + tilesize) / xydiv - (float)(width / 2) / xydiv;
-			vertices[k].point[1] = (float)(i + tilesize) / xydiv - (float)(height / 2) / xydiv;
-			vertices[k].point[2] = (float)get_pixel(data, j + tilesize, i + tilesize, width) / zdiv;
-			k++;
-
-			vertices[k].texcoord[0] = 0.25f * ((j/tilesize % 4) + 1.0f);
-			vertices[k].texcoord[1] = 0.25f * ((i/tilesize % 4) + 1.0f);
-			vertices[k].point[0] = (float)(j + tilesize) / xydiv - (float)(width / 2) / xydiv;
-			vertices[k].point[1] = (float)i / xydiv - (float)(height / 2) / xydiv;
-			vertices[k].point[2] = (float)get_pixel(data, j + tilesize, i, width) / zdiv;
-			k++;
-
-			vertices[k].texcoord[0] = 0.25f * (j/tilesize % 4);
-			vertices[k].texcoord[1] = 0.25f * ((i/tilesize % 4) + 1.0f);
-			vertices[k].point[0] = (float)j / xydiv - (float)(width / 2) / xydiv;
-			vertices[k].point[1] = (float)i / xydiv - (float)(height / 2) / xydiv;
-			vertices[k].point[2] = (float)get_pixel(data, j, i, width) / zdiv;
-			k = 0;
-
-			o = create_object(OBJ_PLANE);
-			if(!o) {
-				free(data);
-				free_octree_branch(map_structure.octree);
-				return NULL;
-			}
-
-			o->render_separately = 0;
-			o->vertices = malloc(sizeof(struct vertex) * 4);
-			if(!o->vertices) {
-				fprintf(stderr, "Error: Couldn't allocate memory for heightmap vertices\n");	
-				free(data);
-				free_octree_branch(map_structure.octree);
-				return NULL;
-			}
-			o->num_vertices = 4;
-			memcpy(o->vertices, vertices, sizeof(struct vertex) * 4);
-
-			p = (struct plane_object *)(o->aux);
-			setup_plane(p->plane, o->vertices[0].point, o->vertices[1].point, o->vertices[2].point);
-			p->minx = lowest(o->vertices[0].point[0], o->vertices[1].point[0],
-			                 o->vertices[2].point[0], o->vertices[3].point[0]);
-			p->maxx = highest(o->vertices[0].point[0], o->vertices[1].point[0],
-			                 o->vertices[2].point[0], o->vertices[3].point[0]);
-			p->miny = lowest(o->vertices[0].point[1], o->vertices[1].point[1],
-			                 o->vertices[2].point[1], o->vertices[3].point[1]);
-			p->maxy = highest(o->vertices[0].point[1], o->vertices[1].point[1],
-			                 o->vertices[2].point[1], o->vertices[3].point[1]);
-			p->minz = lowest(o->vertices[0].point[2], o->vertices[1].point[2],
-			                 o->vertices[2].point[2], o->vertices[3].point[2]);
-			p->maxz = highest(o->vertices[0].point[2], o->vertices[1].point[2],
-			                 o->vertices[2].point[2], o->vertices[3].point[2]);
-
-			on = get_octree_leaf_from_point(map_structure.octree, o->vertices[0].point);
-			add_object_to_octree_node(on, o);
+	free(data);
+
+	if(!finish_map(&map_structure)) {
+		free_map(&map_structure);
+		return NULL;
+	}
+
+	fprintf(stderr, "%s loaded in %.1f ms (decode %.1f ms, quads %.1f ms and octree %.1f ms on %u threads)\n",
+	        filename, merged - start, decoded - start, built - decoded,
+	        merged - built, b.num_threads);
+
+	/* compare with a quad as an object with its own vertices and plane */
+	quads = hf->cols * hf->rows;
+	if(quads > 0)
+		fprintf(stderr, "%s: %u quads in %.1f KB (%.1f bytes per quad, %lu as separate objects)\n",
+		        filename, quads, (double)get_heightfield_data_size(hf->cols, hf->rows) / 1024.0,
+		        (double)get_heightfield_data_size(hf->cols, hf->rows) / quads,
+		        (unsigned long)(sizeof(struct object) + sizeof(struct vertex) * 4 + sizeof(struct plane_object)));
+
+	return &map_structure;
+}
+
+/*
+ * load a map; if a map cache that's at least as new as the
+ * heightmap exists, the map is mapped from it, otherwise the
+ * map is built from the heightmap and the cache is rebaked
+ */
+struct map *
+load_map(const char *filename)
+{
+	char cachename[1024];
+	struct map *m;
+	double start;
+
+	get_map_cache_name(cachename, sizeof(cachename), filename);
+
+	start = get_time_ms();
+	map_structure.heightfield = &map_heightfield;
+	if(is_cache_fresh(filename, cachename) && load_map_cache(&map_structure, cachename)) {
+		if(!finish_map(&map_structure)) {
+			free_map(&map_structure);
+			return NULL;
+		}
+		fprintf(stderr, "%s loaded from %s in %.2f ms\n", filename, cachename, get_time_ms() - start);
+		return &map_structure;
+	}
+
+	m = build_map(filename);
+	if(m && write_map_cache(m, cachename))
+		fprintf(stderr, "%s baked to %s\n", filename, cachename);
+
+	return m;
+}
+
+/* build a map from its heightmap and write its cache */
+struct map *
+bake_map(const char *filename)
+{
+	char cachename[1024];
+	struct map *m;
+
+	get_map_cache_name(cachename, sizeof(cachename), filename);
+
+	m = build_map(filename);
+	if(!m)
+		return NULL;
+	if(!write_map_cache(m, cachename)) {
+		free_map(m);
+		return NULL;
+	}
+
+	fprintf(stderr, "%s baked to %s\n", filename, cachename);
+	return m;
+}
+
+/*
+ * get the height and normal of the map at x, y; returns 0 if
+ * x, y is off the map
+ */
+int
+get_map_height(struct map *m, float x, float y, float *z, float n[3])
+{
+	if(!m || !m->heightfield)
+		return 0;
+
+	return get_heightfield_height(m->heightfield, x, y, z, n);
+}
+
+/*
+ * move quad (c, r) to the octree leaf its first vertex is in now
+ * that the vertex's height has changed from z; the octree may split
+ * as the quad goes in, so the new height has to be set already
+ */
+static void
+move_map_quad(struct map *m, unsigned int c, unsigned int r, float z)
+{
+	struct heightfield *hf = m->heightfield;
+	float a[3], b[3];
+
+	a[0] = b[0] = hf->xs[c];
+	a[1] = b[1] = hf->ys[r + 1];
+	a[2] = z;
+	b[2] = HEIGHTFIELD_SAMPLE(hf, c, r + 1);
+	move_quad_in_octree(m->octree, hf, r * hf->cols + c, a, b);
+}
+
+/*
+ * set the heights of a w x h rectangle of samples starting at
+ * sample (col, row), where samples are the corners of the map's
+ * quads; heights holds w * h heights, row by row. only the quads
+ * around the rectangle are rebuilt, so the cost of an edit depends
+ * on its size rather than the size of the map. returns 1 on success
+ */
+int
+set_map_heights(struct map *m, unsigned int col, unsigned int row,
+                unsigned int w, unsigned int h, const float *heights)
+{
+	struct heightfield *hf;
+	unsigned int c, r, lastc, lastr;
+	float z, old;
+
+	if(!m || !m->heightfield || !m->octree)
+		return 0;
+
+	hf = m->heightfield;
+	if(w == 0 || h == 0 || col + w > hf->cols + 1 || row + h > hf->rows + 1) {
+		fprintf(stderr, "Error: Map edit is outside of the map\n");
+		return 0;
+	}
+
+	for(r = row; r < row + h; r++) {
+		for(c = col; c < col + w; c++) {
+			z = heights[(r - row) * w + (c - col)];
+			old = HEIGHTFIELD_SAMPLE(hf, c, r);
+			HEIGHTFIELD_SAMPLE(hf, c, r) = z;
+
+			/* quads are in the leaf that their top left corner is in */
+			if(r > 0 && c < hf->cols)
+				move_map_quad(m, c, r - 1, old);
+
+			/* the bounds only grow, so they stay conservative */
+			if(z < hf->minz)
+				hf->minz = z;
+			if(z > hf->maxz)
+				hf->maxz = z;
 		}
 	}
 
+	/* each sample is a corner of up to four quads */
+	lastc = (col + w < hf->cols) ? col + w : hf->cols;
+	lastr = (row + h < hf->rows) ? row + h : hf->rows;
+	setup_heightfield_quad_planes(hf, col ? col - 1 : 0, row ? row - 1 : 0, lastc, lastr);
+	update_height_pyramid(m->pyramid, hf, col, row, col + w, row + h);
+
+	/* so do the octree and quadtree bounds around them */
+	for(r = row ? row - 1 : 0; r < lastr; r++) {
+		for(c = col ? col - 1 : 0; c < lastc; c++)
+			update_octree_quad_bounds(m->octree, hf, r * hf->cols + c);
+	}
+	update_terrain_quadtree(m->quadtree, col ? col - 1 : 0, row ? row - 1 : 0, lastc, lastr);
+
+	return 1;
+}
+
+/*
+ * free a map's octree and heightfield, or unmap them if they
+ * came from a map cache
+ */
+void
+free_map(struct map *m)
+{
+	if(!m)
+		return;
+
+	/* nodes from the cache are left alone, but not ones split off them */
+	free_octree_branch(m->octree);
+	if(m->cache)
+		munmap(m->cache, m->cache_size);
+	else if(m->heightfield)
+		free_heightfield_data(m->heightfield);
+
+	free_height_pyramid(m->pyramid);
+	m->pyramid = NULL;
+	free_terrain_quadtree(m->quadtree);
+	m->quadtree = NULL;
+	m->octree = NULL;
+	m->cache = NULL;
+	m->cache_size = 0;
+}
+
+/* load a map and print the shape of its octree */
+void
+print_map_octree_stats(const char *filename)
+{
+	struct map *m;
+
+	m = load_map(filename);
+	if(!m)
+		return;
+
+	printf("%s: %u x %u quads\n", filename, m->heightfield->cols, m->heightfield->rows);
+	print_octree_stats(m->octree);
+	free_map(m);
+}
+
+/* thread counts to benchmark: 1, 2, 3, 4, 8, 16, ... and max */
+static unsigned int
+next_thread_count(unsigned int n, unsigned int max)
+{
+	unsigned int next;
+
+	next = (n < 4) ? n + 1 : n * 2;
+	if(n < max && next > max)
+		next = max;
+
+	return next;
+}
+
+/*
+ * time the heightfield and octree builds of a heightmap with
+ * increasing numbers of threads and print the speed-up over a
+ * single thread
+ */
+void
+benchmark_map_build(const char *filename)
+{
+	unsigned char *data;
+	unsigned int width, height;
+	unsigned int n, max_threads, run;
+	int type;
+	struct map_build b;
+	struct heightfield hf;
+	double start, t, best, serial = 0.0;
+
+	data = (unsigned char *)read_png(filename, &width, &height, &type);
+	if(!data) {
+		fprintf(stderr, "Error: Couldn't load heightmap %s\n", filename);
+		return;
+	}
+
+	if(!init_map_build(&b, data, width, height, &hf)) {
+		free(data);
+		return;
+	}
+	max_threads = get_map_build_threads();
+	if(max_threads < get_num_cpus())
+		max_threads = get_num_cpus();
+
+	printf("%s: %u x %u quads, %u processors\n", filename, b.grid.cols, b.grid.rows, get_num_cpus());
+	printf("threads    quads (ms)    speed-up\n");
+	for(n = 1; n <= max_threads; n = next_thread_count(n, max_threads)) {
+		/* best of three runs */
+		best = 0.0;
+		for(run = 0; run < 3; run++) {
+			start = get_time_ms();
+			run_map_build(&b, n);
+			t = get_time_ms() - start;
+
+			if(run == 0 || t < best)
+				best = t;
+		}
+
+		if(n == 1)
+			serial = best;
+		printf("%7u    %10.2f    %7.2fx\n", n, best, (best > 0.0) ? serial / best : 0.0);
+	}
+
+	benchmark_octree_build(&hf);
+	free_heightfield_data(&hf);
 	free(data);
-	fprintf(stderr, "%s loaded\n", filename);
-	return &map_structure;
 }
@@ -23,10 +23,42 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define MAP_CACHE_SUFFIX ".cache"
+#define MAP_TILESIZE      8 /* heightmap pixels along the side of a quad */
+#define MAP_FULL_TILESIZE 1 /* the same, keeping the whole heightmap for the terrain LOD */
+
 struct map {
 	char skypic[256];
 
 	struct octree_node *octree;
+	struct heightfield *heightfield; /* the map's quads */
+	unsigned int object; /* object for colliding with the heightfield */
+	struct height_pyramid *pyramid; /* min/max heights for ray casts */
+	struct terrain_quadtree *quadtree; /* the quads again, for drawing and collision */
+
+	void *cache; /* mapped map cache the octree and heightfield live in, if any */
+	size_t cache_size;
+};
+
+/* how heightmap pixels are turned into map quads */
+struct map_grid {
+	unsigned int width, height; /* heightmap size in pixels */
+	unsigned int tilesize;      /* pixels along the side of a quad */
+	float xydiv, zdiv;          /* pixels per unit, heightmap values per unit */
+	unsigned int cols, rows;    /* number of quads */
 };
 
 struct map *load_map(const char *);
+struct map *bake_map(const char *);
+void free_map(struct map *);
+void init_map_grid(struct map_grid *, unsigned int, unsigned int, unsigned int);
+int get_map_height(struct map *, float, float, float *, float[3]);
+int set_map_heights(struct map *, unsigned int, unsigned int, unsigned int, unsigned int, const float *);
+void setup_map_heightfield(const struct map_grid *, struct heightfield *, unsigned int, unsigned int);
+void set_map_build_threads(unsigned int);
+void set_map_tilesize(unsigned int);
+void benchmark_map_build(const char *);
+void print_map_octree_stats(const char *);
+
+int write_map_cache(struct map *, const char *);
+int load_map_cache(struct map *, const char *);
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * the map cache is a baked copy of a loaded map: the sample
+ * and plane data of the map's heightfield and the octree
+ * nodes, written so that the file can be mapped and used in
+ * place. pointers in the octree nodes are stored as node
+ * numbers + 1 (0 for NULL) and are fixed up when the cache
+ * is mapped. nodes holding more quads than fit in the node
+ * keep them in a pool after the nodes. objects aren't cached
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "object.h"
+#include "heightfield.h"
+#include "map.h"
+#include "octree.h"
+
+#define MAP_CACHE_MAGIC   "JABMAPC"
+#define MAP_CACHE_VERSION 6
+#define MAP_CACHE_ALIGN   64
+
+struct map_cache_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int byte_order; /* 0x01020304 in the writer's byte order */
+	unsigned int sizes[4];   /* pointer, float, heightfield and node sizes */
+
+	struct heightfield heightfield; /* pointers are meaningless */
+	unsigned int num_nodes;
+	unsigned long data_offset;      /* heightfield planes, heights, xs and ys */
+	unsigned long nodes_offset;
+	unsigned int num_pool_quads;
+	unsigned long pool_offset;      /* quads that didn't fit in their nodes */
+	unsigned long size;             /* total file size */
+
+	char skypic[256];
+};
+
+static void
+set_cache_sizes(unsigned int sizes[4])
+{
+	sizes[0] = sizeof(void *);
+	sizes[1] = sizeof(float);
+	sizes[2] = sizeof(struct heightfield);
+	sizes[3] = sizeof(struct octree_node);
+}
+
+static unsigned long
+align_offset(unsigned long offset)
+{
+	return (offset + MAP_CACHE_ALIGN - 1) & ~(unsigned long)(MAP_CACHE_ALIGN - 1);
+}
+
+/* write zeros to pad the file to offset */
+static int
+pad_to(FILE *fp, unsigned long offset)
+{
+	while((unsigned long)ftell(fp) < offset) {
+		if(fputc(0, fp) == EOF)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* count the nodes in a branch, and the quads that go in the pool */
+static unsigned int
+count_octree_nodes(struct octree_node *n, unsigned int *pool)
+{
+	unsigned int i, count;
+
+	if(!n)
+		return 0;
+
+	count = 1;
+	if(n->num_quads > MAX_OCTREE_NODE_OBJECTS)
+		*pool += n->num_quads;
+	for(i = 0; i < 8; i++)
+		count += count_octree_nodes(n->subnodes[i], pool);
+
+	return count;
+}
+
+/*
+ * copy the branch into out in depth first order, replacing
+ * pointers with node numbers + 1, the heightfield pointer with
+ * 1 if the node has quads and the quads pointer with 0 if they
+ * fit in the node or their place in the pool + 1; returns n's
+ * node number
+ */
+static unsigned int
+flatten_octree_branch(struct octree_node *n, struct octree_node *out,
+                      unsigned int parent, unsigned int *next,
+                      unsigned int *pool, unsigned int *pool_next)
+{
+	struct octree_node *o;
+	unsigned int i, num;
+
+	num = (*next)++;
+	o = &out[num];
+	*o = *n;
+	o->parent = (struct octree_node *)(size_t)parent;
+	o->heightfield = (struct heightfield *)(size_t)(n->heightfield ? 1 : 0);
+	o->objects = NULL;
+	o->num_objects = 0;
+	o->max_objects = MAX_OCTREE_NODE_OBJECTS;
+	o->flags = 0;
+	memset(o->object_store, 0, sizeof(o->object_store));
+	if(n->num_quads > MAX_OCTREE_NODE_OBJECTS) {
+		memcpy(&pool[*pool_next], n->quads, sizeof(unsigned int) * n->num_quads);
+		o->quads = (unsigned int *)(size_t)(*pool_next + 1);
+		o->max_quads = n->num_quads;
+		*pool_next += n->num_quads;
+	} else {
+		if(n->num_quads)
+			memmove(o->quad_store, n->quads, sizeof(unsigned int) * n->num_quads);
+		o->quads = NULL;
+		o->max_quads = MAX_OCTREE_NODE_OBJECTS;
+	}
+
+	for(i = 0; i < 8; i++) {
+		if(n->subnodes[i])
+			out[num].subnodes[i] = (struct octree_node *)(size_t)(flatten_octree_branch(n->subnodes[i], out, num + 1, next, pool, pool_next) + 1);
+	}
+
+	return num;
+}
+
+/* write map m to cachename; returns 1 on success */
+int
+write_map_cache(struct map *m, const char *cachename)
+{
+	struct map_cache_header h;
+	struct octree_node *nodes;
+	struct heightfield *hf = m->heightfield;
+	unsigned int next, *pool, pool_next;
+	size_t size;
+	char tmpname[1024];
+	FILE *fp;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MAP_CACHE_MAGIC, sizeof(MAP_CACHE_MAGIC));
+	h.version = MAP_CACHE_VERSION;
+	h.byte_order = 0x01020304;
+	set_cache_sizes(h.sizes);
+	h.heightfield = *hf;
+	h.heightfield.xs = h.heightfield.ys = h.heightfield.heights = h.heightfield.planes = NULL;
+	h.num_nodes = count_octree_nodes(m->octree, &h.num_pool_quads);
+	size = get_heightfield_data_size(hf->cols, hf->rows);
+	h.data_offset = align_offset(sizeof(h));
+	h.nodes_offset = align_offset(h.data_offset + size);
+	h.pool_offset = h.nodes_offset + sizeof(struct octree_node) * h.num_nodes;
+	h.size = h.pool_offset + sizeof(unsigned int) * h.num_pool_quads;
+	snprintf(h.skypic, sizeof(h.skypic), "%s", m->skypic);
+
+	nodes = malloc(sizeof(struct octree_node) * (h.num_nodes ? h.num_nodes : 1));
+	pool = malloc(sizeof(unsigned int) * (h.num_pool_quads ? h.num_pool_quads : 1));
+	if(!nodes || !pool) {
+		fprintf(stderr, "Error: Couldn't allocate memory for map cache\n");
+		free(nodes);
+		free(pool);
+		return 0;
+	}
+	next = 0;
+	pool_next = 0;
+	if(m->octree)
+		flatten_octree_branch(m->octree, nodes, 0, &next, pool, &pool_next);
+
+	/* write to a temporary file so a reader never sees half a cache */
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", cachename);
+	fp = fopen(tmpname, "wb");
+	if(!fp) {
+		fprintf(stderr, "Error: Couldn't open %s for writing\n", tmpname);
+		free(nodes);
+		free(pool);
+		return 0;
+	}
+
+	/* init_heightfield allocates the arrays as one block */
+	if(fwrite(&h, sizeof(h), 1, fp) != 1 || !pad_to(fp, h.data_offset))
+		goto error;
+	if(size && fwrite(hf->planes, size, 1, fp) != 1)
+		goto error;
+	if(!pad_to(fp, h.nodes_offset))
+		goto error;
+	if(h.num_nodes && fwrite(nodes, sizeof(struct octree_node), h.num_nodes, fp) != h.num_nodes)
+		goto error;
+	if(h.num_pool_quads && fwrite(pool, sizeof(unsigned int), h.num_pool_quads, fp) != h.num_pool_quads)
+		goto error;
+
+	free(nodes);
+	free(pool);
+	if(fclose(fp) != 0 || rename(tmpname, cachename) != 0) {
+		fprintf(stderr, "Error: Couldn't write map cache %s\n", cachename);
+		unlink(tmpname);
+		return 0;
+	}
+
+	return 1;
+
+error:
+	fprintf(stderr, "Error: Couldn't write map cache %s\n", cachename);
+	free(nodes);
+	free(pool);
+	fclose(fp);
+	unlink(tmpname);
+	return 0;
+}
+
+/*
+ * check the node numbers and quads of a cache's nodes before any
+ * of them are turned into pointers: each child has to come after
+ * its parent and name it as its parent, and each node's quads have
+ * to fit in its store or in the pool and be quads of the map
+ */
+static int
+check_cache_nodes(const struct map_cache_header *h, const struct octree_node *nodes,
+                  const unsigned int *pool)
+{
+	const struct octree_node *n;
+	const unsigned int *quads;
+	unsigned long num_quads;
+	unsigned int i, j;
+	size_t idx;
+
+	num_quads = (unsigned long)h->heightfield.cols * h->heightfield.rows;
+	for(i = 0; i < h->num_nodes; i++) {
+		n = &nodes[i];
+		idx = (size_t)n->parent;
+		if((i == 0) ? idx != 0 : (idx == 0 || idx > i))
+			return 0;
+		for(j = 0; j < 8; j++) {
+			idx = (size_t)n->subnodes[j];
+			if(idx && (idx <= i + 1 || idx > h->num_nodes || (size_t)nodes[idx - 1].parent != i + 1))
+				return 0;
+		}
+
+		if(n->num_objects != 0 || n->max_objects > MAX_OCTREE_NODE_OBJECTS ||
+		   n->num_quads > n->max_quads || (n->num_quads && !n->heightfield))
+			return 0;
+		idx = (size_t)n->quads;
+		if(idx) {
+			if(idx - 1 > h->num_pool_quads || n->max_quads > h->num_pool_quads - (idx - 1))
+				return 0;
+			quads = &pool[idx - 1];
+		} else {
+			if(n->max_quads > MAX_OCTREE_NODE_OBJECTS)
+				return 0;
+			quads = n->quad_store;
+		}
+		for(j = 0; j < n->num_quads; j++) {
+			if(quads[j] >= num_quads)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * map the cache into memory and point m's heightfield and
+ * octree into it; returns 1 on success, 0 if the cache can't
+ * be used
+ */
+int
+load_map_cache(struct map *m, const char *cachename)
+{
+	struct map_cache_header *h;
+	struct octree_node *nodes, *n;
+	struct heightfield *hf = m->heightfield;
+	unsigned int sizes[4], *pool;
+	unsigned int i, j;
+	struct stat st;
+	size_t idx;
+	void *p;
+	int fd;
+
+	fd = open(cachename, O_RDONLY);
+	if(fd == -1)
+		return 0;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct map_cache_header)) {
+		close(fd);
+		return 0;
+	}
+
+	/*
+	 * the mapping is private, so fixing up the octree nodes only
+	 * copies the pages they're on; the heightfield pages are
+	 * shared with the page cache
+	 */
+	p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return 0;
+
+	h = p;
+	set_cache_sizes(sizes);
+	if(memcmp(h->magic, MAP_CACHE_MAGIC, sizeof(MAP_CACHE_MAGIC)) != 0 ||
+	   h->version != MAP_CACHE_VERSION || h->byte_order != 0x01020304 ||
+	   memcmp(h->sizes, sizes, sizeof(sizes)) != 0 ||
+	   h->size != (unsigned long)st.st_size || h->num_nodes == 0 ||
+	   h->data_offset < sizeof(struct map_cache_header) ||
+	   h->data_offset != align_offset(h->data_offset) || h->nodes_offset != align_offset(h->nodes_offset) ||
+	   h->data_offset + get_heightfield_data_size(h->heightfield.cols, h->heightfield.rows) > h->nodes_offset ||
+	   h->nodes_offset + sizeof(struct octree_node) * h->num_nodes > h->pool_offset ||
+	   h->pool_offset + sizeof(unsigned int) * h->num_pool_quads != h->size ||
+	   !check_cache_nodes(h, (struct octree_node *)((char *)p + h->nodes_offset),
+	                      (unsigned int *)((char *)p + h->pool_offset))) {
+		fprintf(stderr, "Warning: Ignoring stale or invalid map cache %s\n", cachename);
+		munmap(p, st.st_size);
+		return 0;
+	}
+
+	/* same layout as init_heightfield */
+	*hf = h->heightfield;
+	hf->planes = (float *)((char *)p + h->data_offset);
+	hf->heights = hf->planes + hf->cols * hf->rows * 4;
+	hf->xs = hf->heights + (hf->cols + 1) * (hf->rows + 1);
+	hf->ys = hf->xs + hf->cols + 1;
+
+	nodes = (struct octree_node *)((char *)p + h->nodes_offset);
+	pool = (unsigned int *)((char *)p + h->pool_offset);
+	for(i = 0; i < h->num_nodes; i++) {
+		n = &nodes[i];
+		idx = (size_t)n->parent;
+		n->parent = idx ? &nodes[idx - 1] : NULL;
+		for(j = 0; j < 8; j++) {
+			idx = (size_t)n->subnodes[j];
+			n->subnodes[j] = idx ? &nodes[idx - 1] : NULL;
+		}
+		n->heightfield = n->heightfield ? hf : NULL;
+		idx = (size_t)n->quads;
+		n->quads = idx ? &pool[idx - 1] : n->quad_store;
+		n->objects = n->object_store;
+		n->num_items = n->num_quads;
+		n->flags = OCTREE_NODE_MAPPED;
+	}
+
+	/* children come after their parents */
+	for(i = h->num_nodes - 1; i > 0; i--)
+		nodes[i].parent->num_items += nodes[i].num_items;
+
+	snprintf(m->skypic, sizeof(m->skypic), "%s", h->skypic);
+	m->octree = &nodes[0];
+	m->cache = p;
+	m->cache_size = st.st_size;
+
+	return 1;
+}
@@ -0,0 +1,635 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "object.h"
+#include "heightfield.h"
+#include "quadtree.h"
+#include "mesh.h"
+#include "map.h"
+
+
+/* the most vertices and triangles in a leaf */
+#define MESH_LEAF_VERTICES ((TERRAIN_QUADTREE_LEAF_QUADS + 1) * (TERRAIN_QUADTREE_LEAF_QUADS + 1))
+#define MESH_LEAF_TRIANGLES (2 * TERRAIN_QUADTREE_LEAF_QUADS * TERRAIN_QUADTREE_LEAF_QUADS)
+
+/*
+ * a vertex cache, most recently used vertex first, as triangles are
+ * ordered for it; a bigger cache than a GPU has still gives an order
+ * that does well with a smaller one
+ */
+#define MESH_CACHE_SIZE 32
+
+struct vertex_cache {
+	unsigned int num_entries;
+	unsigned int entries[MESH_CACHE_SIZE];
+};
+
+static struct draw_stats stats;
+
+/* buffer objects are core from GL 1.5 on */
+int
+has_vertex_buffers()
+{
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major, minor;
+
+	if(!version || sscanf(version, "%d.%d", &major, &minor) != 2)
+		return 0;
+
+	return (major > 1 || (major == 1 && minor >= 5));
+}
+
+/*
+ * fill in the vertices of samples [firstc, lastc) x [firstr, lastr);
+ * texture coordinates are the ones get_heightfield_quad_vertices
+ * gives, running on across the whole map for GL_REPEAT to wrap
+ */
+void
+set_terrain_mesh_vertices(struct heightfield *hf, float *v, unsigned int firstc, unsigned int firstr,
+                          unsigned int lastc, unsigned int lastr)
+{
+	unsigned int c, r;
+
+	for(r = firstr; r < lastr; r++) {
+		for(c = firstc; c < lastc; c++) {
+			v[0] = hf->xs[c];
+			v[1] = hf->ys[r];
+			v[2] = HEIGHTFIELD_SAMPLE(hf, c, r);
+			v[3] = hf->xs[c] / TERRAIN_TEXTURE_SIZE;
+			v[4] = -hf->ys[r] / TERRAIN_TEXTURE_SIZE;
+			v += MESH_VERTEX_FLOATS;
+		}
+	}
+}
+
+/*
+ * score a vertex for how much drawing a triangle with it next would
+ * save: more if it's near the front of the cache, and more if it's
+ * only got a few triangles left, so that no vertex is left with one
+ * triangle that has to load it again much later. these are the
+ * weights from Tom Forsyth's linear-speed vertex cache optimisation
+ */
+static float
+score_cached_vertex(int pos, unsigned int valence)
+{
+	float score = 0.0f;
+
+	if(valence == 0)
+		return -1.0f;
+
+	if(pos >= 3)
+		score = powf(1.0f - (float)(pos - 3) / (MESH_CACHE_SIZE - 3), 1.5f);
+	else if(pos >= 0)
+		score = 0.75f; /* the last triangle's vertices are scored the same */
+
+	return score + 2.0f / sqrtf((float)valence);
+}
+
+/*
+ * reorder the triangles of the leaf at node on, which idx holds, so
+ * each goes in where the most of its vertices are still in cache c;
+ * c is carried on from one leaf to the next, so a leaf starts where
+ * the last one left off
+ */
+static void
+order_terrain_mesh_leaf(struct terrain_mesh *m, struct terrain_quadtree_node *on, unsigned int *idx,
+                        struct vertex_cache *c)
+{
+	unsigned int tris[MESH_LEAF_TRIANGLES * 3], valence[MESH_LEAF_VERTICES];
+	unsigned int i, j, k, v, n, w, lw, best, num_tris, col, row;
+	int pos[MESH_LEAF_VERTICES];
+	float score[MESH_LEAF_VERTICES], s, best_score;
+	char done[MESH_LEAF_TRIANGLES];
+
+	w = m->quadtree->heightfield->cols + 1;
+	lw = on->lastc - on->firstc + 1;
+	num_tris = 2 * (on->lastc - on->firstc) * (on->lastr - on->firstr);
+
+	/* vertices are numbered within the leaf from here on */
+	bzero(valence, sizeof(valence));
+	for(i = 0; i < num_tris * 3; i++) {
+		tris[i] = (idx[i] / w - on->firstr) * lw + idx[i] % w - on->firstc;
+		valence[tris[i]]++;
+	}
+	bzero(done, sizeof(done));
+
+	for(n = 0; n < num_tris; n++) {
+		for(v = 0; v < lw * (on->lastr - on->firstr + 1); v++)
+			pos[v] = -1;
+		for(i = 0; i < c->num_entries; i++) {
+			col = c->entries[i] % w;
+			row = c->entries[i] / w;
+			if(col >= on->firstc && col <= on->lastc && row >= on->firstr && row <= on->lastr)
+				pos[(row - on->firstr) * lw + col - on->firstc] = i;
+		}
+		for(v = 0; v < lw * (on->lastr - on->firstr + 1); v++)
+			score[v] = score_cached_vertex(pos[v], valence[v]);
+
+		best = 0;
+		best_score = -1.0f;
+		for(i = 0; i < num_tris; i++) {
+			if(done[i])
+				continue;
+			s = score[tris[i * 3]] + score[tris[i * 3 + 1]] + score[tris[i * 3 + 2]];
+			if(s > best_score) {
+				best = i;
+				best_score = s;
+			}
+		}
+		done[best] = 1;
+
+		/* put its vertices at the front of the cache */
+		for(j = 0; j < 3; j++) {
+			v = tris[best * 3 + j];
+			valence[v]--;
+			v = (v / lw + on->firstr) * w + v % lw + on->firstc;
+			idx[n * 3 + j] = v;
+			for(k = 0; k < c->num_entries && c->entries[k] != v; k++)
+				;
+			if(k == c->num_entries && c->num_entries < MESH_CACHE_SIZE)
+				c->num_entries++;
+			if(k == MESH_CACHE_SIZE)
+				k--;
+			memmove(&c->entries[1], &c->entries[0], sizeof(unsigned int) * k);
+			c->entries[0] = v;
+		}
+	}
+}
+
+/*
+ * put each leaf's quads in the index array, in node order, as the
+ * triangles v0 v1 v2 and v0 v2 v3 that get_heightfield_height and
+ * the collision code take a quad to be. with reorder set, each
+ * leaf's triangles are then ordered to make the most of the GPU's
+ * vertex cache; otherwise they're left row by row
+ */
+static void
+set_terrain_mesh_indices(struct terrain_mesh *m, int reorder)
+{
+	struct terrain_quadtree *qt = m->quadtree;
+	struct terrain_quadtree_node *on;
+	struct vertex_cache cache;
+	unsigned int i, c, r, v, w, *idx = m->indices;
+
+	cache.num_entries = 0;
+	w = qt->heightfield->cols + 1;
+	for(i = 0; i < qt->num_nodes; i++) {
+		on = &qt->nodes[i];
+		m->starts[i] = idx - m->indices;
+		if(on->skip != i + 1)
+			continue;
+
+		for(r = on->firstr; r < on->lastr; r++) {
+			for(c = on->firstc; c < on->lastc; c++) {
+				v = r * w + c;
+				idx[0] = v + w;
+				idx[1] = v + w + 1;
+				idx[2] = v + 1;
+				idx[3] = v + w;
+				idx[4] = v + 1;
+				idx[5] = v;
+				idx += 6;
+			}
+		}
+		if(reorder)
+			order_terrain_mesh_leaf(m, on, m->indices + m->starts[i], &cache);
+	}
+	m->starts[qt->num_nodes] = idx - m->indices;
+}
+
+/*
+ * copy vertices and indices into a pair of new buffer objects. returns
+ * 0, with the buffers left as 0, if GL couldn't make them, so that the
+ * arrays in memory can be drawn from instead
+ */
+int
+upload_mesh_buffers(unsigned int buffers[2], const float *vertices, unsigned int num_vertices,
+                    const unsigned int *indices, unsigned int num_indices)
+{
+	while(glGetError() != GL_NO_ERROR)
+		;
+
+	glGenBuffers(2, buffers);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * MESH_VERTEX_FLOATS * num_vertices,
+	             vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * num_indices,
+	             indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	if(glGetError() != GL_NO_ERROR) {
+		fprintf(stderr, "Error: Couldn't create terrain vertex buffers; drawing from memory\n");
+		glDeleteBuffers(2, buffers);
+		buffers[0] = buffers[1] = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * pack the quadtree's heightfield into a mesh, in buffer objects if
+ * use_buffers is set, or as vertex arrays drawn from memory if it
+ * isn't. needs a current GL context
+ */
+struct terrain_mesh *
+new_terrain_mesh(struct terrain_quadtree *qt, int use_buffers)
+{
+	struct terrain_mesh *m;
+	struct heightfield *hf;
+
+	if(!qt || qt->num_nodes == 0)
+		return NULL;
+
+	m = malloc(sizeof(struct terrain_mesh));
+	if(!m) {
+		fprintf(stderr, "Error: Couldn't allocate memory for terrain mesh\n");
+		return NULL;
+	}
+	bzero(m, sizeof(struct terrain_mesh));
+
+	hf = qt->heightfield;
+	m->quadtree = qt;
+	m->num_vertices = (hf->cols + 1) * (hf->rows + 1);
+	m->num_indices = hf->cols * hf->rows * 6;
+	m->vertices = malloc(sizeof(float) * MESH_VERTEX_FLOATS * m->num_vertices);
+	m->indices = malloc(sizeof(unsigned int) * m->num_indices);
+	m->starts = malloc(sizeof(unsigned int) * (qt->num_nodes + 1));
+	if(!m->vertices || !m->indices || !m->starts) {
+		fprintf(stderr, "Error: Couldn't allocate memory for terrain mesh\n");
+		free_terrain_mesh(m);
+		return NULL;
+	}
+
+	set_terrain_mesh_vertices(hf, m->vertices, 0, 0, hf->cols + 1, hf->rows + 1);
+	set_terrain_mesh_indices(m, 1);
+
+	/* the arrays in memory aren't needed once they're in buffers */
+	if(use_buffers && upload_mesh_buffers(m->buffers, m->vertices, m->num_vertices,
+	                                      m->indices, m->num_indices)) {
+		free(m->vertices);
+		free(m->indices);
+		m->vertices = NULL;
+		m->indices = NULL;
+	}
+
+	return m;
+}
+
+void
+free_terrain_mesh(struct terrain_mesh *m)
+{
+	if(!m)
+		return;
+
+	if(m->buffers[0])
+		glDeleteBuffers(2, m->buffers);
+	free(m->vertices);
+	free(m->indices);
+	free(m->starts);
+	free(m);
+}
+
+/*
+ * bring the vertices of samples [firstc, lastc) x [firstr, lastr)
+ * of a heightfield's grid of vertices up to date after it's been
+ * edited; they're in vertex buffer object buffer if it isn't 0, and
+ * in vertices if it is
+ */
+void
+update_mesh_vertices(unsigned int buffer, float *vertices, struct heightfield *hf,
+                     unsigned int firstc, unsigned int firstr, unsigned int lastc, unsigned int lastr)
+{
+	unsigned int r, w;
+	float *row;
+
+	w = hf->cols + 1;
+	if(lastc > w)
+		lastc = w;
+	if(lastr > hf->rows + 1)
+		lastr = hf->rows + 1;
+	if(firstc >= lastc || firstr >= lastr)
+		return;
+
+	if(!buffer) {
+		for(r = firstr; r < lastr; r++)
+			set_terrain_mesh_vertices(hf, vertices + (r * w + firstc) * MESH_VERTEX_FLOATS,
+			                          firstc, r, lastc, r + 1);
+		return;
+	}
+
+	/* each row of samples is one range of the vertex buffer */
+	row = malloc(sizeof(float) * MESH_VERTEX_FLOATS * (lastc - firstc));
+	if(!row) {
+		fprintf(stderr, "Error: Couldn't allocate memory for terrain mesh update\n");
+		return;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for(r = firstr; r < lastr; r++) {
+		set_terrain_mesh_vertices(hf, row, firstc, r, lastc, r + 1);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * MESH_VERTEX_FLOATS * (r * w + firstc),
+		                sizeof(float) * MESH_VERTEX_FLOATS * (lastc - firstc), row);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	free(row);
+}
+
+void
+update_terrain_mesh(struct terrain_mesh *m, unsigned int firstc, unsigned int firstr,
+                    unsigned int lastc, unsigned int lastr)
+{
+	if(m)
+		update_mesh_vertices(m->buffers[0], m->vertices, m->quadtree->heightfield,
+		                     firstc, firstr, lastc, lastr);
+}
+
+/*
+ * set up GL to draw triangles from a pair of buffer objects, or from
+ * vertices in memory if there aren't any buffers
+ */
+void
+bind_mesh_buffers(const unsigned int buffers[2], const float *vertices)
+{
+	const float *v = buffers[0] ? NULL : vertices;
+
+	if(buffers[0]) {
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(float) * MESH_VERTEX_FLOATS, v);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(float) * MESH_VERTEX_FLOATS, v + 3);
+}
+
+/* put GL back the way it was before bind_mesh_buffers */
+void
+unbind_mesh_buffers(const unsigned int buffers[2])
+{
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	if(buffers[0]) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
+
+/* set up GL to draw from the mesh; nodes are drawn by draw_terrain_mesh_node */
+void
+begin_terrain_mesh(struct terrain_mesh *m)
+{
+	bind_mesh_buffers(m->buffers, m->vertices);
+	m->first = m->count = 0;
+}
+
+/* draw the indices waiting to be drawn */
+static void
+flush_terrain_mesh(struct terrain_mesh *m)
+{
+	if(m->count == 0)
+		return;
+
+	if(m->buffers[0])
+		glDrawElements(GL_TRIANGLES, m->count, GL_UNSIGNED_INT,
+		               (const GLvoid *)(sizeof(unsigned int) * (size_t)m->first));
+	else
+		glDrawElements(GL_TRIANGLES, m->count, GL_UNSIGNED_INT, m->indices + m->first);
+
+	stats.calls++;
+	stats.vertices += m->count;
+	m->count = 0;
+}
+
+/*
+ * draw every quad under node n. the draw is held back until a node
+ * that doesn't follow on from it comes along, so that neighbours in
+ * the node order, such as the leaves of a branch, go in one call
+ */
+void
+draw_terrain_mesh_node(struct terrain_mesh *m, unsigned int n)
+{
+	unsigned int first, last;
+
+	first = m->starts[n];
+	last = m->starts[m->quadtree->nodes[n].skip];
+	if(first == last)
+		return;
+
+	if(m->count && m->first + m->count == first) {
+		m->count += last - first;
+		return;
+	}
+
+	flush_terrain_mesh(m);
+	m->first = first;
+	m->count = last - first;
+}
+
+/* draw what's left and put GL back the way it was */
+void
+end_terrain_mesh(struct terrain_mesh *m)
+{
+	flush_terrain_mesh(m);
+	unbind_mesh_buffers(m->buffers);
+}
+
+/* count draw calls made with glBegin and glVertex elsewhere */
+void
+add_draw_stats(unsigned int calls, unsigned int vertices)
+{
+	stats.calls += calls;
+	stats.vertices += vertices;
+}
+
+/* copy the draw counters into s and reset them to zero */
+void
+take_draw_stats(struct draw_stats *s)
+{
+	*s = stats;
+	stats.calls = 0;
+	stats.vertices = 0;
+}
+
+/* count the vertices drawing n indices would transform with a FIFO cache of the given size */
+static unsigned int
+count_vertex_cache_misses(const unsigned int *idx, unsigned int n, unsigned int size)
+{
+	unsigned int fifo[64], i, j, next = 0, misses = 0;
+
+	for(i = 0; i < size; i++)
+		fifo[i] = ~0u;
+	for(i = 0; i < n; i++) {
+		for(j = 0; j < size && fifo[j] != idx[i]; j++)
+			;
+		if(j < size)
+			continue;
+		fifo[next] = idx[i];
+		next = (next + 1) % size;
+		misses++;
+	}
+
+	return misses;
+}
+
+/*
+ * print the average cache miss ratio, or vertices transformed per
+ * triangle, of the mesh's nodes at each depth when drawn on their own
+ */
+static void
+print_terrain_mesh_acmr(struct terrain_mesh *m, const unsigned int *sizes, unsigned int num_sizes)
+{
+	struct terrain_quadtree *qt = m->quadtree;
+	unsigned int i, j, d, max_depth, nodes, first, count;
+	unsigned int *depths, ends[64], num_ends = 0;
+	double acmr[4];
+
+	depths = malloc(sizeof(unsigned int) * qt->num_nodes);
+	if(!depths) {
+		fprintf(stderr, "Error: Couldn't allocate memory for mesh stats\n");
+		return;
+	}
+
+	/* a node's depth is how many branches it's under */
+	max_depth = 0;
+	for(i = 0; i < qt->num_nodes; i++) {
+		while(num_ends && ends[num_ends - 1] <= i)
+			num_ends--;
+		depths[i] = num_ends;
+		if(num_ends > max_depth)
+			max_depth = num_ends;
+		if(qt->nodes[i].skip != i + 1 && num_ends < 64)
+			ends[num_ends++] = qt->nodes[i].skip;
+	}
+
+	for(d = max_depth + 1; d-- > 0; ) {
+		nodes = 0;
+		for(j = 0; j < num_sizes; j++)
+			acmr[j] = 0.0;
+		for(i = 0; i < qt->num_nodes; i++) {
+			first = m->starts[i];
+			count = m->starts[qt->nodes[i].skip] - first;
+			if(depths[i] != d || count == 0)
+				continue;
+			for(j = 0; j < num_sizes; j++)
+				acmr[j] += 3.0 * count_vertex_cache_misses(m->indices + first, count, sizes[j]) / count;
+			nodes++;
+		}
+
+		if(nodes) {
+			printf("%5u x %-5u %8u", TERRAIN_QUADTREE_LEAF_QUADS << (max_depth - d),
+			       TERRAIN_QUADTREE_LEAF_QUADS << (max_depth - d), nodes);
+			for(j = 0; j < num_sizes; j++)
+				printf(" %9.3f", acmr[j] / nodes);
+			printf("\n");
+		}
+	}
+
+	free(depths);
+}
+
+/*
+ * print the lowest, average and highest cache miss ratio of the
+ * mesh's leaves, the chunks it's drawn in, each drawn on its own
+ */
+static void
+print_terrain_mesh_leaf_acmr(struct terrain_mesh *m, const unsigned int *sizes, unsigned int num_sizes)
+{
+	struct terrain_quadtree *qt = m->quadtree;
+	unsigned int i, j, leaves, first, count;
+	double acmr, min, max, sum;
+
+	for(j = 0; j < num_sizes; j++) {
+		leaves = 0;
+		min = max = sum = 0.0;
+		for(i = 0; i < qt->num_nodes; i++) {
+			first = m->starts[i];
+			count = m->starts[i + 1] - first;
+			if(qt->nodes[i].skip != i + 1 || count == 0)
+				continue;
+			acmr = 3.0 * count_vertex_cache_misses(m->indices + first, count, sizes[j]) / count;
+			if(leaves == 0 || acmr < min)
+				min = acmr;
+			if(leaves == 0 || acmr > max)
+				max = acmr;
+			sum += acmr;
+			leaves++;
+		}
+
+		if(leaves)
+			printf("%5u %14u %9.3f %9.3f %9.3f\n", sizes[j], leaves, min, sum / leaves, max);
+	}
+}
+
+/*
+ * compare how well the mesh's triangles use GPU vertex caches of a
+ * few sizes, in the row by row order they're made in and after
+ * they've been ordered for the cache. the best that's possible is
+ * about 0.5 vertices per triangle, for one big mesh
+ */
+void
+print_terrain_mesh_stats(const char *filename)
+{
+	static unsigned int sizes[] = { 8, 16, 32 };
+	struct map *m;
+	struct terrain_mesh *mesh;
+	unsigned int i;
+
+	m = load_map(filename);
+	if(!m)
+		return;
+
+	/* the mesh stays in memory without a GL context */
+	mesh = new_terrain_mesh(m->quadtree, 0);
+	if(!mesh) {
+		free_map(m);
+		return;
+	}
+
+	printf("%s: %u x %u quads, %u vertices, %u triangles\n", filename,
+	       m->heightfield->cols, m->heightfield->rows, mesh->num_vertices, mesh->num_indices / 3);
+	for(i = 0; i < 2; i++) {
+		printf("%s: average vertices transformed per triangle, by FIFO cache size\n",
+		       i ? "cache order" : "row order");
+		printf("node quads       nodes         8        16        32\n");
+		set_terrain_mesh_indices(mesh, i);
+		print_terrain_mesh_acmr(mesh, sizes, sizeof(sizes) / sizeof(sizes[0]));
+		printf("cache       leaves       min       avg       max\n");
+		print_terrain_mesh_leaf_acmr(mesh, sizes, sizeof(sizes) / sizeof(sizes[0]));
+	}
+
+	free_terrain_mesh(mesh);
+	free_map(m);
+}
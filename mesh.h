@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * a terrain mesh is a map's quadtree packed into vertex and index
+ * arrays, in GL buffer objects where there are any. every sample is
+ * one vertex, shared by the quads around it, and the quads' triangles
+ * are stored leaf by leaf in the quadtree's node order, so the
+ * triangles under any node are one range of indices, and a leaf or a
+ * whole branch is drawn with one call
+ */
+
+#define MESH_VERTEX_FLOATS 5 /* x, y, z, s, t */
+
+/* vertices and draw calls sent to GL since the counters were taken */
+struct draw_stats {
+	unsigned int calls;    /* glBegin/glEnd pairs and glDrawElements calls */
+	unsigned int vertices; /* vertices in them, or indices for glDrawElements */
+};
+
+struct terrain_mesh {
+	struct terrain_quadtree *quadtree;
+	unsigned int num_vertices, num_indices;
+	float *vertices;        /* x, y, z, s, t of each sample, row by row */
+	unsigned int *indices;  /* two triangles per quad */
+	unsigned int *starts;   /* first index of each node's triangles, and the total */
+	unsigned int buffers[2]; /* vertex and index buffer objects, or 0 to draw from memory */
+	unsigned int first, count; /* indices waiting to be drawn */
+};
+
+int has_vertex_buffers();
+void set_terrain_mesh_vertices(struct heightfield *, float *, unsigned int, unsigned int, unsigned int, unsigned int);
+struct terrain_mesh *new_terrain_mesh(struct terrain_quadtree *, int);
+void free_terrain_mesh(struct terrain_mesh *);
+int upload_mesh_buffers(unsigned int[2], const float *, unsigned int, const unsigned int *, unsigned int);
+void update_mesh_vertices(unsigned int, float *, struct heightfield *, unsigned int, unsigned int, unsigned int, unsigned int);
+void bind_mesh_buffers(const unsigned int[2], const float *);
+void unbind_mesh_buffers(const unsigned int[2]);
+void update_terrain_mesh(struct terrain_mesh *, unsigned int, unsigned int, unsigned int, unsigned int);
+void begin_terrain_mesh(struct terrain_mesh *);
+void draw_terrain_mesh_node(struct terrain_mesh *, unsigned int);
+void end_terrain_mesh(struct terrain_mesh *);
+void add_draw_stats(unsigned int, unsigned int);
+void take_draw_stats(struct draw_stats *);
+void print_terrain_mesh_stats(const char *);
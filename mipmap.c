@@ -0,0 +1,725 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * textures are filtered down to each mipmap level on the cpu, with
+ * a 2 x 2 box filter that works on two pixels at once with SSE2,
+ * and can then be compressed to DXT1. the rows of a level, or its
+ * rows of blocks, are split into bands across threads. the result
+ * is cached next to the png, so later loads skip decoding the png
+ * as well as filtering and compressing it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "cachefile.h"
+#include "mipmap.h"
+#include "my_math.h"
+#include "parallel.h"
+
+extern void *read_png(const char *, unsigned int *, unsigned int *, int *);
+
+#define MIPMAP_CACHE_MAGIC     "JABMIPC"
+#define MIPMAP_CACHE_VERSION   1
+#define MIPMAP_ROWS_PER_THREAD 16 /* fewest rows, or rows of blocks, worth a thread */
+
+struct mipmap_cache_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int byte_order; /* 0x01020304 in the writer's byte order */
+	unsigned int format, num_levels;
+	unsigned int widths[MIPMAP_MAX_LEVELS], heights[MIPMAP_MAX_LEVELS];
+	unsigned long offsets[MIPMAP_MAX_LEVELS + 1];
+};
+
+/* one level being made from another, by bands of rows */
+struct mipmap_job {
+	const unsigned char *src;  /* RGBA pixels */
+	unsigned char *dst;        /* RGBA pixels or DXT1 blocks */
+	unsigned int width, height; /* of src */
+	unsigned int rows;          /* rows, or rows of blocks, of dst */
+	unsigned int num_threads;
+};
+
+static int use_simd = 1; /* switched off to time the plain filter */
+
+/* bytes a width x height level takes up */
+static unsigned long
+get_mipmap_level_size(unsigned int format, unsigned int width, unsigned int height)
+{
+	if(format == MIPMAP_DXT1)
+		return (unsigned long)((width + 3) / 4) * ((height + 3) / 4) * 8;
+
+	return (unsigned long)width * height * 4;
+}
+
+/* allocate a chain for a width x height texture, with every level down to 1 x 1 */
+static struct mipmap_chain *
+new_mipmap_chain(unsigned int format, unsigned int width, unsigned int height)
+{
+	struct mipmap_chain *c;
+	unsigned int i;
+
+	c = malloc(sizeof(struct mipmap_chain));
+	if(!c) {
+		fprintf(stderr, "Error: Couldn't allocate memory for mipmaps\n");
+		return NULL;
+	}
+	bzero(c, sizeof(struct mipmap_chain));
+
+	c->format = format;
+	for(i = 0; i < MIPMAP_MAX_LEVELS; i++) {
+		c->widths[i] = width;
+		c->heights[i] = height;
+		c->offsets[i + 1] = c->offsets[i] + get_mipmap_level_size(format, width, height);
+		c->num_levels++;
+		if(width == 1 && height == 1)
+			break;
+		width = (width > 1) ? width / 2 : 1;
+		height = (height > 1) ? height / 2 : 1;
+	}
+
+	c->data = malloc(c->offsets[c->num_levels]);
+	if(!c->data) {
+		fprintf(stderr, "Error: Couldn't allocate memory for mipmaps\n");
+		free(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+void
+free_mipmap_chain(struct mipmap_chain *c)
+{
+	if(!c)
+		return;
+
+	free(c->data);
+	free(c);
+}
+
+/*
+ * average each 2 x 2 square of pixels in rows a and b into a pixel
+ * of out; a source width that's odd has its last column used twice
+ */
+static void
+filter_mipmap_row(const unsigned char *a, const unsigned char *b, unsigned char *out,
+                  unsigned int width, unsigned int out_width)
+{
+	unsigned int x = 0, x0, x1, k;
+#ifdef __SSE2__
+	__m128i zero, two, va, vb, lo, hi, sum;
+
+	if(use_simd) {
+		zero = _mm_setzero_si128();
+		two = _mm_set1_epi16(2);
+		for(; x + 2 <= out_width && x * 2 + 4 <= width; x += 2) {
+			va = _mm_loadu_si128((const __m128i *)(a + x * 8));
+			vb = _mm_loadu_si128((const __m128i *)(b + x * 8));
+
+			/* sum the rows, pixels 0 and 1 in lo and 2 and 3 in hi, then across */
+			lo = _mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+			hi = _mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+			sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+			_mm_storel_epi64((__m128i *)(out + x * 4), _mm_packus_epi16(sum, sum));
+		}
+	}
+#endif
+
+	for(; x < out_width; x++) {
+		x0 = x * 2 * 4;
+		x1 = (x * 2 + 1 < width) ? x0 + 4 : x0;
+		for(k = 0; k < 4; k++)
+			out[x * 4 + k] = (a[x0 + k] + a[x1 + k] + b[x0 + k] + b[x1 + k] + 2) >> 2;
+	}
+}
+
+/* filter band n of the job's rows */
+static void
+filter_mipmap_band(void *arg, unsigned int n)
+{
+	struct mipmap_job *job = arg;
+	unsigned int y, first, last, out_width, y1;
+
+	first = (unsigned int)((unsigned long)job->rows * n / job->num_threads);
+	last = (unsigned int)((unsigned long)job->rows * (n + 1) / job->num_threads);
+	out_width = (job->width > 1) ? job->width / 2 : 1;
+	for(y = first; y < last; y++) {
+		y1 = (y * 2 + 1 < job->height) ? y * 2 + 1 : y * 2;
+		filter_mipmap_row(job->src + (unsigned long)y * 2 * job->width * 4,
+		                  job->src + (unsigned long)y1 * job->width * 4,
+		                  job->dst + (unsigned long)y * out_width * 4, job->width, out_width);
+	}
+}
+
+/* run a job over rows rows on up to num_threads threads, leaving small levels on one */
+static void
+run_mipmap_job(struct mipmap_job *job, parallel_job band, unsigned int num_threads)
+{
+	if(num_threads > job->rows / MIPMAP_ROWS_PER_THREAD)
+		num_threads = job->rows / MIPMAP_ROWS_PER_THREAD;
+	if(num_threads < 1)
+		num_threads = 1;
+
+	job->num_threads = num_threads;
+	run_parallel(band, job, num_threads);
+}
+
+/*
+ * build the RGBA mipmap chain of a width x height RGB image on up
+ * to num_threads threads (0 for one per processor)
+ */
+struct mipmap_chain *
+build_mipmap_chain(const unsigned char *rgb, unsigned int width, unsigned int height,
+                   unsigned int num_threads)
+{
+	struct mipmap_chain *c;
+	struct mipmap_job job;
+	unsigned long i;
+	unsigned int l;
+
+	if(num_threads == 0)
+		num_threads = get_num_cpus();
+
+	c = new_mipmap_chain(MIPMAP_RGBA, width, height);
+	if(!c)
+		return NULL;
+
+	for(i = 0; i < (unsigned long)width * height; i++) {
+		c->data[i * 4] = rgb[i * 3];
+		c->data[i * 4 + 1] = rgb[i * 3 + 1];
+		c->data[i * 4 + 2] = rgb[i * 3 + 2];
+		c->data[i * 4 + 3] = 255;
+	}
+
+	for(l = 1; l < c->num_levels; l++) {
+		job.src = c->data + c->offsets[l - 1];
+		job.dst = c->data + c->offsets[l];
+		job.width = c->widths[l - 1];
+		job.height = c->heights[l - 1];
+		job.rows = c->heights[l];
+		run_mipmap_job(&job, filter_mipmap_band, num_threads);
+	}
+
+	return c;
+}
+
+/* pack an 8 bit colour into 5:6:5 bits */
+static unsigned int
+pack_rgb565(const int rgb[3])
+{
+	return ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+}
+
+/* unpack 5:6:5 bits into an 8 bit colour */
+static void
+unpack_rgb565(unsigned int c, int rgb[3])
+{
+	rgb[0] = (c >> 11) & 31;
+	rgb[1] = (c >> 5) & 63;
+	rgb[2] = c & 31;
+	rgb[0] = (rgb[0] << 3) | (rgb[0] >> 2);
+	rgb[1] = (rgb[1] << 2) | (rgb[1] >> 4);
+	rgb[2] = (rgb[2] << 3) | (rgb[2] >> 2);
+}
+
+/* the four colours a block with end points c0 and c1, c0 > c1, can use */
+static void
+get_dxt1_palette(unsigned int c0, unsigned int c1, int palette[4][3])
+{
+	int k;
+
+	unpack_rgb565(c0, palette[0]);
+	unpack_rgb565(c1, palette[1]);
+	for(k = 0; k < 3; k++) {
+		palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+		palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+	}
+}
+
+/*
+ * compress the 4 x 4 block of pixels at (bx, by) in a width x height
+ * RGBA level into out. the end points are the corners of the box
+ * around the block's colours, along the diagonal the colours run
+ * along, pulled in a sixteenth at each end so that they're spent on
+ * the colours rather than outliers; pixels past the edges of levels
+ * smaller than a block repeat the last row or column
+ */
+static void
+encode_dxt1_block(const unsigned char *src, unsigned int width, unsigned int height,
+                  unsigned int bx, unsigned int by, unsigned char out[8])
+{
+	static const unsigned int order[4] = { 1, 3, 2, 0 }; /* palette index of each step from c1 to c0 */
+	int px[16][3], lo[3], hi[3], mid[3], palette[4][3], dir[3], cov, d, t, k, p, len, base;
+	unsigned int i, x, y, c0, c1, bits = 0;
+	const unsigned char *s;
+
+	for(i = 0; i < 16; i++) {
+		x = bx * 4 + (i & 3);
+		y = by * 4 + (i >> 2);
+		s = src + ((unsigned long)((y < height) ? y : height - 1) * width + ((x < width) ? x : width - 1)) * 4;
+		for(k = 0; k < 3; k++)
+			px[i][k] = s[k];
+	}
+
+	for(k = 0; k < 3; k++) {
+		lo[k] = hi[k] = px[0][k];
+		for(i = 1; i < 16; i++) {
+			if(px[i][k] < lo[k])
+				lo[k] = px[i][k];
+			if(px[i][k] > hi[k])
+				hi[k] = px[i][k];
+		}
+		mid[k] = (lo[k] + hi[k]) / 2;
+	}
+
+	/* turn the box's diagonal around wherever a channel falls as the widest one rises */
+	p = 0;
+	for(k = 1; k < 3; k++) {
+		if(hi[k] - lo[k] > hi[p] - lo[p])
+			p = k;
+	}
+	for(k = 0; k < 3; k++) {
+		if(k == p)
+			continue;
+		for(cov = 0, i = 0; i < 16; i++)
+			cov += (px[i][p] - mid[p]) * (px[i][k] - mid[k]);
+		if(cov < 0) {
+			t = lo[k];
+			lo[k] = hi[k];
+			hi[k] = t;
+		}
+	}
+	for(k = 0; k < 3; k++) {
+		d = (hi[k] - lo[k]) / 16;
+		hi[k] -= d;
+		lo[k] += d;
+	}
+
+	c0 = pack_rgb565(hi);
+	c1 = pack_rgb565(lo);
+	if(c0 < c1) {
+		t = c0;
+		c0 = c1;
+		c1 = t;
+	}
+
+	/*
+	 * c0 == c1 picks the three colour mode, where index 0 is c0 all
+	 * the same. otherwise each pixel gets the palette colour nearest
+	 * to where it falls along the line from c1 to c0
+	 */
+	if(c0 != c1) {
+		get_dxt1_palette(c0, c1, palette);
+		for(k = 0; k < 3; k++)
+			dir[k] = palette[0][k] - palette[1][k];
+		len = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+		base = dir[0] * palette[1][0] + dir[1] * palette[1][1] + dir[2] * palette[1][2];
+		for(i = 0; i < 16; i++) {
+			d = dir[0] * px[i][0] + dir[1] * px[i][1] + dir[2] * px[i][2] - base;
+			t = (d <= 0) ? 0 : (d >= len) ? 3 : (d * 6 + len) / (len * 2);
+			bits |= order[t] << (i * 2);
+		}
+	}
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	out[4] = bits & 0xff;
+	out[5] = (bits >> 8) & 0xff;
+	out[6] = (bits >> 16) & 0xff;
+	out[7] = bits >> 24;
+}
+
+/* compress band n of the job's rows of blocks */
+static void
+encode_dxt1_band(void *arg, unsigned int n)
+{
+	struct mipmap_job *job = arg;
+	unsigned int bx, by, first, last, blocks;
+
+	first = (unsigned int)((unsigned long)job->rows * n / job->num_threads);
+	last = (unsigned int)((unsigned long)job->rows * (n + 1) / job->num_threads);
+	blocks = (job->width + 3) / 4;
+	for(by = first; by < last; by++) {
+		for(bx = 0; bx < blocks; bx++)
+			encode_dxt1_block(job->src, job->width, job->height, bx, by,
+			                  job->dst + ((unsigned long)by * blocks + bx) * 8);
+	}
+}
+
+/* make a DXT1 copy of an RGBA chain on num_threads threads */
+static struct mipmap_chain *
+encode_dxt1_chain(const struct mipmap_chain *c, unsigned int num_threads)
+{
+	struct mipmap_chain *dxt;
+	struct mipmap_job job;
+	unsigned int l;
+
+	dxt = new_mipmap_chain(MIPMAP_DXT1, c->widths[0], c->heights[0]);
+	if(!dxt)
+		return NULL;
+
+	for(l = 0; l < c->num_levels; l++) {
+		job.src = c->data + c->offsets[l];
+		job.dst = dxt->data + dxt->offsets[l];
+		job.width = c->widths[l];
+		job.height = c->heights[l];
+		job.rows = (c->heights[l] + 3) / 4;
+		run_mipmap_job(&job, encode_dxt1_band, num_threads);
+	}
+
+	return dxt;
+}
+
+/*
+ * compress an RGBA chain to DXT1 in place on up to num_threads
+ * threads (0 for one per processor); returns 1 on success
+ */
+int
+compress_mipmap_chain(struct mipmap_chain *c, unsigned int num_threads)
+{
+	struct mipmap_chain *dxt;
+
+	if(c->format != MIPMAP_RGBA)
+		return 0;
+
+	dxt = encode_dxt1_chain(c, num_threads ? num_threads : get_num_cpus());
+	if(!dxt)
+		return 0;
+
+	free(c->data);
+	*c = *dxt;
+	free(dxt);
+
+	return 1;
+}
+
+/* return 1 if the cache was written */
+int
+write_mipmap_cache(struct mipmap_chain *c, const char *cachename)
+{
+	struct mipmap_cache_header h;
+	FILE *fp;
+
+	bzero(&h, sizeof(h));
+	memcpy(h.magic, MIPMAP_CACHE_MAGIC, sizeof(h.magic));
+	h.version = MIPMAP_CACHE_VERSION;
+	h.byte_order = 0x01020304;
+	h.format = c->format;
+	h.num_levels = c->num_levels;
+	memcpy(h.widths, c->widths, sizeof(h.widths));
+	memcpy(h.heights, c->heights, sizeof(h.heights));
+	memcpy(h.offsets, c->offsets, sizeof(h.offsets));
+
+	fp = fopen(cachename, "wb");
+	if(!fp) {
+		fprintf(stderr, "Error: Couldn't create mipmap cache %s\n", cachename);
+		return 0;
+	}
+	if(fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	   fwrite(c->data, c->offsets[c->num_levels], 1, fp) != 1) {
+		fprintf(stderr, "Error: Couldn't write mipmap cache %s\n", cachename);
+		fclose(fp);
+		remove(cachename);
+		return 0;
+	}
+	if(fclose(fp) != 0) {
+		fprintf(stderr, "Error: Couldn't write mipmap cache %s\n", cachename);
+		remove(cachename);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* read a cached chain; returns NULL if it's missing or wasn't written by this build */
+struct mipmap_chain *
+load_mipmap_cache(const char *cachename)
+{
+	struct mipmap_cache_header h;
+	struct mipmap_chain *c;
+	FILE *fp;
+
+	fp = fopen(cachename, "rb");
+	if(!fp)
+		return NULL;
+
+	if(fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, MIPMAP_CACHE_MAGIC, sizeof(h.magic)) != 0 ||
+	   h.version != MIPMAP_CACHE_VERSION || h.byte_order != 0x01020304 ||
+	   (h.format != MIPMAP_RGBA && h.format != MIPMAP_DXT1) || h.widths[0] == 0 || h.heights[0] == 0) {
+		fclose(fp);
+		return NULL;
+	}
+
+	/* the levels have to be laid out the way they'd be built */
+	c = new_mipmap_chain(h.format, h.widths[0], h.heights[0]);
+	if(!c) {
+		fclose(fp);
+		return NULL;
+	}
+	if(c->num_levels != h.num_levels || memcmp(c->offsets, h.offsets, sizeof(h.offsets)) != 0 ||
+	   fread(c->data, c->offsets[c->num_levels], 1, fp) != 1) {
+		fclose(fp);
+		free_mipmap_chain(c);
+		return NULL;
+	}
+	fclose(fp);
+
+	return c;
+}
+
+/*
+ * get the mipmap chain of a png, DXT1 compressed if compress is
+ * set, from its cache if the cache is newer than it, or else by
+ * building it and caching it for next time
+ */
+struct mipmap_chain *
+load_mipmap_chain(const char *filename, int compress)
+{
+	struct mipmap_chain *c;
+	unsigned int width, height;
+	int type;
+	unsigned char *data;
+	char cachename[256];
+
+	snprintf(cachename, sizeof(cachename), "%s%s", filename, compress ? MIPMAP_DXT1_SUFFIX : MIPMAP_SUFFIX);
+	if(is_cache_fresh(filename, cachename)) {
+		c = load_mipmap_cache(cachename);
+		if(c)
+			return c;
+	}
+
+	data = (unsigned char *)read_png(filename, &width, &height, &type);
+	if(!data)
+		return NULL;
+	c = build_mipmap_chain(data, width, height, 0);
+	free(data);
+	if(!c)
+		return NULL;
+	if(compress && !compress_mipmap_chain(c, 0)) {
+		free_mipmap_chain(c);
+		return NULL;
+	}
+
+	write_mipmap_cache(c, cachename);
+
+	return c;
+}
+
+/* decode the DXT1 block at in into 4 x 4 RGB pixels */
+static void
+decode_dxt1_block(const unsigned char *in, int px[16][3])
+{
+	int palette[4][3];
+	unsigned int c0, c1, bits, i, k;
+
+	c0 = in[0] | (in[1] << 8);
+	c1 = in[2] | (in[3] << 8);
+	bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int)in[7] << 24);
+	get_dxt1_palette(c0, c1, palette);
+	if(c0 <= c1) {
+		for(k = 0; k < 3; k++)
+			palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+	}
+	for(i = 0; i < 16; i++) {
+		for(k = 0; k < 3; k++)
+			px[i][k] = palette[(bits >> (i * 2)) & 3][k];
+	}
+}
+
+/* root mean square difference of a DXT1 chain's pixels from the RGBA chain it came from */
+static double
+get_dxt1_error(const struct mipmap_chain *rgba, const struct mipmap_chain *dxt)
+{
+	int px[16][3];
+	unsigned int l, bx, by, i, k, x, y, blocks;
+	unsigned long count = 0;
+	const unsigned char *s;
+	double sum = 0.0;
+
+	for(l = 0; l < rgba->num_levels; l++) {
+		blocks = (rgba->widths[l] + 3) / 4;
+		for(by = 0; by < (rgba->heights[l] + 3) / 4; by++) {
+			for(bx = 0; bx < blocks; bx++) {
+				decode_dxt1_block(dxt->data + dxt->offsets[l] + ((unsigned long)by * blocks + bx) * 8, px);
+				for(i = 0; i < 16; i++) {
+					x = bx * 4 + (i & 3);
+					y = by * 4 + (i >> 2);
+					if(x >= rgba->widths[l] || y >= rgba->heights[l])
+						continue;
+					s = rgba->data + rgba->offsets[l] + ((unsigned long)y * rgba->widths[l] + x) * 4;
+					for(k = 0; k < 3; k++)
+						sum += (double)SQUARE(px[i][k] - s[k]);
+					count += 3;
+				}
+			}
+		}
+	}
+
+	return sqrt(sum / (double)count);
+}
+
+/*
+ * time filtering and compressing the mipmaps of a width x height
+ * RGB image, and print what each way of storing it takes up
+ */
+static void
+benchmark_mipmap_image(const char *name, const unsigned char *rgb, unsigned int width, unsigned int height)
+{
+	struct mipmap_chain *c = NULL, *dxt = NULL;
+	unsigned int i, k, r, reps, threads[2];
+	unsigned long before;
+	double t, pixels;
+
+	threads[0] = 1;
+	threads[1] = get_num_cpus();
+	pixels = (double)width * height;
+	reps = 1 + (unsigned int)(4.0 * 1024.0 * 1024.0 / pixels);
+
+	printf("%s: %u x %u, %u processors\n", name, width, height, threads[1]);
+	printf("                     threads  ms/texture  Mpixels/s\n");
+	for(k = 0; k < 2; k++) {
+#ifndef __SSE2__
+		if(k == 1)
+			break;
+#endif
+		use_simd = k;
+		for(i = 0; i < (k ? 2 : 1); i++) {
+			if(i && threads[1] == 1)
+				break;
+			t = get_time_ms();
+			for(r = 0; r < reps; r++) {
+				free_mipmap_chain(c);
+				c = build_mipmap_chain(rgb, width, height, threads[i]);
+				if(!c)
+					return;
+			}
+			t = (get_time_ms() - t) / reps;
+			printf("%-20s %7u %11.3f %10.1f\n", k ? "box filter, SSE2" : "box filter, plain",
+			       threads[i], t, pixels / 1000.0 / t);
+		}
+	}
+	use_simd = 1;
+
+	for(i = 0; i < 2; i++) {
+		if(i && threads[1] == 1)
+			break;
+		t = get_time_ms();
+		for(r = 0; r < reps; r++) {
+			free_mipmap_chain(dxt);
+			dxt = encode_dxt1_chain(c, threads[i]);
+			if(!dxt) {
+				free_mipmap_chain(c);
+				return;
+			}
+		}
+		t = (get_time_ms() - t) / reps;
+		printf("%-20s %7u %11.3f %10.1f\n", "DXT1 encoding", threads[i], t, pixels / 1000.0 / t);
+	}
+	printf("DXT1 error: %.2f RMS over all levels, in 8 bit steps\n", get_dxt1_error(c, dxt));
+
+	/* what's sent to GL: a single RGB level before, then each chain */
+	before = (unsigned long)width * height * 3;
+	printf("                       bytes  vs. RGB, one level\n");
+	printf("%-16s %11lu %10.1f%%\n", "RGB, one level", before, 100.0);
+	printf("%-16s %11lu %10.1f%%\n", "RGBA mipmaps", c->offsets[c->num_levels],
+	       100.0 * c->offsets[c->num_levels] / before);
+	printf("%-16s %11lu %10.1f%%\n", "DXT1 mipmaps", dxt->offsets[dxt->num_levels],
+	       100.0 * dxt->offsets[dxt->num_levels] / before);
+
+	free_mipmap_chain(c);
+	free_mipmap_chain(dxt);
+}
+
+/*
+ * time loading a texture's mipmaps from its png and from its
+ * caches, and building and compressing them for it and for a
+ * bigger copy of it tiled to 2048 x 2048
+ */
+void
+benchmark_mipmaps(const char *filename)
+{
+	struct mipmap_chain *c;
+	unsigned int width, height, x, y, k, big = 2048;
+	unsigned char *rgb, *tiled;
+	char cachename[256];
+	double t;
+	int type;
+
+	rgb = (unsigned char *)read_png(filename, &width, &height, &type);
+	if(!rgb) {
+		fprintf(stderr, "Error: Couldn't load texture %s\n", filename);
+		return;
+	}
+
+	benchmark_mipmap_image(filename, rgb, width, height);
+
+	tiled = malloc((unsigned long)big * big * 3);
+	if(!tiled) {
+		fprintf(stderr, "Error: Couldn't allocate memory for texture\n");
+		free(rgb);
+		return;
+	}
+	for(y = 0; y < big; y++) {
+		for(x = 0; x < big; x++)
+			memcpy(tiled + ((unsigned long)y * big + x) * 3, rgb + ((y % height) * width + x % width) * 3, 3);
+	}
+	printf("\n");
+	benchmark_mipmap_image("tiled copy", tiled, big, big);
+	free(tiled);
+	free(rgb);
+
+	printf("\nloading %s        ms\n", filename);
+	for(k = 0; k < 2; k++) {
+		t = get_time_ms();
+		rgb = (unsigned char *)read_png(filename, &width, &height, &type);
+		c = rgb ? build_mipmap_chain(rgb, width, height, 0) : NULL;
+		if(c && k)
+			compress_mipmap_chain(c, 0);
+		t = get_time_ms() - t;
+		free(rgb);
+		if(!c)
+			return;
+		printf("%-28s %8.3f\n", k ? "png, mipmaps and DXT1" : "png and mipmaps", t);
+
+		snprintf(cachename, sizeof(cachename), "%s%s", filename, k ? MIPMAP_DXT1_SUFFIX : MIPMAP_SUFFIX);
+		write_mipmap_cache(c, cachename);
+		free_mipmap_chain(c);
+		t = get_time_ms();
+		c = load_mipmap_cache(cachename);
+		t = get_time_ms() - t;
+		printf("%-28s %8.3f\n", k ? "DXT1 cache" : "mipmap cache", t);
+		free_mipmap_chain(c);
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * a mipmap chain is a texture and each of its halvings down to a
+ * single pixel, in one block of memory, built on the cpu so that
+ * it can be cached on disk with the png it came from. levels are
+ * either 8 bit RGBA pixels or DXT1 blocks of 4 x 4 pixels
+ */
+
+#define MIPMAP_MAX_LEVELS  16
+#define MIPMAP_RGBA        0 /* 4 bytes a pixel */
+#define MIPMAP_DXT1        1 /* 8 bytes a block of 4 x 4 pixels */
+#define MIPMAP_SUFFIX      ".mips" /* caches of RGBA chains */
+#define MIPMAP_DXT1_SUFFIX ".dxt"  /* caches of DXT1 chains */
+
+struct mipmap_chain {
+	unsigned int format;
+	unsigned int num_levels;
+	unsigned int widths[MIPMAP_MAX_LEVELS], heights[MIPMAP_MAX_LEVELS];
+	unsigned long offsets[MIPMAP_MAX_LEVELS + 1]; /* where each level starts in data; and the end */
+	unsigned char *data;
+};
+
+struct mipmap_chain *build_mipmap_chain(const unsigned char *, unsigned int, unsigned int, unsigned int);
+int compress_mipmap_chain(struct mipmap_chain *, unsigned int);
+void free_mipmap_chain(struct mipmap_chain *);
+int write_mipmap_cache(struct mipmap_chain *, const char *);
+struct mipmap_chain *load_mipmap_cache(const char *);
+struct mipmap_chain *load_mipmap_chain(const char *, int);
+void benchmark_mipmaps(const char *);
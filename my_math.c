@@ -26,8 +26,10 @@
 #include <math.h>
 #include <GL/gl.h>
 #include "my_math.h"
+#include "frustum.h"
 
 static float view[6][4];
+static struct cull_stats stats;
 
 /* multiply 4x4 matrix */
 void
@@ -54,77 +56,55 @@ mult_matrix_4x4(float out[16], float m1[16], float m2[16])
 	out[15] = m1[12] * m2[3] + m1[13] * m2[7] + m1[14] * m2[11] + m1[15] * m2[15];
 }
 
+/* set plane p to (a, b, c, d), scaled so that its normal is unit length */
+static void
+set_view_plane(float p[4], float a, float b, float c, float d)
+{
+	float scale;
+
+	scale = 1.0f / sqrtf(a * a + b * b + c * c);
+	p[0] = a * scale;
+	p[1] = b * scale;
+	p[2] = c * scale;
+	p[3] = d * scale;
+}
+
+/*
+ * work out the planes of the frustum seen through modelview matrix
+ * mm and projection matrix pm, with their normals pointing inwards
+ */
+void
+get_frustum_planes(float planes[6][4], float mm[16], float pm[16])
+{
+	float p[16];
+
+	mult_matrix_4x4(p, mm, pm);
+
+	set_view_plane(planes[0], p[3] - p[0], p[7] - p[4], p[11] - p[8], p[15] - p[12]);
+	set_view_plane(planes[1], p[3] + p[0], p[7] + p[4], p[11] + p[8], p[15] + p[12]);
+	set_view_plane(planes[2], p[3] - p[1], p[7] - p[5], p[11] - p[9], p[15] - p[13]);
+	set_view_plane(planes[3], p[3] + p[1], p[7] + p[5], p[11] + p[9], p[15] + p[13]);
+	set_view_plane(planes[4], p[3] - p[2], p[7] - p[6], p[11] - p[10], p[15] - p[14]);
+	set_view_plane(planes[5], p[3] + p[2], p[7] + p[6], p[11] + p[10], p[15] + p[14]);
+}
+
+/* set the view frustum to the one seen through matrices mm and pm */
+void
+set_view_frustum(float mm[16], float pm[16])
+{
+	get_frustum_planes(view, mm, pm);
+}
+
 /* update the view frustum; called once every rendering cycle */
 void
 update_view_frustum()
 {
-	float mm[16], pm[16], product[16];
-	float scale;
+	float mm[16], pm[16];
 
 	glGetFloatv(GL_MODELVIEW_MATRIX, mm);
 	glGetFloatv(GL_PROJECTION_MATRIX, pm);
 
-	mult_matrix_4x4(product, mm, pm);
-
-	view[0][0] = product[3] - product[0];
-	view[0][1] = product[7] - product[4];
-	view[0][2] = product[11] - product[8];
-	view[0][3] = product[15] - product[12];
-	scale  = 1.0f / sqrtf(SQUARE(view[0][0]) + SQUARE(view[0][1]) + SQUARE(view[0][2]));
-	view[0][0] *= scale;
-	view[0][1] *= scale;
-	view[0][2] *= scale;
-	view[0][3] *= scale;
-
-	view[1][0] = product[3] + product[0];
-	view[1][1] = product[7] + product[4];
-	view[1][2] = product[11] + product[8];
-	view[1][3] = product[15] + product[12];
-	scale = 1.0f / sqrtf(SQUARE(view[1][0]) + SQUARE(view[1][1]) + SQUARE(view[1][2]));
-	view[1][0] *= scale;
-	view[1][1] *= scale;
-	view[1][2] *= scale;
-	view[1][3] *= scale;
-
-	view[2][0] = product[3] - product[1];
-	view[2][1] = product[7] - product[5];
-	view[2][2] = product[11] - product[9];
-	view[2][3] = product[15] - product[13];
-	scale = 1.0f / sqrtf(SQUARE(view[1][0]) + SQUARE(view[1][1]) + SQUARE(view[1][2]));
-	view[2][0] *= scale;
-	view[2][1] *= scale;
-	view[2][2] *= scale;
-	view[2][3] *= scale;
-
-	view[3][0] = product[3] + product[1];
-	view[3][1] = product[7] + product[5];
-	view[3][2] = product[11] + product[9];
-	view[3][3] = product[15] + product[13];
-	scale = 1.0f / sqrtf(SQUARE(view[1][0]) + SQUARE(view[1][1]) + SQUARE(view[1][2]));
-	view[3][0] *= scale;
-	view[3][1] *= scale;
-	view[3][2] *= scale;
-	view[3][3] *= scale;
-
-	view[4][0] = product[3] - product[2];
-	view[4][1] = product[7] - product[6];
-	view[4][2] = product[11] - product[10];
-	view[4][3] = product[15] - product[14];
-	scale = 1.0f / sqrtf(SQUARE(view[1][0]) + SQUARE(view[1][1]) + SQUARE(view[1][2]));
-	view[4][0] *= scale;
-	view[4][1] *= scale;
-	view[4][2] *= scale;
-	view[4][3] *= scale;
-
-	view[5][0] = product[3] + product[2];
-	view[5][1] = product[7] + product[6];
-	view[5][2] = product[11] + product[10];
-	view[5][3] = product[15] + product[14];
-	scale = 1.0f / sqrtf(SQUARE(view[1][0]) + SQUARE(view[1][1]) + SQUARE(view[1][2]));
-	view[5][0] *= scale;
-	view[5][1] *= scale;
-	view[5][2] *= scale;
-	view[5][3] *= scale;
+	set_view_frustum(mm, pm);
 }
 
 /* normalize vector v */
@@ -192,3 +172,126 @@ is_point_in_viewport(float v[3], float r)
 
 	return 1;
 }
+
+/*
+ * return 1 if any of box b, given as min, max of x, y and z, is
+ * inside the view frustum; the box is tested against each plane
+ * by the corner that's furthest along the plane's normal
+ */
+int
+is_box_in_viewport(float b[6])
+{
+	float v[3];
+	int i;
+
+	for(i = 0; i < 6; i++) {
+		v[0] = (view[i][0] > 0.0f) ? b[1] : b[0];
+		v[1] = (view[i][1] > 0.0f) ? b[3] : b[2];
+		v[2] = (view[i][2] > 0.0f) ? b[5] : b[4];
+		if(plane_equation(view[i], v) < 0.0f)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * classify box b against the planes of the view frustum whose bits
+ * are set in *planes; the bits of planes that the whole box is in
+ * front of are cleared, so that a box's children only need testing
+ * against the planes that are left. returns VIEW_OUTSIDE if the box
+ * is behind any plane, VIEW_INSIDE once no planes are left and
+ * VIEW_PARTIAL otherwise. nothing is counted, so it's safe to call
+ * from several threads at once
+ */
+int
+classify_box_in_viewport(float b[6], unsigned int *planes)
+{
+	float v[3];
+	unsigned int mask = *planes;
+	int i;
+
+	for(i = 0; i < 6; i++) {
+		if(!(mask & (1 << i)))
+			continue;
+
+		/* the corner furthest along the normal decides if it's outside */
+		v[0] = (view[i][0] > 0.0f) ? b[1] : b[0];
+		v[1] = (view[i][1] > 0.0f) ? b[3] : b[2];
+		v[2] = (view[i][2] > 0.0f) ? b[5] : b[4];
+		if(plane_equation(view[i], v) < 0.0f)
+			return VIEW_OUTSIDE;
+
+		/* and the nearest corner decides if it's all inside */
+		v[0] = (view[i][0] > 0.0f) ? b[0] : b[1];
+		v[1] = (view[i][1] > 0.0f) ? b[2] : b[3];
+		v[2] = (view[i][2] > 0.0f) ? b[4] : b[5];
+		if(plane_equation(view[i], v) >= 0.0f)
+			mask &= ~(1 << i);
+	}
+
+	*planes = mask;
+
+	return mask ? VIEW_PARTIAL : VIEW_INSIDE;
+}
+
+/* classify_box_in_viewport, counting the result */
+int
+cull_box_in_viewport(float b[6], unsigned int *planes)
+{
+	int result;
+
+	result = classify_box_in_viewport(b, planes);
+	stats.tested++;
+	if(result == VIEW_OUTSIDE)
+		stats.outside++;
+	else if(result == VIEW_INSIDE)
+		stats.inside++;
+
+	return result;
+}
+
+/*
+ * classify a batch of n boxes against the planes of the view
+ * frustum in planes, the way cull_box_in_viewport does for one box;
+ * the boxes are in struct of arrays order, as cull_boxes takes them.
+ * returns a mask with the bits of the boxes that aren't outside set,
+ * and left[i] gets the planes box i isn't entirely inside of
+ */
+unsigned int
+cull_boxes_in_viewport(const float *bounds, unsigned int stride, unsigned int n,
+                       unsigned int planes, unsigned int *left)
+{
+	unsigned int visible, i;
+
+	visible = cull_boxes(view, bounds, stride, n, planes, left);
+
+	stats.tested += n;
+	for(i = 0; i < n; i++) {
+		if(!(visible & (1 << i)))
+			stats.outside++;
+		else if(left[i] == 0)
+			stats.inside++;
+	}
+
+	return visible;
+}
+
+/* add counts from culling done elsewhere, such as on other threads */
+void
+add_cull_stats(struct cull_stats *s)
+{
+	stats.tested += s->tested;
+	stats.inside += s->inside;
+	stats.outside += s->outside;
+}
+
+/* copy the culling counters into s and reset them to zero */
+void
+take_cull_stats(struct cull_stats *s)
+{
+	*s = stats;
+	stats.tested = 0;
+	stats.inside = 0;
+	stats.outside = 0;
+}
@@ -23,13 +23,37 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define SQUARE(a) (a * a)
-#define DEG2RAD(a) (a * M_PI) / 180.0f
+#define SQUARE(a) ((a) * (a))
+#define DEG2RAD(a) ((a) * M_PI / 180.0f)
+
+/* results of cull_box_in_viewport */
+#define VIEW_OUTSIDE 0
+#define VIEW_PARTIAL 1
+#define VIEW_INSIDE 2
+
+/* plane mask with all six view frustum planes left to test */
+#define VIEW_ALL_PLANES 0x3f
+
+/* boxes tested against the view frustum since the counters were taken */
+struct cull_stats {
+	unsigned int tested;	/* boxes tested */
+	unsigned int inside;	/* found entirely inside and drawn whole */
+	unsigned int outside;	/* rejected */
+};
 
 unsigned int my_letoh32(unsigned int);
+void mult_matrix_4x4(float[16], float[16], float[16]);
+void get_frustum_planes(float[6][4], float[16], float[16]);
+void set_view_frustum(float[16], float[16]);
 void update_view_frustum();
 void normalize(float[3]);
 void cross_product(float[3], float[3], float[3]);
 void setup_plane(float[4], float[3], float[3], float[3]);
 float plane_equation(float[4], float[3]);
 int is_point_in_viewport(float[3], float);
+int is_box_in_viewport(float[6]);
+int classify_box_in_viewport(float[6], unsigned int *);
+int cull_box_in_viewport(float[6], unsigned int *);
+unsigned int cull_boxes_in_viewport(const float *, unsigned int, unsigned int, unsigned int, unsigned int *);
+void add_cull_stats(struct cull_stats *);
+void take_cull_stats(struct cull_stats *);
@@ -25,20 +25,159 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <GL/gl.h>
 #include "object.h"
+#include "heightfield.h"
 #include "octree.h"
 #include "my_math.h"
 
-static struct object *objects = NULL;
+/*
+ * objects are kept in fixed size chunks so that they never move
+ * once created; the chunk table is all that's reallocated as the
+ * number of objects grows. the type of each object and the plane
+ * of each plane object are also kept in columns in the chunk, so
+ * loops over all objects read through memory in order instead of
+ * following a pointer per object
+ */
+#define OBJECT_CHUNK_SIZE 256
+#define OBJECT_ARENA_BLOCK_SIZE (256 * 1024)
+
+struct object_chunk {
+	int types[OBJECT_CHUNK_SIZE];
+	struct plane_object planes[OBJECT_CHUNK_SIZE];
+	struct object objects[OBJECT_CHUNK_SIZE];
+};
+
+/*
+ * type-specific data and vertices that aren't kept in a column
+ * are carved out of big blocks, which are only freed all at once
+ */
+struct object_arena_block {
+	struct object_arena_block *next;
+	size_t size, used;
+};
+
+static struct object_chunk **chunks = NULL;
+static unsigned int num_chunks = 0, max_chunks = 0;
 static unsigned int num_objects = 0;
+static struct object_arena_block *arena = NULL;
+
+/* numbers of removed objects, reused before adding new ones */
+static unsigned int *free_nums = NULL;
+static unsigned int num_free = 0, max_free = 0;
+
+#define OBJECT_CHUNK(n) (chunks[(n) / OBJECT_CHUNK_SIZE])
+#define OBJECT_INDEX(n) ((n) % OBJECT_CHUNK_SIZE)
+
+/* allocate size bytes of zeroed memory that lasts until free_all_objects */
+static void *
+alloc_object_data(size_t size)
+{
+	struct object_arena_block *b;
+	size_t blocksize;
+	void *p;
+
+	size = (size + 15) & ~(size_t)15;
+	if(!arena || arena->used + size > arena->size) {
+		blocksize = OBJECT_ARENA_BLOCK_SIZE;
+		if(blocksize < size + sizeof(struct object_arena_block))
+			blocksize = size + sizeof(struct object_arena_block);
+
+		b = malloc(blocksize);
+		if(!b)
+			return NULL;
+		b->next = arena;
+		b->size = blocksize;
+		b->used = (sizeof(struct object_arena_block) + 15) & ~(size_t)15;
+		arena = b;
+	}
+
+	p = (char *)arena + arena->used;
+	arena->used += size;
+	memset(p, 0, size);
+
+	return p;
+}
+
+/* make room for n more objects; returns 1 on success */
+static int
+reserve_objects(unsigned int n)
+{
+	struct object_chunk **tmp;
+	unsigned int needed;
+
+	needed = (num_objects + n + OBJECT_CHUNK_SIZE - 1) / OBJECT_CHUNK_SIZE;
+	if(needed > max_chunks) {
+		/* double the table so that adding objects stays linear */
+		tmp = realloc(chunks, sizeof(struct object_chunk *) * (needed > max_chunks * 2 ? needed : max_chunks * 2));
+		if(!tmp)
+			return 0;
+		chunks = tmp;
+		max_chunks = (needed > max_chunks * 2) ? needed : max_chunks * 2;
+	}
+
+	while(num_chunks < needed) {
+		chunks[num_chunks] = malloc(sizeof(struct object_chunk));
+		if(!chunks[num_chunks])
+			return 0;
+		num_chunks++;
+	}
+
+	return 1;
+}
+
+/*
+ * get the number for a new object, reusing the number of a
+ * removed object if there is one; returns -1 if there's no room
+ */
+static int
+next_object_num()
+{
+	if(num_free > 0)
+		return free_nums[--num_free];
+
+	if(!reserve_objects(1))
+		return -1;
+
+	/* a number's generation carries on when it's reused */
+	OBJECT_CHUNK(num_objects)->objects[OBJECT_INDEX(num_objects)].generation = 1;
+	return num_objects++;
+}
+
+/* set up object number n and return a pointer to it */
+static struct object *
+new_object(unsigned int n, int type, void *aux, struct vertex *vertices,
+           unsigned int num_vertices)
+{
+	struct object_chunk *c;
+	struct object *o;
+
+	c = OBJECT_CHUNK(n);
+	o = &c->objects[OBJECT_INDEX(n)];
+	c->types[OBJECT_INDEX(n)] = type;
+
+	o->type = type;
+	o->aux = aux;
+	o->position[0] = o->position[1] = o->position[2] = 0.0f;
+	o->radius = 0.0f;
+	o->render_separately = 1;
+	o->gl_primitive = GL_QUADS;
+	o->vertices = vertices;
+	o->num_vertices = num_vertices;
+	o->external_data = 0;
+	o->num = n;
+	o->node = NULL;
+
+	return o;
+}
 
 /* allocate memory for object and return pointer to it */
 struct object *
 create_object(int type)
 {
-	struct object *tmp;
 	void *aux;
+	int n;
 
 	switch(type) {
 		default:
@@ -46,66 +185,229 @@ create_object(int type)
 			return NULL;
 			break;
 		case OBJ_DEFAULT:
-			fprintf(stderr, "making default object\n");
 			aux = NULL;
 			break;
 		case OBJ_PLANE:
-			aux = malloc(sizeof(struct plane_object));
+			aux = NULL; /* kept in the chunk's plane column */
+			break;
+		case OBJ_HEIGHTFIELD:
+			aux = alloc_object_data(sizeof(struct heightfield));
+			if(!aux) {
+				fprintf(stderr, "Error: Couldn't allocate memory for type-specific object data\n");
+				return NULL;
+			}
 			break;
 	}
-	if(type != OBJ_DEFAULT && !aux) {
-		fprintf(stderr, "Error: Couldn't allocate memory for type-specific object data\n");
+
+	n = next_object_num();
+	if(n == -1) {
+		fprintf(stderr, "Error: Couldn't allocate memory for object\n");
 		return NULL;
 	}
+	if(type == OBJ_PLANE)
+		aux = &OBJECT_CHUNK(n)->planes[OBJECT_INDEX(n)];
 
-	tmp = realloc(objects, sizeof(struct object) * (num_objects + 1));
-	if(!tmp) {
-		fprintf(stderr, "Error: Couldn't allocate memory for object\n");
-		free(aux);
+	return new_object(n, type, aux, NULL, 0);
+}
+
+/*
+ * give an object room for n vertices; the vertices are freed
+ * along with all other objects
+ */
+struct vertex *
+create_object_vertices(struct object *o, unsigned int n)
+{
+	o->vertices = alloc_object_data(sizeof(struct vertex) * n);
+	if(!o->vertices) {
+		fprintf(stderr, "Error: Couldn't allocate memory for object vertices\n");
+		o->num_vertices = 0;
+		return NULL;
+	}
+
+	o->num_vertices = n;
+	return o->vertices;
+}
+
+/*
+ * create n objects at once whose vertices and type-specific
+ * data already exist in memory owned by the caller (such as a
+ * mapped map cache); object i uses num_vertices vertices starting
+ * at vertices[i * num_vertices] and the auxsize bytes starting at
+ * aux + i * auxsize. returns a pointer to the first object
+ */
+struct object *
+create_objects_in_place(int type, unsigned int n, struct vertex *vertices,
+                        unsigned int num_vertices, void *aux, size_t auxsize)
+{
+	struct object *first, *o;
+	unsigned int i;
+
+	if(n == 0)
+		return NULL;
+
+	if(!reserve_objects(n)) {
+		fprintf(stderr, "Error: Couldn't allocate memory for objects\n");
 		return NULL;
 	}
 
-	objects = tmp;
-	objects[num_objects].type = type;
-	objects[num_objects].aux = aux;
-	objects[num_objects].render_separately = 1;
-	objects[num_objects].gl_primitive = GL_QUADS;
-	objects[num_objects].vertices = NULL;
-	objects[num_objects].num_vertices = 0;
+	/* the objects always get consecutive new numbers */
+	first = NULL;
+	for(i = 0; i < n; i++) {
+		OBJECT_CHUNK(num_objects)->objects[OBJECT_INDEX(num_objects)].generation = 1;
+		o = new_object(num_objects++, type, aux ? (char *)aux + auxsize * i : NULL,
+		               vertices ? vertices + num_vertices * i : NULL, num_vertices);
+		o->render_separately = 0;
+		o->external_data = 1;
+		if(!first)
+			first = o;
+	}
 
-	return &objects[num_objects++];
+	return first;
 }
 
+/* free all objects along with their chunks and arena blocks */
 void
 free_all_objects()
 {
-	int i;
+	unsigned int i;
 	struct object *o;
+	struct object_arena_block *b;
 
 	for(i = 0; i < num_objects; i++) {
-		o = &objects[i];
-		if(o->aux)
-			free(o->aux);
-		if(o->vertices)
-			free(o->vertices);
+		o = &OBJECT_CHUNK(i)->objects[OBJECT_INDEX(i)];
+		if(!o->external_data && o->type == OBJ_HEIGHTFIELD)
+			free_heightfield_data(o->aux);
 	}
 
-	free(objects);
+	for(i = 0; i < num_chunks; i++)
+		free(chunks[i]);
+	free(chunks);
+	chunks = NULL;
+	num_chunks = max_chunks = 0;
 	num_objects = 0;
+
+	free(free_nums);
+	free_nums = NULL;
+	num_free = max_free = 0;
+
+	while(arena) {
+		b = arena->next;
+		free(arena);
+		arena = b;
+	}
 }
 
 /* return object number from pointer */
 int
 get_object_num(struct object *o)
 {
-	int i;
+	if(!o)
+		return -1;
 
-	for(i = 0; i < num_objects; i++) {
-		if(&objects[i] == o)
-			return i;
+	return o->num;
+}
+
+struct object_handle
+get_object_handle(struct object *o)
+{
+	struct object_handle h;
+
+	h.num = o->num;
+	h.generation = o->generation;
+
+	return h;
+}
+
+/* return the object a handle is for, or NULL if it's been removed */
+struct object *
+get_object_from_handle(struct object_handle h)
+{
+	struct object *o;
+
+	o = get_object(h.num);
+	if(!o || o->generation != h.generation || o->type == OBJ_NONE)
+		return NULL;
+
+	return o;
+}
+
+/*
+ * remove an object, unlinking it from the octree; its number is
+ * reused by the next object created. its vertices are only freed
+ * along with all other objects
+ */
+int
+remove_object(struct object_handle h)
+{
+	struct object *o;
+	unsigned int *tmp;
+
+	o = get_object_from_handle(h);
+	if(!o)
+		return 0;
+
+	if(num_free >= max_free) {
+		tmp = realloc(free_nums, sizeof(unsigned int) * (max_free ? max_free * 2 : 64));
+		if(!tmp) {
+			fprintf(stderr, "Error: Couldn't allocate memory for removed object\n");
+			return 0;
+		}
+		free_nums = tmp;
+		max_free = max_free ? max_free * 2 : 64;
 	}
 
-	return -1;
+	if(o->node)
+		remove_object_from_octree_node(o->node, o);
+	if(!o->external_data && o->type == OBJ_HEIGHTFIELD)
+		free_heightfield_data(o->aux);
+
+	o->type = OBJ_NONE;
+	OBJECT_CHUNK(o->num)->types[OBJECT_INDEX(o->num)] = OBJ_NONE;
+	o->aux = NULL;
+	o->vertices = NULL;
+	o->num_vertices = 0;
+	o->generation++;
+	free_nums[num_free++] = o->num;
+
+	return 1;
+}
+
+/*
+ * move an object to v; if it's in the octree, it's moved to the
+ * leaf containing v. returns 0 if the handle is stale
+ */
+int
+move_object(struct object_handle h, float v[3])
+{
+	struct object *o;
+
+	o = get_object_from_handle(h);
+	if(!o)
+		return 0;
+
+	o->position[0] = v[0];
+	o->position[1] = v[1];
+	o->position[2] = v[2];
+	if(o->node)
+		relink_object_in_octree(o);
+
+	return 1;
+}
+
+/* return pointer to object number n */
+struct object *
+get_object(unsigned int n)
+{
+	if(n >= num_objects)
+		return NULL;
+
+	return &OBJECT_CHUNK(n)->objects[OBJECT_INDEX(n)];
+}
+
+unsigned int
+get_num_objects()
+{
+	return num_objects;
 }
 
 void
@@ -114,17 +416,16 @@ draw_object(int n)
 	int i;
 	struct object *o;
 
-	if(n >= num_objects) {
+	o = get_object(n);
+	if(!o) {
 		fprintf(stderr, "Error: Bad object number %d\n", n);
 		return;
 	}
 
-	o = &objects[n];
-	if(!o)
-		return;
-
 	if(o->render_separately)
 		glBegin(o->gl_primitive);
+	if(o->type == OBJ_HEIGHTFIELD)
+		draw_heightfield(o->aux);
 	for(i = 0; i < o->num_vertices; i++) {
 		glTexCoord2f(o->vertices[i].texcoord[0], o->vertices[i].texcoord[1]);
 		glVertex3f(o->vertices[i].point[0], o->vertices[i].point[1], o->vertices[i].point[2]);
@@ -161,18 +462,34 @@ plane_object_collision(struct object *o1, struct object *o2)
 	return 0;
 }
 
-/* check if specified object collides with any others */
+/*
+ * check if specified object collides with any others; the
+ * type column of each chunk is scanned in order, and plane
+ * objects' planes are in a column of the same chunk
+ */
 int
 object_collision(struct object *o)
 {
-	int i;
+	unsigned int i, j, n;
+	struct object_chunk *c;
 
-	for(i = 0; i < num_objects; i++) {
-		switch(objects[i].type) {
-			case OBJ_PLANE:
-				if(plane_object_collision(o, &objects[i]))
-					return 1;
-				break;
+	for(i = 0; i < num_chunks; i++) {
+		c = chunks[i];
+		n = num_objects - i * OBJECT_CHUNK_SIZE;
+		if(n > OBJECT_CHUNK_SIZE)
+			n = OBJECT_CHUNK_SIZE;
+
+		for(j = 0; j < n; j++) {
+			switch(c->types[j]) {
+				case OBJ_PLANE:
+					if(plane_object_collision(o, &c->objects[j]))
+						return 1;
+					break;
+				case OBJ_HEIGHTFIELD:
+					if(heightfield_collision(c->objects[j].aux, o->position))
+						return 1;
+					break;
+			}
 		}
 	}
 
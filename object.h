@@ -23,8 +23,10 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define OBJ_DEFAULT 0x1
-#define OBJ_PLANE   0x2
+#define OBJ_NONE        0x0 /* removed object */
+#define OBJ_DEFAULT     0x1
+#define OBJ_PLANE       0x2
+#define OBJ_HEIGHTFIELD 0x4
 
 struct vertex {
 	float texcoord[2];
@@ -36,11 +38,27 @@ struct object {
 	void *aux;
 
 	float position[3];
+	float radius; /* size of the object for object-object collision */
 
 	int render_separately;
 	int gl_primitive;
 	struct vertex *vertices;
 	unsigned int num_vertices;
+
+	int external_data; /* aux and vertices aren't ours to free */
+
+	unsigned int num;          /* object number */
+	unsigned int generation;   /* changes when the object is removed */
+	struct octree_node *node;  /* octree node the object is in, if any */
+};
+
+/*
+ * a handle stays valid until its object is removed, even if the
+ * object's number is reused for a new object afterwards
+ */
+struct object_handle {
+	unsigned int num;
+	unsigned int generation;
 };
 
 struct plane_object {
@@ -49,7 +67,15 @@ struct plane_object {
 };
 
 struct object *create_object(int);
+struct vertex *create_object_vertices(struct object *, unsigned int);
+struct object *create_objects_in_place(int, unsigned int, struct vertex *, unsigned int, void *, size_t);
 void free_all_objects();
 int get_object_num(struct object *);
+struct object_handle get_object_handle(struct object *);
+struct object *get_object_from_handle(struct object_handle);
+int remove_object(struct object_handle);
+int move_object(struct object_handle, float[3]);
+struct object *get_object(unsigned int);
+unsigned int get_num_objects();
 void draw_object(int);
 int object_collision(struct object *);
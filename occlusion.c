@@ -0,0 +1,740 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * cull terrain that's hidden behind nearer terrain. the quadtree is
+ * walked front to back, and each branch or leaf that's in the view
+ * frustum is tested against a small depth buffer before going any
+ * further; leaves that get through are drawn into the buffer, so
+ * they hide what's behind them. drawing into the buffer only ever
+ * writes pixels the quad covers completely, at the farthest depth
+ * it has over the pixel, so that nothing that would show is culled
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <GL/gl.h>
+#include "object.h"
+#include "heightfield.h"
+#include "octree.h"
+#include "quadtree.h"
+#include "mesh.h"
+#include "lod.h"
+#include "map.h"
+#include "my_math.h"
+#include "frustum.h"
+#include "occlusion.h"
+#include "parallel.h"
+
+#define OCCLUSION_NEAR 0.1f /* points nearer the camera than this aren't projected */
+#define OCCLUSION_DETAIL_AREA 256.0f /* pixels a leaf covers before its quads are drawn one by one */
+
+/* a point projected into the buffer: x and y in pixels, and depth */
+struct occlusion_point {
+	float x, y, z;
+};
+
+/* an edge or depth plane across the buffer: a * x + b * y + c */
+struct occlusion_plane {
+	float a, b, c;
+};
+
+struct occlusion_buffer *
+new_occlusion_buffer(unsigned int width, unsigned int height)
+{
+	struct occlusion_buffer *ob;
+
+	ob = malloc(sizeof(struct occlusion_buffer));
+	if(!ob) {
+		fprintf(stderr, "Error: Couldn't allocate memory for occlusion buffer\n");
+		return NULL;
+	}
+	bzero(ob, sizeof(struct occlusion_buffer));
+
+	ob->depth = malloc(sizeof(float) * width * height);
+	if(!ob->depth) {
+		fprintf(stderr, "Error: Couldn't allocate memory for occlusion buffer\n");
+		free(ob);
+		return NULL;
+	}
+	ob->width = width;
+	ob->height = height;
+
+	return ob;
+}
+
+void
+free_occlusion_buffer(struct occlusion_buffer *ob)
+{
+	if(!ob)
+		return;
+
+	free(ob->depth);
+	free(ob->leaves);
+	free(ob);
+}
+
+/*
+ * empty the buffer for a frame seen through modelview matrix mm and
+ * projection matrix pm; the modelview matrix is only turned and
+ * moved, so the camera is where its rotation takes its translation
+ * back to
+ */
+void
+clear_occlusion_buffer(struct occlusion_buffer *ob, float mm[16], float pm[16])
+{
+	unsigned int i;
+
+	mult_matrix_4x4(ob->matrix, mm, pm);
+	for(i = 0; i < 3; i++)
+		ob->eye[i] = -(mm[i * 4] * mm[12] + mm[i * 4 + 1] * mm[13] + mm[i * 4 + 2] * mm[14]);
+
+	for(i = 0; i < ob->width * ob->height; i++)
+		ob->depth[i] = 1.0f;
+}
+
+/* project v into the buffer; returns 0 if it's too near the camera or behind it */
+static int
+project_occlusion_point(struct occlusion_buffer *ob, const float v[3], struct occlusion_point *p)
+{
+	const float *m = ob->matrix;
+	float w;
+
+	w = m[3] * v[0] + m[7] * v[1] + m[11] * v[2] + m[15];
+	if(w < OCCLUSION_NEAR)
+		return 0;
+
+	w = 1.0f / w;
+	p->x = ((m[0] * v[0] + m[4] * v[1] + m[8] * v[2] + m[12]) * w * 0.5f + 0.5f) * ob->width;
+	p->y = ((m[1] * v[0] + m[5] * v[1] + m[9] * v[2] + m[13]) * w * 0.5f + 0.5f) * ob->height;
+	p->z = (m[2] * v[0] + m[6] * v[1] + m[10] * v[2] + m[14]) * w;
+
+	return 1;
+}
+
+/* is every pixel in [x0, x1] of row y nearer than z? */
+static int
+is_occlusion_row_nearer(const float *row, int x0, int x1, float z)
+{
+	int x = x0;
+#ifdef __SSE2__
+	__m128 zz = _mm_set1_ps(z);
+
+	for(; x + 3 <= x1; x += 4) {
+		if(_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(&row[x]), zz)))
+			return 0;
+	}
+#endif
+	for(; x <= x1; x++) {
+		if(row[x] >= z)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * return 1 if box b is hidden behind what's been drawn into the
+ * buffer: its nearest corner is behind every pixel its corners span
+ */
+int
+is_box_occluded(struct occlusion_buffer *ob, float b[6])
+{
+	struct occlusion_point p;
+	float v[3], minx, maxx, miny, maxy, minz;
+	int i, x0, x1, y0, y1, y;
+
+	ob->stats.tested++;
+	minx = miny = minz = 1e30f;
+	maxx = maxy = -1e30f;
+	for(i = 0; i < 8; i++) {
+		v[0] = b[i & 1];
+		v[1] = b[2 + ((i >> 1) & 1)];
+		v[2] = b[4 + ((i >> 2) & 1)];
+		if(!project_occlusion_point(ob, v, &p))
+			return 0;
+
+		if(p.x < minx)
+			minx = p.x;
+		if(p.x > maxx)
+			maxx = p.x;
+		if(p.y < miny)
+			miny = p.y;
+		if(p.y > maxy)
+			maxy = p.y;
+		if(p.z < minz)
+			minz = p.z;
+	}
+
+	/* the part off the screen can't be seen anyway */
+	x0 = (minx > 0.0f) ? (int)minx : 0;
+	y0 = (miny > 0.0f) ? (int)miny : 0;
+	x1 = (maxx < ob->width - 1) ? (int)maxx : (int)ob->width - 1;
+	y1 = (maxy < ob->height - 1) ? (int)maxy : (int)ob->height - 1;
+	if(x0 > x1 || y0 > y1)
+		return 0;
+
+	for(y = y0; y <= y1; y++) {
+		if(!is_occlusion_row_nearer(&ob->depth[y * ob->width], x0, x1, minz))
+			return 0;
+	}
+
+	ob->stats.occluded++;
+	return 1;
+}
+
+/* twice the area of triangle p, q, r; positive if it's anticlockwise */
+static float
+get_occlusion_area(const struct occlusion_point *p, const struct occlusion_point *q,
+                   const struct occlusion_point *r)
+{
+	return (q->x - p->x) * (r->y - p->y) - (r->x - p->x) * (q->y - p->y);
+}
+
+/*
+ * set e to the edge from p to q of a shape whose area has the sign
+ * of area, positive on the inside and moved in by half a pixel each
+ * way, so that it's only positive at the centres of pixels that are
+ * entirely inside
+ */
+static void
+set_occlusion_edge(struct occlusion_plane *e, const struct occlusion_point *p,
+                   const struct occlusion_point *q, float area)
+{
+	e->a = p->y - q->y;
+	e->b = q->x - p->x;
+	e->c = p->x * q->y - p->y * q->x;
+	if(area < 0.0f) {
+		e->a = -e->a;
+		e->b = -e->b;
+		e->c = -e->c;
+	}
+	e->c -= 0.5f * (fabsf(e->a) + fabsf(e->b));
+}
+
+/*
+ * set the edges of triangle p, q, r and the depth across it, moved
+ * back by half a pixel each way so that it gives the farthest depth
+ * over a pixel from its centre. returns 0 if it's edge on
+ */
+static int
+set_occlusion_triangle(struct occlusion_plane e[3], struct occlusion_plane *d, const struct occlusion_point *p,
+                       const struct occlusion_point *q, const struct occlusion_point *r)
+{
+	float area;
+
+	area = get_occlusion_area(p, q, r);
+	if(fabsf(area) < 1e-6f)
+		return 0;
+
+	set_occlusion_edge(&e[0], p, q, area);
+	set_occlusion_edge(&e[1], q, r, area);
+	set_occlusion_edge(&e[2], r, p, area);
+	d->a = ((q->z - p->z) * (r->y - p->y) - (r->z - p->z) * (q->y - p->y)) / area;
+	d->b = ((r->z - p->z) * (q->x - p->x) - (q->z - p->z) * (r->x - p->x)) / area;
+	d->c = p->z - d->a * p->x - d->b * p->y + 0.5f * (fabsf(d->a) + fabsf(d->b));
+
+	return 1;
+}
+
+#define OCCLUSION_EVAL(e, x, y) ((e).a * (x) + (e).b * (y) + (e).c)
+#define OCCLUSION_INSIDE(e, x, y) (OCCLUSION_EVAL((e)[0], x, y) >= 0.0f && \
+                                   OCCLUSION_EVAL((e)[1], x, y) >= 0.0f && \
+                                   OCCLUSION_EVAL((e)[2], x, y) >= 0.0f)
+
+/*
+ * draw a quad with corners v[0] to v[3] into the buffer. GL draws
+ * it as the triangles v0 v1 v2 and v0 v2 v3; a pixel is covered if
+ * either triangle covers all of it, or if the quad is convex on the
+ * screen and covers all of it, in which case it gets the farther of
+ * the two triangles' depths
+ */
+static void
+add_occluder_quad(struct occlusion_buffer *ob, struct occlusion_point v[4])
+{
+	struct occlusion_plane edges[4], t1[3], t2[3], d1, d2;
+	float minx, maxx, miny, maxy, fx, fy, z, z1, z2, area;
+	int i, x, y, x0, x1, y0, y1, convex, in1, in2;
+
+	minx = maxx = v[0].x;
+	miny = maxy = v[0].y;
+	for(i = 1; i < 4; i++) {
+		if(v[i].x < minx)
+			minx = v[i].x;
+		if(v[i].x > maxx)
+			maxx = v[i].x;
+		if(v[i].y < miny)
+			miny = v[i].y;
+		if(v[i].y > maxy)
+			maxy = v[i].y;
+	}
+
+	/* only pixels entirely within the quad's bounds can be covered */
+	x0 = (minx > 0.0f) ? (int)ceilf(minx) : 0;
+	y0 = (miny > 0.0f) ? (int)ceilf(miny) : 0;
+	x1 = (maxx < ob->width) ? (int)floorf(maxx) - 1 : (int)ob->width - 1;
+	y1 = (maxy < ob->height) ? (int)floorf(maxy) - 1 : (int)ob->height - 1;
+	if(x0 > x1 || y0 > y1)
+		return;
+
+	if(!set_occlusion_triangle(t1, &d1, &v[0], &v[1], &v[2]) ||
+	   !set_occlusion_triangle(t2, &d2, &v[0], &v[2], &v[3]))
+		return;
+
+	/* convex if it turns the same way at every corner */
+	area = get_occlusion_area(&v[0], &v[1], &v[2]) + get_occlusion_area(&v[0], &v[2], &v[3]);
+	convex = 1;
+	for(i = 0; i < 4; i++) {
+		if(get_occlusion_area(&v[i], &v[(i + 1) % 4], &v[(i + 2) % 4]) * area <= 0.0f)
+			convex = 0;
+		set_occlusion_edge(&edges[i], &v[i], &v[(i + 1) % 4], area);
+	}
+
+	for(y = y0; y <= y1; y++) {
+		fy = y + 0.5f;
+		for(x = x0; x <= x1; x++) {
+			fx = x + 0.5f;
+			in1 = OCCLUSION_INSIDE(t1, fx, fy);
+			in2 = OCCLUSION_INSIDE(t2, fx, fy);
+			z1 = OCCLUSION_EVAL(d1, fx, fy);
+			z2 = OCCLUSION_EVAL(d2, fx, fy);
+			if(in1 && !in2)
+				z = z1;
+			else if(in2 && !in1)
+				z = z2;
+			else if(in1 || (convex && OCCLUSION_INSIDE(edges, fx, fy) &&
+			                OCCLUSION_EVAL(edges[3], fx, fy) >= 0.0f))
+				z = (z1 > z2) ? z1 : z2;
+			else
+				continue;
+
+			if(z < ob->depth[y * ob->width + x])
+				ob->depth[y * ob->width + x] = z;
+		}
+	}
+}
+
+/*
+ * draw node n into the buffer as a mesh of quads with corners step
+ * samples apart, the last row and column cut off at the node's edge:
+ * a leaf at a step of 1 is drawn quad by quad, and a bigger node the
+ * way the terrain LOD draws it. from above the terrain, any point
+ * under it is hidden by the terrain between it and the camera, so a
+ * node that's small on the screen is drawn as a flat quad at its
+ * lowest height instead. a node can't be more than
+ * TERRAIN_QUADTREE_LEAF_QUADS quads across at the step it's given
+ */
+void
+add_occluder_node(struct occlusion_buffer *ob, struct terrain_quadtree *qt, unsigned int n, unsigned int step)
+{
+	struct occlusion_point p[(TERRAIN_QUADTREE_LEAF_QUADS + 1) * (TERRAIN_QUADTREE_LEAF_QUADS + 1)];
+	struct occlusion_point v[4];
+	char ok[(TERRAIN_QUADTREE_LEAF_QUADS + 1) * (TERRAIN_QUADTREE_LEAF_QUADS + 1)];
+	unsigned int cs[TERRAIN_QUADTREE_LEAF_QUADS + 1], rs[TERRAIN_QUADTREE_LEAF_QUADS + 1];
+	struct terrain_quadtree_node *on = &qt->nodes[n];
+	struct heightfield *hf = qt->heightfield;
+	unsigned int c, r, w, h, i;
+	float s[3], minx, maxx, miny, maxy;
+
+	if(ob->above) {
+		s[2] = on->bounds[4];
+		for(i = 0; i < 4; i++) {
+			s[0] = (i == 1 || i == 2) ? on->bounds[1] : on->bounds[0];
+			s[1] = (i < 2) ? on->bounds[3] : on->bounds[2];
+			if(!project_occlusion_point(ob, s, &v[i]))
+				break;
+		}
+		if(i == 4) {
+			minx = maxx = v[0].x;
+			miny = maxy = v[0].y;
+			for(i = 1; i < 4; i++) {
+				minx = (v[i].x < minx) ? v[i].x : minx;
+				maxx = (v[i].x > maxx) ? v[i].x : maxx;
+				miny = (v[i].y < miny) ? v[i].y : miny;
+				maxy = (v[i].y > maxy) ? v[i].y : maxy;
+			}
+			if((maxx - minx) * (maxy - miny) < OCCLUSION_DETAIL_AREA) {
+				add_occluder_quad(ob, v);
+				ob->stats.occluders++;
+				return;
+			}
+		}
+	}
+
+	for(w = 0, c = on->firstc; c < on->lastc && w < TERRAIN_QUADTREE_LEAF_QUADS; c += step)
+		cs[w++] = c;
+	cs[w++] = on->lastc;
+	for(h = 0, r = on->firstr; r < on->lastr && h < TERRAIN_QUADTREE_LEAF_QUADS; r += step)
+		rs[h++] = r;
+	rs[h++] = on->lastr;
+
+	/* the quads share their corners, so each is projected once */
+	for(r = 0; r < h; r++) {
+		for(c = 0; c < w; c++) {
+			s[0] = hf->xs[cs[c]];
+			s[1] = hf->ys[rs[r]];
+			s[2] = HEIGHTFIELD_SAMPLE(hf, cs[c], rs[r]);
+			i = r * w + c;
+			ok[i] = project_occlusion_point(ob, s, &p[i]);
+		}
+	}
+
+	/* corners in the order get_heightfield_quad_vertices gives them */
+	for(r = 0; r + 1 < h; r++) {
+		for(c = 0; c + 1 < w; c++) {
+			i = r * w + c;
+			if(!ok[i] || !ok[i + 1] || !ok[i + w] || !ok[i + w + 1])
+				continue;
+
+			v[0] = p[i + w];
+			v[1] = p[i + w + 1];
+			v[2] = p[i + 1];
+			v[3] = p[i];
+			add_occluder_quad(ob, v);
+			ob->stats.occluders++;
+		}
+	}
+}
+
+/*
+ * note whether the camera's above the heightfield being culled, so
+ * that small nodes can be drawn into the buffer roughly; call after
+ * clear_occlusion_buffer
+ */
+void
+set_occlusion_terrain(struct occlusion_buffer *ob, struct heightfield *hf)
+{
+	float z;
+
+	ob->above = (get_heightfield_height(hf, ob->eye[0], ob->eye[1], &z, NULL) && ob->eye[2] > z);
+}
+
+/* the quads under node n */
+static unsigned int
+count_terrain_quadtree_quads(struct terrain_quadtree *qt, unsigned int n)
+{
+	struct terrain_quadtree_node *on = &qt->nodes[n];
+
+	return (on->lastc - on->firstc) * (on->lastr - on->firstr);
+}
+
+/* let a leaf through: put it on the list to draw, and into the buffer */
+static void
+add_occlusion_leaf(struct terrain_quadtree *qt, struct occlusion_buffer *ob, unsigned int n)
+{
+	unsigned int *leaves;
+
+	if(ob->num_leaves == ob->max_leaves) {
+		leaves = realloc(ob->leaves, sizeof(unsigned int) * (ob->max_leaves ? ob->max_leaves * 2 : 256));
+		if(!leaves) {
+			fprintf(stderr, "Error: Couldn't allocate memory for visible leaves\n");
+			return;
+		}
+		ob->leaves = leaves;
+		ob->max_leaves = ob->max_leaves ? ob->max_leaves * 2 : 256;
+	}
+	ob->leaves[ob->num_leaves++] = n;
+
+	add_occluder_node(ob, qt, n, 1);
+}
+
+/*
+ * put the children of node n in the order to visit them in, nearest
+ * first: children are in Morton order, so the nearest is the one on
+ * the camera's side of the middle in x and y, and the farthest the
+ * one on neither side
+ */
+void
+get_occlusion_order(struct occlusion_buffer *ob, struct terrain_quadtree *qt, unsigned int n,
+                    unsigned int order[4])
+{
+	struct terrain_quadtree_node *on = &qt->nodes[n], *cn;
+	struct terrain_quadtree_branch *br = &qt->branches[on->branch];
+	unsigned int i, j, side = 0, key[4];
+
+	for(i = 0; i < br->num_children; i++) {
+		cn = &qt->nodes[br->children[i]];
+		if(cn->firstc > on->firstc && ob->eye[0] >= qt->heightfield->xs[cn->firstc])
+			side |= 1;
+		if(cn->firstr > on->firstr && ob->eye[1] >= qt->heightfield->ys[cn->firstr])
+			side |= 2;
+	}
+	for(i = 0; i < br->num_children; i++) {
+		cn = &qt->nodes[br->children[i]];
+		key[i] = ((cn->firstc > on->firstc) | ((cn->firstr > on->firstr) << 1)) ^ side;
+		for(j = i; j > 0 && key[order[j - 1]] > key[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+}
+
+/* is node n hidden behind what's in the buffer? counts its quads if it is */
+int
+is_terrain_node_occluded(struct occlusion_buffer *ob, struct terrain_quadtree *qt, unsigned int n)
+{
+	if(!is_box_occluded(ob, qt->nodes[n].bounds))
+		return 0;
+
+	ob->stats.quads_occluded += count_terrain_quadtree_quads(qt, n);
+	return 1;
+}
+
+/* cull the children of node n against the view frustum, then visit the ones left nearest first */
+static void
+cull_occluded_branch(struct terrain_quadtree *qt, struct occlusion_buffer *ob,
+                     unsigned int n, unsigned int planes)
+{
+	struct terrain_quadtree_branch *br = &qt->branches[qt->nodes[n].branch];
+	unsigned int i, j, c, visible, left[4], order[4];
+
+	if(planes) {
+		visible = cull_boxes_in_viewport(&br->bounds[0][0], 4, br->num_children, planes, left);
+	} else {
+		visible = (1 << br->num_children) - 1;
+		left[0] = left[1] = left[2] = left[3] = 0;
+	}
+
+	get_occlusion_order(ob, qt, n, order);
+	for(j = 0; j < br->num_children; j++) {
+		i = order[j];
+		if(!(visible & (1 << i)))
+			continue;
+
+		c = br->children[i];
+		if(is_terrain_node_occluded(ob, qt, c))
+			continue;
+
+		if(qt->nodes[c].skip == c + 1)
+			add_occlusion_leaf(qt, ob, c);
+		else
+			cull_occluded_branch(qt, ob, c, left[i]);
+	}
+}
+
+/*
+ * find the leaves of a quadtree that are in the view frustum and
+ * not hidden by nearer terrain, front to back, into ob->leaves; the
+ * buffer must have been cleared for this frame's view first. leaves
+ * are only drawn into the buffer roughly when the camera's above the
+ * terrain
+ */
+void
+cull_terrain_quadtree_occluded(struct terrain_quadtree *qt, struct occlusion_buffer *ob)
+{
+	unsigned int planes = VIEW_ALL_PLANES;
+	double t;
+
+	ob->num_leaves = 0;
+	if(!qt || qt->num_nodes == 0)
+		return;
+
+	t = get_time_ms();
+	set_occlusion_terrain(ob, qt->heightfield);
+	if(cull_box_in_viewport(qt->nodes[0].bounds, &planes) != VIEW_OUTSIDE) {
+		if(qt->nodes[0].skip == 1)
+			add_occlusion_leaf(qt, ob, 0);
+		else
+			cull_occluded_branch(qt, ob, 0, planes);
+	}
+	ob->stats.ms += get_time_ms() - t;
+}
+
+/*
+ * draw the leaves of a quadtree that are in view and not hidden,
+ * from mesh m if there is one
+ */
+void
+draw_terrain_quadtree_occluded(struct terrain_quadtree *qt, struct occlusion_buffer *ob, struct terrain_mesh *m)
+{
+	struct terrain_quadtree_node *on;
+	unsigned int i, c, r;
+
+	cull_terrain_quadtree_occluded(qt, ob);
+
+	if(m) {
+		begin_terrain_mesh(m);
+		for(i = 0; i < ob->num_leaves; i++)
+			draw_terrain_mesh_node(m, ob->leaves[i]);
+		end_terrain_mesh(m);
+		return;
+	}
+
+	glBegin(GL_QUADS);
+	for(i = 0; i < ob->num_leaves; i++) {
+		on = &qt->nodes[ob->leaves[i]];
+		for(r = on->firstr; r < on->lastr; r++) {
+			for(c = on->firstc; c < on->lastc; c++)
+				draw_heightfield_quad(qt->heightfield, r * qt->heightfield->cols + c);
+		}
+		add_draw_stats(0, 4 * (on->lastc - on->firstc) * (on->lastr - on->firstr));
+	}
+	glEnd();
+	add_draw_stats(1, 0);
+}
+
+/* copy the occlusion counters into s and reset them to zero */
+void
+take_occlusion_stats(struct occlusion_buffer *ob, struct occlusion_stats *s)
+{
+	*s = ob->stats;
+	bzero(&ob->stats, sizeof(struct occlusion_stats));
+}
+
+/* count the quads under node n that are in the view frustum */
+static unsigned int
+count_frustum_quads(struct terrain_quadtree *qt, unsigned int n, unsigned int planes)
+{
+	struct terrain_quadtree_branch *br;
+	unsigned int i, c, visible, left[4], num = 0;
+
+	if(qt->nodes[n].skip == n + 1 || planes == 0)
+		return count_terrain_quadtree_quads(qt, n);
+
+	br = &qt->branches[qt->nodes[n].branch];
+	visible = cull_boxes_in_viewport(&br->bounds[0][0], 4, br->num_children, planes, left);
+	for(i = 0; i < br->num_children; i++) {
+		c = br->children[i];
+		if(visible & (1 << i))
+			num += count_frustum_quads(qt, c, left[i]);
+	}
+
+	return num;
+}
+
+/*
+ * look across a heightfield from a little above the ground at
+ * random points and count the quads that would be drawn with only
+ * frustum culling and with occlusion culling as well, and how long
+ * each takes
+ */
+static void
+benchmark_occlusion_culling(const char *name, struct heightfield *hf)
+{
+	struct terrain_quadtree *qt;
+	struct occlusion_buffer *ob;
+	struct terrain_lod *lod;
+	struct occlusion_stats s;
+	struct cull_stats cs;
+	struct lod_stats ls;
+	unsigned int i, j, num_views = 200, planes;
+	unsigned long frustum = 0, drawn = 0, occluders = 0;
+	unsigned long lod_drawn = 0, lod_occluded = 0, lod_occluders = 0;
+	float mm[16], pm[16], pos[3], far;
+	double t, frustum_ms = 0.0, occlusion_ms = 0.0, lod_ms = 0.0, lod_occlusion_ms = 0.0;
+
+	qt = build_terrain_quadtree(hf);
+	ob = new_occlusion_buffer(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+	lod = qt ? new_terrain_lod(qt, 0) : NULL;
+	if(!qt || !ob || !lod) {
+		free_terrain_lod(lod);
+		free_terrain_quadtree(qt);
+		free_occlusion_buffer(ob);
+		return;
+	}
+
+	srand(1);
+	far = (hf->xs[hf->cols] - hf->xs[0]) / 2.0f;
+	for(i = 0; i < num_views; i++) {
+		pos[0] = hf->xs[0] + (hf->xs[hf->cols] - hf->xs[0]) * rand() / (float)RAND_MAX;
+		pos[1] = hf->ys[0] + (hf->ys[hf->rows] - hf->ys[0]) * rand() / (float)RAND_MAX;
+		if(!get_heightfield_height(hf, pos[0], pos[1], &pos[2], NULL))
+			pos[2] = hf->maxz;
+		pos[2] += 2.0f;
+		make_view_matrices(mm, pm, pos, 2.0f * M_PI * rand() / (float)RAND_MAX,
+		                   DEG2RAD(-90.0f + 20.0f * rand() / (float)RAND_MAX), far);
+		set_view_frustum(mm, pm);
+
+		t = get_time_ms();
+		planes = VIEW_ALL_PLANES;
+		if(cull_box_in_viewport(qt->nodes[0].bounds, &planes) != VIEW_OUTSIDE)
+			frustum += count_frustum_quads(qt, 0, planes);
+		frustum_ms += get_time_ms() - t;
+
+		clear_occlusion_buffer(ob, mm, pm);
+		cull_terrain_quadtree_occluded(qt, ob);
+		take_occlusion_stats(ob, &s);
+		occlusion_ms += s.ms;
+		occluders += s.occluders;
+		for(j = 0; j < ob->num_leaves; j++)
+			drawn += count_terrain_quadtree_quads(qt, ob->leaves[j]);
+
+		/* the same view through the terrain LOD, with and without the buffer */
+		set_terrain_lod_view(lod, mm, pm, 480);
+		t = get_time_ms();
+		pick_terrain_lod(lod, NULL);
+		lod_ms += get_time_ms() - t;
+		take_lod_stats(lod, &ls);
+		lod_drawn += ls.triangles;
+
+		clear_occlusion_buffer(ob, mm, pm);
+		pick_terrain_lod(lod, ob);
+		take_occlusion_stats(ob, &s);
+		lod_occlusion_ms += s.ms;
+		lod_occluders += s.occluders;
+		take_lod_stats(lod, &ls);
+		lod_occluded += ls.triangles;
+	}
+	take_cull_stats(&cs);
+
+	printf("%s: %u x %u quads, %u views, %u x %u buffer\n", name, hf->cols, hf->rows,
+	       num_views, OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+	printf("                      frustum   occlusion\n");
+	printf("quads drawn       %11lu %11lu   (%.1f%% hidden)\n", frustum / num_views, drawn / num_views,
+	       frustum ? 100.0 * (frustum - drawn) / frustum : 0.0);
+	printf("culling (ms)      %11.3f %11.3f\n", frustum_ms / num_views, occlusion_ms / num_views);
+	printf("occluder quads                %11lu\n", occluders / num_views);
+	printf("LOD triangles     %11lu %11lu   (%.1f%% hidden)\n", lod_drawn / num_views,
+	       lod_occluded / num_views, lod_drawn ? 100.0 * (lod_drawn - lod_occluded) / lod_drawn : 0.0);
+	printf("LOD picking (ms)  %11.3f %11.3f\n", lod_ms / num_views, lod_occlusion_ms / num_views);
+	printf("LOD occluder quads            %11lu\n", lod_occluders / num_views);
+
+	free_terrain_lod(lod);
+	free_terrain_quadtree(qt);
+	free_occlusion_buffer(ob);
+}
+
+/* compare occlusion culling with frustum culling alone over a map and synthetic hills */
+void
+benchmark_occlusion(const char *filename)
+{
+	struct map *m;
+	struct heightfield hf;
+
+	m = load_map(filename);
+	if(m) {
+		benchmark_occlusion_culling(filename, m->heightfield);
+		free_map(m);
+	}
+
+	if(!init_hills_heightfield(&hf, 1024, 1024))
+		return;
+	benchmark_occlusion_culling("synthetic hills", &hf);
+	free_heightfield_data(&hf);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * an occlusion buffer is a small depth buffer drawn on the cpu.
+ * terrain that's been let through is drawn into it, and boxes that
+ * are behind what's in it everywhere they cover can be skipped
+ * before they're sent to GL. each pixel holds the farthest depth
+ * the pixel is certainly covered to, so a box is only found hidden
+ * if it really is
+ */
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 192
+
+struct occlusion_stats {
+	unsigned int tested, occluded; /* boxes tested, and found hidden */
+	unsigned int quads_occluded;   /* quads in the hidden boxes */
+	unsigned int occluders;        /* quads drawn into the buffer */
+	double ms;                     /* time spent culling */
+};
+
+struct occlusion_buffer {
+	unsigned int width, height;
+	float *depth;      /* z / w, row by row from the bottom */
+	float matrix[16];  /* projection times modelview, column major */
+	float eye[3];      /* where the camera is */
+	int above;         /* set if it's above the terrain being culled */
+
+	unsigned int num_leaves, max_leaves;
+	unsigned int *leaves; /* quadtree leaves to draw, front to back */
+
+	struct occlusion_stats stats;
+};
+
+struct occlusion_buffer *new_occlusion_buffer(unsigned int, unsigned int);
+void free_occlusion_buffer(struct occlusion_buffer *);
+void clear_occlusion_buffer(struct occlusion_buffer *, float[16], float[16]);
+int is_box_occluded(struct occlusion_buffer *, float[6]);
+void set_occlusion_terrain(struct occlusion_buffer *, struct heightfield *);
+void get_occlusion_order(struct occlusion_buffer *, struct terrain_quadtree *, unsigned int, unsigned int[4]);
+int is_terrain_node_occluded(struct occlusion_buffer *, struct terrain_quadtree *, unsigned int);
+void add_occluder_node(struct occlusion_buffer *, struct terrain_quadtree *, unsigned int, unsigned int);
+void cull_terrain_quadtree_occluded(struct terrain_quadtree *, struct occlusion_buffer *);
+void draw_terrain_quadtree_occluded(struct terrain_quadtree *, struct occlusion_buffer *, struct terrain_mesh *);
+void take_occlusion_stats(struct occlusion_buffer *, struct occlusion_stats *);
+void benchmark_occlusion(const char *);
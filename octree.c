@@ -25,68 +25,117 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <float.h>
 #include <GL/gl.h>
 #include "object.h"
+#include "heightfield.h"
 #include "my_math.h"
 #include "octree.h"
+#include "quadtree.h"
+#include "mesh.h"
+#include "parallel.h"
 
-#define MAX_LEAF_SIZE 10.0f /* leaf node width/height/depth will <= this */
+/* make bounds that nothing is in yet */
+static void
+empty_bounds(float b[6])
+{
+	b[0] = b[2] = b[4] = FLT_MAX;
+	b[1] = b[3] = b[5] = -FLT_MAX;
+}
 
-/*
- * recursively create octree nodes until we have
- * leaf nodes with a size <= MAX_LEAF_SIZE
- * max[xyz] and min[xyz] are the boundaries
- */
-struct octree_node *
-new_octree_branch(struct octree_node *parent, float minx, float maxx,
-                  float miny, float maxy, float minz, float maxz)
+/* grow bounds b to take in bounds c */
+static void
+grow_bounds(float b[6], const float c[6])
 {
 	int i;
-	struct octree_node *branch;
-	float midx, midy, midz;
 
-	if(maxx - minx <= MAX_LEAF_SIZE)
-		return NULL;
-	if(maxy - miny <= MAX_LEAF_SIZE)
-		return NULL;
-	if(maxz - minz <= MAX_LEAF_SIZE)
-		return NULL;
+	for(i = 0; i < 6; i += 2) {
+		if(c[i] < b[i])
+			b[i] = c[i];
+		if(c[i + 1] > b[i + 1])
+			b[i + 1] = c[i + 1];
+	}
+}
 
-	midx = minx + ((maxx - minx) / 2);
-	midy = miny + ((maxy - miny) / 2);
-	midz = minz + ((maxz - minz) / 2);
+/* create a leaf node; max[xyz] and min[xyz] are the boundaries */
+static struct octree_node *
+new_octree_node(struct octree_node *parent, float minx, float maxx,
+                float miny, float maxy, float minz, float maxz)
+{
+	struct octree_node *on;
 
-	branch = malloc(sizeof(struct octree_node));
-	if(!branch) {
+	on = malloc(sizeof(struct octree_node));
+	if(!on) {
 		fprintf(stderr, "Error: Couldn't allocate memory for octree node\n");
 		return NULL;
 	}
 
-	branch->subnodes[0] = new_octree_branch(branch, minx, midx, miny, midy, midz, maxz);
-	branch->subnodes[1] = new_octree_branch(branch, midx, maxx, miny, midy, midz, maxz);
-	branch->subnodes[2] = new_octree_branch(branch, midx, maxx, midy, maxy, midz, maxz);
-	branch->subnodes[3] = new_octree_branch(branch, minx, midx, midy, maxy, midz, maxz);
+	memset(on, 0, sizeof(struct octree_node));
+	on->parent = parent;
+	on->minx = minx; on->maxx = maxx;
+	on->miny = miny; on->maxy = maxy;
+	on->minz = minz; on->maxz = maxz;
+	on->objects = on->object_store;
+	on->max_objects = MAX_OCTREE_NODE_OBJECTS;
+	on->quads = on->quad_store;
+	on->max_quads = MAX_OCTREE_NODE_OBJECTS;
+	empty_bounds(on->bounds);
 
-	branch->subnodes[4] = new_octree_branch(branch, minx, midx, miny, midy, minz, midz);
-	branch->subnodes[5] = new_octree_branch(branch, midx, maxx, miny, midy, minz, midz);
-	branch->subnodes[6] = new_octree_branch(branch, midx, maxx, midy, maxy, minz, midz);
-	branch->subnodes[7] = new_octree_branch(branch, minx, midx, midy, maxy, minz, midz);
+	return on;
+}
 
-	branch->parent = parent;
-	branch->minx = minx; branch->maxx = maxx;
-	branch->miny = miny; branch->maxy = maxy;
-	branch->minz = minz; branch->maxz = maxz;
-	branch->num_objects = 0;
-	for(i = 0; i < MAX_OCTREE_NODE_OBJECTS; i++)
-		branch->objects[i] = 0;
+/* free a node's own storage, and the node unless it's in a map cache */
+static void
+free_octree_node(struct octree_node *on)
+{
+	if(on->flags & OCTREE_HEAP_OBJECTS)
+		free(on->objects);
+	if(on->flags & OCTREE_HEAP_QUADS)
+		free(on->quads);
+	if(!(on->flags & OCTREE_NODE_MAPPED))
+		free(on);
+}
 
-	return branch;
+/*
+ * create an octree that starts out as a single leaf; nodes are
+ * only created where objects and quads go, as leaves split up
+ */
+struct octree_node *
+new_octree_branch(struct octree_node *parent, float minx, float maxx,
+                  float miny, float maxy, float minz, float maxz)
+{
+	return new_octree_node(parent, minx, maxx, miny, maxy, minz, maxz);
+}
+
+/*
+ * create an empty octree for a heightfield's quads: a cube around
+ * the heightfield, centred on its heights
+ */
+struct octree_node *
+new_heightfield_octree(struct heightfield *hf)
+{
+	float size, mid[3];
+
+	size = hf->xs[hf->cols] - hf->xs[0];
+	if(hf->ys[hf->rows] - hf->ys[0] > size)
+		size = hf->ys[hf->rows] - hf->ys[0];
+	if(hf->maxz - hf->minz > size)
+		size = hf->maxz - hf->minz;
+	size = size / 2.0f + hf->quadsize; /* quads on the far edges stay inside */
+	mid[0] = (hf->xs[0] + hf->xs[hf->cols]) / 2.0f;
+	mid[1] = (hf->ys[0] + hf->ys[hf->rows]) / 2.0f;
+	mid[2] = (hf->minz + hf->maxz) / 2.0f;
+
+	return new_octree_branch(NULL, mid[0] - size, mid[0] + size,
+	                         mid[1] - size, mid[1] + size, mid[2] - size, mid[2] + size);
 }
 
 void
 free_octree_branch(struct octree_node *o)
 {
 	int i;
+	struct object *obj;
 
 	if(!o)
 		return;
@@ -94,83 +143,1354 @@ free_octree_branch(struct octree_node *o)
 	for(i = 0; i < 8; i++)
 		free_octree_branch(o->subnodes[i]);
 
-	free(o);
+	/* the objects in the branch aren't in any node now */
+	for(i = 0; i < o->num_objects; i++) {
+		obj = get_object(o->objects[i]);
+		if(obj && obj->node == o)
+			obj->node = NULL;
+	}
+
+	free_octree_node(o);
+}
+
+static int
+is_point_in_octree_node(struct octree_node *on, float p[3])
+{
+	return (p[0] >= on->minx && p[0] < on->maxx &&
+	        p[1] >= on->miny && p[1] < on->maxy &&
+	        p[2] >= on->minz && p[2] < on->maxz);
+}
+
+static int
+is_box_in_octree_node(struct octree_node *on, float b[6])
+{
+	return (b[0] >= on->minx && b[1] <= on->maxx &&
+	        b[2] >= on->miny && b[3] <= on->maxy &&
+	        b[4] >= on->minz && b[5] <= on->maxz);
+}
+
+static int
+is_octree_leaf(struct octree_node *on)
+{
+	int i;
+
+	for(i = 0; i < 8; i++) {
+		if(on->subnodes[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * subnodes 0 to 3 are the top half of a node and 4 to 7 the
+ * bottom half, each going round from minx, miny
+ */
+static const int subnode_xs[8] = { 0, 1, 1, 0, 0, 1, 1, 0 };
+static const int subnode_ys[8] = { 0, 0, 1, 1, 0, 0, 1, 1 };
+static const int subnode_zs[8] = { 1, 1, 1, 1, 0, 0, 0, 0 };
+static const int subnode_from_halves[8] = { 4, 5, 7, 6, 0, 1, 3, 2 }; /* x + 2y + 4z */
+
+static void
+get_octree_node_middle(struct octree_node *on, float mid[3])
+{
+	mid[0] = on->minx + ((on->maxx - on->minx) / 2);
+	mid[1] = on->miny + ((on->maxy - on->miny) / 2);
+	mid[2] = on->minz + ((on->maxz - on->minz) / 2);
+}
+
+/* get the subnode of a node that point p is in, or -1 if it's outside the node */
+static int
+get_subnode_for_point(struct octree_node *on, float p[3])
+{
+	float mid[3];
+
+	if(!is_point_in_octree_node(on, p))
+		return -1;
+
+	get_octree_node_middle(on, mid);
+	return subnode_from_halves[(p[0] >= mid[0]) + (p[1] >= mid[1]) * 2 + (p[2] >= mid[2]) * 4];
+}
+
+/* get the subnode of a node that box b fits in, or -1 if it doesn't fit in one */
+static int
+get_subnode_for_box(struct octree_node *on, float b[6])
+{
+	float mid[3];
+	int i, halves = 0;
+
+	if(!is_box_in_octree_node(on, b))
+		return -1;
+
+	get_octree_node_middle(on, mid);
+	for(i = 0; i < 3; i++) {
+		if(b[i * 2] >= mid[i])
+			halves += 1 << i;
+		else if(b[i * 2 + 1] > mid[i])
+			return -1;
+	}
+
+	return subnode_from_halves[halves];
+}
+
+/* get subnode i of a node, creating it if it doesn't exist yet */
+static struct octree_node *
+make_octree_subnode(struct octree_node *on, int i)
+{
+	float mid[3];
+
+	if(on->subnodes[i])
+		return on->subnodes[i];
+
+	get_octree_node_middle(on, mid);
+	on->subnodes[i] = new_octree_node(on,
+	                                  subnode_xs[i] ? mid[0] : on->minx, subnode_xs[i] ? on->maxx : mid[0],
+	                                  subnode_ys[i] ? mid[1] : on->miny, subnode_ys[i] ? on->maxy : mid[1],
+	                                  subnode_zs[i] ? mid[2] : on->minz, subnode_zs[i] ? on->maxz : mid[2]);
+	return on->subnodes[i];
 }
 
-/* get the leaf node that point p falls within */
+/*
+ * get the deepest node that point p falls within; that's a leaf
+ * unless the child p would be in hasn't been needed yet
+ */
 struct octree_node *
 get_octree_leaf_from_point(struct octree_node *root, float p[3])
 {
 	int i;
 
-	if(!root->subnodes[0])
-		return root;
+	for(;;) {
+		i = get_subnode_for_point(root, p);
+		if(i == -1 || !root->subnodes[i])
+			return root;
+		root = root->subnodes[i];
+	}
+}
+
+/*
+ * get the smallest node that entirely contains the box;
+ * returns NULL if the box isn't inside root at all
+ */
+struct octree_node *
+get_octree_node_from_box(struct octree_node *root, float minx, float maxx,
+                         float miny, float maxy, float minz, float maxz)
+{
+	int i;
+	struct octree_node *n;
+
+	if(!root)
+		return NULL;
+	if(minx < root->minx || maxx > root->maxx ||
+	   miny < root->miny || maxy > root->maxy ||
+	   minz < root->minz || maxz > root->maxz)
+		return NULL;
 
 	for(i = 0; i < 8; i++) {
-		if(p[0] >= root->subnodes[i]->minx && p[0] < root->subnodes[i]->maxx &&
-		   p[1] >= root->subnodes[i]->miny && p[1] < root->subnodes[i]->maxy &&
-		   p[2] >= root->subnodes[i]->minz && p[2] < root->subnodes[i]->maxz)
-			return get_octree_leaf_from_point(root->subnodes[i], p);
+		n = get_octree_node_from_box(root->subnodes[i], minx, maxx, miny, maxy, minz, maxz);
+		if(n)
+			return n;
 	}
 
 	return root;
 }
 
-/* add an object to a node */
+/* add to a branch's count of objects and quads, and its parents' */
+static void
+count_octree_items(struct octree_node *on, int n)
+{
+	for(; on; on = on->parent)
+		on->num_items += n;
+}
+
+/*
+ * make room for one more number in a node's objects or quads,
+ * moving them out of the node's own store once it's full;
+ * returns the (possibly moved) array, or NULL if it can't grow
+ */
+static unsigned int *
+grow_octree_array(unsigned int *a, unsigned int num, unsigned int *max,
+                  unsigned int *flags, unsigned int heapflag)
+{
+	unsigned int *b;
+
+	if(num < *max)
+		return a;
+
+	b = malloc(sizeof(unsigned int) * *max * 2);
+	if(!b) {
+		fprintf(stderr, "Error: Couldn't allocate memory for octree node\n");
+		return NULL;
+	}
+	memcpy(b, a, sizeof(unsigned int) * num);
+	if(*flags & heapflag)
+		free(a);
+	*flags |= heapflag;
+	*max *= 2;
+
+	return b;
+}
+
+/* move a node's objects and quads back into its own store once they fit */
+static void
+shrink_octree_arrays(struct octree_node *on)
+{
+	if((on->flags & OCTREE_HEAP_OBJECTS) && on->num_objects <= MAX_OCTREE_NODE_OBJECTS) {
+		memcpy(on->object_store, on->objects, sizeof(unsigned int) * on->num_objects);
+		free(on->objects);
+		on->objects = on->object_store;
+		on->max_objects = MAX_OCTREE_NODE_OBJECTS;
+		on->flags &= ~OCTREE_HEAP_OBJECTS;
+	}
+	if((on->flags & OCTREE_HEAP_QUADS) && on->num_quads <= MAX_OCTREE_NODE_OBJECTS) {
+		memcpy(on->quad_store, on->quads, sizeof(unsigned int) * on->num_quads);
+		free(on->quads);
+		on->quads = on->quad_store;
+		on->max_quads = MAX_OCTREE_NODE_OBJECTS;
+		on->flags &= ~OCTREE_HEAP_QUADS;
+	}
+}
+
+static int
+push_octree_object(struct octree_node *on, unsigned int n)
+{
+	unsigned int *a;
+
+	a = grow_octree_array(on->objects, on->num_objects, &on->max_objects, &on->flags, OCTREE_HEAP_OBJECTS);
+	if(!a)
+		return 0;
+
+	on->objects = a;
+	on->objects[on->num_objects++] = n;
+	return 1;
+}
+
+static int
+push_octree_quad(struct octree_node *on, struct heightfield *hf, unsigned int q)
+{
+	unsigned int *a;
+
+	a = grow_octree_array(on->quads, on->num_quads, &on->max_quads, &on->flags, OCTREE_HEAP_QUADS);
+	if(!a)
+		return 0;
+
+	on->heightfield = hf;
+	on->quads = a;
+	on->quads[on->num_quads++] = q;
+	return 1;
+}
+
+/* quads are in the leaf their first vertex is in */
+static void
+get_quad_point(struct heightfield *hf, unsigned int q, float v[3])
+{
+	unsigned int c, r;
+
+	c = q % hf->cols;
+	r = q / hf->cols;
+	v[0] = hf->xs[c];
+	v[1] = hf->ys[r + 1];
+	v[2] = HEIGHTFIELD_SAMPLE(hf, c, r + 1);
+}
+
+/* get the bounds of what an object takes up */
 void
-add_object_to_octree_node(struct octree_node *on, struct object *o)
+get_object_bounds(struct object *o, float b[6])
 {
+	struct heightfield *hf;
 	int i;
 
+	if(o->type == OBJ_HEIGHTFIELD) {
+		hf = o->aux;
+		if(hf->cols == 0 || hf->rows == 0) {
+			empty_bounds(b);
+			return;
+		}
+		b[0] = hf->xs[0];
+		b[1] = hf->xs[hf->cols];
+		b[2] = hf->ys[0];
+		b[3] = hf->ys[hf->rows];
+		b[4] = hf->minz;
+		b[5] = hf->maxz;
+		return;
+	}
+
+	for(i = 0; i < 3; i++) {
+		b[i * 2] = o->position[i] - o->radius;
+		b[i * 2 + 1] = o->position[i] + o->radius;
+	}
+}
+
+/*
+ * get the child of a node that an object belongs in, or -1;
+ * heightfield objects cover an area, so they belong in the child
+ * their bounds fit in, and other objects in the child their
+ * position is in
+ */
+static int
+get_object_subnode(struct octree_node *on, struct object *o)
+{
+	struct heightfield *hf;
+	float b[6];
+
+	if(o->type == OBJ_HEIGHTFIELD) {
+		hf = o->aux;
+		if(hf->cols == 0 || hf->rows == 0)
+			return -1;
+		get_object_bounds(o, b);
+		return get_subnode_for_box(on, b);
+	}
+
+	return get_subnode_for_point(on, o->position);
+}
+
+/*
+ * work out the bounds of what's in a node and its children from
+ * scratch; returns 1 if they've changed
+ */
+static int
+refit_octree_node(struct octree_node *on)
+{
+	struct object *o;
+	unsigned int i;
+	float b[6], c[6];
+
+	empty_bounds(b);
+	for(i = 0; i < on->num_quads; i++) {
+		get_heightfield_quad_bounds(on->heightfield, on->quads[i], c);
+		grow_bounds(b, c);
+	}
+	for(i = 0; i < on->num_objects; i++) {
+		o = get_object(on->objects[i]);
+		if(o) {
+			get_object_bounds(o, c);
+			grow_bounds(b, c);
+		}
+	}
+	for(i = 0; i < 8; i++) {
+		if(on->subnodes[i])
+			grow_bounds(b, on->subnodes[i]->bounds);
+	}
+
+	if(memcmp(b, on->bounds, sizeof(b)) == 0)
+		return 0;
+
+	memcpy(on->bounds, b, sizeof(b));
+	return 1;
+}
+
+/* refit a node and its parents, stopping once their bounds don't change */
+static void
+refit_octree_branch(struct octree_node *on)
+{
+	for(; on && refit_octree_node(on); on = on->parent)
+		;
+}
+
+/*
+ * move what fits into a node's children down into them, creating
+ * them as needed, if the node is a leaf that holds too much or
+ * already has children; children that end up holding too much
+ * are split in turn. only the children something was moved into
+ * are split and refitted, so an insert into a branch costs the
+ * same however much is under it; the node itself is left to the
+ * caller
+ */
+static void
+split_octree_node(struct octree_node *on)
+{
+	struct octree_node *child;
+	struct object *o;
+	unsigned int i, keep, moved = 0;
+	float v[3];
+	int n;
+
+	if(is_octree_leaf(on)) {
+		if(on->num_objects + on->num_quads <= MAX_OCTREE_NODE_OBJECTS)
+			return;
+		if(on->maxx - on->minx < MIN_OCTREE_NODE_SIZE * 2.0f ||
+		   on->maxy - on->miny < MIN_OCTREE_NODE_SIZE * 2.0f ||
+		   on->maxz - on->minz < MIN_OCTREE_NODE_SIZE * 2.0f)
+			return;
+	}
+
+	/* keep the items in order, in the node and in the children */
+	keep = 0;
+	for(i = 0; i < on->num_quads; i++) {
+		get_quad_point(on->heightfield, on->quads[i], v);
+		n = get_subnode_for_point(on, v);
+		child = (n == -1) ? NULL : make_octree_subnode(on, n);
+		if(child && push_octree_quad(child, on->heightfield, on->quads[i])) {
+			child->num_items++;
+			moved |= 1 << n;
+		} else
+			on->quads[keep++] = on->quads[i];
+	}
+	on->num_quads = keep;
+	if(on->num_quads == 0)
+		on->heightfield = NULL;
+
+	keep = 0;
+	for(i = 0; i < on->num_objects; i++) {
+		o = get_object(on->objects[i]);
+		n = o ? get_object_subnode(on, o) : -1;
+		child = (n == -1) ? NULL : make_octree_subnode(on, n);
+		if(child && push_octree_object(child, on->objects[i])) {
+			child->num_items++;
+			o->node = child;
+			moved |= 1 << n;
+		} else {
+			on->objects[keep++] = on->objects[i];
+		}
+	}
+	on->num_objects = keep;
+	shrink_octree_arrays(on);
+
+	for(i = 0; i < 8; i++) {
+		if(moved & (1 << i)) {
+			split_octree_node(on->subnodes[i]);
+			refit_octree_node(on->subnodes[i]);
+		}
+	}
+}
+
+/* move everything in a branch's children up into the branch */
+static void
+gather_octree_branch(struct octree_node *on, struct octree_node *to)
+{
+	struct object *o;
+	unsigned int i;
+
+	for(i = 0; i < 8; i++) {
+		if(on->subnodes[i]) {
+			gather_octree_branch(on->subnodes[i], to);
+			free_octree_node(on->subnodes[i]);
+			on->subnodes[i] = NULL;
+		}
+	}
+	if(on == to)
+		return;
+
+	for(i = 0; i < on->num_quads; i++)
+		push_octree_quad(to, on->heightfield, on->quads[i]);
+	for(i = 0; i < on->num_objects; i++) {
+		push_octree_object(to, on->objects[i]);
+		o = get_object(on->objects[i]);
+		if(o)
+			o->node = to;
+	}
+}
+
+/* can a branch's quads all go in one node? */
+static int
+branch_has_one_heightfield(struct octree_node *on, struct heightfield **hf)
+{
+	unsigned int i;
+
+	if(on->heightfield) {
+		if(*hf && *hf != on->heightfield)
+			return 0;
+		*hf = on->heightfield;
+	}
+
+	for(i = 0; i < 8; i++) {
+		if(on->subnodes[i] && !branch_has_one_heightfield(on->subnodes[i], hf))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * after something has been taken out of a node, free the largest
+ * empty branch above it, then merge the largest branch above that
+ * which holds few enough items back into one leaf
+ */
+static void
+merge_octree_branch(struct octree_node *on)
+{
+	struct octree_node *top = NULL;
+	struct heightfield *hf;
+	int i;
+
+	for(; on->parent && on->num_items == 0; on = on->parent)
+		top = on;
+	if(top) {
+		for(i = 0; i < 8; i++) {
+			if(on->subnodes[i] == top)
+				on->subnodes[i] = NULL;
+		}
+		free_octree_branch(top);
+		top = NULL;
+	}
+
+	for(; on && on->num_items <= OCTREE_MERGE_THRESHOLD; on = on->parent) {
+		hf = NULL;
+		if(!is_octree_leaf(on) && branch_has_one_heightfield(on, &hf))
+			top = on;
+	}
+
+	if(top)
+		gather_octree_branch(top, top);
+}
+
+/* take an object out of a node without merging; returns 1 if it was there */
+static int
+take_octree_object(struct octree_node *on, struct object *o)
+{
+	unsigned int i, n;
+
+	n = get_object_num(o);
+	for(i = 0; i < on->num_objects; i++) {
+		if(on->objects[i] == n)
+			break;
+	}
+	if(i == on->num_objects)
+		return 0;
+
+	/* keep the remaining objects in order */
+	for(; i + 1 < on->num_objects; i++)
+		on->objects[i] = on->objects[i + 1];
+	on->num_objects--;
+	count_octree_items(on, -1);
+	shrink_octree_arrays(on);
+	refit_octree_branch(on);
+	o->node = NULL;
+
+	return 1;
+}
+
+/* take a quad out of a node without merging; returns 1 if it was there */
+static int
+take_octree_quad(struct octree_node *on, unsigned int q)
+{
+	unsigned int i;
+
+	for(i = 0; i < on->num_quads; i++) {
+		if(on->quads[i] == q)
+			break;
+	}
+	if(i == on->num_quads)
+		return 0;
+
+	/* keep the remaining quads in order */
+	for(; i + 1 < on->num_quads; i++)
+		on->quads[i] = on->quads[i + 1];
+	on->num_quads--;
+	if(on->num_quads == 0)
+		on->heightfield = NULL;
+	count_octree_items(on, -1);
+	shrink_octree_arrays(on);
+	refit_octree_branch(on);
+
+	return 1;
+}
+
+/*
+ * add an object to a node; returns 1 on success. if the node is
+ * a leaf and now holds too much, it's split up, so the object
+ * may end up in one of its new children
+ */
+int
+add_object_to_octree_node(struct octree_node *on, struct object *o)
+{
 	if(!on || !o)
+		return 0;
+
+	if(o->node) {
+		fprintf(stderr, "Error: object %d is already in an octree node\n", get_object_num(o));
+		return 0;
+	}
+
+	if(!push_octree_object(on, get_object_num(o)))
+		return 0;
+	count_octree_items(on, 1);
+	o->node = on;
+	split_octree_node(on);
+	refit_octree_branch(on);
+
+	return 1;
+}
+
+/* add an object to the leaf of the branch that its position is in */
+int
+link_object_to_octree(struct octree_node *root, struct object *o)
+{
+	if(!root || !o)
+		return 0;
+
+	return add_object_to_octree_node(get_octree_leaf_from_point(root, o->position), o);
+}
+
+/*
+ * move an object to the leaf its position is now in; the search
+ * starts from the object's node and only goes up as far as the
+ * first node containing the position, so small moves are cheap
+ */
+int
+relink_object_in_octree(struct object *o)
+{
+	struct octree_node *from, *n, *to;
+	float *v = o->position;
+
+	from = o->node;
+	if(!from)
+		return 0;
+
+	for(n = from; n->parent; n = n->parent) {
+		if(is_point_in_octree_node(n, v))
+			break;
+	}
+
+	/* the object's bounds have moved even if it stays put */
+	to = get_octree_leaf_from_point(n, v);
+	if(to == from) {
+		refit_octree_branch(from);
+		return 1;
+	}
+
+	/* from can't be merged away until the object is in its new leaf */
+	take_octree_object(from, o);
+	if(!add_object_to_octree_node(to, o)) {
+		add_object_to_octree_node(from, o);
+		return 0;
+	}
+	merge_octree_branch(from);
+
+	return 1;
+}
+
+/* remove an object from a node; returns 1 if it was there */
+int
+remove_object_from_octree_node(struct octree_node *on, struct object *o)
+{
+	if(!on || !o)
+		return 0;
+
+	if(!take_octree_object(on, o))
+		return 0;
+	merge_octree_branch(on);
+
+	return 1;
+}
+
+/*
+ * add a heightfield quad to a node; returns 1 on success. like
+ * objects, the quad may end up in a child if the node splits
+ */
+int
+add_quad_to_octree_node(struct octree_node *on, struct heightfield *hf, unsigned int q)
+{
+	if(!on || !hf)
+		return 0;
+
+	if(on->heightfield && on->heightfield != hf) {
+		fprintf(stderr, "Error: octree_node already has quads from another heightfield\n");
+		return 0;
+	}
+
+	if(!push_octree_quad(on, hf, q))
+		return 0;
+	count_octree_items(on, 1);
+	split_octree_node(on);
+	refit_octree_branch(on);
+
+	return 1;
+}
+
+/* remove a heightfield quad from a node; returns 1 if it was there */
+int
+remove_quad_from_octree_node(struct octree_node *on, unsigned int q)
+{
+	if(!on)
+		return 0;
+
+	if(!take_octree_quad(on, q))
+		return 0;
+	merge_octree_branch(on);
+
+	return 1;
+}
+
+/*
+ * refit the bounds of the node that heightfield quad q is in, and
+ * its parents, after the quad's heights have changed
+ */
+void
+update_octree_quad_bounds(struct octree_node *root, struct heightfield *hf, unsigned int q)
+{
+	float v[3];
+
+	if(!root)
 		return;
 
-	if(on->num_objects >= MAX_OCTREE_NODE_OBJECTS) {
-		fprintf(stderr, "Error: octree_node already has max number of objects\n");
+	get_quad_point(hf, q, v);
+	refit_octree_branch(get_octree_leaf_from_point(root, v));
+}
+
+/*
+ * move quad q, whose first vertex is moving from a to b, to the
+ * leaf b is in; returns 1 if the quad is where it belongs
+ */
+int
+move_quad_in_octree(struct octree_node *root, struct heightfield *hf,
+                    unsigned int q, float a[3], float b[3])
+{
+	struct octree_node *from, *to;
+
+	if(!root)
+		return 0;
+
+	from = get_octree_leaf_from_point(root, a);
+	to = get_octree_leaf_from_point(root, b);
+	if(from == to) {
+		refit_octree_branch(from);
+		return 1;
+	}
+
+	/* from can't be merged away until the quad is in its new leaf */
+	if(!take_octree_quad(from, q))
+		return 0;
+	if(!add_quad_to_octree_node(to, hf, q)) {
+		add_quad_to_octree_node(from, hf, q);
+		return 0;
+	}
+	merge_octree_branch(from);
+
+	return 1;
+}
+
+
+/*
+ * the parallel builder gives each quad a key that's the path of
+ * subnodes down to the smallest node its first vertex could end up
+ * in, three bits a level with the top level highest, so sorting the
+ * quads by key puts every branch's quads next to each other. quads
+ * outside the root get a key with the bit above every path set
+ */
+#define OCTREE_KEY_LEVELS 21 /* levels that fit in a key with the outside bit */
+#define OCTREE_BUILD_TASKS_PER_THREAD 8
+
+struct octree_build_task {
+	struct octree_node *node;
+	unsigned int first, last; /* its quads in the sorted quads */
+	unsigned int level;
+};
+
+struct octree_build {
+	struct heightfield *hf;
+	struct octree_node *root;
+	unsigned int num_quads, num_outside, num_threads;
+	unsigned int levels; /* levels of subnodes the keys go down */
+	unsigned long long outside; /* key of the quads outside the root */
+
+	unsigned long long *keys, *keys2;
+	unsigned int *quads, *quads2;
+	unsigned int *counts; /* 256 radix counts per thread */
+	unsigned int shift;   /* bit the current radix digit starts at */
+
+	struct octree_build_task *tasks;
+	unsigned int num_tasks, next_task;
+};
+
+/* can a node with this box be split? the same test split_octree_node makes */
+static int
+is_octree_cell_splittable(const float c[6])
+{
+	return (c[1] - c[0] >= MIN_OCTREE_NODE_SIZE * 2.0f &&
+	        c[3] - c[2] >= MIN_OCTREE_NODE_SIZE * 2.0f &&
+	        c[5] - c[4] >= MIN_OCTREE_NODE_SIZE * 2.0f);
+}
+
+/* work out the keys of a band of quads */
+static void
+find_octree_build_keys(void *arg, unsigned int n)
+{
+	struct octree_build *b = arg;
+	struct octree_node *root = b->root;
+	unsigned long long key;
+	unsigned int q, first, last, l;
+	float c[6], mid[3], v[3];
+	int i, halves;
+
+	first = (unsigned int)((unsigned long)b->num_quads * n / b->num_threads);
+	last = (unsigned int)((unsigned long)b->num_quads * (n + 1) / b->num_threads);
+	for(q = first; q < last; q++) {
+		get_quad_point(b->hf, q, v);
+		b->quads[q] = q;
+		if(!is_point_in_octree_node(root, v)) {
+			b->keys[q] = b->outside;
+			continue;
+		}
+
+		/* the same arithmetic as get_subnode_for_point and make_octree_subnode */
+		c[0] = root->minx; c[1] = root->maxx;
+		c[2] = root->miny; c[3] = root->maxy;
+		c[4] = root->minz; c[5] = root->maxz;
+		key = 0;
+		for(l = 1; l <= b->levels && is_octree_cell_splittable(c); l++) {
+			halves = 0;
+			for(i = 0; i < 3; i++) {
+				mid[i] = c[i * 2] + ((c[i * 2 + 1] - c[i * 2]) / 2);
+				if(v[i] >= mid[i]) {
+					halves += 1 << i;
+					c[i * 2] = mid[i];
+				} else {
+					c[i * 2 + 1] = mid[i];
+				}
+			}
+			key |= (unsigned long long)halves << ((b->levels - l) * 3);
+		}
+		b->keys[q] = key;
+	}
+}
+
+/* count the radix digits in a band of keys */
+static void
+count_octree_build_keys(void *arg, unsigned int n)
+{
+	struct octree_build *b = arg;
+	unsigned int *counts = &b->counts[n * 256];
+	unsigned int i, first, last;
+
+	first = (unsigned int)((unsigned long)b->num_quads * n / b->num_threads);
+	last = (unsigned int)((unsigned long)b->num_quads * (n + 1) / b->num_threads);
+	memset(counts, 0, sizeof(unsigned int) * 256);
+	for(i = first; i < last; i++)
+		counts[(b->keys[i] >> b->shift) & 255]++;
+}
+
+/* move a band of keys to where the counts say their digits start */
+static void
+scatter_octree_build_keys(void *arg, unsigned int n)
+{
+	struct octree_build *b = arg;
+	unsigned int *starts = &b->counts[n * 256];
+	unsigned int i, j, first, last;
+
+	first = (unsigned int)((unsigned long)b->num_quads * n / b->num_threads);
+	last = (unsigned int)((unsigned long)b->num_quads * (n + 1) / b->num_threads);
+	for(i = first; i < last; i++) {
+		j = starts[(b->keys[i] >> b->shift) & 255]++;
+		b->keys2[j] = b->keys[i];
+		b->quads2[j] = b->quads[i];
+	}
+}
+
+/*
+ * sort the quads by key, a byte at a time from the bottom; each
+ * pass is stable, so quads with the same key stay in order
+ */
+static void
+sort_octree_build_keys(struct octree_build *b)
+{
+	unsigned long long *k;
+	unsigned int *q, d, t, sum, n;
+
+	for(b->shift = 0; b->shift <= b->levels * 3; b->shift += 8) {
+		run_parallel(count_octree_build_keys, b, b->num_threads);
+		sum = 0;
+		for(d = 0; d < 256; d++) {
+			for(t = 0; t < b->num_threads; t++) {
+				n = b->counts[t * 256 + d];
+				b->counts[t * 256 + d] = sum;
+				sum += n;
+			}
+		}
+		run_parallel(scatter_octree_build_keys, b, b->num_threads);
+
+		k = b->keys;
+		b->keys = b->keys2;
+		b->keys2 = k;
+		q = b->quads;
+		b->quads = b->quads2;
+		b->quads2 = q;
+	}
+}
+
+static int
+compare_quad_numbers(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * put the sorted quads first to last into a leaf in the order
+ * they'd have been added in. quads deeper than the leaf are sorted
+ * by the rest of their path, so they're put back in order, but a
+ * leaf that can't split is as deep as the keys go and is in order.
+ * a root that's a leaf gets the quads outside it as well
+ */
+static void
+fill_octree_build_leaf(struct octree_build *b, struct octree_node *on,
+                       unsigned int first, unsigned int last)
+{
+	unsigned int i, j, q, sorted[MAX_OCTREE_NODE_OBJECTS];
+
+	if(!on->parent) {
+		last = b->num_quads;
+		b->num_outside = 0;
+		if(last - first > MAX_OCTREE_NODE_OBJECTS)
+			qsort(&b->quads[first], last - first, sizeof(unsigned int), compare_quad_numbers);
+	}
+
+	if(last - first > MAX_OCTREE_NODE_OBJECTS) {
+		for(i = first; i < last; i++)
+			push_octree_quad(on, b->hf, b->quads[i]);
 		return;
 	}
 
-	i = get_object_num(o);
-	if(i == -1) {
-		fprintf(stderr, "Error: Couldn't get number for object at %p\n", o);
+	for(i = 0; i < last - first; i++) {
+		q = b->quads[first + i];
+		for(j = i; j > 0 && sorted[j - 1] > q; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = q;
+	}
+	for(i = 0; i < last - first; i++)
+		push_octree_quad(on, b->hf, sorted[i]);
+}
+
+/*
+ * split a node's sorted quads between its children, creating them,
+ * and call fn with each child's share; returns 0 if the node is a
+ * leaf and gets the quads itself
+ */
+static int
+split_octree_build_node(struct octree_build *b, struct octree_build_task *t,
+                        void (*fn)(struct octree_build *, struct octree_build_task *))
+{
+	struct octree_build_task child;
+	unsigned int shift, i, j, count;
+	float c[6];
+
+	count = t->last - t->first;
+	if(!t->node->parent)
+		count += b->num_outside;
+	t->node->num_items = count;
+
+	c[0] = t->node->minx; c[1] = t->node->maxx;
+	c[2] = t->node->miny; c[3] = t->node->maxy;
+	c[4] = t->node->minz; c[5] = t->node->maxz;
+	if(count <= MAX_OCTREE_NODE_OBJECTS || t->level >= b->levels || !is_octree_cell_splittable(c))
+		return 0;
+
+	shift = (b->levels - t->level - 1) * 3;
+	for(i = t->first; i < t->last; i = j) {
+		for(j = i + 1; j < t->last && ((b->keys[j] >> shift) & 7) == ((b->keys[i] >> shift) & 7); j++)
+			;
+		child.node = make_octree_subnode(t->node, subnode_from_halves[(b->keys[i] >> shift) & 7]);
+		child.first = i;
+		child.last = j;
+		child.level = t->level + 1;
+		fn(b, &child);
+	}
+
+	return 1;
+}
+
+/* build a branch from its sorted quads, depth first */
+static void
+build_octree_branch(struct octree_build *b, struct octree_build_task *t)
+{
+	unsigned int i;
+
+	if(!split_octree_build_node(b, t, build_octree_branch))
+		fill_octree_build_leaf(b, t->node, t->first, t->last);
+	for(i = 0; i < 8; i++) {
+		if(t->node->subnodes[i])
+			refit_octree_node(t->node->subnodes[i]);
+	}
+}
+
+static void
+add_octree_build_task(struct octree_build *b, struct octree_build_task *t)
+{
+	b->tasks[b->num_tasks++] = *t;
+}
+
+/* build thread; takes branches off the list until there are none left */
+static void
+run_octree_build_tasks(void *arg, unsigned int n)
+{
+	struct octree_build *b = arg;
+	unsigned int i;
+
+	(void)n;
+	while((i = __sync_fetch_and_add(&b->next_task, 1)) < b->num_tasks) {
+		build_octree_branch(b, &b->tasks[i]);
+		refit_octree_node(b->tasks[i].node);
+	}
+}
+
+/*
+ * build the top of the tree on this thread until it has split into
+ * enough branches to keep the threads busy, then build the branches
+ * on all of them. nodes split here are refitted once their branches
+ * are built, children before parents
+ */
+static int
+build_octree_top(struct octree_build *b)
+{
+	struct octree_build_task t, *top, *newtop;
+	unsigned int i, biggest, want, num_top = 0, max_top = 16;
+
+	want = b->num_threads * OCTREE_BUILD_TASKS_PER_THREAD;
+	top = malloc(sizeof(struct octree_build_task) * max_top);
+	b->tasks = malloc(sizeof(struct octree_build_task) * (want + 8));
+	if(!top || !b->tasks) {
+		fprintf(stderr, "Error: Couldn't allocate memory for octree build\n");
+		free(top);
+		return 0;
+	}
+
+	b->tasks[0].node = b->root;
+	b->tasks[0].first = 0;
+	b->tasks[0].last = b->num_quads - b->num_outside;
+	b->tasks[0].level = 0;
+	b->num_tasks = 1;
+
+	/* split the biggest branch until there are enough */
+	while(b->num_tasks < want) {
+		biggest = 0;
+		for(i = 1; i < b->num_tasks; i++) {
+			if(b->tasks[i].last - b->tasks[i].first > b->tasks[biggest].last - b->tasks[biggest].first)
+				biggest = i;
+		}
+		t = b->tasks[biggest];
+		b->tasks[biggest] = b->tasks[--b->num_tasks];
+
+		if(num_top == max_top) {
+			newtop = realloc(top, sizeof(struct octree_build_task) * max_top * 2);
+			if(!newtop) {
+				fprintf(stderr, "Error: Couldn't allocate memory for octree build\n");
+				free(top);
+				return 0;
+			}
+			top = newtop;
+			max_top *= 2;
+		}
+
+		if(!split_octree_build_node(b, &t, add_octree_build_task)) {
+			/* it's a leaf, so none of the smaller ones will split much */
+			b->tasks[b->num_tasks++] = t;
+			break;
+		}
+		top[num_top++] = t;
+	}
+
+	b->next_task = 0;
+	run_parallel(run_octree_build_tasks, b, b->num_threads);
+
+	/* the outside quads stay in the root, in order */
+	for(i = b->num_quads - b->num_outside; i < b->num_quads; i++)
+		push_octree_quad(b->root, b->hf, b->quads[i]);
+
+	/* children were split after their parents */
+	while(num_top > 0)
+		refit_octree_node(top[--num_top].node);
+	refit_octree_node(b->root);
+	free(top);
+
+	return 1;
+}
+
+/* put a heightfield's quads into an octree one at a time, in order */
+static void
+add_heightfield_quads_to_octree(struct octree_node *root, struct heightfield *hf)
+{
+	unsigned int q;
+	float v[3];
+
+	for(q = 0; q < hf->cols * hf->rows; q++) {
+		get_quad_point(hf, q, v);
+		add_quad_to_octree_node(get_octree_leaf_from_point(root, v), hf, q);
+	}
+}
+
+/*
+ * build an octree holding all of a heightfield's quads on
+ * num_threads threads. the tree is the same as putting the quads
+ * in one at a time in order would make: a node's shape only
+ * depends on how many quads end up under it, so the quads are
+ * sorted by the path down to where they go and each branch is
+ * built from its share of them in one go. returns NULL on failure
+ */
+struct octree_node *
+build_heightfield_octree(struct heightfield *hf, unsigned int num_threads)
+{
+	struct octree_build b;
+	unsigned int i;
+	float c[6], mid;
+	int ok;
+
+	memset(&b, 0, sizeof(b));
+	b.hf = hf;
+	b.root = new_heightfield_octree(hf);
+	if(!b.root)
+		return NULL;
+
+	/* the keys have to go as deep as any node can split, and a level more */
+	c[0] = b.root->minx; c[1] = b.root->maxx;
+	c[2] = b.root->miny; c[3] = b.root->maxy;
+	c[4] = b.root->minz; c[5] = b.root->maxz;
+	for(b.levels = 1; is_octree_cell_splittable(c); b.levels++) {
+		for(i = 0; i < 6; i += 2) {
+			mid = c[i] + ((c[i + 1] - c[i]) / 2);
+			c[i + 1] = mid;
+		}
+	}
+
+	b.outside = 1ULL << (b.levels * 3);
+	b.num_quads = hf->cols * hf->rows;
+	if(num_threads < 1)
+		num_threads = 1;
+	if(num_threads > b.num_quads / 1024 + 1)
+		num_threads = b.num_quads / 1024 + 1;
+	b.num_threads = num_threads;
+
+	if(b.levels > OCTREE_KEY_LEVELS || b.num_quads == 0) {
+		add_heightfield_quads_to_octree(b.root, hf);
+		return b.root;
+	}
+
+	b.keys = malloc(sizeof(unsigned long long) * b.num_quads);
+	b.keys2 = malloc(sizeof(unsigned long long) * b.num_quads);
+	b.quads = malloc(sizeof(unsigned int) * b.num_quads);
+	b.quads2 = malloc(sizeof(unsigned int) * b.num_quads);
+	b.counts = malloc(sizeof(unsigned int) * 256 * num_threads);
+	ok = (b.keys && b.keys2 && b.quads && b.quads2 && b.counts);
+	if(ok) {
+		run_parallel(find_octree_build_keys, &b, num_threads);
+		sort_octree_build_keys(&b);
+		for(i = b.num_quads; i > 0 && b.keys[i - 1] == b.outside; i--)
+			b.num_outside++;
+		ok = build_octree_top(&b);
+	} else {
+		fprintf(stderr, "Error: Couldn't allocate memory for octree build\n");
+	}
+
+	free(b.keys);
+	free(b.keys2);
+	free(b.quads);
+	free(b.quads2);
+	free(b.counts);
+	free(b.tasks);
+	if(!ok) {
+		free_octree_branch(b.root);
+		return NULL;
+	}
+
+	return b.root;
+}
+
+/* count the nodes of two branches that differ in shape or contents */
+static unsigned int
+compare_octree_branches(struct octree_node *a, struct octree_node *b)
+{
+	unsigned int i, n = 0;
+
+	if(!a || !b)
+		return (a != b);
+
+	if(a->minx != b->minx || a->maxx != b->maxx || a->miny != b->miny ||
+	   a->maxy != b->maxy || a->minz != b->minz || a->maxz != b->maxz ||
+	   memcmp(a->bounds, b->bounds, sizeof(a->bounds)) != 0 ||
+	   a->num_items != b->num_items || a->flags != b->flags ||
+	   a->heightfield != b->heightfield || a->num_quads != b->num_quads ||
+	   a->max_quads != b->max_quads ||
+	   memcmp(a->quads, b->quads, sizeof(unsigned int) * a->num_quads) != 0)
+		n++;
+
+	for(i = 0; i < 8; i++)
+		n += compare_octree_branches(a->subnodes[i], b->subnodes[i]);
+
+	return n;
+}
+
+/* time building an octree for a heightfield serially and on more and more threads */
+static void
+benchmark_octree_builds(const char *name, struct heightfield *hf)
+{
+	struct octree_node *serial, *root;
+	unsigned int threads, max_threads;
+	double t, base;
+
+	t = get_time_ms();
+	serial = new_heightfield_octree(hf);
+	if(!serial)
 		return;
+	add_heightfield_quads_to_octree(serial, hf);
+	base = get_time_ms() - t;
+
+	printf("%s: %u quads\n", name, hf->cols * hf->rows);
+	printf("threads      build (ms)   speed-up   differences\n");
+	printf("one by one %12.1f\n", base);
+
+	max_threads = get_num_cpus();
+	if(max_threads < 8)
+		max_threads = 8;
+	for(threads = 1; threads <= max_threads; threads *= 2) {
+		t = get_time_ms();
+		root = build_heightfield_octree(hf, threads);
+		t = get_time_ms() - t;
+		if(!root)
+			break;
+		printf("%7u    %12.1f   %7.2fx   %11u\n", threads, t, base / t,
+		       compare_octree_branches(serial, root));
+		free_octree_branch(root);
 	}
-	on->objects[on->num_objects] = i;
-	on->num_objects++;
+	free_octree_branch(serial);
 }
 
 /*
- * recursively draw objects in a branch; if the node
- * we're testing is outside of the view frustum, don't
- * draw its objects or process the child nodes
+ * compare the parallel octree builder with putting quads in one at
+ * a time, over a map and a synthetic heightfield of four million
+ * quads; on fewer cores than threads the threads just take turns
  */
 void
-draw_octree_branch_objects(struct octree_node *branch)
+benchmark_octree_build(struct heightfield *map)
 {
-	int i;
-	float v[8][3];
-	float mid;
+	struct heightfield hf;
 
-	if(!branch)
+	if(map)
+		benchmark_octree_builds("map", map);
+
+	if(!init_hills_heightfield(&hf, 2048, 2048))
 		return;
+	benchmark_octree_builds("synthetic hills", &hf);
+	free_heightfield_data(&hf);
+}
 
-	mid = (branch->maxx - branch->minx) * 0.5f;
-	v[0][0] = branch->minx + mid;
-	v[0][1] = branch->miny + mid;
-	v[0][2] = branch->minz + mid;
+/*
+ * recursively draw objects in a branch; if the bounds of what's
+ * in the node we're testing are outside of the view frustum,
+ * don't draw its objects or process the child nodes. planes has
+ * the bits of the frustum planes the node isn't known to be inside
+ * of; once none are left, the whole branch is drawn untested
+ */
+static void
+draw_octree_branch(struct octree_node *branch, unsigned int planes)
+{
+	struct object *o;
+	unsigned int p;
+	float b[6];
+	int i;
 
-	if(!is_point_in_viewport(v[0], mid * 4.0f))
+	if(!branch || branch->bounds[0] > branch->bounds[1])
+		return;
+	if(planes && cull_box_in_viewport(branch->bounds, &planes) == VIEW_OUTSIDE)
 		return;
 
-	if(!branch->parent)
-		glBegin(GL_QUADS);
-
-	for(i = 0; i < branch->num_objects; i++)
+	/* heightfields can be much smaller than the node they're in */
+	for(i = 0; i < branch->num_objects; i++) {
+		o = get_object(branch->objects[i]);
+		if(planes && o && o->type == OBJ_HEIGHTFIELD) {
+			get_object_bounds(o, b);
+			p = planes;
+			if(b[0] > b[1] || cull_box_in_viewport(b, &p) == VIEW_OUTSIDE)
+				continue;
+		}
 		draw_object(branch->objects[i]);
+	}
+	for(i = 0; i < branch->num_quads; i++)
+		draw_heightfield_quad(branch->heightfield, branch->quads[i]);
+	add_draw_stats(0, 4 * branch->num_quads);
 
 	for(i = 0; i < 8; i++)
-		draw_octree_branch_objects(branch->subnodes[i]);
+		draw_octree_branch(branch->subnodes[i], planes);
+}
+
+void
+draw_octree_branch_objects(struct octree_node *branch)
+{
+	if(!branch)
+		return;
+
+	if(!branch->parent) {
+		glBegin(GL_QUADS);
+		add_draw_stats(1, 0);
+	}
+
+	draw_octree_branch(branch, VIEW_ALL_PLANES);
 
 	if(!branch->parent)
 		glEnd();
 }
+
+struct octree_stats {
+	unsigned int nodes, leaves, empty_leaves, overflowed;
+	unsigned int depth;
+	unsigned long leaf_depths;
+	unsigned int objects, quads, leaf_items, largest;
+	double cell_volume, bounds_volume;
+	size_t bytes;
+};
+
+static void
+add_octree_stats(struct octree_node *on, unsigned int depth, struct octree_stats *s)
+{
+	unsigned int i, items;
+
+	if(!on)
+		return;
+
+	items = on->num_objects + on->num_quads;
+	s->nodes++;
+	s->objects += on->num_objects;
+	s->quads += on->num_quads;
+	if(depth > s->depth)
+		s->depth = depth;
+	if(items > s->largest)
+		s->largest = items;
+	if(on->flags & (OCTREE_HEAP_OBJECTS | OCTREE_HEAP_QUADS))
+		s->overflowed++;
+
+	s->bytes += sizeof(struct octree_node);
+	if(on->flags & OCTREE_HEAP_OBJECTS)
+		s->bytes += sizeof(unsigned int) * on->max_objects;
+	if(on->flags & OCTREE_HEAP_QUADS)
+		s->bytes += sizeof(unsigned int) * on->max_quads;
+
+	if(is_octree_leaf(on)) {
+		s->cell_volume += (double)(on->maxx - on->minx) * (on->maxy - on->miny) * (on->maxz - on->minz);
+		if(on->bounds[0] <= on->bounds[1])
+			s->bounds_volume += (double)(on->bounds[1] - on->bounds[0]) *
+			                    (on->bounds[3] - on->bounds[2]) * (on->bounds[5] - on->bounds[4]);
+		s->leaves++;
+		s->leaf_depths += depth;
+		s->leaf_items += items;
+		if(items == 0)
+			s->empty_leaves++;
+	}
+
+	for(i = 0; i < 8; i++)
+		add_octree_stats(on->subnodes[i], depth + 1, s);
+}
+
+/*
+ * print the shape of an octree: how deep it goes, how full its
+ * leaves are and how many nodes had to grow past their own store
+ */
+void
+print_octree_stats(struct octree_node *root)
+{
+	struct octree_stats s;
+
+	memset(&s, 0, sizeof(s));
+	add_octree_stats(root, 0, &s);
+	if(s.nodes == 0) {
+		printf("octree: empty\n");
+		return;
+	}
+
+	printf("octree: %u nodes, %u leaves (%u empty), depth %u, leaves %.1f deep on average\n",
+	       s.nodes, s.leaves, s.empty_leaves, s.depth, (double)s.leaf_depths / s.leaves);
+	printf("        %u objects and %u quads, %u in leaves, %.1f per leaf (%.0f%% fill)\n",
+	       s.objects, s.quads, s.leaf_items, (double)s.leaf_items / s.leaves,
+	       100.0 * s.leaf_items / ((double)s.leaves * MAX_OCTREE_NODE_OBJECTS));
+	printf("        largest node holds %u, %u nodes overflowed, %.1f KB\n",
+	       s.largest, s.overflowed, s.bytes / 1024.0);
+	printf("        leaf bounds fill %.1f%% of their cells\n",
+	       s.cell_volume > 0.0 ? 100.0 * s.bounds_volume / s.cell_volume : 0.0);
+}
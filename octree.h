@@ -23,22 +23,63 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define MAX_OCTREE_NODE_OBJECTS 16
+#define MAX_OCTREE_NODE_OBJECTS 16 /* items a leaf holds before it splits */
+#define OCTREE_MERGE_THRESHOLD  8  /* items a branch holds before it merges */
+#define MIN_OCTREE_NODE_SIZE    2.0f /* nodes this small don't split */
 
+/* node flags */
+#define OCTREE_NODE_MAPPED  1 /* the node lives in a map cache */
+#define OCTREE_HEAP_OBJECTS 2 /* objects has outgrown object_store */
+#define OCTREE_HEAP_QUADS   4 /* quads has outgrown quad_store */
+
+/*
+ * a leaf splits when it holds more than MAX_OCTREE_NODE_OBJECTS
+ * objects and quads, but only the children that something goes in
+ * are created, and a branch is merged back into one leaf when it
+ * holds OCTREE_MERGE_THRESHOLD or fewer. items that can't be split
+ * up any further, because the node is already as small as it gets
+ * or they don't fit in one child, go into storage that grows as
+ * needed. bounds is the box around what's actually in the branch,
+ * which is usually much smaller than the node's own box
+ */
 struct octree_node {
 	float minx, maxx;
 	float miny, maxy;
 	float minz, maxz;
+	float bounds[6]; /* min, max of x, y and z; min > max when empty */
 
 	struct octree_node *parent;
 	struct octree_node *subnodes[8];
 
-	unsigned int objects[MAX_OCTREE_NODE_OBJECTS]; /* object id numbers */
-	unsigned int num_objects; /* total number of objects */
+	unsigned int *objects; /* object id numbers */
+	unsigned int num_objects, max_objects;
+
+	struct heightfield *heightfield; /* heightfield the quads are in */
+	unsigned int *quads; /* heightfield quad numbers */
+	unsigned int num_quads, max_quads;
+
+	unsigned int num_items; /* objects and quads in the whole branch */
+	unsigned int flags;
+
+	unsigned int object_store[MAX_OCTREE_NODE_OBJECTS];
+	unsigned int quad_store[MAX_OCTREE_NODE_OBJECTS];
 };
 
 struct octree_node *new_octree_branch(struct octree_node *, float, float, float, float, float, float);
+struct octree_node *new_heightfield_octree(struct heightfield *);
+struct octree_node *build_heightfield_octree(struct heightfield *, unsigned int);
+void benchmark_octree_build(struct heightfield *);
 void free_octree_branch(struct octree_node *);
 struct octree_node *get_octree_leaf_from_point(struct octree_node *, float[3]);
-void add_object_to_octree_node(struct octree_node *, struct object *);
+struct octree_node *get_octree_node_from_box(struct octree_node *, float, float, float, float, float, float);
+int add_object_to_octree_node(struct octree_node *, struct object *);
+int link_object_to_octree(struct octree_node *, struct object *);
+int relink_object_in_octree(struct object *);
+int remove_object_from_octree_node(struct octree_node *, struct object *);
+int add_quad_to_octree_node(struct octree_node *, struct heightfield *, unsigned int);
+int remove_quad_from_octree_node(struct octree_node *, unsigned int);
+void update_octree_quad_bounds(struct octree_node *, struct heightfield *, unsigned int);
+int move_quad_in_octree(struct octree_node *, struct heightfield *, unsigned int, float[3], float[3]);
+void get_object_bounds(struct object *, float[6]);
 void draw_octree_branch_objects(struct octree_node *);
+void print_octree_stats(struct octree_node *);
@@ -0,0 +1,805 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * the terrain pager streams a map in pages of PAGE_QUADS x
+ * PAGE_QUADS quads from a page file baked from the heightmap,
+ * so that maps too big to keep in memory can be used. a loader
+ * thread keeps the pages around the camera resident in a fixed
+ * ring of page slots; each slot is a heightfield object that gets
+ * its samples swapped in by the render thread and is linked into a
+ * small octree covering a window of pages around the camera.
+ * all octree and object changes happen on the render thread, so
+ * drawing and collision never wait on the loader
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "object.h"
+#include "heightfield.h"
+#include "map.h"
+#include "octree.h"
+#include "pager.h"
+#include "cachefile.h"
+
+#define PAGE_FILE_MAGIC   "JABPAGE"
+#define PAGE_FILE_VERSION 1
+#define NUM_PAGE_BUFFERS  4 /* pages that can be loading at once */
+
+#define BUFFER_FREE    0
+#define BUFFER_LOADING 1
+#define BUFFER_READY   2
+
+extern void *open_png_rows(const char *, unsigned int *, unsigned int *, unsigned int *);
+extern int read_png_row(void *, unsigned char *);
+extern void close_png_rows(void *);
+
+/*
+ * the page file is this header followed by pages_x * pages_y
+ * pages, row by row; a page is (PAGE_QUADS + 1)^2 heightmap
+ * samples, one per quad corner, so neighbouring pages share
+ * their edge samples
+ */
+struct page_file_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int page_quads;
+	unsigned int pages_x, pages_y;
+	struct map_grid grid;
+};
+
+/* a page's worth of quads, being filled in by the loader */
+struct page_buffer {
+	int state;
+	int px, py;
+	struct heightfield hf;
+};
+
+/* a slot in the ring of resident pages */
+struct page_slot {
+	int px, py;                /* resident page, -1 if none */
+	unsigned int object;       /* the slot's heightfield object */
+};
+
+struct terrain_pager {
+	int fd;
+	struct page_file_header h;
+	float page_size;     /* units along the side of a page */
+	float view_distance; /* pages farther away than this are evicted */
+
+	int reach;  /* pages each way from the camera that can be wanted */
+	int ring;   /* slots along each side of the ring */
+	struct page_slot *slots;
+	struct page_buffer buffers[NUM_PAGE_BUFFERS];
+	unsigned char *samples;
+
+	float position[2]; /* camera position */
+	float heading[2];  /* direction the camera last moved in */
+	float ahead[2];    /* where the camera is heading */
+	int center_x, center_y;
+
+	int window; /* pages along each side of the octree */
+	int window_x, window_y;
+	struct octree_node *octree;
+
+	unsigned int pages_loaded, pages_evicted;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int thread_running;
+	int quit;
+};
+
+/* position of the left edge of page column px */
+static float
+page_edge_x(struct terrain_pager *p, int px)
+{
+	struct map_grid *g = &p->h.grid;
+
+	return (float)((long)px * PAGE_QUADS * g->tilesize) / g->xydiv - (float)(g->width / 2) / g->xydiv;
+}
+
+/* position of the bottom edge of page row py */
+static float
+page_edge_y(struct terrain_pager *p, int py)
+{
+	struct map_grid *g = &p->h.grid;
+
+	return (float)((long)py * PAGE_QUADS * g->tilesize) / g->xydiv - (float)(g->height / 2) / g->xydiv;
+}
+
+/* get the minx, maxx, miny, maxy of a page's quads */
+static void
+get_page_rect(struct terrain_pager *p, int px, int py, float r[4])
+{
+	struct map_grid *g = &p->h.grid;
+	float left, bottom;
+
+	left = page_edge_x(p, 0);
+	bottom = page_edge_y(p, 0);
+
+	r[0] = page_edge_x(p, px);
+	r[1] = page_edge_x(p, px + 1);
+	if(r[1] > left + (float)(g->cols * g->tilesize) / g->xydiv)
+		r[1] = left + (float)(g->cols * g->tilesize) / g->xydiv;
+	r[2] = page_edge_y(p, py);
+	r[3] = page_edge_y(p, py + 1);
+	if(r[3] > bottom + (float)(g->rows * g->tilesize) / g->xydiv)
+		r[3] = bottom + (float)(g->rows * g->tilesize) / g->xydiv;
+}
+
+static float
+page_distance(struct terrain_pager *p, int px, int py, float v[2])
+{
+	float r[4];
+	float dx = 0.0f, dy = 0.0f;
+
+	get_page_rect(p, px, py, r);
+	if(v[0] < r[0])
+		dx = r[0] - v[0];
+	else if(v[0] > r[1])
+		dx = v[0] - r[1];
+	if(v[1] < r[2])
+		dy = r[2] - v[1];
+	else if(v[1] > r[3])
+		dy = v[1] - r[3];
+
+	return sqrtf(dx * dx + dy * dy);
+}
+
+static int
+page_x_from_point(struct terrain_pager *p, float x)
+{
+	return (int)floorf((x - page_edge_x(p, 0)) / p->page_size);
+}
+
+static int
+page_y_from_point(struct terrain_pager *p, float y)
+{
+	return (int)floorf((y - page_edge_y(p, 0)) / p->page_size);
+}
+
+static int
+page_in_window(struct terrain_pager *p, int px, int py)
+{
+	return (px >= 0 && py >= 0 &&
+	        px < (int)p->h.pages_x && py < (int)p->h.pages_y &&
+	        px >= p->window_x && px < p->window_x + p->window &&
+	        py >= p->window_y && py < p->window_y + p->window);
+}
+
+/*
+ * return 1 if a page should be resident; slack is added to
+ * the view distance so that pages aren't evicted as soon as
+ * they stop being loaded
+ */
+static int
+page_is_wanted(struct terrain_pager *p, int px, int py, float slack)
+{
+	if(!page_in_window(p, px, py))
+		return 0;
+
+	return (page_distance(p, px, py, p->position) <= p->view_distance + slack ||
+	        page_distance(p, px, py, p->ahead) <= p->view_distance + slack);
+}
+
+static struct page_slot *
+get_page_slot(struct terrain_pager *p, int px, int py)
+{
+	return &p->slots[(py % p->ring) * p->ring + (px % p->ring)];
+}
+
+static void
+link_page_slot(struct terrain_pager *p, struct page_slot *s)
+{
+	struct object *o = get_object(s->object);
+	struct heightfield *hf = o->aux;
+	struct octree_node *on;
+
+	on = get_octree_node_from_box(p->octree, hf->xs[0], hf->xs[hf->cols],
+	                              hf->ys[0], hf->ys[hf->rows],
+	                              hf->minz, hf->maxz);
+	if(on)
+		add_object_to_octree_node(on, o);
+}
+
+static void
+unlink_page_slot(struct terrain_pager *p, struct page_slot *s)
+{
+	struct object *o = get_object(s->object);
+	struct heightfield *hf = o->aux;
+
+	/* the object moves between nodes as the octree splits and merges */
+	if(o->node)
+		remove_object_from_octree_node(o->node, o);
+
+	s->px = s->py = -1;
+	hf->cols = hf->rows = 0;
+}
+
+/*
+ * pick the page the loader should load next: the nearest page
+ * to the camera that's wanted but neither resident nor being
+ * loaded, then pages in the direction the camera is heading.
+ * called with the lock held; returns 0 if nothing is needed
+ */
+static int
+find_wanted_page(struct terrain_pager *p, int *pxp, int *pyp)
+{
+	int px, py, i, found = 0;
+	float d, best = 0.0f;
+	struct page_slot *s;
+
+	for(py = p->center_y - p->reach; py <= p->center_y + p->reach; py++) {
+		for(px = p->center_x - p->reach; px <= p->center_x + p->reach; px++) {
+			if(!page_is_wanted(p, px, py, 0.0f))
+				continue;
+
+			s = get_page_slot(p, px, py);
+			if(s->px == px && s->py == py)
+				continue;
+			for(i = 0; i < NUM_PAGE_BUFFERS; i++) {
+				if(p->buffers[i].state != BUFFER_FREE &&
+				   p->buffers[i].px == px && p->buffers[i].py == py)
+					break;
+			}
+			if(i < NUM_PAGE_BUFFERS)
+				continue;
+
+			/* pages around the camera come before prefetched ones */
+			d = page_distance(p, px, py, p->position);
+			if(d > p->view_distance)
+				d = p->view_distance + page_distance(p, px, py, p->ahead);
+
+			if(!found || d < best) {
+				best = d;
+				*pxp = px;
+				*pyp = py;
+				found = 1;
+			}
+		}
+	}
+
+	return found;
+}
+
+static struct page_buffer *
+get_free_page_buffer(struct terrain_pager *p)
+{
+	int i;
+
+	for(i = 0; i < NUM_PAGE_BUFFERS; i++) {
+		if(p->buffers[i].state == BUFFER_FREE)
+			return &p->buffers[i];
+	}
+
+	return NULL;
+}
+
+/* read a page from the page file and build its heightfield in b */
+static void
+load_page(struct terrain_pager *p, struct page_buffer *b)
+{
+	struct map_grid *g = &p->h.grid;
+	struct heightfield *hf = &b->hf;
+	unsigned int stride = PAGE_QUADS + 1;
+	unsigned int r, c;
+	off_t offset;
+	ssize_t size;
+
+	offset = sizeof(struct page_file_header) + (off_t)(b->py * p->h.pages_x + b->px) * stride * stride;
+	size = pread(p->fd, p->samples, stride * stride, offset);
+
+	if(size != (ssize_t)(stride * stride)) {
+		fprintf(stderr, "Error: Couldn't read terrain page %d, %d\n", b->px, b->py);
+		hf->cols = hf->rows = 0;
+		return;
+	}
+
+	/* pages along the top and right edges can be smaller */
+	hf->cols = g->cols - b->px * PAGE_QUADS;
+	if(hf->cols > PAGE_QUADS)
+		hf->cols = PAGE_QUADS;
+	hf->rows = g->rows - b->py * PAGE_QUADS;
+	if(hf->rows > PAGE_QUADS)
+		hf->rows = PAGE_QUADS;
+
+	setup_map_heightfield(g, hf, b->px * PAGE_QUADS, b->py * PAGE_QUADS);
+	for(r = 0; r <= hf->rows; r++) {
+		for(c = 0; c <= hf->cols; c++)
+			HEIGHTFIELD_SAMPLE(hf, c, r) = (float)p->samples[r * stride + c] / g->zdiv;
+	}
+	setup_heightfield_planes(hf, 0, hf->rows);
+	update_heightfield_bounds(hf);
+}
+
+/*
+ * move loaded pages into their slots; the slot's old heightfield
+ * is handed back to the buffer for the loader to reuse.
+ * called on the render thread with the lock held
+ */
+static void
+apply_loaded_pages(struct terrain_pager *p)
+{
+	int i;
+	struct page_buffer *b;
+	struct page_slot *s;
+	struct heightfield tmp;
+	struct object *o;
+
+	for(i = 0; i < NUM_PAGE_BUFFERS; i++) {
+		b = &p->buffers[i];
+		if(b->state != BUFFER_READY)
+			continue;
+
+		b->state = BUFFER_FREE;
+		if(!page_is_wanted(p, b->px, b->py, 0.5f * p->page_size) || b->hf.cols == 0)
+			continue;
+
+		s = get_page_slot(p, b->px, b->py);
+		if(s->px != -1)
+			unlink_page_slot(p, s);
+
+		o = get_object(s->object);
+		tmp = *(struct heightfield *)o->aux;
+		*(struct heightfield *)o->aux = b->hf;
+		b->hf = tmp;
+
+		s->px = b->px;
+		s->py = b->py;
+		link_page_slot(p, s);
+		p->pages_loaded++;
+	}
+}
+
+/* unlink pages that are beyond the view distance */
+static void
+evict_pages(struct terrain_pager *p)
+{
+	int i;
+	struct page_slot *s;
+
+	for(i = 0; i < p->ring * p->ring; i++) {
+		s = &p->slots[i];
+		if(s->px != -1 && !page_is_wanted(p, s->px, s->py, 0.5f * p->page_size)) {
+			unlink_page_slot(p, s);
+			p->pages_evicted++;
+		}
+	}
+}
+
+/*
+ * rebuild the octree around the page the camera is over and
+ * relink the resident pages into it
+ */
+static void
+recenter_terrain_pager(struct terrain_pager *p)
+{
+	int i;
+	float size;
+
+	p->window_x = p->center_x - p->window / 2;
+	p->window_y = p->center_y - p->window / 2;
+
+	free_octree_branch(p->octree);
+	size = p->page_size * (float)p->window;
+	p->octree = new_octree_branch(NULL,
+	                              page_edge_x(p, p->window_x),
+	                              page_edge_x(p, p->window_x + p->window),
+	                              page_edge_y(p, p->window_y),
+	                              page_edge_y(p, p->window_y + p->window),
+	                              -size / 2.0f, size / 2.0f);
+
+	for(i = 0; i < p->ring * p->ring; i++) {
+		if(p->slots[i].px != -1)
+			link_page_slot(p, &p->slots[i]);
+	}
+	evict_pages(p);
+}
+
+static void
+move_terrain_pager(struct terrain_pager *p, float v[3])
+{
+	float dx, dy, len;
+	int cx, cy;
+
+	dx = v[0] - p->position[0];
+	dy = v[1] - p->position[1];
+	len = sqrtf(dx * dx + dy * dy);
+	if(len > 0.001f) {
+		p->heading[0] = dx / len;
+		p->heading[1] = dy / len;
+	}
+
+	p->position[0] = v[0];
+	p->position[1] = v[1];
+	p->ahead[0] = v[0] + p->heading[0] * p->page_size;
+	p->ahead[1] = v[1] + p->heading[1] * p->page_size;
+
+	cx = page_x_from_point(p, v[0]);
+	cy = page_y_from_point(p, v[1]);
+	if(cx != p->center_x || cy != p->center_y || !p->octree) {
+		p->center_x = cx;
+		p->center_y = cy;
+		recenter_terrain_pager(p);
+	}
+}
+
+static void *
+pager_thread(void *arg)
+{
+	struct terrain_pager *p = arg;
+	struct page_buffer *b;
+	int px, py;
+
+	pthread_mutex_lock(&p->lock);
+	while(!p->quit) {
+		b = get_free_page_buffer(p);
+		if(!b || !find_wanted_page(p, &px, &py)) {
+			pthread_cond_wait(&p->wake, &p->lock);
+			continue;
+		}
+
+		b->state = BUFFER_LOADING;
+		b->px = px;
+		b->py = py;
+
+		/* the lock isn't held during i/o */
+		pthread_mutex_unlock(&p->lock);
+		load_page(p, b);
+		pthread_mutex_lock(&p->lock);
+
+		b->state = BUFFER_READY;
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+/*
+ * tell the pager where the camera is; loaded pages are swapped
+ * in and distant ones are evicted. called once per frame on the
+ * render thread. if the loader happens to hold the lock, the
+ * update is skipped rather than waited for
+ */
+void
+update_terrain_pager(struct terrain_pager *p, float v[3])
+{
+	if(!p)
+		return;
+
+	if(pthread_mutex_trylock(&p->lock) != 0)
+		return;
+
+	move_terrain_pager(p, v);
+	apply_loaded_pages(p);
+	evict_pages(p);
+
+	pthread_cond_signal(&p->wake);
+	pthread_mutex_unlock(&p->lock);
+}
+
+struct octree_node *
+get_terrain_pager_octree(struct terrain_pager *p)
+{
+	return p ? p->octree : NULL;
+}
+
+/*
+ * get the height and normal of the terrain at x, y from the page
+ * it's in; returns 0 if that page isn't resident. called on the
+ * render thread, which is the only thread that changes the slots
+ */
+int
+get_terrain_pager_height(struct terrain_pager *p, float x, float y, float *z, float n[3])
+{
+	struct page_slot *s;
+	int px, py;
+
+	if(!p)
+		return 0;
+
+	px = page_x_from_point(p, x);
+	py = page_y_from_point(p, y);
+	if(px < 0 || py < 0 || px >= (int)p->h.pages_x || py >= (int)p->h.pages_y)
+		return 0;
+
+	s = get_page_slot(p, px, py);
+	if(s->px != px || s->py != py)
+		return 0;
+
+	return get_heightfield_height(get_object(s->object)->aux, x, y, z, n);
+}
+
+/*
+ * open the page file for a heightmap, baking it first if it's
+ * missing or older than the heightmap, and load the pages around
+ * v before starting the loader thread
+ */
+struct terrain_pager *
+open_terrain_pager(const char *filename, float v[3], float view_distance)
+{
+	struct terrain_pager *p;
+	struct page_slot *s;
+	struct heightfield *hf;
+	struct object *o;
+	char pagename[1024];
+	int i, px, py;
+
+	snprintf(pagename, sizeof(pagename), "%s%s", filename, PAGE_SUFFIX);
+	if(!is_cache_fresh(filename, pagename)) {
+		if(!bake_terrain_pages(filename, pagename))
+			return NULL;
+		fprintf(stderr, "%s baked to %s\n", filename, pagename);
+	}
+
+	p = calloc(1, sizeof(struct terrain_pager));
+	if(!p) {
+		fprintf(stderr, "Error: Couldn't allocate memory for terrain pager\n");
+		return NULL;
+	}
+
+	p->fd = open(pagename, O_RDONLY);
+	if(p->fd == -1) {
+		fprintf(stderr, "Error: Couldn't open %s\n", pagename);
+		free(p);
+		return NULL;
+	}
+	if(read(p->fd, &p->h, sizeof(p->h)) != sizeof(p->h) ||
+	   memcmp(p->h.magic, PAGE_FILE_MAGIC, sizeof(PAGE_FILE_MAGIC)) != 0 ||
+	   p->h.version != PAGE_FILE_VERSION || p->h.page_quads != PAGE_QUADS) {
+		fprintf(stderr, "Error: %s isn't a usable page file; remove it to rebake it\n", pagename);
+		close(p->fd);
+		free(p);
+		return NULL;
+	}
+
+	p->page_size = (float)(PAGE_QUADS * p->h.grid.tilesize) / p->h.grid.xydiv;
+	p->view_distance = view_distance;
+	p->reach = (int)ceilf(view_distance / p->page_size) + 1;
+	p->ring = p->reach * 2 + 1;
+	for(p->window = 1; p->window < (p->reach + 1) * 2; p->window *= 2)
+		;
+
+	/* every slot and buffer holds a whole page, so memory use is fixed */
+	p->slots = calloc(p->ring * p->ring, sizeof(struct page_slot));
+	p->samples = malloc((PAGE_QUADS + 1) * (PAGE_QUADS + 1));
+	if(!p->slots || !p->samples)
+		goto nomem;
+
+	for(i = 0; i < p->ring * p->ring; i++) {
+		s = &p->slots[i];
+		s->px = s->py = -1;
+
+		o = create_object(OBJ_HEIGHTFIELD);
+		if(!o)
+			goto nomem;
+		s->object = get_object_num(o);
+		o->render_separately = 0;
+		hf = o->aux;
+		if(!init_heightfield(hf, PAGE_QUADS, PAGE_QUADS))
+			goto nomem;
+		hf->cols = hf->rows = 0; /* nothing resident yet */
+	}
+	for(i = 0; i < NUM_PAGE_BUFFERS; i++) {
+		if(!init_heightfield(&p->buffers[i].hf, PAGE_QUADS, PAGE_QUADS))
+			goto nomem;
+	}
+
+	p->position[0] = v[0];
+	p->position[1] = v[1];
+	move_terrain_pager(p, v);
+
+	/* load the pages around the starting point before drawing anything */
+	while(find_wanted_page(p, &px, &py)) {
+		p->buffers[0].px = px;
+		p->buffers[0].py = py;
+		load_page(p, &p->buffers[0]);
+		p->buffers[0].state = BUFFER_READY;
+		apply_loaded_pages(p);
+	}
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->wake, NULL);
+	if(pthread_create(&p->thread, NULL, pager_thread, p) != 0) {
+		fprintf(stderr, "Error: Couldn't start terrain pager thread\n");
+		close_terrain_pager(p);
+		return NULL;
+	}
+	p->thread_running = 1;
+
+	fprintf(stderr, "%s: %u x %u pages of %d x %d quads, %d x %d resident (%.1f MB)\n",
+	        pagename, p->h.pages_x, p->h.pages_y, PAGE_QUADS, PAGE_QUADS,
+	        p->ring, p->ring,
+	        (double)((p->ring * p->ring + NUM_PAGE_BUFFERS) *
+	                 get_heightfield_data_size(PAGE_QUADS, PAGE_QUADS)) / (1024.0 * 1024.0));
+
+	return p;
+
+nomem:
+	fprintf(stderr, "Error: Couldn't allocate memory for terrain pages\n");
+	p->thread_running = 0;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->wake, NULL);
+	close_terrain_pager(p);
+	return NULL;
+}
+
+/*
+ * stop the loader and free the pager; the slots' heightfields
+ * are freed along with all other objects
+ */
+void
+close_terrain_pager(struct terrain_pager *p)
+{
+	int i;
+
+	if(!p)
+		return;
+
+	if(p->thread_running) {
+		pthread_mutex_lock(&p->lock);
+		p->quit = 1;
+		pthread_cond_signal(&p->wake);
+		pthread_mutex_unlock(&p->lock);
+		pthread_join(p->thread, NULL);
+		fprintf(stderr, "terrain pager: %u pages loaded, %u evicted\n",
+		        p->pages_loaded, p->pages_evicted);
+	}
+
+	for(i = 0; i < NUM_PAGE_BUFFERS; i++)
+		free_heightfield_data(&p->buffers[i].hf);
+
+	free_octree_branch(p->octree);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->wake);
+	free(p->slots);
+	free(p->samples);
+	close(p->fd);
+	free(p);
+}
+
+/*
+ * split a heightmap into a page file; the heightmap is read a
+ * row at a time and only one row of pages is kept in memory, so
+ * heightmaps of any size can be baked
+ */
+int
+bake_terrain_pages(const char *filename, const char *pagename)
+{
+	struct page_file_header h;
+	struct map_grid *g = &h.grid;
+	unsigned int width, height, channels;
+	unsigned int stride, pr, px, r, c, first, last, pixel_row, sr, sc;
+	unsigned char *row = NULL, *band = NULL, *page = NULL;
+	char tmpname[1024];
+	void *png;
+	FILE *fp = NULL;
+
+	png = open_png_rows(filename, &width, &height, &channels);
+	if(!png) {
+		fprintf(stderr, "Error: Couldn't load heightmap %s\n", filename);
+		return 0;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, PAGE_FILE_MAGIC, sizeof(PAGE_FILE_MAGIC));
+	h.version = PAGE_FILE_VERSION;
+	h.page_quads = PAGE_QUADS;
+	init_map_grid(g, width, height, PAGE_TILESIZE);
+	h.pages_x = (g->cols + PAGE_QUADS - 1) / PAGE_QUADS;
+	h.pages_y = (g->rows + PAGE_QUADS - 1) / PAGE_QUADS;
+
+	stride = g->cols + 1; /* samples in a row of the band */
+	row = malloc(width * channels);
+	band = malloc((PAGE_QUADS + 1) * stride);
+	page = malloc((PAGE_QUADS + 1) * (PAGE_QUADS + 1));
+	if(!row || !band || !page) {
+		fprintf(stderr, "Error: Couldn't allocate memory for terrain pages\n");
+		goto error;
+	}
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", pagename);
+	fp = fopen(tmpname, "wb");
+	if(!fp) {
+		fprintf(stderr, "Error: Couldn't open %s for writing\n", tmpname);
+		goto error;
+	}
+	if(fwrite(&h, sizeof(h), 1, fp) != 1)
+		goto writeerror;
+
+	pixel_row = 0; /* rows read from the heightmap so far */
+	for(pr = 0; pr < h.pages_y; pr++) {
+		/* sample rows first to last of the heightmap */
+		first = pr * PAGE_QUADS;
+		last = first + PAGE_QUADS;
+		if(last > g->rows)
+			last = g->rows;
+
+		for(r = first; r <= last; r++) {
+			/* the first row is the last row of the previous band */
+			if(pr > 0 && r == first) {
+				memcpy(band, band + PAGE_QUADS * stride, stride);
+				continue;
+			}
+
+			while(pixel_row <= r * g->tilesize) {
+				if(!read_png_row(png, row)) {
+					fprintf(stderr, "Error: Couldn't read heightmap %s\n", filename);
+					goto error;
+				}
+				pixel_row++;
+			}
+			for(c = 0; c <= g->cols; c++)
+				band[(r - first) * stride + c] = row[c * g->tilesize * channels];
+		}
+
+		/* samples past the edge of the map repeat the last one */
+		for(px = 0; px < h.pages_x; px++) {
+			for(r = 0; r <= PAGE_QUADS; r++) {
+				sr = (first + r > last) ? last - first : r;
+				for(c = 0; c <= PAGE_QUADS; c++) {
+					sc = px * PAGE_QUADS + c;
+					if(sc > g->cols)
+						sc = g->cols;
+					page[r * (PAGE_QUADS + 1) + c] = band[sr * stride + sc];
+				}
+			}
+			if(fwrite(page, (PAGE_QUADS + 1) * (PAGE_QUADS + 1), 1, fp) != 1)
+				goto writeerror;
+		}
+	}
+
+	close_png_rows(png);
+	free(row);
+	free(band);
+	free(page);
+	if(fclose(fp) != 0 || rename(tmpname, pagename) != 0) {
+		fprintf(stderr, "Error: Couldn't write %s\n", pagename);
+		unlink(tmpname);
+		return 0;
+	}
+
+	return 1;
+
+writeerror:
+	fprintf(stderr, "Error: Couldn't write %s\n", pagename);
+error:
+	close_png_rows(png);
+	free(row);
+	free(band);
+	free(page);
+	if(fp) {
+		fclose(fp);
+		unlink(tmpname);
+	}
+	return 0;
+}
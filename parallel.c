@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "parallel.h"
+
+struct parallel_thread {
+	parallel_job job;
+	void *arg;
+	unsigned int num;
+};
+
+struct parallel_pool_thread {
+	struct parallel_pool *pool;
+	unsigned int num;
+	pthread_t thread;
+	int started;
+};
+
+struct parallel_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned int num_threads;
+	struct parallel_pool_thread *threads; /* thread 0 is the caller's, and isn't started */
+
+	parallel_job job;
+	void *arg;
+	unsigned int generation; /* goes up by one for each job */
+	unsigned int running;    /* pool threads still on the current job */
+	int quit;
+};
+
+/* return the number of online processors (at least 1) */
+unsigned int
+get_num_cpus()
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1)
+		return 1;
+
+	return (unsigned int)n;
+}
+
+static void *
+parallel_thread_main(void *arg)
+{
+	struct parallel_thread *t = arg;
+
+	t->job(t->arg, t->num);
+
+	return NULL;
+}
+
+/*
+ * run job on num_threads threads and wait for all of them
+ * to finish; thread 0 is the calling thread. if a thread
+ * can't be created, its share of the work is done by the
+ * calling thread instead, so the job always runs exactly
+ * once for every thread number
+ */
+void
+run_parallel(parallel_job job, void *arg, unsigned int num_threads)
+{
+	unsigned int i;
+	pthread_t *threads;
+	struct parallel_thread *t;
+	int *started;
+
+	if(num_threads <= 1) {
+		job(arg, 0);
+		return;
+	}
+
+	threads = malloc(sizeof(pthread_t) * num_threads);
+	t = malloc(sizeof(struct parallel_thread) * num_threads);
+	started = malloc(sizeof(int) * num_threads);
+	if(!threads || !t || !started) {
+		fprintf(stderr, "Error: Couldn't allocate memory for threads; running serially\n");
+		free(threads);
+		free(t);
+		free(started);
+		for(i = 0; i < num_threads; i++)
+			job(arg, i);
+		return;
+	}
+
+	for(i = 1; i < num_threads; i++) {
+		t[i].job = job;
+		t[i].arg = arg;
+		t[i].num = i;
+		started[i] = (pthread_create(&threads[i], NULL, parallel_thread_main, &t[i]) == 0);
+	}
+
+	job(arg, 0);
+
+	for(i = 1; i < num_threads; i++) {
+		if(started[i])
+			pthread_join(threads[i], NULL);
+		else
+			job(arg, i);
+	}
+
+	free(threads);
+	free(t);
+	free(started);
+}
+
+/* wait for each job and run it, until the pool is freed */
+static void *
+parallel_pool_main(void *arg)
+{
+	struct parallel_pool_thread *t = arg;
+	struct parallel_pool *p = t->pool;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&p->lock);
+	for(;;) {
+		while(!p->quit && p->generation == generation)
+			pthread_cond_wait(&p->start, &p->lock);
+		if(p->quit)
+			break;
+		generation = p->generation;
+		pthread_mutex_unlock(&p->lock);
+
+		p->job(p->arg, t->num);
+
+		pthread_mutex_lock(&p->lock);
+		if(--p->running == 0)
+			pthread_cond_signal(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+/*
+ * start a pool of num_threads threads, counting the caller's as
+ * thread 0. as with run_parallel, the share of a thread that can't
+ * be created is done by the calling thread
+ */
+struct parallel_pool *
+new_parallel_pool(unsigned int num_threads)
+{
+	struct parallel_pool *p;
+	unsigned int i;
+
+	if(num_threads < 1)
+		num_threads = 1;
+
+	p = malloc(sizeof(struct parallel_pool));
+	if(!p) {
+		fprintf(stderr, "Error: Couldn't allocate memory for thread pool\n");
+		return NULL;
+	}
+	p->threads = malloc(sizeof(struct parallel_pool_thread) * num_threads);
+	if(!p->threads) {
+		fprintf(stderr, "Error: Couldn't allocate memory for thread pool\n");
+		free(p);
+		return NULL;
+	}
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->done, NULL);
+	p->num_threads = num_threads;
+	p->job = NULL;
+	p->arg = NULL;
+	p->generation = 0;
+	p->running = 0;
+	p->quit = 0;
+
+	for(i = 0; i < num_threads; i++) {
+		p->threads[i].pool = p;
+		p->threads[i].num = i;
+		p->threads[i].started = (i > 0 && pthread_create(&p->threads[i].thread, NULL,
+		                                                 parallel_pool_main, &p->threads[i]) == 0);
+	}
+
+	return p;
+}
+
+/* stop a pool's threads once they've finished their job */
+void
+free_parallel_pool(struct parallel_pool *p)
+{
+	unsigned int i;
+
+	if(!p)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	for(i = 1; i < p->num_threads; i++) {
+		if(p->threads[i].started)
+			pthread_join(p->threads[i].thread, NULL);
+	}
+
+	pthread_cond_destroy(&p->start);
+	pthread_cond_destroy(&p->done);
+	pthread_mutex_destroy(&p->lock);
+	free(p->threads);
+	free(p);
+}
+
+/*
+ * run job once for each of a pool's threads, as run_parallel
+ * does, and wait for all of them to finish
+ */
+void
+run_parallel_pool(struct parallel_pool *p, parallel_job job, void *arg)
+{
+	unsigned int i, running = 0;
+
+	for(i = 1; i < p->num_threads; i++)
+		running += p->threads[i].started;
+
+	if(running > 0) {
+		pthread_mutex_lock(&p->lock);
+		p->job = job;
+		p->arg = arg;
+		p->running = running;
+		p->generation++;
+		pthread_cond_broadcast(&p->start);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	job(arg, 0);
+	for(i = 1; i < p->num_threads; i++) {
+		if(!p->threads[i].started)
+			job(arg, i);
+	}
+
+	if(running > 0) {
+		pthread_mutex_lock(&p->lock);
+		while(p->running > 0)
+			pthread_cond_wait(&p->done, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+	}
+}
+
+/* return wall clock time in milliseconds */
+double
+get_time_ms()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec * 1000.0 + (double)tv.tv_usec / 1000.0;
+}
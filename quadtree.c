@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <GL/gl.h>
+#include "object.h"
+#include "heightfield.h"
+#include "octree.h"
+#include "linoctree.h"
+#include "quadtree.h"
+#include "mesh.h"
+#include "map.h"
+#include "my_math.h"
+#include "parallel.h"
+
+/*
+ * count the nodes of the branch whose top left quad is (c, r) and
+ * that's size quads across, adding the ones that aren't leaves to
+ * *branches
+ */
+static unsigned int
+count_terrain_quadtree(struct heightfield *hf, unsigned int c, unsigned int r, unsigned int size,
+                       unsigned int *branches)
+{
+	unsigned int half;
+
+	if(c >= hf->cols || r >= hf->rows)
+		return 0;
+	if(size <= TERRAIN_QUADTREE_LEAF_QUADS)
+		return 1;
+
+	half = size / 2;
+	(*branches)++;
+	return 1 + count_terrain_quadtree(hf, c, r, half, branches) +
+	       count_terrain_quadtree(hf, c + half, r, half, branches) +
+	       count_terrain_quadtree(hf, c, r + half, half, branches) +
+	       count_terrain_quadtree(hf, c + half, r + half, half, branches);
+}
+
+/* work out the bounds of a leaf from the samples at the corners of its quads */
+static void
+fit_terrain_quadtree_leaf(struct heightfield *hf, struct terrain_quadtree_node *n)
+{
+	unsigned int c, r;
+	float z;
+
+	n->bounds[0] = hf->xs[n->firstc];
+	n->bounds[1] = hf->xs[n->lastc];
+	n->bounds[2] = hf->ys[n->firstr];
+	n->bounds[3] = hf->ys[n->lastr];
+	n->bounds[4] = n->bounds[5] = HEIGHTFIELD_SAMPLE(hf, n->firstc, n->firstr);
+	for(r = n->firstr; r <= n->lastr; r++) {
+		for(c = n->firstc; c <= n->lastc; c++) {
+			z = HEIGHTFIELD_SAMPLE(hf, c, r);
+			if(z < n->bounds[4])
+				n->bounds[4] = z;
+			if(z > n->bounds[5])
+				n->bounds[5] = z;
+		}
+	}
+}
+
+/* work out the bounds of an inner node, and copy its children's into its branch */
+static void
+fit_terrain_quadtree_node(struct terrain_quadtree *qt, unsigned int n)
+{
+	struct terrain_quadtree_node *on = &qt->nodes[n], *cn;
+	struct terrain_quadtree_branch *br = &qt->branches[on->branch];
+	unsigned int c, i, k;
+
+	memset(br, 0, sizeof(struct terrain_quadtree_branch));
+	memcpy(on->bounds, qt->nodes[n + 1].bounds, sizeof(on->bounds));
+	for(c = n + 1; c < on->skip; c = qt->nodes[c].skip) {
+		cn = &qt->nodes[c];
+		k = br->num_children++;
+		br->children[k] = c;
+		for(i = 0; i < 6; i += 2) {
+			br->bounds[i][k] = cn->bounds[i];
+			br->bounds[i + 1][k] = cn->bounds[i + 1];
+			if(cn->bounds[i] < on->bounds[i])
+				on->bounds[i] = cn->bounds[i];
+			if(cn->bounds[i + 1] > on->bounds[i + 1])
+				on->bounds[i + 1] = cn->bounds[i + 1];
+		}
+	}
+}
+
+static void
+fill_terrain_quadtree(struct terrain_quadtree *qt, unsigned int c, unsigned int r,
+                      unsigned int size, unsigned int *next, unsigned int *next_branch)
+{
+	struct heightfield *hf = qt->heightfield;
+	struct terrain_quadtree_node *n;
+	unsigned int num, half;
+
+	if(c >= hf->cols || r >= hf->rows)
+		return;
+
+	num = (*next)++;
+	n = &qt->nodes[num];
+	n->firstc = c;
+	n->firstr = r;
+	n->lastc = (c + size < hf->cols) ? c + size : hf->cols;
+	n->lastr = (r + size < hf->rows) ? r + size : hf->rows;
+
+	n->branch = 0;
+	if(size <= TERRAIN_QUADTREE_LEAF_QUADS) {
+		fit_terrain_quadtree_leaf(hf, n);
+		n->skip = *next;
+		return;
+	}
+	n->branch = (*next_branch)++;
+
+	/* children in Morton order: x is the lowest bit, then y */
+	half = size / 2;
+	fill_terrain_quadtree(qt, c, r, half, next, next_branch);
+	fill_terrain_quadtree(qt, c + half, r, half, next, next_branch);
+	fill_terrain_quadtree(qt, c, r + half, half, next, next_branch);
+	fill_terrain_quadtree(qt, c + half, r + half, half, next, next_branch);
+
+	qt->nodes[num].skip = *next;
+	fit_terrain_quadtree_node(qt, num);
+}
+
+/*
+ * build a quadtree over a heightfield's quads in one allocation;
+ * leaves are TERRAIN_QUADTREE_LEAF_QUADS quads across, or less at
+ * the heightfield's far edges. returns NULL on failure
+ */
+struct terrain_quadtree *
+build_terrain_quadtree(struct heightfield *hf)
+{
+	struct terrain_quadtree *qt;
+	unsigned int nodes, branches = 0, size, next = 0, next_branch = 0;
+
+	if(!hf || hf->cols == 0 || hf->rows == 0)
+		return NULL;
+
+	for(size = TERRAIN_QUADTREE_LEAF_QUADS; size < hf->cols || size < hf->rows; size *= 2)
+		;
+	nodes = count_terrain_quadtree(hf, 0, 0, size, &branches);
+
+	qt = malloc(sizeof(struct terrain_quadtree) + sizeof(struct terrain_quadtree_node) * nodes +
+	            sizeof(struct terrain_quadtree_branch) * branches);
+	if(!qt) {
+		fprintf(stderr, "Error: Couldn't allocate memory for terrain quadtree\n");
+		return NULL;
+	}
+
+	qt->num_nodes = nodes;
+	qt->num_branches = branches;
+	qt->heightfield = hf;
+	qt->nodes = (struct terrain_quadtree_node *)(qt + 1);
+	qt->branches = (struct terrain_quadtree_branch *)(qt->nodes + nodes);
+	fill_terrain_quadtree(qt, 0, 0, size, &next, &next_branch);
+
+	return qt;
+}
+
+void
+free_terrain_quadtree(struct terrain_quadtree *qt)
+{
+	free(qt);
+}
+
+static void
+refit_terrain_quadtree(struct terrain_quadtree *qt, unsigned int n, unsigned int firstc,
+                       unsigned int firstr, unsigned int lastc, unsigned int lastr)
+{
+	struct terrain_quadtree_node *on = &qt->nodes[n];
+	unsigned int c;
+
+	if(on->lastc <= firstc || on->firstc >= lastc || on->lastr <= firstr || on->firstr >= lastr)
+		return;
+
+	if(on->skip == n + 1) {
+		fit_terrain_quadtree_leaf(qt->heightfield, on);
+		return;
+	}
+
+	for(c = n + 1; c < on->skip; c = qt->nodes[c].skip)
+		refit_terrain_quadtree(qt, c, firstc, firstr, lastc, lastr);
+	fit_terrain_quadtree_node(qt, n);
+}
+
+/*
+ * refit the bounds of the nodes over quads [firstc, lastc) x
+ * [firstr, lastr) after their heights have changed
+ */
+void
+update_terrain_quadtree(struct terrain_quadtree *qt, unsigned int firstc, unsigned int firstr,
+                        unsigned int lastc, unsigned int lastr)
+{
+	if(!qt || qt->num_nodes == 0)
+		return;
+
+	refit_terrain_quadtree(qt, 0, firstc, firstr, lastc, lastr);
+}
+
+/* clip a range of quads along one side to the ones between min and max */
+static void
+clip_quad_range(float first, float quadsize, float min, float max,
+                unsigned int *from, unsigned int *to)
+{
+	float c;
+
+	c = floorf((min - first) / quadsize) - 1.0f;
+	if(c > (float)*from)
+		*from = (c < (float)*to) ? (unsigned int)c : *to;
+	c = floorf((max - first) / quadsize) + 1.0f;
+	if(c < (float)*to)
+		*to = (c > (float)*from) ? (unsigned int)c : *from;
+}
+
+/*
+ * get the quads of leaf n whose x and y could overlap box b, as
+ * [firstc, lastc) x [firstr, lastr); the heightfield's quads are
+ * all the same size, so they can be found without looking at them.
+ * returns 0 if there are none
+ */
+int
+get_terrain_quadtree_leaf_quads(struct terrain_quadtree *qt, unsigned int n, const float b[6],
+                                unsigned int *firstc, unsigned int *firstr,
+                                unsigned int *lastc, unsigned int *lastr)
+{
+	struct heightfield *hf = qt->heightfield;
+	struct terrain_quadtree_node *on = &qt->nodes[n];
+
+	*firstc = on->firstc;
+	*lastc = on->lastc;
+	*firstr = on->firstr;
+	*lastr = on->lastr;
+	clip_quad_range(hf->xs[0], hf->quadsize, b[0], b[1], firstc, lastc);
+	clip_quad_range(hf->ys[0], hf->quadsize, b[2], b[3], firstr, lastr);
+
+	return (*firstc < *lastc && *firstr < *lastr);
+}
+
+static void
+draw_terrain_quadtree_leaf(struct terrain_quadtree *qt, struct terrain_mesh *m, unsigned int n)
+{
+	struct terrain_quadtree_node *on = &qt->nodes[n];
+	unsigned int c, r;
+
+	if(m) {
+		draw_terrain_mesh_node(m, n);
+		return;
+	}
+
+	for(r = on->firstr; r < on->lastr; r++) {
+		for(c = on->firstc; c < on->lastc; c++)
+			draw_heightfield_quad(qt->heightfield, r * qt->heightfield->cols + c);
+	}
+	add_draw_stats(0, 4 * (on->lastc - on->firstc) * (on->lastr - on->firstr));
+}
+
+/* draw all of the leaves of the branch at node n */
+static void
+draw_terrain_quadtree_whole(struct terrain_quadtree *qt, struct terrain_mesh *m, unsigned int n)
+{
+	unsigned int i;
+
+	/* the branch's triangles are all together in the mesh */
+	if(m) {
+		draw_terrain_mesh_node(m, n);
+		return;
+	}
+
+	for(i = n; i < qt->nodes[n].skip; i++) {
+		if(qt->nodes[i].skip == i + 1)
+			draw_terrain_quadtree_leaf(qt, NULL, i);
+	}
+}
+
+/*
+ * cull the children of node n against the frustum planes it isn't
+ * entirely inside of, all at once, and draw the ones that are left
+ */
+static void
+draw_terrain_quadtree_branch(struct terrain_quadtree *qt, struct terrain_mesh *m, unsigned int n,
+                             unsigned int planes)
+{
+	struct terrain_quadtree_branch *br = &qt->branches[qt->nodes[n].branch];
+	unsigned int i, c, visible, left[4];
+
+	visible = cull_boxes_in_viewport(&br->bounds[0][0], 4, br->num_children, planes, left);
+	for(i = 0; i < br->num_children; i++) {
+		if(!(visible & (1 << i)))
+			continue;
+
+		c = br->children[i];
+		if(qt->nodes[c].skip == c + 1)
+			draw_terrain_quadtree_leaf(qt, m, c);
+		else if(left[i] == 0)
+			draw_terrain_quadtree_whole(qt, m, c);
+		else
+			draw_terrain_quadtree_branch(qt, m, c, left[i]);
+	}
+}
+
+/*
+ * draw the quads in the leaves that might be in the view frustum.
+ * siblings are culled together, and only against the planes their
+ * parent isn't entirely inside of; a branch that's inside all of
+ * them is drawn without any more tests. the quads are drawn from
+ * mesh m if there is one, and one by one with glVertex if not
+ */
+void
+draw_terrain_quadtree(struct terrain_quadtree *qt, struct terrain_mesh *m)
+{
+	unsigned int planes = VIEW_ALL_PLANES;
+	int result;
+
+	if(!qt || qt->num_nodes == 0)
+		return;
+
+	result = cull_box_in_viewport(qt->nodes[0].bounds, &planes);
+	if(result == VIEW_OUTSIDE)
+		return;
+
+	if(m) {
+		begin_terrain_mesh(m);
+	} else {
+		glBegin(GL_QUADS);
+		add_draw_stats(1, 0);
+	}
+
+	if(qt->nodes[0].skip == 1)
+		draw_terrain_quadtree_leaf(qt, m, 0);
+	else if(result == VIEW_INSIDE)
+		draw_terrain_quadtree_whole(qt, m, 0);
+	else
+		draw_terrain_quadtree_branch(qt, m, 0, planes);
+
+	if(m)
+		end_terrain_mesh(m);
+	else
+		glEnd();
+}
+
+static int
+is_box_overlapping(const float a[6], const float b[6])
+{
+	return (a[1] >= b[0] && a[0] <= b[1] && a[3] >= b[2] &&
+	        a[2] <= b[3] && a[5] >= b[4] && a[4] <= b[5]);
+}
+
+/* count the quads in a linear octree whose bounds overlap box b */
+static unsigned int
+count_linear_octree_box_quads(struct linear_octree *lo, float b[6])
+{
+	struct linear_octree_node *on;
+	unsigned int i, j, n = 0, *quads;
+	float qb[6];
+
+	for(i = 0; i < lo->num_nodes; ) {
+		on = &lo->nodes[i];
+		if(!is_box_overlapping(on->bounds, b)) {
+			i = on->skip;
+			continue;
+		}
+		quads = LINEAR_OCTREE_QUADS(lo, i);
+		for(j = 0; j < on->num_quads; j++) {
+			get_heightfield_quad_bounds(lo->heightfield, quads[j], qb);
+			n += is_box_overlapping(qb, b);
+		}
+		i++;
+	}
+
+	return n;
+}
+
+/* the same for a terrain quadtree */
+static unsigned int
+count_terrain_quadtree_box_quads(struct terrain_quadtree *qt, float b[6])
+{
+	struct terrain_quadtree_node *on;
+	unsigned int i, c, r, n = 0, firstc, firstr, lastc, lastr;
+	float qb[6];
+
+	for(i = 0; i < qt->num_nodes; ) {
+		on = &qt->nodes[i];
+		if(!is_box_overlapping(on->bounds, b)) {
+			i = on->skip;
+			continue;
+		}
+		if(on->skip == i + 1 &&
+		   get_terrain_quadtree_leaf_quads(qt, i, b, &firstc, &firstr, &lastc, &lastr)) {
+			for(r = firstr; r < lastr; r++) {
+				for(c = firstc; c < lastc; c++) {
+					get_heightfield_quad_bounds(qt->heightfield, r * qt->heightfield->cols + c, qb);
+					n += is_box_overlapping(qb, b);
+				}
+			}
+		}
+		i++;
+	}
+
+	return n;
+}
+
+/*
+ * compare a heightfield's quadtree with the linear copy of an
+ * octree holding the same quads: their size, and the box queries
+ * collision makes, which must find the same quads in both
+ */
+static void
+benchmark_terrain_layouts(const char *name, struct octree_node *root, struct heightfield *hf)
+{
+	struct linear_octree *lo;
+	struct terrain_quadtree *qt;
+	unsigned int i, n, num_boxes = 20000, mismatches = 0;
+	unsigned long found[2];
+	float b[6], p[3], size;
+	double t, built[2], times[2];
+
+	t = get_time_ms();
+	lo = build_linear_octree(root);
+	built[0] = get_time_ms() - t;
+	t = get_time_ms();
+	qt = build_terrain_quadtree(hf);
+	built[1] = get_time_ms() - t;
+	if(!lo || !qt) {
+		free_linear_octree(lo);
+		free_terrain_quadtree(qt);
+		return;
+	}
+
+	/* boxes four quads across at random points over the terrain */
+	size = hf->quadsize * 2.0f;
+	found[0] = found[1] = 0;
+	for(n = 0; n < 2; n++) {
+		srand(1);
+		t = get_time_ms();
+		for(i = 0; i < num_boxes; i++) {
+			p[0] = hf->xs[0] + (hf->xs[hf->cols] - hf->xs[0]) * rand() / (float)RAND_MAX;
+			p[1] = hf->ys[0] + (hf->ys[hf->rows] - hf->ys[0]) * rand() / (float)RAND_MAX;
+			p[2] = hf->minz + (hf->maxz - hf->minz) * rand() / (float)RAND_MAX;
+			b[0] = p[0] - size;
+			b[1] = p[0] + size;
+			b[2] = p[1] - size;
+			b[3] = p[1] + size;
+			b[4] = p[2] - size;
+			b[5] = p[2] + size;
+			found[n] += n ? count_terrain_quadtree_box_quads(qt, b) : count_linear_octree_box_quads(lo, b);
+		}
+		times[n] = get_time_ms() - t;
+	}
+	if(found[0] != found[1])
+		mismatches++;
+
+	printf("%s: %u x %u quads\n", name, hf->cols, hf->rows);
+	printf("                      octree     quadtree\n");
+	printf("nodes             %10u   %10u\n", lo->num_nodes, qt->num_nodes);
+	printf("size (KB)         %10.1f   %10.1f\n",
+	       (sizeof(struct linear_octree) + sizeof(struct linear_octree_node) * lo->num_nodes +
+	        sizeof(unsigned int) * lo->num_items) / 1024.0,
+	       (sizeof(struct terrain_quadtree) + sizeof(struct terrain_quadtree_node) * qt->num_nodes +
+	        sizeof(struct terrain_quadtree_branch) * qt->num_branches) / 1024.0);
+	printf("packed in (ms)    %10.2f   %10.2f\n", built[0], built[1]);
+	printf("box queries (us)  %10.2f   %10.2f\n", times[0] * 1e3 / num_boxes, times[1] * 1e3 / num_boxes);
+	printf("%lu quads found, %u differences between the two\n", found[0], mismatches);
+
+	free_linear_octree(lo);
+	free_terrain_quadtree(qt);
+}
+
+/*
+ * compare terrain quadtrees with octrees over a map and over a big
+ * synthetic heightfield put in an octree the way build_map does
+ */
+void
+benchmark_terrain_quadtree(const char *filename)
+{
+	struct map *m;
+	struct heightfield hf;
+	struct octree_node *root;
+
+	m = load_map(filename);
+	if(m) {
+		benchmark_terrain_layouts(filename, m->octree, m->heightfield);
+		free_map(m);
+	}
+
+	if(!init_hills_heightfield(&hf, 1024, 1024))
+		return;
+
+	root = build_heightfield_octree(&hf, get_num_cpus());
+	if(root) {
+		benchmark_terrain_layouts("synthetic hills", root, &hf);
+		free_octree_branch(root);
+	}
+	free_heightfield_data(&hf);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * a terrain quadtree is a 2.5D index over one heightfield's quads:
+ * it splits the quads into squares of rows and columns rather than
+ * splitting space into eighths, so there are no empty children
+ * above or below the terrain, and each node just keeps the range
+ * of heights under it. the nodes are in one array in depth first
+ * order with children in Morton order, like a linear octree, and a
+ * leaf's quads are the rectangle it covers, so nothing else is
+ * stored. each branch also keeps its children's bounds side by
+ * side, so that they can be culled all at once
+ */
+
+#define TERRAIN_QUADTREE_LEAF_QUADS 4 /* quads along the side of a leaf */
+
+struct terrain_quadtree_node {
+	float bounds[6]; /* min, max of x, y and z of the quads under it */
+	unsigned int skip; /* node after this branch; the next node if it's a leaf */
+	unsigned int firstc, firstr, lastc, lastr; /* quads [firstc, lastc) x [firstr, lastr) */
+	unsigned int branch; /* its entry in branches, if it isn't a leaf */
+};
+
+/* a branch's children, with their bounds in the order cull_boxes takes */
+struct terrain_quadtree_branch {
+	float bounds[6][4]; /* bounds[k][i] is bounds[k] of child i */
+	unsigned int children[4];
+	unsigned int num_children;
+};
+
+struct terrain_quadtree {
+	unsigned int num_nodes, num_branches;
+	struct heightfield *heightfield;
+	struct terrain_quadtree_node *nodes;
+	struct terrain_quadtree_branch *branches;
+};
+
+struct terrain_mesh; /* see mesh.h */
+
+struct terrain_quadtree *build_terrain_quadtree(struct heightfield *);
+void free_terrain_quadtree(struct terrain_quadtree *);
+int get_terrain_quadtree_leaf_quads(struct terrain_quadtree *, unsigned int, const float[6],
+                                    unsigned int *, unsigned int *, unsigned int *, unsigned int *);
+void update_terrain_quadtree(struct terrain_quadtree *, unsigned int, unsigned int, unsigned int, unsigned int);
+void draw_terrain_quadtree(struct terrain_quadtree *, struct terrain_mesh *);
+void benchmark_terrain_quadtree(const char *);
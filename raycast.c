@@ -0,0 +1,589 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * ray casts against heightfields. a ray is tested against the
+ * two triangles each quad is drawn as; the min/max height pyramid
+ * lets whole blocks of quads that the ray passes over or under be
+ * skipped, and blocks are visited nearest first so the search can
+ * stop at the first hit
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "object.h"
+#include "heightfield.h"
+#include "map.h"
+#include "raycast.h"
+#include "my_math.h"
+#include "parallel.h"
+
+#define RAYS_PER_THREAD 256 /* smallest batch worth its own thread */
+#define RAY_EPSILON 1e-6f
+
+struct ray {
+	float o[3], d[3];
+	float maxt;
+};
+
+struct raycast_job {
+	struct heightfield *hf;
+	struct height_pyramid *p;
+	float *origins, *dirs;
+	unsigned int num_rays, num_threads;
+	float maxt;
+	struct ray_hit *hits;
+	unsigned int found[64];
+};
+
+/* work out the lowest and highest samples of cell i, j of a level */
+static void
+setup_pyramid_cell(struct height_pyramid *p, struct heightfield *hf,
+                   unsigned int level, unsigned int i, unsigned int j)
+{
+	unsigned int c, r, lastc, lastr;
+	float *mm, *child, lo, hi, z;
+
+	mm = &p->minmax[level][(j * p->cols[level] + i) * 2];
+
+	if(level == 0) {
+		/* the samples around quads 2i, 2j to 2i + 1, 2j + 1 */
+		lastc = (i * 2 + 2 < hf->cols) ? i * 2 + 2 : hf->cols;
+		lastr = (j * 2 + 2 < hf->rows) ? j * 2 + 2 : hf->rows;
+		lo = hi = HEIGHTFIELD_SAMPLE(hf, i * 2, j * 2);
+		for(r = j * 2; r <= lastr; r++) {
+			for(c = i * 2; c <= lastc; c++) {
+				z = HEIGHTFIELD_SAMPLE(hf, c, r);
+				if(z < lo)
+					lo = z;
+				if(z > hi)
+					hi = z;
+			}
+		}
+	} else {
+		lastc = (i * 2 + 1 < p->cols[level - 1]) ? i * 2 + 1 : p->cols[level - 1] - 1;
+		lastr = (j * 2 + 1 < p->rows[level - 1]) ? j * 2 + 1 : p->rows[level - 1] - 1;
+		child = &p->minmax[level - 1][(j * 2 * p->cols[level - 1] + i * 2) * 2];
+		lo = child[0];
+		hi = child[1];
+		for(r = j * 2; r <= lastr; r++) {
+			for(c = i * 2; c <= lastc; c++) {
+				child = &p->minmax[level - 1][(r * p->cols[level - 1] + c) * 2];
+				if(child[0] < lo)
+					lo = child[0];
+				if(child[1] > hi)
+					hi = child[1];
+			}
+		}
+	}
+
+	mm[0] = lo;
+	mm[1] = hi;
+}
+
+/* build a pyramid over a heightfield; returns NULL on failure */
+struct height_pyramid *
+build_height_pyramid(struct heightfield *hf)
+{
+	struct height_pyramid *p;
+	unsigned int l, cols, rows;
+
+	if(hf->cols == 0 || hf->rows == 0)
+		return NULL;
+
+	p = calloc(1, sizeof(struct height_pyramid));
+	if(!p) {
+		fprintf(stderr, "Error: Couldn't allocate memory for height pyramid\n");
+		return NULL;
+	}
+
+	cols = hf->cols;
+	rows = hf->rows;
+	for(l = 0; l < HEIGHT_PYRAMID_MAX_LEVELS; l++) {
+		cols = (cols + 1) / 2;
+		rows = (rows + 1) / 2;
+		p->cols[l] = cols;
+		p->rows[l] = rows;
+		p->minmax[l] = malloc(sizeof(float) * 2 * cols * rows);
+		if(!p->minmax[l]) {
+			fprintf(stderr, "Error: Couldn't allocate memory for height pyramid\n");
+			p->num_levels = l;
+			free_height_pyramid(p);
+			return NULL;
+		}
+		p->num_levels++;
+
+		if(cols == 1 && rows == 1)
+			break;
+	}
+
+	update_height_pyramid(p, hf, 0, 0, hf->cols + 1, hf->rows + 1);
+	return p;
+}
+
+/*
+ * update the cells over samples firstc to lastc - 1 of rows firstr
+ * to lastr - 1 after their heights have changed
+ */
+void
+update_height_pyramid(struct height_pyramid *p, struct heightfield *hf,
+                      unsigned int firstc, unsigned int firstr,
+                      unsigned int lastc, unsigned int lastr)
+{
+	unsigned int l, i, j, i0, j0, i1, j1;
+
+	if(!p)
+		return;
+
+	/* the quads the samples are corners of, then the cells over them */
+	i0 = (firstc ? firstc - 1 : 0) / 2;
+	j0 = (firstr ? firstr - 1 : 0) / 2;
+	i1 = ((lastc < hf->cols) ? lastc : hf->cols) - 1;
+	j1 = ((lastr < hf->rows) ? lastr : hf->rows) - 1;
+	i1 /= 2;
+	j1 /= 2;
+
+	for(l = 0; l < p->num_levels; l++) {
+		for(j = j0; j <= j1 && j < p->rows[l]; j++) {
+			for(i = i0; i <= i1 && i < p->cols[l]; i++)
+				setup_pyramid_cell(p, hf, l, i, j);
+		}
+
+		i0 /= 2;
+		j0 /= 2;
+		i1 /= 2;
+		j1 /= 2;
+	}
+}
+
+void
+free_height_pyramid(struct height_pyramid *p)
+{
+	unsigned int l;
+
+	if(!p)
+		return;
+
+	for(l = 0; l < p->num_levels; l++)
+		free(p->minmax[l]);
+	free(p);
+}
+
+/*
+ * get the distance along the ray to where it enters box b (minx,
+ * maxx, miny, maxy, minz, maxz); returns 0 if it misses the box
+ * within the length of the ray
+ */
+static int
+ray_box(struct ray *ray, float b[6], float *tmin)
+{
+	int a;
+	float tn = 0.0f, tf = ray->maxt, t1, t2, tmp;
+
+	for(a = 0; a < 3; a++) {
+		if(ray->d[a] == 0.0f) {
+			if(ray->o[a] < b[a * 2] || ray->o[a] > b[a * 2 + 1])
+				return 0;
+			continue;
+		}
+
+		t1 = (b[a * 2] - ray->o[a]) / ray->d[a];
+		t2 = (b[a * 2 + 1] - ray->o[a]) / ray->d[a];
+		if(t1 > t2) {
+			tmp = t1;
+			t1 = t2;
+			t2 = tmp;
+		}
+		if(t1 > tn)
+			tn = t1;
+		if(t2 < tf)
+			tf = t2;
+		if(tn > tf)
+			return 0;
+	}
+
+	*tmin = tn;
+	return 1;
+}
+
+/* intersect the ray with triangle v0 v1 v2, keeping it if it's nearest */
+static void
+ray_triangle(struct ray *ray, float v0[3], float v1[3], float v2[3],
+             unsigned int q, struct ray_hit *hit)
+{
+	float e1[3], e2[3], pv[3], tv[3], qv[3];
+	float det, u, v, t;
+	int i;
+
+	for(i = 0; i < 3; i++) {
+		e1[i] = v1[i] - v0[i];
+		e2[i] = v2[i] - v0[i];
+	}
+
+	cross_product(pv, ray->d, e2);
+	det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+	if(det > -RAY_EPSILON && det < RAY_EPSILON)
+		return;
+
+	for(i = 0; i < 3; i++)
+		tv[i] = ray->o[i] - v0[i];
+	u = (tv[0] * pv[0] + tv[1] * pv[1] + tv[2] * pv[2]) / det;
+	if(u < -RAY_EPSILON || u > 1.0f + RAY_EPSILON)
+		return;
+
+	cross_product(qv, tv, e1);
+	v = (ray->d[0] * qv[0] + ray->d[1] * qv[1] + ray->d[2] * qv[2]) / det;
+	if(v < -RAY_EPSILON || u + v > 1.0f + RAY_EPSILON)
+		return;
+
+	t = (e2[0] * qv[0] + e2[1] * qv[1] + e2[2] * qv[2]) / det;
+	if(t < 0.0f || t >= hit->t)
+		return;
+
+	hit->hit = 1;
+	hit->t = t;
+	hit->quad = q;
+	for(i = 0; i < 3; i++)
+		hit->point[i] = ray->o[i] + ray->d[i] * t;
+
+	/* the normal faces up, whichever side the ray came from */
+	cross_product(hit->normal, e1, e2);
+	if(hit->normal[2] < 0.0f) {
+		for(i = 0; i < 3; i++)
+			hit->normal[i] = -hit->normal[i];
+	}
+	normalize(hit->normal);
+}
+
+/* intersect the ray with the two triangles quad q is drawn as */
+static void
+ray_quad(struct heightfield *hf, struct ray *ray, unsigned int q, struct ray_hit *hit)
+{
+	struct vertex v[4];
+
+	get_heightfield_quad_vertices(hf, q, v);
+	ray_triangle(ray, v[0].point, v[1].point, v[2].point, q, hit);
+	ray_triangle(ray, v[0].point, v[2].point, v[3].point, q, hit);
+}
+
+/* get the bounds of cell i, j of a pyramid level */
+static void
+get_pyramid_cell_box(struct height_pyramid *p, struct heightfield *hf,
+                     unsigned int level, unsigned int i, unsigned int j, float b[6])
+{
+	unsigned int c0, c1, r0, r1;
+	float *mm;
+
+	c0 = i << (level + 1);
+	r0 = j << (level + 1);
+	c1 = (i + 1) << (level + 1);
+	r1 = (j + 1) << (level + 1);
+	if(c1 > hf->cols)
+		c1 = hf->cols;
+	if(r1 > hf->rows)
+		r1 = hf->rows;
+
+	mm = &p->minmax[level][(j * p->cols[level] + i) * 2];
+	b[0] = hf->xs[c0];
+	b[1] = hf->xs[c1];
+	b[2] = hf->ys[r0];
+	b[3] = hf->ys[r1];
+	b[4] = mm[0];
+	b[5] = mm[1];
+}
+
+/*
+ * search cell i, j of a level; its children are visited in the
+ * order the ray enters them, and the search stops as soon as the
+ * nearest hit so far is nearer than the next child
+ */
+static void
+raycast_cell(struct heightfield *hf, struct height_pyramid *p, struct ray *ray,
+             unsigned int level, unsigned int i, unsigned int j, struct ray_hit *hit)
+{
+	unsigned int c, r, n, k, ci[4], cj[4];
+	float b[6], t, ts[4];
+
+	if(level == 0) {
+		for(r = j * 2; r < j * 2 + 2 && r < hf->rows; r++) {
+			for(c = i * 2; c < i * 2 + 2 && c < hf->cols; c++)
+				ray_quad(hf, ray, r * hf->cols + c, hit);
+		}
+		return;
+	}
+
+	n = 0;
+	for(r = j * 2; r < j * 2 + 2 && r < p->rows[level - 1]; r++) {
+		for(c = i * 2; c < i * 2 + 2 && c < p->cols[level - 1]; c++) {
+			get_pyramid_cell_box(p, hf, level - 1, c, r, b);
+			if(!ray_box(ray, b, &t))
+				continue;
+
+			/* insert in order of entry */
+			for(k = n; k > 0 && ts[k - 1] > t; k--) {
+				ts[k] = ts[k - 1];
+				ci[k] = ci[k - 1];
+				cj[k] = cj[k - 1];
+			}
+			ts[k] = t;
+			ci[k] = c;
+			cj[k] = r;
+			n++;
+		}
+	}
+
+	for(k = 0; k < n; k++) {
+		if(ts[k] > hit->t)
+			break;
+		raycast_cell(hf, p, ray, level - 1, ci[k], cj[k], hit);
+	}
+}
+
+static void
+init_ray(struct ray *ray, float o[3], float d[3], float maxt, struct ray_hit *hit)
+{
+	memcpy(ray->o, o, sizeof(ray->o));
+	memcpy(ray->d, d, sizeof(ray->d));
+	ray->maxt = maxt;
+
+	memset(hit, 0, sizeof(struct ray_hit));
+	hit->t = maxt;
+}
+
+/*
+ * find the first point where the ray o + t * d, 0 <= t <= maxt,
+ * hits the heightfield; returns 1 and fills in hit if it does
+ */
+int
+raycast_heightfield(struct heightfield *hf, struct height_pyramid *p,
+                    float o[3], float d[3], float maxt, struct ray_hit *hit)
+{
+	struct ray ray;
+	float b[6], t;
+	unsigned int l;
+
+	init_ray(&ray, o, d, maxt, hit);
+	if(!p)
+		return raycast_heightfield_brute_force(hf, o, d, maxt, hit);
+
+	l = p->num_levels - 1;
+	get_pyramid_cell_box(p, hf, l, 0, 0, b);
+	if(ray_box(&ray, b, &t))
+		raycast_cell(hf, p, &ray, l, 0, 0, hit);
+
+	return hit->hit;
+}
+
+/* the same as raycast_heightfield, but testing every quad */
+int
+raycast_heightfield_brute_force(struct heightfield *hf, float o[3], float d[3],
+                                float maxt, struct ray_hit *hit)
+{
+	struct ray ray;
+	unsigned int q;
+
+	init_ray(&ray, o, d, maxt, hit);
+	for(q = 0; q < hf->cols * hf->rows; q++)
+		ray_quad(hf, &ray, q, hit);
+
+	return hit->hit;
+}
+
+/* cast a ray against a map's heightfield */
+int
+raycast_map(struct map *m, float o[3], float d[3], float maxt, struct ray_hit *hit)
+{
+	if(!m || !m->heightfield) {
+		memset(hit, 0, sizeof(struct ray_hit));
+		return 0;
+	}
+
+	return raycast_heightfield(m->heightfield, m->pyramid, o, d, maxt, hit);
+}
+
+static void
+raycast_band(void *arg, unsigned int n)
+{
+	struct raycast_job *job = arg;
+	unsigned int i, first, last, found = 0;
+
+	first = (unsigned int)((unsigned long)job->num_rays * n / job->num_threads);
+	last = (unsigned int)((unsigned long)job->num_rays * (n + 1) / job->num_threads);
+	for(i = first; i < last; i++)
+		found += raycast_heightfield(job->hf, job->p, &job->origins[i * 3],
+		                             &job->dirs[i * 3], job->maxt, &job->hits[i]);
+	job->found[n] = found;
+}
+
+/*
+ * cast num_rays rays with origins and directions packed 3 floats
+ * each, splitting them across up to num_threads threads (0 for one
+ * per processor); returns the number of rays that hit
+ */
+unsigned int
+raycast_heightfield_batch(struct heightfield *hf, struct height_pyramid *p,
+                          float *origins, float *dirs, unsigned int num_rays,
+                          float maxt, struct ray_hit *hits, unsigned int num_threads)
+{
+	struct raycast_job job;
+	unsigned int i, found = 0;
+
+	if(num_threads == 0)
+		num_threads = get_num_cpus();
+	if(num_threads > num_rays / RAYS_PER_THREAD)
+		num_threads = num_rays / RAYS_PER_THREAD;
+	if(num_threads > 64)
+		num_threads = 64;
+	if(num_threads < 1)
+		num_threads = 1;
+
+	job.hf = hf;
+	job.p = p;
+	job.origins = origins;
+	job.dirs = dirs;
+	job.num_rays = num_rays;
+	job.num_threads = num_threads;
+	job.maxt = maxt;
+	job.hits = hits;
+	run_parallel(raycast_band, &job, num_threads);
+
+	for(i = 0; i < num_threads; i++)
+		found += job.found[i];
+
+	return found;
+}
+
+/*
+ * make rays across a heightfield: most come down from above it
+ * at a slant like picking or projectiles would, the rest go across
+ * it near the ground like line of sight checks. maxt is 1
+ */
+static void
+make_rays(struct heightfield *hf, float *origins, float *dirs, unsigned int n)
+{
+	unsigned int i;
+	float w, h, *o, *d;
+
+	w = hf->xs[hf->cols] - hf->xs[0];
+	h = hf->ys[hf->rows] - hf->ys[0];
+
+	srand(1);
+	for(i = 0; i < n; i++) {
+		o = &origins[i * 3];
+		d = &dirs[i * 3];
+		o[0] = hf->xs[0] + w * rand() / (float)RAND_MAX;
+		o[1] = hf->ys[0] + h * rand() / (float)RAND_MAX;
+		if(i % 4 != 3) {
+			o[2] = hf->maxz + 10.0f;
+			d[0] = hf->xs[0] + w * rand() / (float)RAND_MAX - o[0];
+			d[1] = hf->ys[0] + h * rand() / (float)RAND_MAX - o[1];
+			d[2] = hf->minz - 1.0f - o[2];
+		} else {
+			o[2] = (hf->minz + hf->maxz) / 2.0f;
+			d[0] = hf->xs[0] + w * rand() / (float)RAND_MAX - o[0];
+			d[1] = hf->ys[0] + h * rand() / (float)RAND_MAX - o[1];
+			d[2] = 0.0f;
+		}
+	}
+}
+
+/* time brute force and pyramid ray casts against one heightfield */
+static void
+benchmark_heightfield_raycast(const char *name, struct heightfield *hf, unsigned int num_brute)
+{
+	struct height_pyramid *p;
+	struct ray_hit *hits, ref;
+	float *origins, *dirs;
+	unsigned int i, n = 100000, found, mismatches = 0;
+	double t, brute, single, threaded;
+	size_t size = 0;
+
+	p = build_height_pyramid(hf);
+	origins = malloc(sizeof(float) * 3 * n);
+	dirs = malloc(sizeof(float) * 3 * n);
+	hits = malloc(sizeof(struct ray_hit) * n);
+	if(!p || !origins || !dirs || !hits) {
+		fprintf(stderr, "Error: Couldn't allocate memory for ray benchmark\n");
+		goto done;
+	}
+	make_rays(hf, origins, dirs, n);
+
+	for(i = 0; i < p->num_levels; i++)
+		size += sizeof(float) * 2 * p->cols[i] * p->rows[i];
+
+	t = get_time_ms();
+	raycast_heightfield_batch(hf, p, origins, dirs, n, 1.0f, hits, 1);
+	single = get_time_ms() - t;
+
+	t = get_time_ms();
+	found = raycast_heightfield_batch(hf, p, origins, dirs, n, 1.0f, hits, 0);
+	threaded = get_time_ms() - t;
+
+	/* the pyramid has to find the same hits as testing every quad */
+	t = get_time_ms();
+	for(i = 0; i < num_brute; i++) {
+		raycast_heightfield_brute_force(hf, &origins[i * 3], &dirs[i * 3], 1.0f, &ref);
+		if(ref.hit != hits[i].hit || (ref.hit && fabsf(ref.t - hits[i].t) > 1e-5f))
+			mismatches++;
+	}
+	brute = get_time_ms() - t;
+
+	printf("%s: %u x %u quads, %u pyramid levels in %.1f KB\n", name, hf->cols, hf->rows,
+	       p->num_levels, size / 1024.0);
+	printf("  brute force %.2f us/ray (%u rays), pyramid %.2f us/ray, pyramid threaded %.2f us/ray\n",
+	       brute * 1000.0 / num_brute, num_brute, single * 1000.0 / n, threaded * 1000.0 / n);
+	printf("  %u of %u rays hit, %u differ from brute force\n", found, n, mismatches);
+
+done:
+	free_height_pyramid(p);
+	free(origins);
+	free(dirs);
+	free(hits);
+}
+
+/*
+ * time ray casts against a map and against a big synthetic
+ * heightfield, checking the pyramid against brute force
+ */
+void
+benchmark_raycast(const char *filename)
+{
+	struct map *m;
+	struct heightfield hf;
+
+	m = load_map(filename);
+	if(m) {
+		benchmark_heightfield_raycast(filename, m->heightfield, 2000);
+		free_map(m);
+	}
+
+	if(!init_hills_heightfield(&hf, 1024, 1024))
+		return;
+
+	benchmark_heightfield_raycast("synthetic hills", &hf, 20);
+	free_heightfield_data(&hf);
+}
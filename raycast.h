@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HEIGHT_PYRAMID_MAX_LEVELS 32
+
+/*
+ * a min/max height pyramid over a heightfield; a cell of level
+ * l covers 2^(l + 1) x 2^(l + 1) quads and holds the lowest and
+ * highest samples of those quads, so rays can skip over whole
+ * cells they pass above or below
+ */
+struct height_pyramid {
+	unsigned int num_levels;
+	unsigned int cols[HEIGHT_PYRAMID_MAX_LEVELS], rows[HEIGHT_PYRAMID_MAX_LEVELS];
+	float *minmax[HEIGHT_PYRAMID_MAX_LEVELS]; /* 2 floats per cell, row by row */
+};
+
+struct ray_hit {
+	int hit;
+	float t;         /* distance along the ray in lengths of its direction */
+	float point[3];
+	float normal[3];
+	unsigned int quad;
+};
+
+struct height_pyramid *build_height_pyramid(struct heightfield *);
+void update_height_pyramid(struct height_pyramid *, struct heightfield *, unsigned int, unsigned int, unsigned int, unsigned int);
+void free_height_pyramid(struct height_pyramid *);
+int raycast_heightfield(struct heightfield *, struct height_pyramid *, float[3], float[3], float, struct ray_hit *);
+int raycast_heightfield_brute_force(struct heightfield *, float[3], float[3], float, struct ray_hit *);
+unsigned int raycast_heightfield_batch(struct heightfield *, struct height_pyramid *, float *, float *, unsigned int, float, struct ray_hit *, unsigned int);
+int raycast_map(struct map *, float[3], float[3], float, struct ray_hit *);
+void benchmark_raycast(const char *);
@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * continuous collision of a moving sphere with the terrain. the
+ * sphere is swept along its whole motion against the quads in the
+ * octree or quadtree leaves under the path, so it can't pass through a slope
+ * however far it moves in one go, and it slides along whatever it
+ * touches instead of stopping dead
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "object.h"
+#include "heightfield.h"
+#include "octree.h"
+#include "quadtree.h"
+#include "sweep.h"
+#include "my_math.h"
+
+#define SWEEP_EPSILON 0.005f /* how far the sphere stops short of a contact */
+
+struct sweep {
+	struct octree_node *octree; /* what the sphere is swept through */
+	struct terrain_quadtree *quadtree;
+
+	float pos[3], vel[3]; /* the sphere moves from pos to pos + vel */
+	float radius;
+	float box[6];         /* bounds of the path */
+
+	int hit;
+	float t;              /* fraction of vel to the nearest contact */
+	float contact[3];
+};
+
+static float
+dot(float a[3], float b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+/* get the lowest root of a t^2 + b t + c between 0 and max */
+static int
+lowest_root(float a, float b, float c, float max, float *root)
+{
+	float det, sq, r1, r2, tmp;
+
+	det = b * b - 4.0f * a * c;
+	if(det < 0.0f || a == 0.0f)
+		return 0;
+
+	sq = sqrtf(det);
+	r1 = (-b - sq) / (2.0f * a);
+	r2 = (-b + sq) / (2.0f * a);
+	if(r1 > r2) {
+		tmp = r1;
+		r1 = r2;
+		r2 = tmp;
+	}
+
+	if(r1 > 0.0f && r1 < max) {
+		*root = r1;
+		return 1;
+	}
+	if(r2 > 0.0f && r2 < max) {
+		*root = r2;
+		return 1;
+	}
+	return 0;
+}
+
+static void
+set_contact(struct sweep *s, float t, float p[3])
+{
+	s->hit = 1;
+	s->t = t;
+	s->contact[0] = p[0];
+	s->contact[1] = p[1];
+	s->contact[2] = p[2];
+}
+
+/*
+ * is p, which is on the plane of triangle a b c with normal n,
+ * inside it? it is if it's on the same side of all three edges
+ */
+static int
+is_point_in_triangle(float p[3], float a[3], float b[3], float c[3], float n[3])
+{
+	float *v[3], e[3], d[3], x[3];
+	int i, j, above = 0, below = 0;
+
+	v[0] = a;
+	v[1] = b;
+	v[2] = c;
+	for(i = 0; i < 3; i++) {
+		for(j = 0; j < 3; j++) {
+			e[j] = v[(i + 1) % 3][j] - v[i][j];
+			d[j] = p[j] - v[i][j];
+		}
+		cross_product(x, e, d);
+		if(dot(x, n) > 0.0f)
+			above = 1;
+		else if(dot(x, n) < 0.0f)
+			below = 1;
+	}
+
+	return !(above && below);
+}
+
+/* sweep the sphere against an edge of a triangle */
+static void
+sweep_edge(struct sweep *s, float p1[3], float p2[3])
+{
+	float edge[3], bte[3], p[3];
+	float el2, ev, ebt, a, b, c, t, f;
+	int i;
+
+	for(i = 0; i < 3; i++) {
+		edge[i] = p2[i] - p1[i];
+		bte[i] = p1[i] - s->pos[i];
+	}
+	el2 = dot(edge, edge);
+	ev = dot(edge, s->vel);
+	ebt = dot(edge, bte);
+
+	a = el2 * -dot(s->vel, s->vel) + ev * ev;
+	b = el2 * 2.0f * dot(s->vel, bte) - 2.0f * ev * ebt;
+	c = el2 * (s->radius * s->radius - dot(bte, bte)) + ebt * ebt;
+	if(c > 0.0f) {
+		/* already touching the edge's line; stop if moving into it */
+		if(b <= 0.0f)
+			return;
+		t = 0.0f;
+	} else if(!lowest_root(a, b, c, s->t, &t)) {
+		return;
+	}
+
+	/* where along the edge it touches */
+	f = (ev * t - ebt) / el2;
+	if(f < 0.0f || f > 1.0f)
+		return;
+
+	for(i = 0; i < 3; i++)
+		p[i] = p1[i] + edge[i] * f;
+	set_contact(s, t, p);
+}
+
+/* sweep the sphere against a corner of a triangle */
+static void
+sweep_vertex(struct sweep *s, float p[3])
+{
+	float d[3], a, b, c, t;
+	int i;
+
+	for(i = 0; i < 3; i++)
+		d[i] = s->pos[i] - p[i];
+
+	a = dot(s->vel, s->vel);
+	b = 2.0f * dot(s->vel, d);
+	c = dot(d, d) - s->radius * s->radius;
+	if(c < 0.0f) {
+		/* already touching the corner; stop if moving into it */
+		if(b < 0.0f)
+			set_contact(s, 0.0f, p);
+	} else if(lowest_root(a, b, c, s->t, &t)) {
+		set_contact(s, t, p);
+	}
+}
+
+/*
+ * sweep the sphere against triangle a b c, keeping the contact if
+ * it's nearer than any so far. triangles only collide from above,
+ * so a sphere that has ended up under the terrain can get back out
+ */
+static void
+sweep_triangle(struct sweep *s, float a[3], float b[3], float c[3])
+{
+	float e1[3], e2[3], n[3], p[3];
+	float dist, nv, t0, t1, tmp;
+	int i, embedded = 0;
+
+	for(i = 0; i < 3; i++) {
+		e1[i] = b[i] - a[i];
+		e2[i] = c[i] - a[i];
+	}
+	cross_product(n, e1, e2);
+	if(n[2] < 0.0f) {
+		for(i = 0; i < 3; i++)
+			n[i] = -n[i];
+	}
+	normalize(n);
+
+	dist = dot(n, s->pos) - dot(n, a);
+	if(dist < 0.0f)
+		return;
+
+	/* moving away from or along the plane */
+	nv = dot(n, s->vel);
+	if(nv >= 0.0f)
+		return;
+
+	t0 = (s->radius - dist) / nv;
+	t1 = (-s->radius - dist) / nv;
+	if(t0 > t1) {
+		tmp = t0;
+		t0 = t1;
+		t1 = tmp;
+	}
+	if(t0 > 1.0f || t1 < 0.0f)
+		return;
+	if(t0 < 0.0f) {
+		embedded = 1;
+		t0 = 0.0f;
+	}
+	if(t0 >= s->t)
+		return;
+
+	/* where the sphere first touches the plane */
+	for(i = 0; i < 3; i++)
+		p[i] = s->pos[i] + s->vel[i] * t0 - n[i] * (embedded ? dist : s->radius);
+	if(is_point_in_triangle(p, a, b, c, n)) {
+		set_contact(s, t0, p);
+		return;
+	}
+
+	/* otherwise it can only touch a corner or an edge */
+	sweep_vertex(s, a);
+	sweep_vertex(s, b);
+	sweep_vertex(s, c);
+	sweep_edge(s, a, b);
+	sweep_edge(s, b, c);
+	sweep_edge(s, c, a);
+}
+
+/* sweep the sphere against the quads in a branch */
+static void
+sweep_branch(struct sweep *s, struct octree_node *on)
+{
+	struct vertex v[4];
+	float *b = on ? on->bounds : NULL;
+	float qb[6];
+	unsigned int i;
+
+	/* the bounds are around the quads themselves, wherever they reach */
+	if(!on || b[1] < s->box[0] || b[0] > s->box[1] || b[3] < s->box[2] ||
+	   b[2] > s->box[3] || b[5] < s->box[4] || b[4] > s->box[5])
+		return;
+
+	for(i = 0; i < on->num_quads; i++) {
+		get_heightfield_quad_bounds(on->heightfield, on->quads[i], qb);
+		if(qb[1] < s->box[0] || qb[0] > s->box[1] || qb[3] < s->box[2] ||
+		   qb[2] > s->box[3] || qb[5] < s->box[4] || qb[4] > s->box[5])
+			continue;
+
+		get_heightfield_quad_vertices(on->heightfield, on->quads[i], v);
+		sweep_triangle(s, v[0].point, v[1].point, v[2].point);
+		sweep_triangle(s, v[0].point, v[2].point, v[3].point);
+	}
+
+	for(i = 0; i < 8; i++)
+		sweep_branch(s, on->subnodes[i]);
+}
+
+/* sweep the sphere against the quads in the quadtree leaves under its path */
+static void
+sweep_quadtree(struct sweep *s, struct terrain_quadtree *qt)
+{
+	struct terrain_quadtree_node *on;
+	struct vertex v[4];
+	unsigned int i, c, r, q, firstc, firstr, lastc, lastr;
+	float *b;
+
+	for(i = 0; i < qt->num_nodes; ) {
+		on = &qt->nodes[i];
+		b = on->bounds;
+		if(b[1] < s->box[0] || b[0] > s->box[1] || b[3] < s->box[2] ||
+		   b[2] > s->box[3] || b[5] < s->box[4] || b[4] > s->box[5]) {
+			i = on->skip;
+			continue;
+		}
+
+		if(on->skip == i + 1 &&
+		   get_terrain_quadtree_leaf_quads(qt, i, s->box, &firstc, &firstr, &lastc, &lastr)) {
+			for(r = firstr; r < lastr; r++) {
+				for(c = firstc; c < lastc; c++) {
+					q = r * qt->heightfield->cols + c;
+					get_heightfield_quad_vertices(qt->heightfield, q, v);
+					sweep_triangle(s, v[0].point, v[1].point, v[2].point);
+					sweep_triangle(s, v[0].point, v[2].point, v[3].point);
+				}
+			}
+		}
+		i++;
+	}
+}
+
+/*
+ * move the sphere by motion through the octree or quadtree. at
+ * each contact the rest of the motion is slid along the surface
+ * touched, up to slides times; with no slides the sphere just
+ * stops at the first contact. pos is updated, and 1 is returned
+ * if the sphere touched anything
+ */
+static int
+sweep_sphere_through(struct sweep *s0, float pos[3], float radius, float motion[3], int slides)
+{
+	struct sweep s = *s0;
+	float dest[3], n[3], len, d;
+	int i, touched = 0;
+
+	s.radius = radius;
+	for(i = 0; i < 3; i++) {
+		s.pos[i] = pos[i];
+		s.vel[i] = motion[i];
+	}
+
+	for(;;) {
+		len = sqrtf(dot(s.vel, s.vel));
+		if(len < SWEEP_EPSILON)
+			break;
+
+		for(i = 0; i < 3; i++) {
+			dest[i] = s.pos[i] + s.vel[i];
+			s.box[i * 2] = ((s.pos[i] < dest[i]) ? s.pos[i] : dest[i]) - radius;
+			s.box[i * 2 + 1] = ((s.pos[i] > dest[i]) ? s.pos[i] : dest[i]) + radius;
+		}
+		s.hit = 0;
+		s.t = 1.0f;
+		if(s.quadtree)
+			sweep_quadtree(&s, s.quadtree);
+		else
+			sweep_branch(&s, s.octree);
+
+		if(!s.hit) {
+			for(i = 0; i < 3; i++)
+				s.pos[i] = dest[i];
+			break;
+		}
+		touched = 1;
+
+		/* stop just short of the contact */
+		d = len * s.t - SWEEP_EPSILON;
+		if(d < 0.0f)
+			d = 0.0f;
+		for(i = 0; i < 3; i++) {
+			n[i] = s.pos[i] + s.vel[i] * s.t - s.contact[i];
+			s.pos[i] += s.vel[i] / len * d;
+		}
+
+		d = sqrtf(dot(n, n));
+		if(slides-- <= 0 || d == 0.0f)
+			break;
+
+		/* slide what's left of the motion along the plane touched */
+		for(i = 0; i < 3; i++)
+			n[i] /= d;
+		for(i = 0; i < 3; i++)
+			s.vel[i] = dest[i] - s.pos[i];
+		d = dot(n, s.vel);
+		for(i = 0; i < 3; i++)
+			s.vel[i] -= n[i] * d;
+	}
+
+	for(i = 0; i < 3; i++)
+		pos[i] = s.pos[i];
+
+	return touched;
+}
+
+/*
+ * move a sphere of the given radius centred at pos by motion
+ * through the terrain in an octree; see sweep_sphere_through
+ */
+int
+sweep_sphere(struct octree_node *root, float pos[3], float radius,
+             float motion[3], int slides)
+{
+	struct sweep s;
+
+	s.octree = root;
+	s.quadtree = NULL;
+	return sweep_sphere_through(&s, pos, radius, motion, slides);
+}
+
+/* the same through the terrain in a quadtree */
+int
+sweep_sphere_quadtree(struct terrain_quadtree *qt, float pos[3], float radius,
+                      float motion[3], int slides)
+{
+	struct sweep s;
+
+	if(!qt)
+		return 0;
+
+	s.octree = NULL;
+	s.quadtree = qt;
+	return sweep_sphere_through(&s, pos, radius, motion, slides);
+}
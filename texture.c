@@ -25,15 +25,36 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <png.h>
 #include "texture.h"
+#include "mipmap.h"
 
 void *read_png(const char *, unsigned int *, unsigned int *, int *);
 
 static struct texture *textures = NULL;
 static unsigned int num_textures = 0;
 static unsigned int curr_gl_num = 0;
+static int compress_textures = 0;
+
+/* store textures DXT1 compressed, where GL can take them */
+void
+set_texture_compression(int c)
+{
+	compress_textures = c;
+}
+
+/* return 1 if GL takes DXT1 textures */
+static int
+has_dxt1_textures()
+{
+	const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+
+	return ext && strstr(ext, "GL_EXT_texture_compression_s3tc") != NULL;
+}
 
 static struct texture *
 create_texture_structure()
@@ -75,38 +96,54 @@ struct texture *
 load_texture_from_png(const char *filename)
 {
 	struct texture *newtexture;
-	unsigned int width, height;
-	int type;
-	unsigned char *data;
+	struct mipmap_chain *mips;
+	unsigned int i;
+	int compress;
 
 	if((newtexture = get_texture_with_name(filename)))
 		return newtexture;
 
-	data = (unsigned char *)read_png(filename, &width, &height, &type);
-	if(!data) {
+	compress = compress_textures && has_dxt1_textures();
+	if(compress_textures && !compress)
+		fprintf(stderr, "GL can't take DXT1 textures; %s won't be compressed\n", filename);
+
+	/* every level is filtered on the cpu, or read back from the cache beside the png */
+	mips = load_mipmap_chain(filename, compress);
+	if(!mips) {
 		fprintf(stderr, "Error: Couldn't load texture %s\n", filename);
 		return NULL;
 	}
 
 	newtexture = create_texture_structure();
-	if(!newtexture)
+	if(!newtexture) {
+		free_mipmap_chain(mips);
 		return NULL;
+	}
 
 	snprintf(newtexture->name, 256, "%s", filename);
 	newtexture->gl_num = curr_gl_num++;
-	newtexture->width = width;
-	newtexture->height = height;
+	newtexture->width = mips->widths[0];
+	newtexture->height = mips->heights[0];
 
 	glBindTexture(GL_TEXTURE_2D, newtexture->gl_num);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mips->num_levels - 1);
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+	for(i = 0; i < mips->num_levels; i++) {
+		if(mips->format == MIPMAP_DXT1)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, mips->widths[i],
+			                       mips->heights[i], 0, mips->offsets[i + 1] - mips->offsets[i],
+			                       mips->data + mips->offsets[i]);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, 3, mips->widths[i], mips->heights[i], 0, GL_RGBA,
+			             GL_UNSIGNED_BYTE, mips->data + mips->offsets[i]);
+	}
 
-	free(data);
+	free_mipmap_chain(mips);
 
 	return newtexture;
 }
@@ -180,3 +217,108 @@ read_png(const char *filename, unsigned int *widthp, unsigned int *heightp,
 
 	return data;
 }
+
+/* state for reading a png one row at a time */
+struct png_rows {
+	FILE *fp;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	unsigned int rowbytes;
+};
+
+/*
+ * open a png for reading one row at a time, so that images
+ * too big to decode at once can be processed; rows are
+ * converted to 8 bits per channel without alpha. returns
+ * NULL if the file can't be read or is interlaced
+ */
+void *
+open_png_rows(const char *filename, unsigned int *widthp, unsigned int *heightp,
+              unsigned int *channelsp)
+{
+	struct png_rows *r;
+	unsigned char header[8];
+	png_uint_32 width, height;
+	int bit_depth, color_type, interlace_method;
+
+	r = malloc(sizeof(struct png_rows));
+	if(!r)
+		return NULL;
+
+	r->fp = fopen(filename, "rb");
+	if(!r->fp) {
+		free(r);
+		return NULL;
+	}
+	if(fread(header, 1, 8, r->fp) != 8 || png_sig_cmp(header, 0, 8) != 0) {
+		fclose(r->fp);
+		free(r);
+		return NULL;
+	}
+
+	r->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if(!r->png_ptr) {
+		fclose(r->fp);
+		free(r);
+		return NULL;
+	}
+	r->info_ptr = png_create_info_struct(r->png_ptr);
+	if(!r->info_ptr || setjmp(png_jmpbuf(r->png_ptr))) {
+		png_destroy_read_struct(&r->png_ptr, r->info_ptr ? &r->info_ptr : (png_infopp)NULL, (png_infopp)NULL);
+		fclose(r->fp);
+		free(r);
+		return NULL;
+	}
+
+	png_init_io(r->png_ptr, r->fp);
+	png_set_sig_bytes(r->png_ptr, 8);
+	png_read_info(r->png_ptr, r->info_ptr);
+	png_get_IHDR(r->png_ptr, r->info_ptr, &width, &height, &bit_depth, &color_type, &interlace_method, NULL, NULL);
+	if(interlace_method != PNG_INTERLACE_NONE) {
+		fprintf(stderr, "Error: %s is interlaced\n", filename);
+		png_destroy_read_struct(&r->png_ptr, &r->info_ptr, (png_infopp)NULL);
+		fclose(r->fp);
+		free(r);
+		return NULL;
+	}
+
+	png_set_strip_alpha(r->png_ptr);
+	png_set_strip_16(r->png_ptr);
+	png_set_packing(r->png_ptr);
+	if(color_type == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(r->png_ptr);
+	png_read_update_info(r->png_ptr, r->info_ptr);
+
+	r->rowbytes = png_get_rowbytes(r->png_ptr, r->info_ptr);
+	*widthp = width;
+	*heightp = height;
+	*channelsp = png_get_channels(r->png_ptr, r->info_ptr);
+
+	return r;
+}
+
+/* read the next row into row; returns 1 on success */
+int
+read_png_row(void *handle, unsigned char *row)
+{
+	struct png_rows *r = handle;
+
+	if(setjmp(png_jmpbuf(r->png_ptr)))
+		return 0;
+
+	png_read_row(r->png_ptr, row, NULL);
+	return 1;
+}
+
+void
+close_png_rows(void *handle)
+{
+	struct png_rows *r = handle;
+
+	if(!r)
+		return;
+
+	png_destroy_read_struct(&r->png_ptr, &r->info_ptr, (png_infopp)NULL);
+	fclose(r->fp);
+	free(r);
+}
@@ -33,3 +33,4 @@ struct texture {
 struct texture *get_texture_with_name(const char *);
 struct texture *load_texture_from_png(const char *);
 void free_all_textures();
+void set_texture_compression(int);
@@ -0,0 +1,521 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * find what's in the view frustum of an octree on several threads.
+ * the walk is split into tasks, one for each node down to
+ * VISIBLE_TASK_DEPTH, below which a task walks the rest of its
+ * branch itself. each thread works through its own queue from the
+ * bottom, pushing the children of the nodes it visits, and a thread
+ * with nothing left steals from the top of the others' queues, where
+ * the biggest branches are. what a task finds goes on the end of
+ * its thread's lists, and the tasks' shares are put back together
+ * in the order of their paths down the tree, which is the order a
+ * walk on one thread would find everything in
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <pthread.h>
+#include <GL/gl.h>
+#include "object.h"
+#include "heightfield.h"
+#include "octree.h"
+#include "quadtree.h"
+#include "mesh.h"
+#include "map.h"
+#include "my_math.h"
+#include "frustum.h"
+#include "visible.h"
+#include "parallel.h"
+
+#define VISIBLE_TASK_DEPTH 5 /* nodes this deep are walked by the task that reaches them */
+
+struct visible_task {
+	struct octree_node *node;
+	unsigned int planes; /* frustum planes the node isn't known to be inside of */
+	unsigned int depth;
+	unsigned int path; /* child numbers down from the root, three bits each */
+};
+
+/* what one task found, at first_object and first_node in its thread's lists */
+struct visible_chunk {
+	unsigned int key; /* path, shifted so that chunks sort in depth first order */
+	unsigned int depth;
+	unsigned int thread;
+	unsigned int first_object, num_objects;
+	unsigned int first_node, num_nodes;
+};
+
+struct visible_thread {
+	pthread_mutex_t lock;
+	struct visible_task *tasks;
+	unsigned int top, bottom, max_tasks; /* others steal from the top */
+
+	unsigned int *objects;
+	unsigned int num_objects, max_objects;
+	struct octree_node **nodes;
+	unsigned int num_nodes, max_nodes;
+	struct visible_chunk *chunks;
+	unsigned int num_chunks, max_chunks;
+
+	struct cull_stats stats;
+};
+
+/* make room for at least num elements of size bytes in *array */
+static int
+grow_visible_array(void **array, unsigned int *max, unsigned int num, size_t size)
+{
+	unsigned int n;
+	void *a;
+
+	if(num <= *max)
+		return 1;
+
+	for(n = *max ? *max : 64; n < num; n *= 2)
+		;
+	a = realloc(*array, size * n);
+	if(!a) {
+		fprintf(stderr, "Error: Couldn't allocate memory for visible set\n");
+		return 0;
+	}
+	*array = a;
+	*max = n;
+
+	return 1;
+}
+
+struct visible_set *
+new_visible_set(unsigned int num_threads)
+{
+	struct visible_set *v;
+	unsigned int i;
+
+	if(num_threads < 1)
+		num_threads = 1;
+
+	v = malloc(sizeof(struct visible_set));
+	if(!v) {
+		fprintf(stderr, "Error: Couldn't allocate memory for visible set\n");
+		return NULL;
+	}
+	bzero(v, sizeof(struct visible_set));
+
+	v->threads = malloc(sizeof(struct visible_thread) * num_threads);
+	if(!v->threads) {
+		fprintf(stderr, "Error: Couldn't allocate memory for visible set\n");
+		free(v);
+		return NULL;
+	}
+	bzero(v->threads, sizeof(struct visible_thread) * num_threads);
+	v->pool = new_parallel_pool(num_threads);
+	if(!v->pool) {
+		free(v->threads);
+		free(v);
+		return NULL;
+	}
+	v->num_threads = num_threads;
+	for(i = 0; i < num_threads; i++)
+		pthread_mutex_init(&v->threads[i].lock, NULL);
+
+	return v;
+}
+
+void
+free_visible_set(struct visible_set *v)
+{
+	unsigned int i;
+
+	if(!v)
+		return;
+
+	free_parallel_pool(v->pool);
+	for(i = 0; i < v->num_threads; i++) {
+		pthread_mutex_destroy(&v->threads[i].lock);
+		free(v->threads[i].tasks);
+		free(v->threads[i].objects);
+		free(v->threads[i].nodes);
+		free(v->threads[i].chunks);
+	}
+	free(v->threads);
+	free(v->objects);
+	free(v->nodes);
+	free(v);
+}
+
+static void
+push_visible_task(struct visible_thread *t, struct visible_task *task)
+{
+	pthread_mutex_lock(&t->lock);
+	if(grow_visible_array((void **)&t->tasks, &t->max_tasks, t->bottom + 1, sizeof(struct visible_task)))
+		t->tasks[t->bottom++] = *task;
+	pthread_mutex_unlock(&t->lock);
+}
+
+/* take a task from the bottom of a queue for its owner, or the top for a thief */
+static int
+take_visible_task(struct visible_thread *t, struct visible_task *task, int steal)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&t->lock);
+	if(t->bottom > t->top) {
+		*task = steal ? t->tasks[t->top++] : t->tasks[--t->bottom];
+		if(t->top == t->bottom)
+			t->top = t->bottom = 0;
+		found = 1;
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	return found;
+}
+
+/* test a node's box against the planes left, counting the result for its thread */
+static int
+classify_visible_box(struct visible_thread *t, float b[6], unsigned int *planes)
+{
+	int result;
+
+	result = classify_box_in_viewport(b, planes);
+	t->stats.tested++;
+	if(result == VIEW_OUTSIDE)
+		t->stats.outside++;
+	else if(result == VIEW_INSIDE)
+		t->stats.inside++;
+
+	return result;
+}
+
+/*
+ * add what's in one node that's at least partly in the frustum;
+ * heightfields can be much smaller than the node they're in, so
+ * they're tested on their own, as draw_octree_branch_objects does
+ */
+static void
+add_visible_node(struct visible_thread *t, struct octree_node *on, unsigned int planes)
+{
+	struct object *o;
+	unsigned int i, p;
+	float b[6];
+
+	for(i = 0; i < on->num_objects; i++) {
+		o = get_object(on->objects[i]);
+		if(planes && o && o->type == OBJ_HEIGHTFIELD) {
+			get_object_bounds(o, b);
+			p = planes;
+			if(b[0] > b[1] || classify_visible_box(t, b, &p) == VIEW_OUTSIDE)
+				continue;
+		}
+		if(grow_visible_array((void **)&t->objects, &t->max_objects, t->num_objects + 1, sizeof(unsigned int)))
+			t->objects[t->num_objects++] = on->objects[i];
+	}
+
+	if(on->num_quads > 0 &&
+	   grow_visible_array((void **)&t->nodes, &t->max_nodes, t->num_nodes + 1, sizeof(struct octree_node *)))
+		t->nodes[t->num_nodes++] = on;
+}
+
+/* walk a whole branch on this thread */
+static void
+add_visible_branch(struct visible_thread *t, struct octree_node *on, unsigned int planes)
+{
+	int i;
+
+	if(!on || on->bounds[0] > on->bounds[1])
+		return;
+	if(planes && classify_visible_box(t, on->bounds, &planes) == VIEW_OUTSIDE)
+		return;
+
+	add_visible_node(t, on, planes);
+	for(i = 0; i < 8; i++)
+		add_visible_branch(t, on->subnodes[i], planes);
+}
+
+static void
+run_visible_task(struct visible_set *v, unsigned int n, struct visible_task *task)
+{
+	struct visible_thread *t = &v->threads[n];
+	struct octree_node *on = task->node;
+	struct visible_task child;
+	struct visible_chunk *c;
+	unsigned int objects = t->num_objects, nodes = t->num_nodes;
+	unsigned int planes = task->planes;
+	int i;
+
+	if(on->bounds[0] > on->bounds[1] ||
+	   (planes && classify_visible_box(t, on->bounds, &planes) == VIEW_OUTSIDE)) {
+		__sync_fetch_and_sub(&v->pending, 1);
+		return;
+	}
+
+	add_visible_node(t, on, planes);
+	if(task->depth + 1 < VISIBLE_TASK_DEPTH) {
+		/* backwards, so that this thread takes the first child next */
+		for(i = 8; i-- > 0; ) {
+			if(!on->subnodes[i])
+				continue;
+			child.node = on->subnodes[i];
+			child.planes = planes;
+			child.depth = task->depth + 1;
+			child.path = (task->path << 3) | i;
+			__sync_fetch_and_add(&v->pending, 1);
+			push_visible_task(t, &child);
+		}
+	} else {
+		for(i = 0; i < 8; i++)
+			add_visible_branch(t, on->subnodes[i], planes);
+	}
+
+	if((t->num_objects > objects || t->num_nodes > nodes) &&
+	   grow_visible_array((void **)&t->chunks, &t->max_chunks, t->num_chunks + 1, sizeof(struct visible_chunk))) {
+		c = &t->chunks[t->num_chunks++];
+		c->key = task->path << (3 * (VISIBLE_TASK_DEPTH - 1 - task->depth));
+		c->depth = task->depth;
+		c->thread = n;
+		c->first_object = objects;
+		c->num_objects = t->num_objects - objects;
+		c->first_node = nodes;
+		c->num_nodes = t->num_nodes - nodes;
+	}
+
+	__sync_fetch_and_sub(&v->pending, 1);
+}
+
+static void
+visible_job(void *arg, unsigned int n)
+{
+	struct visible_set *v = arg;
+	struct visible_task task;
+	unsigned int i;
+	int found;
+
+	while(__atomic_load_n(&v->pending, __ATOMIC_ACQUIRE) > 0) {
+		found = take_visible_task(&v->threads[n], &task, 0);
+		for(i = 1; !found && i < v->num_threads; i++)
+			found = take_visible_task(&v->threads[(n + i) % v->num_threads], &task, 1);
+
+		if(found)
+			run_visible_task(v, n, &task);
+		else
+			sched_yield();
+	}
+}
+
+/* a parent's chunk goes before its children's */
+static int
+compare_visible_chunks(const void *a, const void *b)
+{
+	const struct visible_chunk *ca = a, *cb = b;
+
+	if(ca->key != cb->key)
+		return (ca->key < cb->key) ? -1 : 1;
+	if(ca->depth != cb->depth)
+		return (ca->depth < cb->depth) ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * fill in v with what's in the view frustum of the octree at root;
+ * the result is the same whatever the number of threads. the
+ * set's thread pool is woken up for it rather than starting
+ * threads each time
+ */
+void
+find_visible_in_octree(struct visible_set *v, struct octree_node *root)
+{
+	struct visible_chunk *chunks = NULL, *c;
+	struct visible_thread *t;
+	struct visible_task task;
+	unsigned int i, num = 0, max = 0;
+
+	v->num_objects = 0;
+	v->num_nodes = 0;
+	for(i = 0; i < v->num_threads; i++) {
+		t = &v->threads[i];
+		t->num_objects = t->num_nodes = t->num_chunks = 0;
+		bzero(&t->stats, sizeof(struct cull_stats));
+	}
+	if(!root)
+		return;
+
+	task.node = root;
+	task.planes = VIEW_ALL_PLANES;
+	task.depth = 0;
+	task.path = 0;
+	v->pending = 1;
+	push_visible_task(&v->threads[0], &task);
+	run_parallel_pool(v->pool, visible_job, v);
+
+	for(i = 0; i < v->num_threads; i++) {
+		t = &v->threads[i];
+		add_cull_stats(&t->stats);
+		if(grow_visible_array((void **)&chunks, &max, num + t->num_chunks, sizeof(struct visible_chunk))) {
+			memcpy(&chunks[num], t->chunks, sizeof(struct visible_chunk) * t->num_chunks);
+			num += t->num_chunks;
+		}
+	}
+	qsort(chunks, num, sizeof(struct visible_chunk), compare_visible_chunks);
+
+	for(i = 0; i < num; i++) {
+		c = &chunks[i];
+		t = &v->threads[c->thread];
+		if(grow_visible_array((void **)&v->objects, &v->max_objects,
+		                      v->num_objects + c->num_objects, sizeof(unsigned int))) {
+			memcpy(&v->objects[v->num_objects], &t->objects[c->first_object],
+			       sizeof(unsigned int) * c->num_objects);
+			v->num_objects += c->num_objects;
+		}
+		if(grow_visible_array((void **)&v->nodes, &v->max_nodes,
+		                      v->num_nodes + c->num_nodes, sizeof(struct octree_node *))) {
+			memcpy(&v->nodes[v->num_nodes], &t->nodes[c->first_node],
+			       sizeof(struct octree_node *) * c->num_nodes);
+			v->num_nodes += c->num_nodes;
+		}
+	}
+	free(chunks);
+}
+
+void
+draw_visible_set(struct visible_set *v)
+{
+	unsigned int i, j;
+	struct octree_node *on;
+
+	glBegin(GL_QUADS);
+	for(i = 0; i < v->num_objects; i++)
+		draw_object(v->objects[i]);
+	for(i = 0; i < v->num_nodes; i++) {
+		on = v->nodes[i];
+		for(j = 0; j < on->num_quads; j++)
+			draw_heightfield_quad(on->heightfield, on->quads[j]);
+		add_draw_stats(0, 4 * on->num_quads);
+	}
+	glEnd();
+	add_draw_stats(1, 0);
+}
+
+/* look at a heightfield from the same random view each time for a given number */
+static void
+set_benchmark_view(struct heightfield *hf, unsigned int num)
+{
+	float mm[16], pm[16], pos[3];
+
+	srand(num + 1);
+	pos[0] = hf->xs[0] + (hf->xs[hf->cols] - hf->xs[0]) * rand() / (float)RAND_MAX;
+	pos[1] = hf->ys[0] + (hf->ys[hf->rows] - hf->ys[0]) * rand() / (float)RAND_MAX;
+	pos[2] = hf->maxz + 2.0f;
+	make_view_matrices(mm, pm, pos, 2.0f * M_PI * rand() / (float)RAND_MAX,
+	                   DEG2RAD(-90.0f + 60.0f * rand() / (float)RAND_MAX),
+	                   (hf->xs[hf->cols] - hf->xs[0]) / 2.0f);
+	set_view_frustum(mm, pm);
+}
+
+/* walk the whole tree on one thread, without any tasks, into thread 0's lists */
+static void
+find_visible_serially(struct visible_set *v, struct octree_node *root)
+{
+	v->threads[0].num_objects = v->threads[0].num_nodes = 0;
+	add_visible_branch(&v->threads[0], root, VIEW_ALL_PLANES);
+}
+
+/*
+ * time finding the visible set of a big synthetic heightfield's
+ * octree from cameras at random points over it with increasing
+ * numbers of threads, against walking the tree on one thread
+ * without any tasks; every set must be the same as that walk's.
+ * on fewer cores than threads the threads just take turns
+ */
+void
+benchmark_visible_sets()
+{
+	struct heightfield hf;
+	struct octree_node *root;
+	struct visible_set *serial, *v;
+	struct visible_thread *s;
+	unsigned int i, threads, max_threads, num_views = 64, mismatches;
+	unsigned long found = 0;
+	double start, t, walk = 0.0, one = 0.0;
+
+	if(!init_hills_heightfield(&hf, 2048, 2048))
+		return;
+	root = build_heightfield_octree(&hf, get_num_cpus());
+	serial = new_visible_set(1);
+	if(!root || !serial) {
+		free_octree_branch(root);
+		free_visible_set(serial);
+		free_heightfield_data(&hf);
+		return;
+	}
+	s = &serial->threads[0];
+
+	for(i = 0; i < num_views; i++) {
+		set_benchmark_view(&hf, i);
+		start = get_time_ms();
+		find_visible_serially(serial, root);
+		walk += get_time_ms() - start;
+		found += s->num_nodes;
+	}
+
+	printf("synthetic hills: %u quads, %u views, %u processors\n", hf.cols * hf.rows, num_views, get_num_cpus());
+	printf("threads   per view (ms)   speed-up   differences\n");
+	printf("one walk  %13.3f\n", walk / num_views);
+
+	max_threads = get_num_cpus();
+	if(max_threads < 8)
+		max_threads = 8;
+	for(threads = 1; threads <= max_threads; threads *= 2) {
+		v = new_visible_set(threads);
+		if(!v)
+			break;
+
+		mismatches = 0;
+		t = 0.0;
+		for(i = 0; i < num_views; i++) {
+			set_benchmark_view(&hf, i);
+			start = get_time_ms();
+			find_visible_in_octree(v, root);
+			t += get_time_ms() - start;
+
+			find_visible_serially(serial, root);
+			if(v->num_nodes != s->num_nodes || v->num_objects != s->num_objects ||
+			   memcmp(v->nodes, s->nodes, sizeof(struct octree_node *) * v->num_nodes) ||
+			   memcmp(v->objects, s->objects, sizeof(unsigned int) * v->num_objects))
+				mismatches++;
+		}
+		if(threads == 1)
+			one = t;
+		printf("%7u   %13.3f   %7.2fx   %11u\n", threads, t / num_views, one / t, mismatches);
+		free_visible_set(v);
+	}
+	printf("%lu nodes with quads visible per view\n", found / num_views);
+
+	free_visible_set(serial);
+	free_octree_branch(root);
+	free_heightfield_data(&hf);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * a visible set is what's in the view frustum of an octree: the
+ * objects, and the nodes whose quads are to be drawn, in the order
+ * a depth first walk of the tree finds them. it's worked out on
+ * several threads before anything is drawn, and kept from frame to
+ * frame so its lists don't have to be allocated again
+ */
+struct visible_set {
+	unsigned int num_objects, max_objects;
+	unsigned int *objects; /* object id numbers */
+	unsigned int num_nodes, max_nodes;
+	struct octree_node **nodes; /* nodes with quads to draw */
+
+	unsigned int num_threads;
+	struct visible_thread *threads;
+	struct parallel_pool *pool; /* kept waiting between frames */
+	unsigned int pending; /* tasks queued or running */
+};
+
+struct visible_set *new_visible_set(unsigned int);
+void free_visible_set(struct visible_set *);
+void find_visible_in_octree(struct visible_set *, struct octree_node *);
+void draw_visible_set(struct visible_set *);
+void benchmark_visible_sets();
@@ -34,20 +34,74 @@
 #include <GL/glx.h>
 #include "texture.h"
 #include "object.h"
+#include "heightfield.h"
 #include "octree.h"
 #include "map.h"
+#include "pager.h"
+#include "raycast.h"
+#include "quadtree.h"
+#include "mesh.h"
+#include "lod.h"
+#include "sweep.h"
+#include "visible.h"
+#include "occlusion.h"
+#include "parallel.h"
 #include "my_math.h"
 #include "world.h"
 
+#define VIEW_DISTANCE 200.0f /* fog end */
+#define CAMERA_RADIUS 1.0f   /* the camera is a sphere this big */
+
 static char terrainpic[] = "data/terrain.png";
 static struct camera *cam = NULL;
+static struct map *map = NULL;
+static struct terrain_pager *pager = NULL;
 static struct octree_node *octree = NULL;
+static struct visible_set *visible = NULL;
+static struct occlusion_buffer *occlusion = NULL;
+static int use_occlusion = 0;
+static struct terrain_mesh *mesh = NULL;
+static int vertex_buffers = 1;
+static int use_mesh = 1;
+static struct terrain_lod *lod = NULL;
+static int use_lod = 0;
+static int tiled = 0;
+static int show_stats = 0;
+
+/* stream the terrain in pages instead of loading the whole map */
+void
+set_world_tiled(int t)
+{
+	tiled = t;
+}
 
+/* draw the map's mesh from vertex arrays in memory even if GL has buffer objects */
 void
-init_world()
+set_world_vertex_buffers(int v)
+{
+	vertex_buffers = v;
+}
+
+/* start out leaving terrain hidden behind nearer hills undrawn */
+void
+set_world_occlusion(int o)
+{
+	use_occlusion = o;
+}
+
+/*
+ * start out drawing the map's terrain with fewer triangles in the
+ * distance, loading the whole heightmap for it to pick from
+ */
+void
+set_world_lod(int l)
 {
-	struct map *m;
+	use_lod = l;
+}
 
+void
+init_world()
+{
 	cam = malloc(sizeof(struct camera));
 	if(!cam) {
 		fprintf(stderr, "Error: Couldn't allocate memory for camera\n");
@@ -57,25 +111,98 @@ init_world()
 	bzero(cam, sizeof(struct camera));
 	cam->direction[1] = -1.0f;
 
-	m = load_map("data/map.png");
-	if(!m) {
-		fprintf(stderr, "Error: Couldn't load map\n");
-		exit(1);
+	if(tiled) {
+		pager = open_terrain_pager("data/map.png", cam->obj.position, VIEW_DISTANCE);
+		if(!pager) {
+			fprintf(stderr, "Error: Couldn't open terrain pages\n");
+			exit(1);
+		}
+		octree = get_terrain_pager_octree(pager);
+
+		/* the pages' octree is culled on every processor before it's drawn */
+		visible = new_visible_set(get_num_cpus());
+	} else {
+		set_map_tilesize(use_lod ? MAP_FULL_TILESIZE : MAP_TILESIZE);
+		map = load_map("data/map.png");
+		if(!map) {
+			fprintf(stderr, "Error: Couldn't load map\n");
+			exit(1);
+		}
+		octree = map->octree;
+
+		/* terrain hidden behind nearer hills can be left undrawn */
+		occlusion = new_occlusion_buffer(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+		if(!occlusion) {
+			fprintf(stderr, "Error: Couldn't create occlusion buffer\n");
+			exit(1);
+		}
+
+		/* the terrain is packed once and drawn a node's worth at a time */
+		mesh = new_terrain_mesh(map->quadtree, vertex_buffers && has_vertex_buffers());
+		if(mesh)
+			printf("Terrain mesh: %u vertices, %u indices, %s\n", mesh->num_vertices,
+			       mesh->num_indices, mesh->buffers[0] ? "vertex buffers" : "vertex arrays");
+
+		/* distant terrain is drawn with fewer triangles */
+		lod = new_terrain_lod(map->quadtree, vertex_buffers && has_vertex_buffers());
+#if 0
+		skypic = map->skypic;
+#endif
 	}
 
 	glEnable(GL_TEXTURE_2D);
 	load_texture_from_png(terrainpic);
+}
 
-	octree = m->octree;
-#if 0
-	skypic = m->skypic;
-#endif
+/*
+ * get the height and normal of the terrain at x, y straight from
+ * the grid under it; returns 0 if there's no terrain there
+ */
+int
+get_world_height(float x, float y, float *z, float n[3])
+{
+	if(pager)
+		return get_terrain_pager_height(pager, x, y, z, n);
+
+	return get_map_height(map, x, y, z, n);
+}
+
+/*
+ * find the point on the map the camera is looking at, up to the
+ * fog; returns 0 if it's looking at the sky
+ */
+int
+pick_world(float p[3])
+{
+	struct ray_hit hit;
+	float o[3], d[3], pitch;
+
+	pitch = DEG2RAD(cam->rotation[0]);
+	o[0] = cam->obj.position[0];
+	o[1] = cam->obj.position[1];
+	o[2] = cam->obj.position[2] + 1.5f;
+	d[0] = -cam->direction[0] * cosf(pitch);
+	d[1] = -cam->direction[1] * cosf(pitch);
+	d[2] = -sinf(pitch);
+
+	if(!raycast_map(map, o, d, VIEW_DISTANCE, &hit))
+		return 0;
+
+	p[0] = hit.point[0];
+	p[1] = hit.point[1];
+	p[2] = hit.point[2];
+	return 1;
 }
 
 void
 world_cleanup()
 {
-	free_octree_branch(octree);
+	close_terrain_pager(pager);
+	free_visible_set(visible);
+	free_occlusion_buffer(occlusion);
+	free_terrain_mesh(mesh);
+	free_terrain_lod(lod);
+	free_map(map);
 	free_all_objects();
 	free_all_textures();
 	free(cam);
@@ -127,9 +254,68 @@ world_mouse_input(Window window, XMotionEvent *e)
 	old_y = e->y;
 }
 
+/*
+ * lower the map into a bowl of the given radius and depth
+ * around x, y; only the samples under the bowl are changed
+ */
+static void
+dig_crater(float x, float y, float radius, float depth)
+{
+	struct heightfield *hf;
+	int c, r, firstc, firstr, lastc, lastr;
+	unsigned int w, h;
+	float *heights, dx, dy, d;
+
+	if(!map)
+		return;
+
+	hf = map->heightfield;
+	firstc = (int)ceilf((x - radius - hf->xs[0]) / hf->quadsize);
+	lastc = (int)floorf((x + radius - hf->xs[0]) / hf->quadsize);
+	firstr = (int)ceilf((y - radius - hf->ys[0]) / hf->quadsize);
+	lastr = (int)floorf((y + radius - hf->ys[0]) / hf->quadsize);
+	if(firstc < 0)
+		firstc = 0;
+	if(firstr < 0)
+		firstr = 0;
+	if(lastc > (int)hf->cols)
+		lastc = hf->cols;
+	if(lastr > (int)hf->rows)
+		lastr = hf->rows;
+	if(firstc > lastc || firstr > lastr)
+		return;
+
+	w = lastc - firstc + 1;
+	h = lastr - firstr + 1;
+	heights = malloc(sizeof(float) * w * h);
+	if(!heights) {
+		fprintf(stderr, "Error: Couldn't allocate memory for crater\n");
+		return;
+	}
+
+	for(r = firstr; r <= lastr; r++) {
+		for(c = firstc; c <= lastc; c++) {
+			dx = hf->xs[c] - x;
+			dy = hf->ys[r] - y;
+			d = (dx * dx + dy * dy) / (radius * radius);
+			heights[(r - firstr) * w + (c - firstc)] = HEIGHTFIELD_SAMPLE(hf, c, r) - ((d < 1.0f) ? depth * (1.0f - d) : 0.0f);
+		}
+	}
+
+	if(!set_map_heights(map, firstc, firstr, w, h, heights)) {
+		free(heights);
+		return;
+	}
+	update_terrain_mesh(mesh, firstc, firstr, firstc + w, firstr + h);
+	update_terrain_lod(lod, firstc, firstr, firstc + w, firstr + h);
+	free(heights);
+}
+
 void
 world_key_input(Window window, XKeyEvent *e)
 {
+	float p[3];
+
 	if(!(e->type & KeyPressMask))
 		return;
 
@@ -137,20 +323,43 @@ world_key_input(Window window, XKeyEvent *e)
 		default:
 			break;
 		case XK_Up:
-			cam->obj.position[0] -= cam->direction[0] * 1.0f;
-			cam->obj.position[1] -= cam->direction[1] * 1.0f;
+			cam->motion[0] -= cam->direction[0] * 1.0f;
+			cam->motion[1] -= cam->direction[1] * 1.0f;
 			break;
 		case XK_Down:
-			cam->obj.position[0] += cam->direction[0] * 1.0f;
-			cam->obj.position[1] += cam->direction[1] * 1.0f;
+			cam->motion[0] += cam->direction[0] * 1.0f;
+			cam->motion[1] += cam->direction[1] * 1.0f;
 			break;
 		case XK_Left:
-			cam->obj.position[0] += cam->direction[1] * 1.0f;
-			cam->obj.position[1] -= cam->direction[0] * 1.0f;
+			cam->motion[0] += cam->direction[1] * 1.0f;
+			cam->motion[1] -= cam->direction[0] * 1.0f;
 			break;
 		case XK_Right:
-			cam->obj.position[0] -= cam->direction[1] * 1.0f;
-			cam->obj.position[1] += cam->direction[0] * 1.0f;
+			cam->motion[0] -= cam->direction[1] * 1.0f;
+			cam->motion[1] += cam->direction[0] * 1.0f;
+			break;
+		case XK_c:
+			if(pick_world(p))
+				dig_crater(p[0], p[1], 12.0f, 4.0f);
+			break;
+		case XK_i:
+			show_stats = show_stats ? 0 : 1;
+			break;
+		case XK_o:
+			use_occlusion = use_occlusion ? 0 : 1;
+			break;
+		case XK_v:
+			use_mesh = use_mesh ? 0 : 1;
+			break;
+		case XK_l:
+			use_lod = use_lod ? 0 : 1;
+			break;
+		case XK_bracketleft:
+		case XK_bracketright:
+			if(lod) {
+				lod->threshold *= (XKeycodeToKeysym(e->display, e->keycode, 0) == XK_bracketleft) ? 0.5f : 2.0f;
+				printf("LOD error threshold: %.2f pixels\n", lod->threshold);
+			}
 			break;
 	}
 }
@@ -223,11 +432,114 @@ draw_skybox()
 }
 #endif
 
+/*
+ * sweep the camera along the movement asked for since the last
+ * frame, sliding along slopes it runs into, then let it fall until
+ * it rests on the ground
+ */
+static void
+move_camera()
+{
+	float fall[3] = { 0.0f, 0.0f, -1.0f };
+	float ground;
+
+	if(map) {
+		sweep_sphere_quadtree(map->quadtree, cam->obj.position, CAMERA_RADIUS, cam->motion, SWEEP_MAX_SLIDES);
+		sweep_sphere_quadtree(map->quadtree, cam->obj.position, CAMERA_RADIUS, fall, 0);
+	} else {
+		sweep_sphere(octree, cam->obj.position, CAMERA_RADIUS, cam->motion, SWEEP_MAX_SLIDES);
+		sweep_sphere(octree, cam->obj.position, CAMERA_RADIUS, fall, 0);
+	}
+	cam->motion[0] = cam->motion[1] = cam->motion[2] = 0.0f;
+
+	/* the camera starts out under the ground, and pages can load in above it */
+	if(get_world_height(cam->obj.position[0], cam->obj.position[1], &ground, NULL) &&
+	   cam->obj.position[2] < ground)
+		cam->obj.position[2] = ground + CAMERA_RADIUS;
+}
+
+/*
+ * take the counters for the frame that was just drawn and, if
+ * they're being shown, print their averages about once a second
+ */
+static void
+report_frame_stats()
+{
+	static struct cull_stats total;
+	static struct occlusion_stats hidden;
+	static struct draw_stats drawn;
+	static struct lod_stats detail;
+	static unsigned int frames = 0;
+	static double start = 0.0;
+	struct cull_stats s;
+	struct occlusion_stats os;
+	struct draw_stats ds;
+	struct lod_stats ls;
+	double now;
+
+	take_cull_stats(&s);
+	take_draw_stats(&ds);
+	bzero(&os, sizeof(os));
+	if(occlusion)
+		take_occlusion_stats(occlusion, &os);
+	bzero(&ls, sizeof(ls));
+	if(lod)
+		take_lod_stats(lod, &ls);
+	if(!show_stats) {
+		start = 0.0;
+		return;
+	}
+
+	/* start counting from the end of this frame */
+	now = get_time_ms();
+	if(start == 0.0) {
+		bzero(&total, sizeof(total));
+		bzero(&hidden, sizeof(hidden));
+		bzero(&drawn, sizeof(drawn));
+		bzero(&detail, sizeof(detail));
+		frames = 0;
+		start = now;
+		return;
+	}
+	total.tested += s.tested;
+	total.inside += s.inside;
+	total.outside += s.outside;
+	hidden.tested += os.tested;
+	hidden.occluded += os.occluded;
+	hidden.quads_occluded += os.quads_occluded;
+	hidden.occluders += os.occluders;
+	hidden.ms += os.ms;
+	drawn.calls += ds.calls;
+	drawn.vertices += ds.vertices;
+	detail.nodes += ls.nodes;
+	detail.triangles += ls.triangles;
+	detail.skirts += ls.skirts;
+	frames++;
+
+	if(now - start < 1000.0)
+		return;
+
+	printf("%5.1f fps; per frame, %u nodes tested, %u drawn whole, %u culled\n",
+	       frames * 1000.0 / (now - start), total.tested / frames,
+	       total.inside / frames, total.outside / frames);
+	printf("       %u draw calls, %u vertices\n", drawn.calls / frames, drawn.vertices / frames);
+	if(hidden.tested)
+		printf("       %u of %u nodes occluded hiding %u quads, %u occluder quads, %.2f ms\n",
+		       hidden.occluded / frames, hidden.tested / frames, hidden.quads_occluded / frames,
+		       hidden.occluders / frames, hidden.ms / frames);
+	if(detail.nodes)
+		printf("       LOD %.1f px: %u nodes, %u triangles (%u in skirts)\n", lod->threshold,
+		       detail.nodes / frames, detail.triangles / frames, detail.skirts / frames);
+	start = 0.0;
+}
+
 void
 draw_world(Display *dpy, GLXDrawable drawable)
 {
 	static float fogcolor[3] = { 0.25f, 0.25f, 0.3f };
 	static struct texture *t = NULL;
+	float mm[16], pm[16];
+	GLint viewport[4];
 
 	if(!t) {
 		t = get_texture_with_name(terrainpic);
@@ -246,6 +558,11 @@ draw_world(Display *dpy, GLXDrawable drawable)
 	glTranslatef(-cam->obj.position[0], -cam->obj.position[1], -cam->obj.position[2] - 1.5f);
 	update_view_frustum();
 
+	if(pager) {
+		update_terrain_pager(pager, cam->obj.position);
+		octree = get_terrain_pager_octree(pager);
+	}
+
 #if 0
 	glDisable(GL_FOG);
 	draw_skybox();
@@ -256,16 +573,35 @@ draw_world(Display *dpy, GLXDrawable drawable)
 	glFogi(GL_FOG_MODE, GL_LINEAR);
 	glFogf(GL_FOG_DENSITY, 0.1f);
 	glFogf(GL_FOG_START, 0.5f);
-	glFogf(GL_FOG_END, 200.0f);
+	glFogf(GL_FOG_END, VIEW_DISTANCE);
 
 	glBindTexture(GL_TEXTURE_2D, t->gl_num);
 	glColor4f(0.9f, 0.9f, 0.9f, 1.0f);
-	draw_octree_branch_objects(octree);
+	if(map && lod && use_lod) {
+		glGetFloatv(GL_MODELVIEW_MATRIX, mm);
+		glGetFloatv(GL_PROJECTION_MATRIX, pm);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		set_terrain_lod_view(lod, mm, pm, viewport[3]);
+		if(use_occlusion)
+			clear_occlusion_buffer(occlusion, mm, pm);
+		draw_terrain_lod(lod, use_occlusion ? occlusion : NULL);
+	} else if(map && use_occlusion) {
+		glGetFloatv(GL_MODELVIEW_MATRIX, mm);
+		glGetFloatv(GL_PROJECTION_MATRIX, pm);
+		clear_occlusion_buffer(occlusion, mm, pm);
+		draw_terrain_quadtree_occluded(map->quadtree, occlusion, use_mesh ? mesh : NULL);
+	} else if(map) {
+		draw_terrain_quadtree(map->quadtree, use_mesh ? mesh : NULL);
+	} else if(visible) {
+		find_visible_in_octree(visible, octree);
+		draw_visible_set(visible);
+	} else {
+		draw_octree_branch_objects(octree);
+	}
 
 	glFlush();
 	glXSwapBuffers(dpy, drawable);
+	report_frame_stats();
 
-	cam->obj.position[2] -= 1.0f;
-	while(object_collision(&(cam->obj)))
-		cam->obj.position[2] += 1.0f;
+	move_camera();
 }
@@ -27,9 +27,16 @@ struct camera {
 	struct object obj;
 	float rotation[3];
 	float direction[3];
+	float motion[3]; /* movement asked for since the last frame */
 };
 
+void set_world_tiled(int);
+void set_world_vertex_buffers(int);
+void set_world_occlusion(int);
+void set_world_lod(int);
 void init_world();
+int get_world_height(float, float, float *, float[3]);
+int pick_world(float[3]);
 void world_cleanup();
 void world_mouse_input(Window, XMotionEvent *);
 void world_key_input(Window, XKeyEvent *);